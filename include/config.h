@@ -22,11 +22,24 @@ extern "C"
 #define SINGLE_CHANNEL
 #define BIN_MODE
 
+/* Formats of frames files, selected at runtime by '-f'. TXT_MODE/BIN_MODE only pick the default. */
+#define FRAMES_FORMAT_BIN 0 /* Raw 64-bit frames, big-endian */
+#define FRAMES_FORMAT_TXT 1 /* One 64-character '0'/'1' line per frame */
+#define FRAMES_FORMAT_PACK 2 /* Packed frames, see frame_pack.h */
+#define FRAMES_FORMAT_NATIVE 3 /* Raw 64-bit frames in host order, sent from the file as they are */
+#ifdef TXT_MODE
+#define FRAMES_FORMAT_DEFAULT FRAMES_FORMAT_TXT
+#else
+#define FRAMES_FORMAT_DEFAULT FRAMES_FORMAT_BIN
+#endif
+
 /* Names of devices, files path */
 #define H2C_DEVICE_NAME_DEFAULT "/dev/xdma0_h2c_0"
 #define C2H_DEVICE_NAME_DEFAULT "/dev/xdma0_c2h_0"
 #define USER_REG_NAME_DEFAULT "/dev/xdma0_user"
 #define IRQ_CH1_NAME_DEFAULT "/dev/xdma0_events_0"
+#define CONTROL_NAME_DEFAULT "/dev/xdma0_control" /* Engine registers, for '-x' */
+#define DMA_PROFILE_NAME_DEFAULT "./pcieapp_dma.profile" /* Written by --tune, loaded at startup */
 #ifdef TXT_MODE
 #define CONFIG_FRAMES_PATH_DEFAULT "./test/config.txt"
 #define WORK_FRAMES_PATH_DEFAULT "./test/input.txt"
@@ -40,6 +53,17 @@ extern "C"
 
 /* Memory Mapping Size */
 #define MAP_SIZE (size_t)(4 * 1024) /* 4K bytes */
+#define CONTROL_MAP_SIZE (size_t)(8 * 1024) /* H2C and C2H engines of the control BAR */
+
+/*
+	Window of downstream BRAM channel 1 in the user BAR, for PIO of tiny loops.
+	An assumption about the bitstream, not in its baseline register map: it is
+	mapped only when built with PIO_BRAM_WINDOW (cmake -DPCIEAPP_PIO_WINDOW=ON)
+	for a bitstream decoding the BRAM at this offset, and --tune enables PIO
+	only once the BRAM reads back through it.
+*/
+#define PIO_BRAM_WINDOW_OFFSET (0x10000)
+#define PIO_BRAM_WINDOW_SIZE (size_t)(64 * 1024) /* 64K bytes, the start of the BRAM */
 
 /* Offset of registers */
 #ifdef IN_DEV
@@ -52,10 +76,21 @@ extern "C"
 #define TRANS_INFO_RW_ADDR (0x14)  /* Transaction information register */
 #define TX_DONE_RW_ADDR (0x18)     /* TODO Polling. */
 #define TX_BYTES_NUM_ADDR (0x20)   /* TX writing bytes number register */
+#define RX_PINGPONG_RW_ADDR (0x24) /* Bit0 splits the upstream BRAM into two halves, see RX_HALF_READY_MASK */
+#define RX_HALF_ACK_WO_ADDR (0x28) /* Writing 1 << h hands half h back to the FPGA */
 
 /* In H2C/C2H channel status register */
 #define CHANNEL_DEBUG_OFFSET (0x40) /* Address of H2C/C2H channel status register. See P132 */
 
+/* In the XDMA control BAR, per engine */
+#define XDMA_H2C_CHANNEL_OFFSET(ch) (0x0000 + (ch) * 0x100) /* Registers of H2C engine ch */
+#define XDMA_C2H_CHANNEL_OFFSET(ch) (0x1000 + (ch) * 0x100) /* Registers of C2H engine ch */
+#define XDMA_PERF_CONTROL_ADDR (0xC0)  /* Performance monitor control */
+#define XDMA_PERF_CYCLES_LO_ADDR (0xC4) /* Cycles since the first data beat, [31:0] */
+#define XDMA_PERF_CYCLES_HI_ADDR (0xC8) /* [41:32] in bits 9:0, bit 16 overflow */
+#define XDMA_PERF_DATA_LO_ADDR (0xCC)   /* Data beats, [31:0] */
+#define XDMA_PERF_DATA_HI_ADDR (0xD0)   /* [41:32] in bits 9:0, bit 16 overflow */
+
 #else
 #define IRQ_REG_OFFSET 0     /* Not used */
 #define TX_STATUS_RW_ADDR 4  /* TX status register */
@@ -66,6 +101,14 @@ extern "C"
 #define UP_SIZE_OFFSET 24    /* Not used */
 #endif
 
+/* Performance monitors of the engines */
+#define XDMA_PERF_RUN (uint32_t)(1 << 0)   /* Count from the next data beat while set */
+#define XDMA_PERF_CLEAR (uint32_t)(1 << 1) /* Zero the counters */
+#define XDMA_PERF_COUNT_MASK (0x3FF)       /* Bits 41:32 in the HI registers */
+#define XDMA_PERF_OVERFLOW (uint32_t)(1 << 16)
+#define XDMA_PERF_CLOCK_MHZ_DEFAULT (250.0) /* AXI clock of the IP, see its configuration */
+#define XDMA_PERF_BEAT_BYTES_DEFAULT (16)   /* AXI data width of the IP, 128 bits */
+
 /* Status of registers */
 #ifdef TX_STATUS_RW_ADDR
 #define TX_STATUS_READY 0   /* TX ready */
@@ -109,6 +152,21 @@ extern "C"
 #define UPSTREAM_BRAM_CH2_ADDR (0xC6000000)   /* Address of upstream channel 2 BRAM */
 #define STOP_FRAME (0xFFFFFFFFFFFFFFFF)       /* Stop frame for BRAM */
 
+/* Target address field of config frames, what incremental reconfiguration diffs by */
+#define CONFIG_ADDR_FIELD_OFFSET (32) /* LSB */
+#define CONFIG_ADDR_FIELD_WIDTH (32)
+
+/*
+    Ping-pong upstream: with RX_PINGPONG_RW_ADDR set, the FPGA fills the halves
+    of the upstream BRAM in turn and sets the ready bit of each one in
+    TX_DONE_RW_ADDR, instead of RX done for the whole BRAM. A half is filled
+    again only after its ack; the last one holds a STOP_FRAME.
+*/
+#define UPSTREAM_HALF_SIZE (UPSTREAM_BRAM_SIZE / 2)
+#define RX_PINGPONG_ENABLE (uint32_t)(1 << 0)
+#define RX_HALF_READY_MASK(h) (uint32_t)(1 << (2 + (h))) /* In TX_DONE_RW_ADDR, set by the FPGA */
+#define RX_HALF_ACK_MASK(h) (uint32_t)(1 << (h))         /* In RX_HALF_ACK_WO_ADDR */
+
 /* Blocking IRQ Definitions */
 #ifdef IN_DEV
 #ifdef IRQ_CONTROL_RW_ADDR
@@ -0,0 +1,38 @@
+#ifndef __CONFIG_DIFF_H__
+#define __CONFIG_DIFF_H__
+
+#include "utils.h"
+#include "frame_builder.h"
+#include <stdio.h>
+#include <stddef.h>
+#include <sys/types.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+	Changes between two sets of config frames, indexed by the target address
+	field of each frame. An address is changed if the sequence of frames
+	targeting it differs, so both registers written once and tables streamed
+	through one address reconfigure right. Every frame of a changed address
+	is kept, in the order of the new set.
+*/
+typedef struct ConfigDiff_TypeDef {
+	uint64_t old_frames;
+	uint64_t new_frames;
+	uint64_t addrs;         // Targeted by the new set
+	uint64_t changed_addrs; // Added or changed
+	uint64_t removed_addrs; // Only in the old set, keeping what it configured
+	uint64_t changed_frames;
+} ConfigDiff;
+
+ssize_t config_diff(const FrameField *addr, const FrameBuffer *old_frames, const FrameBuffer *new_frames,
+					FrameBuffer *changed, ConfigDiff *diff);
+void config_diff_dump(FILE *fp, const ConfigDiff *diff);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* __CONFIG_DIFF_H__ */
@@ -2,13 +2,23 @@
 #define __DMA_TO_DEVICE_H__
 
 #include <stdint.h>
+#include "utils.h"
+#include "frame_decoder.h"
+#include "frame_sink.h"
+#include "frame_reduce.h"
 
 #ifdef __cplusplus
 extern "C" {
 #endif
 
 int FramesFile2Device(char *devname, char *user_reg, char *irq_ch1, char *infname, int work_mode);
+int FramesBuffer2Device(char *devname, char *user_reg, char *irq_ch1, FrameBuffer *buffer, int work_mode);
+int ConfigDiff2Device(char *devname, char *user_reg, char *irq_ch1, char *oldname, char *newname,
+                      const FrameField *addr);
 int deviceToFramesFile(char *devname, char *user_reg, char *irq_ch1, char *ofname);
+ssize_t deviceToFrameSink(char *devname, char *user_reg, char *irq_ch1, FrameSink *sink);
+int deviceToFrameReduce(char *devname, char *user_reg, char *irq_ch1, FrameReduce *reduce, char *ofname);
+ssize_t deviceToFrameColumns(char *devname, char *user_reg, char *irq_ch1, FrameColumns *columns);
 
 #ifdef __cplusplus
 }
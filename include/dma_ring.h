@@ -0,0 +1,106 @@
+#ifndef __DMA_RING_H__
+#define __DMA_RING_H__
+
+#include "utils.h"
+#include <stddef.h>
+#include <sys/types.h>
+#include <sys/uio.h>
+#include <pthread.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define DMA_RING_ENTRIES_DEFAULT (64)
+#define DMA_RING_READ_CHUNK (0x100000) /* Bytes per read of an input file, 1M */
+
+typedef enum dma_ring_op {
+	DMA_RING_READ,  /* pread() */
+	DMA_RING_WRITE, /* pwrite() */
+} dma_ring_op_e;
+
+struct DmaRingReq_TypeDef;
+typedef void (*dma_ring_callback)(struct DmaRingReq_TypeDef *req);
+
+/*
+	A positional read or write. It stays owned by the ring from
+	dma_ring_queue() until it is complete; short transfers are resubmitted
+	for the rest, so it completes with all bytes, EOF or an error.
+*/
+typedef struct DmaRingReq_TypeDef {
+	dma_ring_op_e op;
+	int fd;
+	void *buf;
+	size_t bytes;
+	uint64_t offset;
+	dma_ring_callback callback; // On completion, in the thread reaping it, may be NULL
+	void *arg;
+
+	size_t done;   // Bytes transferred
+	ssize_t res;   // done, or -errno
+	int complete;
+
+	struct iovec iov;
+	struct DmaRingReq_TypeDef *next;
+} DmaRingReq;
+
+/*
+	Submits reads and writes of any files and devices at once and reaps
+	their completions in batches: io_uring, or plain pread()/pwrite() at
+	submit time where io_uring is not available. Not thread-safe; one ring
+	is shared by input files, h2c and output files of a process, in the
+	thread that initialized it. dma_ring_active() is false in any other
+	thread, e.g. of tx_sched or the submit engine, whose dma_write() and
+	file sinks keep plain syscalls.
+*/
+typedef struct DmaRing_TypeDef {
+	int fd;            // io_uring, or -1 for plain syscalls
+	pthread_t owner;   // The only thread using it
+	unsigned entries;
+	unsigned queued;   // Queued, not submitted
+	unsigned inflight; // Submitted, not complete
+
+	/* io_uring */
+	void *sq_map;
+	size_t sq_map_size;
+	void *cq_map;
+	size_t cq_map_size;
+	struct io_uring_sqe *sqes;
+	size_t sqes_size;
+	unsigned *sq_head;
+	unsigned *sq_tail;
+	unsigned *sq_mask;
+	unsigned *sq_array;
+	unsigned *cq_head;
+	unsigned *cq_tail;
+	unsigned *cq_mask;
+	struct io_uring_cqe *cqes;
+
+	/* Plain syscalls */
+	DmaRingReq *pending;
+	DmaRingReq *pending_tail;
+	DmaRingReq *done;
+	DmaRingReq *done_tail;
+
+	uint64_t submitted; // Requests, resubmits included
+	uint64_t completed;
+	uint64_t enters;    // System calls of io_uring
+} DmaRing;
+
+/* Ring of the SDK's file and device I/O, used once initialized, by main() with '-U' */
+extern DmaRing dma_ring;
+
+int dma_ring_init(DmaRing *ring, unsigned entries, int use_uring);
+void dma_ring_exit(DmaRing *ring);
+int dma_ring_active(const DmaRing *ring);
+int dma_ring_queue(DmaRing *ring, DmaRingReq *req);
+int dma_ring_submit(DmaRing *ring);
+int dma_ring_reap(DmaRing *ring, unsigned wait);
+ssize_t dma_ring_wait(DmaRing *ring, DmaRingReq *req);
+void dma_ring_dump(FILE *fp, const DmaRing *ring);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* __DMA_RING_H__ */
@@ -0,0 +1,92 @@
+#ifndef __DMA_TRACE_H__
+#define __DMA_TRACE_H__
+
+#include "utils.h"
+#include <stdio.h>
+#include <stddef.h>
+#include <pthread.h>
+#include <sys/types.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define DMA_TRACE_EVENTS_DEFAULT (1 << 16) /* Per thread, 2M bytes */
+
+/* Chrome trace event phases */
+#define DMA_TRACE_BEGIN 'B'
+#define DMA_TRACE_END 'E'
+#define DMA_TRACE_INSTANT 'i'
+
+typedef struct DmaTraceEvent_TypeDef {
+	const char *name; // A string literal, kept by pointer
+	uint64_t ts_ns;
+	uint64_t arg;     // Bytes, 0 for none
+	char ph;
+} DmaTraceEvent;
+
+/*
+	Events of one thread, prefaulted by dma_trace_register() or else
+	allocated at its first event. Begins are dropped
+	once the rest would not hold the ends of all open ones, so spans stay
+	balanced in a full buffer.
+*/
+typedef struct DmaTraceBuffer_TypeDef {
+	DmaTraceEvent *events;
+	size_t count;
+	size_t capacity;
+	int open;          // Recorded begins not ended
+	int skipped;       // Dropped begins not ended
+	uint64_t dropped;
+	pid_t tid;
+	struct DmaTraceBuffer_TypeDef *next;
+} DmaTraceBuffer;
+
+/*
+	Timestamped begin and end of the stages of transfers and file I/O,
+	written as Chrome trace JSON to be viewed in chrome://tracing or
+	Perfetto. Recording takes no lock; threads only register their buffer.
+*/
+typedef struct DmaTrace_TypeDef {
+	int enabled;
+	char *fname;
+	size_t capacity;     // Events per thread
+	uint64_t generation; // Of buffers, threads drop stale ones
+	pthread_mutex_t lock;
+	DmaTraceBuffer *buffers;
+} DmaTrace;
+
+/* Trace of the SDK's transfers, enabled by main() with '-T' */
+extern DmaTrace dma_trace;
+
+int dma_trace_open(DmaTrace *trace, const char *fname, size_t events);
+int dma_trace_close(DmaTrace *trace);
+int dma_trace_register(DmaTrace *trace);
+void dma_trace_event(DmaTrace *trace, const char *name, char ph, uint64_t arg);
+
+#define DMA_TRACE_SPAN_BEGIN(name)                                    \
+	do                                                                \
+	{                                                                 \
+		if (dma_trace.enabled)                                        \
+			dma_trace_event(&dma_trace, (name), DMA_TRACE_BEGIN, 0);  \
+	} while (0)
+
+#define DMA_TRACE_SPAN_END(name, bytes)                                    \
+	do                                                                     \
+	{                                                                      \
+		if (dma_trace.enabled)                                             \
+			dma_trace_event(&dma_trace, (name), DMA_TRACE_END, (bytes));   \
+	} while (0)
+
+#define DMA_TRACE_MARK(name)                                            \
+	do                                                                  \
+	{                                                                   \
+		if (dma_trace.enabled)                                          \
+			dma_trace_event(&dma_trace, (name), DMA_TRACE_INSTANT, 0);  \
+	} while (0)
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* __DMA_TRACE_H__ */
@@ -0,0 +1,65 @@
+#ifndef __DMA_TUNE_H__
+#define __DMA_TUNE_H__
+
+#include "utils.h"
+#include <stdio.h>
+#include <stddef.h>
+#include <sys/types.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define DMA_PROFILE_HOST_LEN 64
+#define DMA_TUNE_ITERS_DEFAULT 64
+#define DMA_RETRIES_DEFAULT 3
+#define DMA_RETRY_US_DEFAULT 1000
+#define DMA_TUNE_PIO_MIN (64) /* Smallest loop timed for the PIO threshold */
+#define DMA_TUNE_PIO_CHECK_BYTES (4096) /* Read back through the PIO window before it is timed */
+
+typedef enum dma_wait {
+	DMA_WAIT_SLEEP, /* Poll TX done, sleeping wait_interval_us between reads */
+	DMA_WAIT_YIELD, /* Poll TX done, yielding the CPU between reads */
+	DMA_WAIT_SPIN,  /* Spin on TX done, see pollUser() */
+} dma_wait_e;
+
+/*
+	How the send path splits and waits for a BRAM loop on this host.
+	Measured by dma_tune() and saved per host, see dma_profile_save().
+*/
+typedef struct DmaProfile_TypeDef {
+	uint32_t chunk;            // Bytes per write() to h2c within a loop
+	uint32_t bounce_align;     // Buffers aligned below this go through an aligned copy, 0 never
+	dma_wait_e wait;
+	uint32_t wait_interval_us; // DMA_WAIT_SLEEP only
+	uint32_t retries;          // Resends of a failed loop before the transfer fails
+	uint32_t retry_us;         // Wait before the first resend, doubled for each next one
+	uint32_t pio_max_bytes;    // Loops up to this go by PIO stores, see pio.h. 0 never
+
+	double h2c_mbps;           // Measured h2c throughput with the settings above
+	double write_us;           // Measured latency of one write()
+	double loop_us;            // Measured latency of an empty loop, request to TX done
+	char host[DMA_PROFILE_HOST_LEN];
+} DmaProfile;
+
+/* Profile of the send path, loaded at startup */
+extern DmaProfile dma_profile;
+
+void dma_profile_default(DmaProfile *profile);
+int dma_profile_load(const char *fname, DmaProfile *profile);
+int dma_profile_save(const char *fname, const DmaProfile *profile);
+void dma_profile_dump(FILE *fp, const DmaProfile *profile);
+
+ssize_t dma_write(int fd, const frame *buf, uint64_t bytes, off_t offset, const DmaProfile *profile);
+int dma_wait_tx_done(void *user_addr, const DmaProfile *profile, long timeout_us);
+
+struct PioWindow_TypeDef;
+
+int dma_tune(char *fname, int fd, void *user_addr, const struct PioWindow_TypeDef *pio, uint64_t base, int iters,
+			 DmaProfile *best);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* __DMA_TUNE_H__ */
@@ -2,6 +2,7 @@
 #define __DMA_UTILS_H__
 
 #include "utils.h"
+#include "frame_pack.h"
 #include <stdint.h>
 
 #ifdef __cplusplus
@@ -10,8 +11,15 @@ extern "C" {
 
 ssize_t read_txt_to_buffer(char *fname, int fd, FrameBuffer *buffer, uint64_t base);
 ssize_t read_bin_to_buffer(char *fname, int fd, FrameBuffer *buffer, ssize_t size, uint64_t base);
+ssize_t receive_to_buffer(char *fname, int fd, FrameBuffer *buffer, uint64_t base);
 ssize_t single_channel_send(char *fname, int fpga_fd, void *user_addr, int irq_fd,  \
     uint64_t addr, FrameBuffer *buffer);
+ssize_t single_channel_send_loop(char *fname, int fpga_fd, void *user_addr, uint64_t addr,  \
+    const frame *buf, uint64_t bytes, int idx, int loops);
+ssize_t single_channel_send_pack(char *fname, int fpga_fd, void *user_addr, int irq_fd,    \
+    uint64_t addr, FramePackReader *reader, FrameBuffer *staging);
+ssize_t single_channel_send_file(char *fname, int fpga_fd, void *user_addr, int irq_fd,    \
+    uint64_t addr, int in_fd, uint64_t size);
 ssize_t double_channel_send(char* fname, int fpga_fd, void *user_addr, int irq_fd1, int irq_fd2,    \
     uint64_t addr1, uint64_t addr2, FrameBuffer* buffer);
 ssize_t single_channel_receive(char *fname, int fpga_fd, void *user_addr, int irq_fd,   \
@@ -0,0 +1,81 @@
+#ifndef __FRAME_BUILDER_H__
+#define __FRAME_BUILDER_H__
+
+#include "utils.h"
+#include <stddef.h>
+#include <sys/types.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define FRAME_FIELDS_MAX 16
+
+/* A bit field of frame, bits [offset + width - 1 : offset] */
+typedef struct FrameField_TypeDef {
+	const char *name;
+	uint8_t offset; // LSB of field
+	uint8_t width;  // in bits, 1~64
+} FrameField;
+
+typedef struct FrameLayout_TypeDef {
+	int num;
+	FrameField fields[FRAME_FIELDS_MAX];
+} FrameLayout;
+
+/*
+	A pool of 4K-aligned frames buffers of the same capacity, so buffers
+	can be reused from one batch to the next. Not thread-safe.
+*/
+typedef struct FramePool_TypeDef {
+	FrameBuffer *buffers;
+	frame *allocated;
+	int *free_list;
+	int num;
+	int free_num;
+	size_t capacity; // capacity of each buffer in bytes
+} FramePool;
+
+typedef struct FrameBuilder_TypeDef {
+	const FrameLayout *layout;
+	FrameBuffer *buffer;
+	size_t capacity; // capacity of buffer in frames
+	frame base;      // Bits shared by all frames, e.g. frame header
+} FrameBuilder;
+
+static inline uint64_t frame_field_mask(const FrameField *field)
+{
+	return field->width >= 64 ? ~0ULL : ((1ULL << field->width) - 1);
+}
+
+static inline uint64_t frame_field_get(frame f, const FrameField *field)
+{
+	return (f >> field->offset) & frame_field_mask(field);
+}
+
+static inline frame frame_field_set(frame f, const FrameField *field, uint64_t value)
+{
+	uint64_t mask = frame_field_mask(field);
+
+	return (f & ~(mask << field->offset)) | ((value & mask) << field->offset);
+}
+
+int frame_layout_add(FrameLayout *layout, const char *name, int offset, int width);
+int frame_layout_find(const FrameLayout *layout, const char *name);
+
+int frame_pool_init(FramePool *pool, int num, size_t capacity);
+FrameBuffer *frame_pool_get(FramePool *pool);
+void frame_pool_put(FramePool *pool, FrameBuffer *buffer);
+void frame_pool_destroy(FramePool *pool);
+
+int frame_builder_init(FrameBuilder *builder, const FrameLayout *layout, FrameBuffer *buffer, size_t capacity);
+ssize_t frame_builder_add(FrameBuilder *builder, const uint64_t *values);
+ssize_t frame_builder_add_rows(FrameBuilder *builder, const uint64_t *values, size_t rows);
+ssize_t frame_builder_add_spikes(FrameBuilder *builder, int addr_field, const uint64_t *addrs, size_t n,
+								 int ts_field, uint64_t timestep);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* __FRAME_BUILDER_H__ */
@@ -0,0 +1,23 @@
+#ifndef __FRAME_CODEC_H__
+#define __FRAME_CODEC_H__
+
+#include "utils.h"
+#include <stddef.h>
+#include <sys/types.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define FRAME_TXT_CHARS 64                      /* '0'/'1' characters of one frame */
+#define FRAME_TXT_LINE_LEN (FRAME_TXT_CHARS + 1) /* One frame per line, ends with '\n' */
+
+ssize_t txt2frames(const char *txt, size_t len, frame *frames, size_t max_frames, size_t *consumed);
+int frames_format_from_name(const char *name);
+const char *frames_format_name(int format);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* __FRAME_CODEC_H__ */
@@ -0,0 +1,35 @@
+#ifndef __FRAME_DECODER_H__
+#define __FRAME_DECODER_H__
+
+#include "frame_builder.h"
+#include <stddef.h>
+#include <sys/types.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+	Received frames decoded into struct-of-arrays columns,
+	columns[i][row] is field i of layout in frame row.
+*/
+typedef struct FrameColumns_TypeDef {
+	const FrameLayout *layout;
+	size_t capacity; // capacity of each column in rows
+	size_t rows;     // # of rows decoded
+	uint64_t *columns[FRAME_FIELDS_MAX];
+} FrameColumns;
+
+int frame_columns_init(FrameColumns *columns, const FrameLayout *layout, size_t capacity);
+void frame_columns_free(FrameColumns *columns);
+
+size_t frames_until_stop(const frame *frames, size_t n);
+void frame_extract_field(const frame *in, size_t n, uint64_t *out, int shift, uint64_t mask);
+ssize_t frame_decode(const frame *frames, size_t n, FrameColumns *columns);
+ssize_t frame_decode_buffer(const FrameBuffer *buffer, FrameColumns *columns);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* __FRAME_DECODER_H__ */
@@ -0,0 +1,66 @@
+#ifndef __FRAME_PACK_H__
+#define __FRAME_PACK_H__
+
+#include "utils.h"
+#include <stddef.h>
+#include <sys/types.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+	Packed frames file (.pfz):
+		Header: magic, version, # of frames
+		Blocks: # of frames, payload bytes, payload
+
+	Every block holds up to one BRAM loop of frames and decodes on its own.
+	Each frame is stored as XOR against the previous one in the block:
+		tag 0x00, varint n: repeat the previous frame n times
+		tag mask != 0: the XOR bytes selected by mask follow, low byte first
+	All fields are little-endian.
+*/
+#define FRAME_PACK_MAGIC (0x5A464350)   /* "PCFZ" */
+#define FRAME_PACK_VERSION (1)
+#define FRAME_PACK_BLOCK_FRAMES (DOWNSTREAM_BRAM_SIZE / sizeof(frame))
+#define FRAME_PACK_BLOCK_MAX (FRAME_PACK_BLOCK_FRAMES * 9) /* Worst case payload of a block */
+
+typedef struct FramePackHeader_TypeDef {
+	uint32_t magic;
+	uint32_t version;
+	uint64_t frames; // # of frames in file
+} FramePackHeader;
+
+typedef struct FramePackBlock_TypeDef {
+	uint32_t frames; // # of frames in block
+	uint32_t bytes;  // size of payload in bytes
+} FramePackBlock;
+
+typedef struct FramePackReader_TypeDef {
+	char *fname;
+	int fd;
+	off_t offset;        // Offset of the next block in file
+	uint64_t frames;     // # of frames in file
+	uint64_t frames_out; // # of frames decoded
+
+	uint8_t *payload;    // Payload of the current block
+	uint32_t payload_len;
+	uint32_t payload_pos;
+	uint32_t block_left; // # of frames of the current block not decoded yet
+	uint32_t repeat;     // Pending repeats of prev
+	frame prev;
+} FramePackReader;
+
+size_t frame_pack_encode_block(const frame *frames, uint32_t n, uint8_t *out);
+ssize_t frame_pack_write(char *fname, int fd, const frame *frames, uint64_t n);
+int frame_pack_probe(int fd);
+
+int frame_pack_open(FramePackReader *reader, char *fname, int fd);
+ssize_t frame_pack_read(FramePackReader *reader, frame *out, uint64_t size);
+void frame_pack_close(FramePackReader *reader);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* __FRAME_PACK_H__ */
@@ -0,0 +1,80 @@
+#ifndef __FRAME_REDUCE_H__
+#define __FRAME_REDUCE_H__
+
+#include "utils.h"
+#include "frame_builder.h"
+#include "frame_sink.h"
+#include <stdio.h>
+#include <stddef.h>
+#include <sys/types.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define FRAME_REDUCERS_MAX 8
+#define FRAME_REDUCE_NAME_LEN 32
+#define FRAME_REDUCE_BLOCK_FRAMES (1024) /* Keys of a block stay in L1 while every reducer counts */
+#define FRAME_REDUCE_BINS_MAX (1 << 24)  /* 128M bytes of counts */
+#define FRAME_REDUCE_LANES 4             /* Copies of small tables, so runs of one key do not serialize */
+#define FRAME_REDUCE_LANE_BINS_MAX (1024) /* Tables up to this many bins get lanes, 32K bytes */
+
+typedef enum frame_reduce_type {
+	FRAME_REDUCE_COUNT,    /* Frames per value of a field, e.g. spikes per neuron */
+	FRAME_REDUCE_HIST,     /* Frames per bucket of 2^shift values of a field, e.g. per timeslot */
+	FRAME_REDUCE_CALLBACK, /* A user function of every batch */
+} frame_reduce_type_e;
+
+/* @return 0, or -errno to fail the batch */
+typedef int (*frame_reduce_callback)(const frame *frames, size_t n, uint64_t seq, void *arg);
+
+typedef struct FrameReducer_TypeDef {
+	frame_reduce_type_e type;
+	char name[FRAME_REDUCE_NAME_LEN];
+	FrameField key;
+	int shift;         // Of key values to bins, 0 for FRAME_REDUCE_COUNT
+	uint64_t bins;     // Keys from bins up count as overflow
+	int lanes;
+	uint64_t *table;   // lanes tables of bins + 1 counts, the last one of overflow
+	uint64_t *counts;  // bins, merged by frame_reduce_counts()
+	uint64_t overflow; // Merged by frame_reduce_counts()
+	frame_reduce_callback callback;
+	void *arg;
+} FrameReducer;
+
+/*
+	Reductions of received frames at receive time, so only aggregates
+	leave the process. Frames are reduced a block at a time: the key of
+	every counter and histogram is extracted by SIMD, then counted into
+	tables small enough to stay in cache.
+*/
+typedef struct FrameReduce_TypeDef {
+	int num;
+	FrameReducer reducers[FRAME_REDUCERS_MAX];
+	uint64_t frames; // # of frames reduced
+	uint64_t *keys;  // FRAME_REDUCE_BLOCK_FRAMES
+} FrameReduce;
+
+int frame_reduce_init(FrameReduce *reduce);
+void frame_reduce_free(FrameReduce *reduce);
+int frame_reduce_add_count(FrameReduce *reduce, const char *name, const FrameField *key);
+int frame_reduce_add_hist(FrameReduce *reduce, const char *name, const FrameField *key, int shift, uint64_t bins);
+int frame_reduce_add_callback(FrameReduce *reduce, const char *name, frame_reduce_callback callback, void *arg);
+int frame_reduce_parse(FrameReduce *reduce, const char *spec);
+void frame_reduce_reset(FrameReduce *reduce);
+
+ssize_t frame_reduce(FrameReduce *reduce, const frame *frames, size_t n);
+ssize_t frame_reduce_buffer(FrameReduce *reduce, const FrameBuffer *buffer);
+const uint64_t *frame_reduce_counts(FrameReducer *reducer);
+
+void frame_reduce_dump(FILE *fp, FrameReduce *reduce);
+int frame_reduce_save(const char *fname, FrameReduce *reduce);
+
+/* Reduce every batch written, then write it on to next unless NULL */
+int frame_sink_open_reduce(FrameSink *sink, FrameReduce *reduce, FrameSink *next);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* __FRAME_REDUCE_H__ */
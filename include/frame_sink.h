@@ -0,0 +1,74 @@
+#ifndef __FRAME_SINK_H__
+#define __FRAME_SINK_H__
+
+#include "utils.h"
+#include <stddef.h>
+#include <sys/types.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define FRAME_SINK_SHM_PREFIX "shm:"         /* Output names starting with this are rings in /dev/shm */
+#define FRAME_RING_CAPACITY_DEFAULT (0x400000) /* 4M bytes, 16 upstream BRAMs */
+#define FRAME_RING_TIMEOUT_US_DEFAULT (-1)   /* Wait for the consumer forever */
+
+/*
+	Where received frames go. Every frame_sink_write() is a batch, numbered
+	from 0; frames are numbered from 0 across batches.
+*/
+struct FrameSink_TypeDef;
+
+typedef struct FrameSinkOps_TypeDef {
+	const char *name;
+	ssize_t (*write)(struct FrameSink_TypeDef *sink, const frame *frames, size_t n);
+	void (*close)(struct FrameSink_TypeDef *sink);
+} FrameSinkOps;
+
+/* @return 0, or -errno to fail the write */
+typedef int (*frame_sink_callback)(const frame *frames, size_t n, uint64_t batch, uint64_t seq, void *arg);
+
+typedef struct FrameSink_TypeDef {
+	const FrameSinkOps *ops;
+	uint64_t batches; // # of batches written, the number of the next one
+	uint64_t frames;  // # of frames written, the number of the next one
+
+	/* Of the implementations */
+	int fd;
+	int format;
+	frame_sink_callback callback;
+	void *arg;
+	void *priv;
+} FrameSink;
+
+/*
+	A single-producer single-consumer ring of frames in shared memory.
+	Records of {seq, n, batch} and n frames follow each other; the producer
+	waits while the ring is full and the consumer while it is empty.
+*/
+typedef struct FrameRing_TypeDef {
+	int fd;
+	void *map;
+	size_t map_size;
+	struct FrameRingShm_TypeDef *shm;
+	char *data;
+	long timeout_us; // Producer's wait for room, < 0 forever
+} FrameRing;
+
+int frame_sink_open_file(FrameSink *sink, const char *fname, int format);
+int frame_sink_open_callback(FrameSink *sink, frame_sink_callback callback, void *arg);
+int frame_sink_open_ring(FrameSink *sink, const char *name, size_t capacity, long timeout_us);
+int frame_sink_open(FrameSink *sink, const char *name, int format);
+ssize_t frame_sink_write(FrameSink *sink, const frame *frames, size_t n);
+void frame_sink_close(FrameSink *sink);
+
+/* Consumer side of frame_sink_open_ring(), in another process */
+int frame_ring_attach(FrameRing *ring, const char *name);
+ssize_t frame_ring_read(FrameRing *ring, frame *frames, size_t max, uint64_t *seq, uint64_t *batch, long timeout_us);
+void frame_ring_detach(FrameRing *ring, const char *name);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* __FRAME_SINK_H__ */
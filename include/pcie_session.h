@@ -0,0 +1,70 @@
+#ifndef __PCIE_SESSION_H__
+#define __PCIE_SESSION_H__
+
+#include "utils.h"
+#include "pio.h"
+#include <stddef.h>
+#include <sys/types.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define SESSION_TIMEOUT_US_DEFAULT (3 * 1000 * 1000) /* Timeout of spin-waits */
+#define SESSION_RX_CHUNK_DEFAULT (4096)             /* First read of an output, doubled until STOP_FRAME */
+
+/* Latency of one step in nanoseconds */
+typedef struct PCIeStepStats_TypeDef {
+	uint64_t send_ns;    // Writing frames and stop frame into h2c
+	uint64_t tx_wait_ns; // Waiting for TX done
+	uint64_t rx_wait_ns; // Waiting for RX done
+	uint64_t recv_ns;    // Reading output from c2h
+	uint64_t total_ns;   // Round trip
+	uint64_t rx_bytes;   // Bytes read from c2h
+	ssize_t rx_frames;   // # of output frames before STOP_FRAME
+} PCIeStepStats;
+
+/*
+	A persistent device handle for closed-loop runs. Devices are opened, the
+	user registers mapped and the FPGA mode set once; every step then costs
+	one write, two register spin-waits and reads sized to the output.
+*/
+typedef struct PCIeSession_TypeDef {
+	int h2c_fd;
+	int c2h_fd;
+	int user_reg_fd;
+	void *user_addr;
+	uint64_t h2c_addr;   // DOWNSTREAM_BRAM_CH1_ADDR
+	uint64_t c2h_addr;   // UPSTREAM_BRAM_CH1_ADDR
+	long timeout_us;
+	size_t rx_chunk;     // Size of the first read of an output in bytes
+	PioWindow pio;       // Steps up to pio_max_bytes of the DMA profile go by PIO
+
+	FrameBuffer tx;      // Pinned, 4K-aligned, DOWNSTREAM_BRAM_SIZE bytes
+	FrameBuffer rx;      // Pinned, 4K-aligned, UPSTREAM_BRAM_SIZE bytes
+	frame *allocated;
+
+	uint64_t steps;
+	PCIeStepStats last;
+} PCIeSession;
+
+int pcie_session_open(PCIeSession *session, char *h2c_name, char *c2h_name, char *user_reg, int work_mode);
+void pcie_session_close(PCIeSession *session);
+ssize_t pcie_session_step(PCIeSession *session, const frame *frames, size_t n, PCIeStepStats *stats);
+
+/* Build the frames of the next step here to skip the copy into session->tx */
+static inline frame *pcie_session_tx_frames(PCIeSession *session)
+{
+	return session->tx.frames;
+}
+
+static inline size_t pcie_session_tx_capacity(const PCIeSession *session)
+{
+	return DOWNSTREAM_BRAM_SIZE / sizeof(frame) - 1; /* Room for the stop frame */
+}
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* __PCIE_SESSION_H__ */
@@ -0,0 +1,441 @@
+#ifndef __PCIEAPP_HPP__
+#define __PCIEAPP_HPP__
+
+/*
+	Header-only C++17 layer on top of the C core.
+
+	- pcie::Buffer: an owning, 4K-aligned and optionally pinned frames buffer
+	- pcie::Session: a move-only PCIeSession, see pcie_session.h
+	- pcie::Engine: a move-only SubmitEngine, whose send()/step() return futures
+	- pcie::Request: an allocation-free request for hot loops
+
+	Frames are passed as pcie::span<frame>, which is std::span under C++20.
+	Errors of the C core (-errno) are thrown as std::system_error.
+*/
+#include "utils.h"
+#include "dma_utils.h"
+#include "pcie_session.h"
+#include "submit_queue.h"
+
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+#include <future>
+#include <memory>
+#include <string>
+#include <system_error>
+#include <thread>
+#include <type_traits>
+#include <utility>
+
+#include <sys/mman.h>
+
+#if __cplusplus >= 202002L
+#include <span>
+#endif
+
+namespace pcie {
+
+using frame = ::frame;
+
+#if __cplusplus >= 202002L
+template <class T>
+using span = std::span<T>;
+#else
+/* The subset of std::span used here */
+template <class T>
+class span {
+public:
+	constexpr span() noexcept = default;
+	constexpr span(T *data, size_t size) noexcept : data_(data), size_(size) {}
+
+	template <class U, class = std::enable_if_t<std::is_convertible<U (*)[], T (*)[]>::value>>
+	constexpr span(const span<U> &other) noexcept : data_(other.data()), size_(other.size()) {}
+
+	constexpr T *data() const noexcept { return data_; }
+	constexpr size_t size() const noexcept { return size_; }
+	constexpr size_t size_bytes() const noexcept { return size_ * sizeof(T); }
+	constexpr bool empty() const noexcept { return size_ == 0; }
+	constexpr T &operator[](size_t i) const noexcept { return data_[i]; }
+	constexpr T *begin() const noexcept { return data_; }
+	constexpr T *end() const noexcept { return data_ + size_; }
+
+	constexpr span first(size_t n) const noexcept { return span(data_, n); }
+	constexpr span subspan(size_t offset, size_t n) const noexcept { return span(data_ + offset, n); }
+	constexpr span subspan(size_t offset) const noexcept { return span(data_ + offset, size_ - offset); }
+
+private:
+	T *data_ = nullptr;
+	size_t size_ = 0;
+};
+#endif
+
+/*
+	@brief
+		Throw rc of the C core as std::system_error if it is -errno
+
+	@return rc
+*/
+inline ssize_t check(ssize_t rc, const char *what)
+{
+	if (rc < 0)
+		throw std::system_error((int)-rc, std::generic_category(), what);
+
+	return rc;
+}
+
+/*
+	An owning frames buffer, 4K-aligned as the XDMA driver wants for
+	zero-copy DMA, and optionally locked in memory. Move-only.
+*/
+class Buffer {
+public:
+	Buffer() noexcept = default;
+
+	explicit Buffer(size_t capacity, bool pinned = false) : capacity_(capacity)
+	{
+		void *p = nullptr;
+		size_t bytes = capacity ? capacity * sizeof(frame) : 4096;
+
+		if (posix_memalign(&p, 4096 /* alignment */, bytes))
+			throw std::bad_alloc();
+
+		frames_ = static_cast<frame *>(p);
+		pinned_ = pinned && mlock(frames_, capacity * sizeof(frame)) == 0;
+	}
+
+	Buffer(const Buffer &) = delete;
+	Buffer &operator=(const Buffer &) = delete;
+
+	Buffer(Buffer &&other) noexcept
+		: frames_(std::exchange(other.frames_, nullptr)), size_(std::exchange(other.size_, 0)),
+		  capacity_(std::exchange(other.capacity_, 0)), pinned_(std::exchange(other.pinned_, false))
+	{
+	}
+
+	Buffer &operator=(Buffer &&other) noexcept
+	{
+		if (this != &other)
+		{
+			reset();
+			frames_ = std::exchange(other.frames_, nullptr);
+			size_ = std::exchange(other.size_, 0);
+			capacity_ = std::exchange(other.capacity_, 0);
+			pinned_ = std::exchange(other.pinned_, false);
+		}
+
+		return *this;
+	}
+
+	~Buffer() { reset(); }
+
+	/* Valid frames, [0, size) */
+	span<frame> frames() noexcept { return span<frame>(frames_, size_); }
+	span<const frame> frames() const noexcept { return span<const frame>(frames_, size_); }
+
+	/* Whole buffer, [0, capacity), to be filled before resize() */
+	span<frame> storage() noexcept { return span<frame>(frames_, capacity_); }
+
+	size_t size() const noexcept { return size_; }
+	size_t capacity() const noexcept { return capacity_; }
+	bool pinned() const noexcept { return pinned_; }
+
+	void resize(size_t size)
+	{
+		if (size > capacity_)
+			throw std::system_error(ENOSPC, std::generic_category(), "pcie::Buffer::resize");
+
+		size_ = size;
+	}
+
+	/* A view for the C API, size in bytes */
+	::FrameBuffer view() noexcept { return ::FrameBuffer{frames_, (ssize_t)(size_ * sizeof(frame))}; }
+
+private:
+	void reset() noexcept
+	{
+		if (!frames_)
+			return;
+
+		if (pinned_)
+			munlock(frames_, capacity_ * sizeof(frame));
+		free(frames_);
+		frames_ = nullptr;
+	}
+
+	frame *frames_ = nullptr;
+	size_t size_ = 0;
+	size_t capacity_ = 0;
+	bool pinned_ = false;
+};
+
+/* Output of a step. frames is a view into the session, valid until its next step */
+struct StepResult {
+	span<const frame> frames;
+	PCIeStepStats stats;
+};
+
+/*
+	A persistent device handle, closed on destruction. Move-only; the
+	PCIeSession stays at the same address, so an Engine survives a move.
+*/
+class Session {
+public:
+	Session(const std::string &h2c_name, const std::string &c2h_name, const std::string &user_reg, int work_mode)
+		: session_(new PCIeSession())
+	{
+		check(pcie_session_open(session_.get(), const_cast<char *>(h2c_name.c_str()),
+								const_cast<char *>(c2h_name.c_str()), const_cast<char *>(user_reg.c_str()), work_mode),
+			  "pcie_session_open");
+	}
+
+	Session(const Session &) = delete;
+	Session &operator=(const Session &) = delete;
+	Session(Session &&) noexcept = default;
+	Session &operator=(Session &&other) noexcept
+	{
+		if (this != &other)
+		{
+			close();
+			session_ = std::move(other.session_);
+		}
+
+		return *this;
+	}
+
+	~Session() { close(); }
+
+	/* Build the frames of the next step here to skip a copy */
+	span<frame> tx() noexcept
+	{
+		return span<frame>(pcie_session_tx_frames(session_.get()), pcie_session_tx_capacity(session_.get()));
+	}
+
+	/*
+		@brief
+			Send frames of one loop and receive its output, see pcie_session_step()
+	*/
+	StepResult step(span<const frame> frames)
+	{
+		StepResult result;
+		ssize_t n = check(pcie_session_step(session_.get(), frames.data(), frames.size(), &result.stats),
+						  "pcie_session_step");
+
+		result.frames = span<const frame>(session_->rx.frames, (size_t)n);
+		return result;
+	}
+
+	/*
+		@brief
+			Send frames of any size in BRAM loops, see single_channel_send()
+
+		@return Bytes sent
+	*/
+	ssize_t send(span<const frame> frames)
+	{
+		::FrameBuffer buffer = {const_cast<frame *>(frames.data()), (ssize_t)frames.size_bytes()};
+
+		return check(single_channel_send(const_cast<char *>("pcie::Session"), session_->h2c_fd,
+										 session_->user_addr, -1, session_->h2c_addr, &buffer),
+					 "single_channel_send");
+	}
+
+	const PCIeStepStats &last() const noexcept { return session_->last; }
+	PCIeSession *get() noexcept { return session_.get(); }
+
+private:
+	void close() noexcept
+	{
+		if (session_)
+			pcie_session_close(session_.get());
+	}
+
+	std::unique_ptr<PCIeSession> session_;
+};
+
+/*
+	A request owned by the caller, reusable and free of allocations.
+	Not movable: the engine keeps its address until it is done.
+*/
+class Request {
+public:
+	Request() noexcept { submit_request_init(&req_, SUBMIT_SEND, nullptr, 0); }
+
+	Request(const Request &) = delete;
+	Request &operator=(const Request &) = delete;
+
+	void send(span<const frame> frames) noexcept { submit_request_init(&req_, SUBMIT_SEND, frames.data(), frames.size()); }
+
+	/* Output frames are copied into output, up to its size */
+	void step(span<const frame> frames, span<frame> output) noexcept
+	{
+		submit_request_init(&req_, SUBMIT_STEP, frames.data(), frames.size());
+		req_.output = output.data();
+		req_.output_max = output.size();
+	}
+
+	bool done() noexcept { return submit_request_done(&req_); }
+
+	/* @return Bytes sent, or # of output frames of a step */
+	ssize_t wait() { return check(submit_request_wait(&req_), "pcie::Request"); }
+
+	const PCIeStepStats &stats() const noexcept { return req_.stats; }
+	SubmitRequest *get() noexcept { return &req_; }
+
+private:
+	SubmitRequest req_;
+};
+
+/*
+	One engine thread owning a session, fed by any number of threads.
+	Stops after completing queued requests on destruction, which must
+	come before the session's.
+*/
+class Engine {
+public:
+	/* Requests up to coalesce_bytes share BRAM loops, see submit_engine_start_coalesce() */
+	explicit Engine(Session &session, size_t depth = SUBMIT_QUEUE_DEPTH_DEFAULT, size_t coalesce_bytes = 0,
+					long coalesce_us = SUBMIT_COALESCE_US_DEFAULT)
+		: engine_(new SubmitEngine())
+	{
+		int rc = submit_engine_start_coalesce(engine_.get(), session.get(), depth, coalesce_bytes, coalesce_us,
+											  nullptr, nullptr);
+
+		if (rc < 0)
+		{
+			engine_.reset();
+			check(rc, "submit_engine_start");
+		}
+	}
+
+	Engine(const Engine &) = delete;
+	Engine &operator=(const Engine &) = delete;
+	Engine(Engine &&) noexcept = default;
+	Engine &operator=(Engine &&other) noexcept
+	{
+		if (this != &other)
+		{
+			stop();
+			engine_ = std::move(other.engine_);
+		}
+
+		return *this;
+	}
+
+	~Engine() { stop(); }
+
+	/* Queue a caller-owned request, yielding while the queue is full */
+	void submit(Request &req) { push(req.get()); }
+
+	/*
+		@brief
+			Send frames of any size in BRAM loops.
+			frames must stay valid until the future is ready.
+
+		@return Future of bytes sent
+	*/
+	std::future<ssize_t> send(span<const frame> frames)
+	{
+		auto op = std::make_unique<Op<ssize_t>>();
+		std::future<ssize_t> future = op->promise.get_future();
+
+		submit_request_init(&op->req, SUBMIT_SEND, frames.data(), frames.size());
+		op->req.callback = &Engine::complete_send;
+		op->req.arg = op.get();
+
+		push(&op->req);
+		op.release();
+
+		return future;
+	}
+
+	/*
+		@brief
+			Send frames of one loop and copy its output into output, up to
+			its size. frames and output must stay valid until the future is ready.
+
+		@return Future of # of output frames and latency of the step
+	*/
+	std::future<StepResult> step(span<const frame> frames, span<frame> output)
+	{
+		auto op = std::make_unique<Op<StepResult>>();
+		std::future<StepResult> future = op->promise.get_future();
+
+		submit_request_init(&op->req, SUBMIT_STEP, frames.data(), frames.size());
+		op->req.output = output.data();
+		op->req.output_max = output.size();
+		op->req.callback = &Engine::complete_step;
+		op->req.arg = op.get();
+		op->output = output;
+
+		push(&op->req);
+		op.release();
+
+		return future;
+	}
+
+private:
+	template <class T>
+	struct Op {
+		SubmitRequest req;
+		std::promise<T> promise;
+		span<frame> output;
+	};
+
+	template <class T>
+	static bool fail(Op<T> *op)
+	{
+		if (op->req.rc >= 0)
+			return false;
+
+		op->promise.set_exception(std::make_exception_ptr(
+			std::system_error((int)-op->req.rc, std::generic_category(), "pcie::Engine")));
+		return true;
+	}
+
+	/* Run on the engine thread, or the one stopping it, the last touch of the request */
+	static void complete_send(SubmitRequest *, void *arg)
+	{
+		std::unique_ptr<Op<ssize_t>> op(static_cast<Op<ssize_t> *>(arg));
+
+		if (!fail(op.get()))
+			op->promise.set_value(op->req.rc);
+	}
+
+	static void complete_step(SubmitRequest *, void *arg)
+	{
+		std::unique_ptr<Op<StepResult>> op(static_cast<Op<StepResult> *>(arg));
+
+		if (!fail(op.get()))
+		{
+			size_t n = (size_t)op->req.rc < op->output.size() ? (size_t)op->req.rc : op->output.size();
+
+			op->promise.set_value(StepResult{span<const frame>(op->output.data(), n), op->req.stats});
+		}
+	}
+
+	void push(SubmitRequest *req)
+	{
+		int rc;
+
+		while ((rc = submit_request_push(engine_.get(), req)) == -EAGAIN)
+			std::this_thread::yield();
+
+		check(rc, "submit_request_push");
+	}
+
+	void stop() noexcept
+	{
+		if (engine_)
+		{
+			submit_engine_stop(engine_.get());
+			engine_.reset();
+		}
+	}
+
+	std::unique_ptr<SubmitEngine> engine_;
+};
+
+} // namespace pcie
+
+#endif /* __PCIEAPP_HPP__ */
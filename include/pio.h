@@ -0,0 +1,37 @@
+#ifndef __PIO_H__
+#define __PIO_H__
+
+#include "utils.h"
+#include "dma_tune.h"
+#include <stddef.h>
+#include <sys/types.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+	A window of the downstream BRAM in a mapped BAR. Loops up to the
+	pio_max_bytes of the DMA profile are stored into it with 64-bit writes
+	instead of a DMA of h2c. Any file mapped the same way stands in for it.
+*/
+typedef struct PioWindow_TypeDef {
+	void *base;    // NULL if not mapped, DMA only
+	size_t size;
+	uint64_t addr; // H2C address of its first byte, DOWNSTREAM_BRAM_CH1_ADDR
+} PioWindow;
+
+/* Window of the send path, mapped by whoever maps the user registers */
+extern PioWindow pio_window;
+
+int pio_map(PioWindow *pio, int fd, off_t offset, size_t size, uint64_t addr);
+void pio_unmap(PioWindow *pio);
+int pio_select(const DmaProfile *profile, const PioWindow *pio, uint64_t bytes, off_t offset);
+ssize_t pio_write(const PioWindow *pio, const frame *buf, uint64_t bytes, off_t offset);
+int pio_verify(const PioWindow *pio, const frame *expect, uint64_t bytes, off_t offset);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* __PIO_H__ */
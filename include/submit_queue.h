@@ -0,0 +1,145 @@
+#ifndef __SUBMIT_QUEUE_H__
+#define __SUBMIT_QUEUE_H__
+
+#include "pcie_session.h"
+#include <stdio.h>
+#include <pthread.h>
+
+/* Same layout as _Atomic, so C++ callers can share the structures */
+#ifdef __cplusplus
+#include <atomic>
+#define SUBMIT_ATOMIC(T) std::atomic<T>
+#else
+#include <stdatomic.h>
+#define SUBMIT_ATOMIC(T) _Atomic T
+#endif
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define SUBMIT_QUEUE_DEPTH_DEFAULT (256)
+#define SUBMIT_COALESCE_MAX (256)        /* Requests packed into one loop at most */
+#define SUBMIT_COALESCE_US_DEFAULT (200) /* Wait of the oldest packed request for more */
+
+typedef enum submit_op {
+	SUBMIT_SEND, /* Send frames of any size in BRAM loops */
+	SUBMIT_STEP, /* Send one loop and receive its output, see pcie_session_step() */
+} submit_op_e;
+
+typedef enum submit_state {
+	SUBMIT_PENDING,
+	SUBMIT_DONE,
+} submit_state_e;
+
+struct SubmitRequest_TypeDef;
+typedef void (*submit_callback)(struct SubmitRequest_TypeDef *req, void *arg);
+
+/*
+	A request is also its own future: wait on it with submit_request_wait(),
+	or get a callback on the engine thread when it completes, or on the
+	thread in submit_engine_stop() for one pushed while the engine stops.
+	The request and its frames must stay valid until then. A request with
+	a callback is never marked done; it belongs to the callback instead.
+*/
+typedef struct SubmitRequest_TypeDef {
+	submit_op_e op;
+	const frame *frames;
+	size_t n;            // # of frames
+	frame *output;       // SUBMIT_STEP: where to copy output frames, may be NULL
+	size_t output_max;   // Capacity of output in frames
+
+	submit_callback callback;
+	void *arg;
+
+	size_t output_n;     // SUBMIT_STEP: its output frames in a packed loop, 0 as many as its frames
+
+	ssize_t rc;          // Bytes sent, or # of output frames of SUBMIT_STEP, or -errno
+	PCIeStepStats stats; // SUBMIT_STEP only
+	SUBMIT_ATOMIC(unsigned int) state;
+} SubmitRequest;
+
+typedef struct SubmitSlot_TypeDef {
+	SUBMIT_ATOMIC(size_t) seq;
+	SubmitRequest *req;
+} SubmitSlot;
+
+/* Bounded multi-producer single-consumer queue */
+typedef struct SubmitQueue_TypeDef {
+	SubmitSlot *slots;
+	size_t mask;
+	SUBMIT_ATOMIC(size_t) tail; // Producers
+	size_t head;                // Consumer only
+	SUBMIT_ATOMIC(unsigned int) doorbell;
+	SUBMIT_ATOMIC(int) sleeping;
+} SubmitQueue;
+
+/*
+	@brief
+		Split the output of a packed step among its requests, in order
+
+	@param counts: # of output frames of each request, to be filled
+*/
+typedef void (*submit_split_fn)(const frame *output, size_t n, SubmitRequest *const *reqs, int count,
+								size_t *counts, void *arg);
+
+/*
+	Packs consecutive small requests of the same op into one BRAM loop in
+	session->tx, so they share one TRANS_INFO setup, stop frame and TX
+	handshake. The loop goes once it is full, a request does not fit, or
+	the oldest request waited deadline_us with nothing else queued.
+*/
+typedef struct SubmitCoalescer_TypeDef {
+	size_t max_bytes;     // Requests up to this are packed, 0 for none
+	long deadline_us;
+	submit_split_fn split; // submit_split_ordered() by default
+	void *split_arg;
+
+	submit_op_e op;
+	SubmitRequest *reqs[SUBMIT_COALESCE_MAX];
+	uint64_t packed_ns[SUBMIT_COALESCE_MAX];
+	int count;
+	size_t n;             // # of frames packed
+
+	uint64_t loops;
+	uint64_t requests;
+	uint64_t bytes;       // Packed into loops
+	uint64_t delay_ns;    // Sum of waits of requests for their loop
+	uint64_t delay_ns_max;
+} SubmitCoalescer;
+
+/* The only thread touching the devices and user registers of a session */
+typedef struct SubmitEngine_TypeDef {
+	SubmitQueue queue;
+	PCIeSession *session;
+	SubmitCoalescer coalesce;
+	pthread_t thread;
+	SUBMIT_ATOMIC(int) stop;
+	SUBMIT_ATOMIC(int) producers; // Pushes in flight, drained by submit_engine_stop()
+	SUBMIT_ATOMIC(unsigned long) completed;
+	SUBMIT_ATOMIC(unsigned long) failed;
+} SubmitEngine;
+
+int submit_queue_init(SubmitQueue *queue, size_t depth);
+void submit_queue_destroy(SubmitQueue *queue);
+int submit_queue_push(SubmitQueue *queue, SubmitRequest *req);
+SubmitRequest *submit_queue_pop(SubmitQueue *queue);
+
+int submit_engine_start(SubmitEngine *engine, PCIeSession *session, size_t depth);
+int submit_engine_start_coalesce(SubmitEngine *engine, PCIeSession *session, size_t depth, size_t max_bytes,
+								 long deadline_us, submit_split_fn split, void *split_arg);
+void submit_engine_stop(SubmitEngine *engine);
+void submit_coalesce_report(const SubmitCoalescer *coalesce, FILE *fp);
+void submit_split_ordered(const frame *output, size_t n, SubmitRequest *const *reqs, int count, size_t *counts,
+						  void *arg);
+
+void submit_request_init(SubmitRequest *req, submit_op_e op, const frame *frames, size_t n);
+int submit_request_push(SubmitEngine *engine, SubmitRequest *req);
+int submit_request_done(SubmitRequest *req);
+ssize_t submit_request_wait(SubmitRequest *req);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* __SUBMIT_QUEUE_H__ */
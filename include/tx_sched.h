@@ -0,0 +1,109 @@
+#ifndef __TX_SCHED_H__
+#define __TX_SCHED_H__
+
+#include "utils.h"
+#include <stdio.h>
+#include <stddef.h>
+#include <pthread.h>
+#include <sys/types.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define TX_TENANTS_MAX 16
+
+/* Priority classes, served strictly in this order */
+typedef enum tx_class {
+	TX_CLASS_LATENCY, /* Short work jobs */
+	TX_CLASS_NORMAL,
+	TX_CLASS_BULK,    /* e.g. config uploads */
+	TX_CLASSES,
+} tx_class_e;
+
+struct TxTenant_TypeDef;
+
+/* A transfer, owned by the caller until tx_sched_wait() returns */
+typedef struct TxJob_TypeDef {
+	struct TxTenant_TypeDef *tenant;
+	int mode; // FPGA mode of its frames, FPGA_MODE_CONFIG or FPGA_MODE_WORK
+	const frame *frames;
+	uint64_t bytes;
+	uint64_t sent;
+
+	uint64_t submit_ns;
+	uint64_t start_ns; // First loop on the device
+	uint64_t done_ns;
+	uint64_t busy_ns;  // Its own loops on the device
+	ssize_t rc;        // Bytes sent, or -errno
+	int done;
+
+	struct TxJob_TypeDef *next;
+} TxJob;
+
+typedef struct TxTenant_TypeDef {
+	const char *name;
+	tx_class_e cls;
+	uint32_t weight;
+	uint64_t vfinish; // Virtual finish time of its last loop
+	TxJob *head;
+	TxJob *tail;
+
+	uint64_t jobs;
+	uint64_t loops;
+	uint64_t bytes;
+	uint64_t queue_ns;     // Sum of submit to first loop
+	uint64_t queue_ns_max;
+	uint64_t wait_ns;      // Sum of time queued, including between preempted loops
+	uint64_t busy_ns;      // Device occupancy
+} TxTenant;
+
+/*
+	Shares one h2c channel between tenants. Every transfer is cut into BRAM
+	loops and the next loop is chosen after each one, so a long transfer is
+	preempted at loop boundaries. Classes are strict priorities; tenants of
+	a class share the device by weight, in start-time fair queueing of bytes.
+
+	Every job carries the FPGA mode its frames are for. The mode is switched
+	between jobs only: while a job is partly sent, only jobs of its mode are
+	picked, so a work job does not preempt a config upload in the middle but
+	goes before the next one. Cut a long upload into several jobs to let
+	jobs of the other mode in between.
+*/
+typedef struct TxScheduler_TypeDef {
+	char *fname;
+	int fd;
+	void *user_addr;
+	uint64_t addr; // DOWNSTREAM_BRAM_CH1_ADDR
+
+	pthread_mutex_t lock;
+	pthread_cond_t work;
+	pthread_cond_t done;
+	pthread_t thread;
+	int stop;
+
+	TxTenant tenants[TX_TENANTS_MAX];
+	int num;
+	uint64_t vclock[TX_CLASSES];
+	int mode;    // FPGA mode set on the device
+	int partial; // # of jobs with loops sent and loops left, all of mode
+
+	uint64_t start_ns;
+	uint64_t busy_ns;
+	uint64_t loops;
+	uint64_t preemptions; // Loops of another job between two loops of a job
+	TxJob *running;       // Job with loops sent and loops left, if any
+} TxScheduler;
+
+int tx_sched_start(TxScheduler *sched, char *fname, int fd, void *user_addr, uint64_t addr);
+void tx_sched_stop(TxScheduler *sched);
+TxTenant *tx_sched_add_tenant(TxScheduler *sched, const char *name, tx_class_e cls, uint32_t weight);
+int tx_sched_submit(TxScheduler *sched, TxTenant *tenant, TxJob *job, int mode, const frame *frames, size_t n);
+ssize_t tx_sched_wait(TxScheduler *sched, TxJob *job);
+void tx_sched_report(TxScheduler *sched, FILE *fp);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* __TX_SCHED_H__ */
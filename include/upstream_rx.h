@@ -0,0 +1,64 @@
+#ifndef __UPSTREAM_RX_H__
+#define __UPSTREAM_RX_H__
+
+#include "utils.h"
+#include "frame_sink.h"
+#include "dma_tune.h"
+#include <stdio.h>
+#include <stddef.h>
+#include <sys/types.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef enum upstream_rx_mode {
+	UPSTREAM_RX_SINGLE,   /* RX done for the whole BRAM, the FPGA waits while it is read */
+	UPSTREAM_RX_PINGPONG, /* Halves read in turn while the FPGA fills the other one */
+} upstream_rx_mode_e;
+
+/* Mode of the work-mode upstream, set before the work frames are sent */
+extern int upstream_rx_mode;
+
+/* @return Bytes read from the upstream BRAM at addr, or -errno */
+typedef ssize_t (*upstream_read_fn)(void *arg, frame *buf, size_t bytes, uint64_t addr);
+
+/*
+	Receives the upstream BRAM block by block into a sink, until a block
+	with a STOP_FRAME. A block is the whole BRAM, or a half in ping-pong
+	mode. Each block is acknowledged as soon as it has been read, before
+	it is written to the sink.
+*/
+typedef struct UpstreamRx_TypeDef {
+	char *fname;
+	int fd;
+	void *user_addr;
+	uint64_t addr;        // UPSTREAM_BRAM_CH1_ADDR
+	upstream_rx_mode_e mode;
+	long timeout_us;      // Wait for each block
+	dma_wait_e wait;      // DMA_WAIT_SPIN by default
+	uint32_t wait_interval_us; // DMA_WAIT_SLEEP only
+	upstream_read_fn read; // pread() of fd, set by upstream_rx_init()
+	void *read_arg;
+	frame *buf;
+
+	/* Of the last upstream_rx_run() */
+	uint64_t blocks;
+	uint64_t frames;
+	uint64_t wait_ns;     // Waiting for ready
+	uint64_t read_ns;     // Reading blocks
+	uint64_t sink_ns;     // Writing frames to the sink
+	uint64_t elapsed_ns;
+} UpstreamRx;
+
+int upstream_rx_init(UpstreamRx *rx, char *fname, int fd, void *user_addr, uint64_t addr, upstream_rx_mode_e mode);
+void upstream_rx_enable(void *user_addr, upstream_rx_mode_e mode);
+ssize_t upstream_rx_run(UpstreamRx *rx, FrameSink *sink);
+void upstream_rx_report(const UpstreamRx *rx, FILE *fp);
+void upstream_rx_release(UpstreamRx *rx);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* __UPSTREAM_RX_H__ */
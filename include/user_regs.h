@@ -0,0 +1,61 @@
+#ifndef __USER_REGS_H__
+#define __USER_REGS_H__
+
+#include <stdio.h>
+#include <stdint.h>
+#include <sys/types.h>
+#include "config.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+	Access layer of the user BAR on top of readUser/writeUser.
+
+	Registers 0x00~0x3C keep a shadow of their host-owned bits, so a
+	read-modify-write of those bits needs no MMIO read, and count their
+	reads, writes and the reads saved by the shadow.
+
+	There is one shadow and one set of counts per process, for a single
+	device. The shadow is of the last mapping accessed, dropped when
+	another one is, and by reset_xdma(); counts add up over mappings. Not
+	thread-safe: threads sharing the device, e.g. the submit engine or
+	tx_sched thread and their callers, must access it one at a time,
+	handing over through a lock as their queues do.
+*/
+#define USER_REGS_NUM (16) /* Shadowed registers, 0x00~0x3C */
+
+typedef struct UserRegWrite_TypeDef {
+	off_t offset;
+	uint32_t val;
+} UserRegWrite;
+
+typedef struct UserRegStats_TypeDef {
+	uint64_t reads;       // MMIO reads
+	uint64_t writes;      // MMIO writes
+	uint64_t saved_reads; // Reads served by the shadow
+} UserRegStats;
+
+typedef struct UserRegBench_TypeDef {
+	double read_ns;  // Mean latency of a MMIO read
+	double write_ns; // Mean latency of a posted MMIO write
+	double rmw_ns;   // Mean latency of a read-modify-write of a device-set register
+} UserRegBench;
+
+void updateUser(void *baseAddr, off_t offset, uint32_t mask, uint32_t val);
+void writeUserBatch(void *baseAddr, const UserRegWrite *seq, int n);
+void writeUser64(void *baseAddr, off_t offset, const uint64_t *vals, size_t n);
+void invalidateUserShadow(void);
+
+void getUserStats(off_t offset, UserRegStats *stats);
+void clearUserStats(void);
+void dumpUserStats(FILE *fp);
+
+int benchUser(void *baseAddr, int iters, UserRegBench *bench);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* __USER_REGS_H__ */
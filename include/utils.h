@@ -36,6 +36,8 @@ uint64_t getopt_integer(char *optarg);
 
 void writeUser(void *baseAddr, off_t offset, uint32_t val);
 uint32_t readUser(void *baseAddr, off_t offset);
+uint64_t get_time_ns(void);
+int pollUser(void *baseAddr, off_t offset, uint32_t mask, long timeout_us, uint32_t *value);
 int checkTXCompleted(void *baseAddr, long timeout);
 int checkRXCompleted(void *baseAddr, long timeout);
 int eventTriggered(int fd, irq_e irq);
@@ -0,0 +1,53 @@
+#ifndef __XDMA_PERF_H__
+#define __XDMA_PERF_H__
+
+#include "utils.h"
+#include "config.h"
+#include <stdio.h>
+#include <stddef.h>
+#include <sys/types.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define XDMA_PERF_HOST_BOUND (0.5) /* Engine counting less than this share of host time: host-bound */
+#define XDMA_PERF_LINK_BOUND (0.8) /* Data beats on at least this share of its cycles: link-bound */
+
+/*
+	Performance monitors of the XDMA engines in the control BAR. Each
+	engine counts cycles from its first data beat while running, and the
+	data beats it moved. Any file of CONTROL_MAP_SIZE bytes mapped the same
+	way stands in for the BAR; its counters read back what the file holds.
+*/
+typedef struct XdmaPerf_TypeDef {
+	int fd;
+	void *base;          // NULL if not mapped, nothing counted
+	double clock_mhz;    // XDMA_PERF_CLOCK_MHZ_DEFAULT
+	uint32_t beat_bytes; // XDMA_PERF_BEAT_BYTES_DEFAULT
+} XdmaPerf;
+
+/* Counters of one engine over one transfer, next to the host's view of it */
+typedef struct XdmaPerfSample_TypeDef {
+	off_t engine;     // XDMA_H2C_CHANNEL_OFFSET(ch) or XDMA_C2H_CHANNEL_OFFSET(ch)
+	uint64_t cycles;
+	uint64_t beats;
+	int overflow;
+	uint64_t host_ns; // From start to stop
+	uint64_t bytes;   // Moved by the host
+} XdmaPerfSample;
+
+/* Monitors of the send and receive paths, opened by main() with '-x' */
+extern XdmaPerf xdma_perf;
+
+int xdma_perf_open(XdmaPerf *perf, const char *name);
+void xdma_perf_close(XdmaPerf *perf);
+void xdma_perf_start(XdmaPerf *perf, off_t engine, XdmaPerfSample *sample);
+void xdma_perf_stop(XdmaPerf *perf, XdmaPerfSample *sample, uint64_t bytes);
+void xdma_perf_report(const XdmaPerf *perf, const char *name, const XdmaPerfSample *sample, FILE *fp);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* __XDMA_PERF_H__ */
@@ -1,9 +1,21 @@
 #include "utils.h"
 #include "config.h"
 #include "dma2device.h"
+#include "frame_codec.h"
+#include "user_regs.h"
+#include "dma_tune.h"
+#include "upstream_rx.h"
+#include "pio.h"
+#include "dma_ring.h"
+#include "xdma_perf.h"
+#include "dma_trace.h"
+#include "frame_reduce.h"
 #include <unistd.h>
 #include <string.h>
+#include <errno.h>
 #include <getopt.h>
+#include <fcntl.h>
+#include <sys/mman.h>
 
 static struct option const long_opts[] = {
     {"device", required_argument, NULL, 'd'},
@@ -13,12 +25,111 @@ static struct option const long_opts[] = {
     {"configframe_path", required_argument, NULL, 'c'},
     {"workframe_path", required_argument, NULL, 'w'},
     {"outputframe_path", required_argument, NULL, 'o'},
+    {"format", required_argument, NULL, 'f'},
+    {"reg_bench", required_argument, NULL, 'r'},
+    {"profile", required_argument, NULL, 'p'},
+    {"tune", required_argument, NULL, 't'},
+    {"pingpong", no_argument, NULL, 'b'},
+    {"perf", required_argument, NULL, 'x'},
+    {"config_diff", required_argument, NULL, 'D'},
+    {"addr_field", required_argument, NULL, 'a'},
+    {"trace", required_argument, NULL, 'T'},
+    {"reduce", required_argument, NULL, 'R'},
+    {"uring", no_argument, NULL, 'U'},
     {"help", no_argument, NULL, 'h'},
     {"verbose", no_argument, NULL, 'v'},
     {0, 0, 0, 0},
 };
 
 extern int verbose;
+extern int frames_format;
+
+static int reg_bench(char *user_reg, int iters)
+{
+    UserRegBench bench;
+    void *user_addr;
+    int fd = open(user_reg, O_RDWR | O_SYNC);
+
+    if (fd < 0)
+    {
+        fprintf(stderr, "unable to open user registers %s, %d.\n", user_reg, fd);
+        perror("open device");
+        return -1;
+    }
+
+    user_addr = mmap(NULL, MAP_SIZE, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (user_addr == (void *)-1)
+    {
+        fprintf(stderr, "Memory mapped failed.\n");
+        perror("mmap error\n");
+        close(fd);
+        return -1;
+    }
+
+    benchUser(user_addr, iters, &bench);
+    fprintf(stdout, "MMIO read: %.1f ns, write: %.1f ns, read-modify-write: %.1f ns\n",
+            bench.read_ns, bench.write_ns, bench.rmw_ns);
+    dumpUserStats(stdout);
+
+    munmap(user_addr, MAP_SIZE);
+    close(fd);
+
+    return 0;
+}
+
+static int dma_tune_run(char *h2c_dev_name, char *user_reg, int mode, int iters, char *profile_name)
+{
+    DmaProfile best;
+    void *user_addr;
+    int rc = -1;
+    int fpga_fd = open(h2c_dev_name, O_RDWR);
+    int user_reg_fd = open(user_reg, O_RDWR | O_SYNC);
+
+    if (fpga_fd < 0 || user_reg_fd < 0)
+    {
+        fprintf(stderr, "unable to open device %s or user registers %s.\n", h2c_dev_name, user_reg);
+        perror("open device");
+        goto out;
+    }
+
+    user_addr = mmap(NULL, MAP_SIZE, PROT_READ | PROT_WRITE, MAP_SHARED, user_reg_fd, 0);
+    if (user_addr == (void *)-1)
+    {
+        fprintf(stderr, "Memory mapped failed.\n");
+        perror("mmap error\n");
+        goto out;
+    }
+
+    /* Reset device and set mode, as sending frames does */
+    reset_xdma(user_addr);
+    writeUser(user_addr, FPGA_MODE_RO_ADDR, mode);
+    sleep(1);
+
+#ifdef PIO_BRAM_WINDOW
+    /* Without a PIO window in the user BAR, tiny loops stay on DMA */
+    pio_map(&pio_window, user_reg_fd, PIO_BRAM_WINDOW_OFFSET, PIO_BRAM_WINDOW_SIZE, DOWNSTREAM_BRAM_CH1_ADDR);
+#endif
+
+    rc = dma_tune(h2c_dev_name, fpga_fd, user_addr, &pio_window, DOWNSTREAM_BRAM_CH1_ADDR, iters, &best);
+    pio_unmap(&pio_window);
+    if (!rc)
+        rc = dma_profile_save(profile_name, &best);
+    if (!rc)
+    {
+        dma_profile_dump(stdout, &best);
+        fprintf(stdout, "DMA profile saved to %s.\n", profile_name);
+    }
+
+    munmap(user_addr, MAP_SIZE);
+
+out:
+    if (user_reg_fd >= 0)
+        close(user_reg_fd);
+    if (fpga_fd >= 0)
+        close(fpga_fd);
+
+    return rc;
+}
 
 static void usage(const char *name)
 {
@@ -45,7 +156,41 @@ static void usage(const char *name)
     fprintf(stdout, "  -%c (--%s) path of work frames\n",
             long_opts[i].val, long_opts[i].name);
     i++;
-    fprintf(stdout, "  -%c (--%s) path of output frames to be saved\n",
+    fprintf(stdout, "  -%c (--%s) path of output frames to be saved, or shm:/name for a ring in /dev/shm\n",
+            long_opts[i].val, long_opts[i].name);
+    i++;
+    fprintf(stdout, "  -%c (--%s) format of frames files, txt, bin, pack or native (defaults to %s)\n",
+            long_opts[i].val, long_opts[i].name, frames_format_name(FRAMES_FORMAT_DEFAULT));
+    i++;
+    fprintf(stdout, "  -%c (--%s) measure MMIO latency of user registers with N accesses and exit\n",
+            long_opts[i].val, long_opts[i].name);
+    i++;
+    fprintf(stdout, "  -%c (--%s) DMA profile of this host (defaults to %s)\n",
+            long_opts[i].val, long_opts[i].name, DMA_PROFILE_NAME_DEFAULT);
+    i++;
+    fprintf(stdout, "  -%c (--%s) tune DMA with N repeats of each setting, save the profile and exit\n",
+            long_opts[i].val, long_opts[i].name);
+    i++;
+    fprintf(stdout, "  -%c (--%s) receive output in ping-pong halves of the upstream BRAM\n",
+            long_opts[i].val, long_opts[i].name);
+    i++;
+    fprintf(stdout, "  -%c (--%s) report XDMA engine counters of each transfer from a control BAR, e.g. %s\n",
+            long_opts[i].val, long_opts[i].name, CONTROL_NAME_DEFAULT);
+    i++;
+    fprintf(stdout, "  -%c (--%s) config frames configured before, send only config frames changed since\n",
+            long_opts[i].val, long_opts[i].name);
+    i++;
+    fprintf(stdout, "  -%c (--%s) OFFSET:WIDTH, target address field of config frames (defaults to %d:%d)\n",
+            long_opts[i].val, long_opts[i].name, CONFIG_ADDR_FIELD_OFFSET, CONFIG_ADDR_FIELD_WIDTH);
+    i++;
+    fprintf(stdout, "  -%c (--%s) record transfer and file I/O stages, written as Chrome trace JSON at exit\n",
+            long_opts[i].val, long_opts[i].name);
+    i++;
+    fprintf(stdout, "  -%c (--%s) count:OFFSET:WIDTH or hist:OFFSET:WIDTH:SHIFT[:BINS], comma-separated, save counts\n"
+                    "      of output frames per field value as CSV in place of output frames\n",
+            long_opts[i].val, long_opts[i].name);
+    i++;
+    fprintf(stdout, "  -%c (--%s) file and h2c I/O through io_uring, plain syscalls without\n",
             long_opts[i].val, long_opts[i].name);
     i++;
     fprintf(stdout, "  -%c (--%s) print usage help and exit\n",
@@ -59,10 +204,19 @@ static void usage(const char *name)
 int main(int argc, char *argv[])
 {
     int cmd_opt;
+    int reg_bench_iters = 0;
+    int tune_iters = 0;
+    char *profile_name = DMA_PROFILE_NAME_DEFAULT;
     char *h2c_dev_name = H2C_DEVICE_NAME_DEFAULT;
     char *c2h_dev_name = C2H_DEVICE_NAME_DEFAULT;
     char *user_reg = USER_REG_NAME_DEFAULT;
     char *irq_ch1_name = IRQ_CH1_NAME_DEFAULT;
+    char *control_name = NULL;
+    char *oldConfigFramePath = NULL;
+    char *trace_name = NULL;
+    int use_uring = 0;
+    FrameField addr_field = {"addr", CONFIG_ADDR_FIELD_OFFSET, CONFIG_ADDR_FIELD_WIDTH};
+    FrameReduce reduce = {0};
 
     int mode = FPGA_MODE_CONFIG;
     char *configFramePath = CONFIG_FRAMES_PATH_DEFAULT;
@@ -71,7 +225,7 @@ int main(int argc, char *argv[])
 
     ssize_t rc;
 
-    while ((cmd_opt = getopt_long(argc, argv, "vhd:u:m:i:c:w:o:", long_opts, NULL)) != -1)
+    while ((cmd_opt = getopt_long(argc, argv, "vhbUd:u:m:i:c:w:o:f:r:p:t:x:D:a:T:R:", long_opts, NULL)) != -1)
     {
         switch (cmd_opt)
         {
@@ -106,6 +260,73 @@ int main(int argc, char *argv[])
             /* path of output frames */
             outputFramePath = strdup(optarg);
             break;
+        case 'f':
+            /* format of frames files */
+            frames_format = frames_format_from_name(optarg);
+            if (frames_format < 0)
+            {
+                fprintf(stderr, "unknown frames format %s.\n", optarg);
+                usage(argv[0]);
+                exit(1);
+            }
+            break;
+        case 'r':
+            /* benchmark user registers */
+            reg_bench_iters = getopt_integer(optarg);
+            break;
+        case 'p':
+            /* DMA profile */
+            profile_name = strdup(optarg);
+            break;
+        case 't':
+            /* tune DMA */
+            tune_iters = getopt_integer(optarg);
+            break;
+        case 'b':
+            /* double-buffered upstream */
+            upstream_rx_mode = UPSTREAM_RX_PINGPONG;
+            break;
+        case 'x':
+            /* XDMA engine counters */
+            control_name = strdup(optarg);
+            break;
+        case 'D':
+            /* incremental reconfiguration */
+            oldConfigFramePath = strdup(optarg);
+            break;
+        case 'a':
+            /* address field of config frames */
+            {
+                char *colon = strchr(optarg, ':');
+                int offset = getopt_integer(optarg);
+                int width = colon ? getopt_integer(colon + 1) : 0;
+
+                if (offset < 0 || width < 1 || offset + width > 64)
+                {
+                    fprintf(stderr, "bad address field %s.\n", optarg);
+                    usage(argv[0]);
+                    exit(1);
+                }
+                addr_field.offset = offset;
+                addr_field.width = width;
+            }
+            break;
+        case 'T':
+            /* trace of transfer stages */
+            trace_name = strdup(optarg);
+            break;
+        case 'U':
+            /* io_uring */
+            use_uring = 1;
+            break;
+        case 'R':
+            /* reductions of output frames */
+            if ((!reduce.keys && frame_reduce_init(&reduce)) || frame_reduce_parse(&reduce, optarg))
+            {
+                usage(argv[0]);
+                exit(1);
+            }
+            break;
 
             /* print usage help and exit */
         case 'v':
@@ -121,22 +342,71 @@ int main(int argc, char *argv[])
 
     if (verbose)
     {
-        fprintf(stdout, "device: %s,\nuser registers: %s,\nmode: %d,\nirq_ch1_name: %s,\nconfigFramePath: %s,\nworkFramePath: %s,\noutputFramePath: %s\n\n",
-                h2c_dev_name, user_reg, mode, irq_ch1_name, configFramePath, workFramePath, outputFramePath);
+        fprintf(stdout, "device: %s,\nuser registers: %s,\nmode: %d,\nirq_ch1_name: %s,\nconfigFramePath: %s,\nworkFramePath: %s,\noutputFramePath: %s,\nformat: %s\n\n",
+                h2c_dev_name, user_reg, mode, irq_ch1_name, configFramePath, workFramePath, outputFramePath,
+                frames_format_name(frames_format));
+    }
+
+    if (reg_bench_iters > 0)
+    {
+        return reg_bench(user_reg, reg_bench_iters);
+    }
+
+    if (tune_iters > 0)
+    {
+        return dma_tune_run(h2c_dev_name, user_reg, mode, tune_iters, profile_name);
     }
 
+    /* Without a profile, send as untuned */
+    rc = dma_profile_load(profile_name, &dma_profile);
+    if (rc < 0 && rc != -ENOENT)
+        fprintf(stderr, "%s, DMA profile ignored.\n", profile_name);
+    if (verbose)
+        dma_profile_dump(stdout, &dma_profile);
+
+    /* Input reads, h2c writes and output writes share one ring, until validated on XDMA only if asked */
+    if (use_uring)
+        dma_ring_init(&dma_ring, DMA_RING_ENTRIES_DEFAULT, 1);
+
+    /* Transfers run uncounted if it does not open */
+    if (control_name)
+        xdma_perf_open(&xdma_perf, control_name);
+
+    if (trace_name)
+        dma_trace_open(&dma_trace, trace_name, DMA_TRACE_EVENTS_DEFAULT);
+
     /*
         Currently, a transaction use an individual program
     */
-    if (mode == FPGA_MODE_CONFIG)
+    rc = -1;
+    if (mode == FPGA_MODE_CONFIG && oldConfigFramePath)
     {
-        return FramesFile2Device(h2c_dev_name, user_reg, irq_ch1_name, configFramePath, mode);
+        rc = ConfigDiff2Device(h2c_dev_name, user_reg, irq_ch1_name, oldConfigFramePath, configFramePath,
+                               &addr_field);
     }
-    else if (mode == FPGA_MODE_WORK)
+    else if (mode == FPGA_MODE_CONFIG)
+    {
+        rc = FramesFile2Device(h2c_dev_name, user_reg, irq_ch1_name, configFramePath, mode);
+    }
+    else if (mode == FPGA_MODE_WORK && reduce.num)
     {
+        /* No counts of work frames that never reached the device */
         rc = FramesFile2Device(h2c_dev_name, user_reg, irq_ch1_name, workFramePath, mode);
-        rc = deviceToFramesFile(c2h_dev_name, user_reg, irq_ch1_name, outputFramePath);
+        if (!rc)
+            rc = deviceToFrameReduce(c2h_dev_name, user_reg, irq_ch1_name, &reduce, outputFramePath);
     }
+    else if (mode == FPGA_MODE_WORK)
+    {
+        FramesFile2Device(h2c_dev_name, user_reg, irq_ch1_name, workFramePath, mode);
+        deviceToFramesFile(c2h_dev_name, user_reg, irq_ch1_name, outputFramePath);
+    }
+
+    if (verbose && dma_ring_active(&dma_ring))
+        dma_ring_dump(stdout, &dma_ring);
+    dma_ring_exit(&dma_ring);
+    xdma_perf_close(&xdma_perf);
+    dma_trace_close(&dma_trace);
+    frame_reduce_free(&reduce);
 
-    return -1;
+    return rc;
 }
\ No newline at end of file
@@ -0,0 +1,536 @@
+/*
+	CPython extension over the C core.
+
+	Frames to send are taken from any C-contiguous buffer-protocol object of
+	8-byte items, e.g. a NumPy uint64 array. send() writes them by DMA straight
+	from its memory, step() copies them into the session's TX buffer. Received frames come back as pcieapp.Frames, which exposes a
+	4K-aligned SDK buffer as a buffer of native uint64, so numpy.asarray()
+	wraps it without a copy. DMA runs with the GIL released.
+*/
+#define PY_SSIZE_T_CLEAN
+#include <Python.h>
+#include <structmember.h>
+#include <pythread.h>
+
+#include "utils.h"
+#include "dma_utils.h"
+#include "pcie_session.h"
+#include "frame_decoder.h"
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <endian.h>
+
+#define FRAMES_FREE_MAX (4) /* Output buffers kept for reuse */
+
+/* Output buffers of UPSTREAM_BRAM_SIZE bytes, only touched with the GIL held */
+static frame *frames_free[FRAMES_FREE_MAX];
+static int frames_free_num;
+
+static frame *frames_alloc(void)
+{
+	frame *buf = NULL;
+
+	if (frames_free_num > 0)
+		return frames_free[--frames_free_num];
+
+	if (posix_memalign((void **)&buf, 4096 /* alignment */, UPSTREAM_BRAM_SIZE))
+		return NULL;
+
+	return buf;
+}
+
+static void frames_release(frame *buf)
+{
+	if (frames_free_num < FRAMES_FREE_MAX)
+		frames_free[frames_free_num++] = buf;
+	else
+		free(buf);
+}
+
+/* pcieapp.Frames */
+typedef struct {
+	PyObject_HEAD
+	frame *frames;
+	Py_ssize_t num;
+	Py_ssize_t shape[1];
+	Py_ssize_t strides[1];
+} FramesObject;
+
+static PyTypeObject FramesType;
+
+static FramesObject *Frames_new_empty(void)
+{
+	FramesObject *self = PyObject_New(FramesObject, &FramesType);
+
+	if (!self)
+		return NULL;
+
+	self->num = 0;
+	self->frames = frames_alloc();
+	if (!self->frames)
+	{
+		Py_DECREF(self);
+		return (FramesObject *)PyErr_NoMemory();
+	}
+
+	return self;
+}
+
+static void Frames_dealloc(FramesObject *self)
+{
+	if (self->frames)
+		frames_release(self->frames);
+
+	PyObject_Free(self);
+}
+
+static int Frames_getbuffer(FramesObject *self, Py_buffer *view, int flags)
+{
+	self->shape[0] = self->num;
+	self->strides[0] = sizeof(frame);
+
+	view->obj = (PyObject *)self;
+	view->buf = self->frames;
+	view->len = self->num * sizeof(frame);
+	view->readonly = 0;
+	view->itemsize = sizeof(frame);
+	view->format = (flags & PyBUF_FORMAT) ? "Q" : NULL;
+	view->ndim = 1;
+	view->shape = (flags & PyBUF_ND) ? self->shape : NULL;
+	view->strides = (flags & PyBUF_STRIDES) == PyBUF_STRIDES ? self->strides : NULL;
+	view->suboffsets = NULL;
+	view->internal = NULL;
+
+	Py_INCREF(self);
+
+	return 0;
+}
+
+static Py_ssize_t Frames_len(FramesObject *self)
+{
+	return self->num;
+}
+
+static PyObject *Frames_item(FramesObject *self, Py_ssize_t i)
+{
+	if (i < 0 || i >= self->num)
+	{
+		PyErr_SetString(PyExc_IndexError, "frame index out of range");
+		return NULL;
+	}
+
+	return PyLong_FromUnsignedLongLong(self->frames[i]);
+}
+
+static PyBufferProcs Frames_as_buffer = {
+	.bf_getbuffer = (getbufferproc)Frames_getbuffer,
+};
+
+static PySequenceMethods Frames_as_sequence = {
+	.sq_length = (lenfunc)Frames_len,
+	.sq_item = (ssizeargfunc)Frames_item,
+};
+
+static PyTypeObject FramesType = {
+	PyVarObject_HEAD_INIT(NULL, 0)
+	.tp_name = "pcieapp.Frames",
+	.tp_doc = PyDoc_STR("Received frames in an aligned SDK buffer, a buffer of native uint64"),
+	.tp_basicsize = sizeof(FramesObject),
+	.tp_flags = Py_TPFLAGS_DEFAULT,
+	.tp_dealloc = (destructor)Frames_dealloc,
+	.tp_as_buffer = &Frames_as_buffer,
+	.tp_as_sequence = &Frames_as_sequence,
+};
+
+/* pcieapp.Session */
+typedef struct {
+	PyObject_HEAD
+	PCIeSession session;
+	PyThread_type_lock lock; // Serializes DMA of threads sharing a session
+	int opened;
+} SessionObject;
+
+static PyObject *raise_errno(ssize_t rc)
+{
+	errno = (int)-rc;
+	return PyErr_SetFromErrno(PyExc_OSError);
+}
+
+/*
+	@brief
+		Get frames of a C-contiguous buffer of native 8-byte integers, or of
+		bytes whose length is a multiple of 8
+*/
+static int get_frames(PyObject *obj, Py_buffer *view)
+{
+	const char *format;
+
+	if (PyObject_GetBuffer(obj, view, PyBUF_C_CONTIGUOUS | PyBUF_FORMAT) < 0)
+		return -1;
+
+	/* Native byte order only, frames are sent as they are in memory */
+	format = view->format ? view->format : "B";
+	if (*format == '@' || *format == '=' || (*format == '<' && __BYTE_ORDER == __LITTLE_ENDIAN))
+		format++;
+
+	if (!((view->itemsize == 8 && format[0] && format[1] == '\0' && strchr("QqLl", format[0])) ||
+		  (view->itemsize == 1 && !strcmp(format, "B"))))
+	{
+		PyErr_Format(PyExc_TypeError, "frames buffer of format '%s', not of 8-byte integers or bytes",
+					 view->format ? view->format : "B");
+		PyBuffer_Release(view);
+		return -1;
+	}
+
+	if (view->len % sizeof(frame))
+	{
+		PyErr_Format(PyExc_ValueError, "frames buffer of %zd bytes, not a multiple of %zu",
+					 view->len, sizeof(frame));
+		PyBuffer_Release(view);
+		return -1;
+	}
+
+	return 0;
+}
+
+static PyObject *Session_closed(void)
+{
+	PyErr_SetString(PyExc_ValueError, "I/O operation on closed session");
+	return NULL;
+}
+
+static int Session_check(SessionObject *self)
+{
+	if (!self->opened)
+	{
+		Session_closed();
+		return -1;
+	}
+
+	return 0;
+}
+
+/*
+	@brief
+		Take the session lock, with the GIL released. A close() may have
+		come first while waiting for it.
+
+	@return 0 with the lock held, or -1 without it if the session is closed
+*/
+static int Session_acquire(SessionObject *self)
+{
+	PyThread_acquire_lock(self->lock, WAIT_LOCK);
+	if (self->opened)
+		return 0;
+
+	PyThread_release_lock(self->lock);
+	return -1;
+}
+
+static int Session_init(SessionObject *self, PyObject *args, PyObject *kwds)
+{
+	static char *kwlist[] = {"h2c", "c2h", "user", "mode", NULL};
+	char *h2c = H2C_DEVICE_NAME_DEFAULT;
+	char *c2h = C2H_DEVICE_NAME_DEFAULT;
+	char *user = USER_REG_NAME_DEFAULT;
+	int mode = FPGA_MODE_WORK;
+	int rc;
+
+	if (!PyArg_ParseTupleAndKeywords(args, kwds, "|sssi", kwlist, &h2c, &c2h, &user, &mode))
+		return -1;
+
+	if (self->opened)
+	{
+		PyErr_SetString(PyExc_ValueError, "session already opened");
+		return -1;
+	}
+
+	if (!self->lock)
+	{
+		self->lock = PyThread_allocate_lock();
+		if (!self->lock)
+		{
+			PyErr_NoMemory();
+			return -1;
+		}
+	}
+
+	Py_BEGIN_ALLOW_THREADS
+	rc = pcie_session_open(&self->session, h2c, c2h, user, mode);
+	Py_END_ALLOW_THREADS
+
+	if (rc < 0)
+	{
+		raise_errno(rc);
+		return -1;
+	}
+
+	self->opened = 1;
+
+	return 0;
+}
+
+static void Session_dealloc(SessionObject *self)
+{
+	if (self->opened)
+		pcie_session_close(&self->session);
+	if (self->lock)
+		PyThread_free_lock(self->lock);
+
+	Py_TYPE(self)->tp_free((PyObject *)self);
+}
+
+static PyObject *Session_close(SessionObject *self, PyObject *Py_UNUSED(ignored))
+{
+	if (self->opened)
+	{
+		Py_BEGIN_ALLOW_THREADS
+		if (!Session_acquire(self))
+		{
+			/* Cleared under the lock, so a send or step waiting for it finds the session closed */
+			self->opened = 0;
+			pcie_session_close(&self->session);
+			PyThread_release_lock(self->lock);
+		}
+		Py_END_ALLOW_THREADS
+	}
+
+	Py_RETURN_NONE;
+}
+
+static PyObject *Session_enter(SessionObject *self, PyObject *Py_UNUSED(ignored))
+{
+	Py_INCREF(self);
+	return (PyObject *)self;
+}
+
+static PyObject *Session_exit(SessionObject *self, PyObject *args)
+{
+	return Session_close(self, NULL);
+}
+
+PyDoc_STRVAR(Session_send_doc,
+			 "send(frames) -> int\n\n"
+			 "Send frames of any size in BRAM loops, directly from the buffer.\n"
+			 "Return bytes sent.");
+
+static PyObject *Session_send(SessionObject *self, PyObject *arg)
+{
+	Py_buffer view;
+	FrameBuffer buffer;
+	ssize_t rc = 0;
+	int closed;
+
+	if (Session_check(self) < 0 || get_frames(arg, &view) < 0)
+		return NULL;
+
+	buffer.frames = (frame *)view.buf;
+	buffer.size = view.len;
+
+	Py_BEGIN_ALLOW_THREADS
+	closed = Session_acquire(self);
+	if (!closed)
+	{
+		rc = single_channel_send("pcieapp", self->session.h2c_fd, self->session.user_addr, -1,
+								 self->session.h2c_addr, &buffer);
+		PyThread_release_lock(self->lock);
+	}
+	Py_END_ALLOW_THREADS
+
+	PyBuffer_Release(&view);
+
+	if (closed)
+		return Session_closed();
+	if (rc < 0)
+		return raise_errno(rc);
+
+	return PyLong_FromSsize_t(rc);
+}
+
+PyDoc_STRVAR(Session_step_doc,
+			 "step(frames) -> Frames\n\n"
+			 "Send frames of one loop and receive its output frames before STOP_FRAME.\n"
+			 "Input is copied into the session's TX buffer; output is read by DMA\n"
+			 "straight into the returned Frames.");
+
+static PyObject *Session_step(SessionObject *self, PyObject *arg)
+{
+	Py_buffer view;
+	FramesObject *out;
+	frame *rx;
+	ssize_t rc = 0;
+	int closed;
+
+	if (Session_check(self) < 0 || get_frames(arg, &view) < 0)
+		return NULL;
+
+	out = Frames_new_empty();
+	if (!out)
+	{
+		PyBuffer_Release(&view);
+		return NULL;
+	}
+
+	Py_BEGIN_ALLOW_THREADS
+	closed = Session_acquire(self);
+	if (!closed)
+	{
+		/* Point the session at the output object for this step, so nothing is copied out */
+		rx = self->session.rx.frames;
+		self->session.rx.frames = out->frames;
+		rc = pcie_session_step(&self->session, (const frame *)view.buf, view.len / sizeof(frame), NULL);
+		self->session.rx.frames = rx;
+		PyThread_release_lock(self->lock);
+	}
+	Py_END_ALLOW_THREADS
+
+	PyBuffer_Release(&view);
+
+	if (closed)
+	{
+		Py_DECREF(out);
+		return Session_closed();
+	}
+	if (rc < 0)
+	{
+		Py_DECREF(out);
+		return raise_errno(rc);
+	}
+
+	out->num = rc;
+
+	return (PyObject *)out;
+}
+
+PyDoc_STRVAR(Session_receive_doc,
+			 "receive() -> Frames\n\n"
+			 "Wait for RX done and read the upstream BRAM, up to STOP_FRAME.");
+
+static PyObject *Session_receive(SessionObject *self, PyObject *Py_UNUSED(ignored))
+{
+	FramesObject *out;
+	FrameBuffer buffer;
+	ssize_t rc = 0;
+	int closed;
+
+	if (Session_check(self) < 0)
+		return NULL;
+
+	out = Frames_new_empty();
+	if (!out)
+		return NULL;
+
+	buffer.frames = out->frames;
+	buffer.size = UPSTREAM_BRAM_SIZE;
+
+	Py_BEGIN_ALLOW_THREADS
+	closed = Session_acquire(self);
+	if (!closed)
+	{
+		rc = single_channel_receive("pcieapp", self->session.c2h_fd, self->session.user_addr, -1,
+									self->session.c2h_addr, &buffer);
+		PyThread_release_lock(self->lock);
+		if (rc > 0)
+			rc = frames_until_stop(out->frames, rc / sizeof(frame));
+	}
+	Py_END_ALLOW_THREADS
+
+	if (closed)
+	{
+		Py_DECREF(out);
+		return Session_closed();
+	}
+	if (rc < 0)
+	{
+		Py_DECREF(out);
+		return raise_errno(rc);
+	}
+
+	out->num = rc;
+
+	return (PyObject *)out;
+}
+
+static PyObject *Session_get_last(SessionObject *self, void *closure)
+{
+	const PCIeStepStats *st = &self->session.last;
+
+	return Py_BuildValue("{s:K,s:K,s:K,s:K,s:K,s:K,s:n}",
+						 "send_ns", (unsigned long long)st->send_ns,
+						 "tx_wait_ns", (unsigned long long)st->tx_wait_ns,
+						 "rx_wait_ns", (unsigned long long)st->rx_wait_ns,
+						 "recv_ns", (unsigned long long)st->recv_ns,
+						 "total_ns", (unsigned long long)st->total_ns,
+						 "rx_bytes", (unsigned long long)st->rx_bytes,
+						 "rx_frames", (Py_ssize_t)st->rx_frames);
+}
+
+static PyObject *Session_get_tx_capacity(SessionObject *self, void *closure)
+{
+	return PyLong_FromSize_t(pcie_session_tx_capacity(&self->session));
+}
+
+static PyMethodDef Session_methods[] = {
+	{"send", (PyCFunction)Session_send, METH_O, Session_send_doc},
+	{"step", (PyCFunction)Session_step, METH_O, Session_step_doc},
+	{"receive", (PyCFunction)Session_receive, METH_NOARGS, Session_receive_doc},
+	{"close", (PyCFunction)Session_close, METH_NOARGS, PyDoc_STR("Close devices of the session")},
+	{"__enter__", (PyCFunction)Session_enter, METH_NOARGS, NULL},
+	{"__exit__", (PyCFunction)Session_exit, METH_VARARGS, NULL},
+	{NULL},
+};
+
+static PyGetSetDef Session_getset[] = {
+	{"last", (getter)Session_get_last, NULL, PyDoc_STR("Latency of the last step, in ns"), NULL},
+	{"tx_capacity", (getter)Session_get_tx_capacity, NULL, PyDoc_STR("Max # of frames of a step"), NULL},
+	{NULL},
+};
+
+static PyTypeObject SessionType = {
+	PyVarObject_HEAD_INIT(NULL, 0)
+	.tp_name = "pcieapp.Session",
+	.tp_doc = PyDoc_STR("Session(h2c, c2h, user, mode): devices opened and FPGA mode set once"),
+	.tp_basicsize = sizeof(SessionObject),
+	.tp_flags = Py_TPFLAGS_DEFAULT,
+	.tp_new = PyType_GenericNew,
+	.tp_init = (initproc)Session_init,
+	.tp_dealloc = (destructor)Session_dealloc,
+	.tp_methods = Session_methods,
+	.tp_getset = Session_getset,
+};
+
+static struct PyModuleDef pcieapp_module = {
+	PyModuleDef_HEAD_INIT,
+	.m_name = "pcieapp",
+	.m_doc = PyDoc_STR("PCIe applications for XDMA"),
+	.m_size = -1,
+};
+
+PyMODINIT_FUNC PyInit_pcieapp(void)
+{
+	PyObject *m;
+
+	if (PyType_Ready(&FramesType) < 0 || PyType_Ready(&SessionType) < 0)
+		return NULL;
+
+	m = PyModule_Create(&pcieapp_module);
+	if (!m)
+		return NULL;
+
+	Py_INCREF(&FramesType);
+	Py_INCREF(&SessionType);
+	if (PyModule_AddObject(m, "Frames", (PyObject *)&FramesType) < 0 ||
+		PyModule_AddObject(m, "Session", (PyObject *)&SessionType) < 0 ||
+		PyModule_AddObject(m, "STOP_FRAME", PyLong_FromUnsignedLongLong(STOP_FRAME)) < 0 ||
+		PyModule_AddIntConstant(m, "DOWNSTREAM_BRAM_SIZE", DOWNSTREAM_BRAM_SIZE) < 0 ||
+		PyModule_AddIntConstant(m, "UPSTREAM_BRAM_SIZE", UPSTREAM_BRAM_SIZE) < 0 ||
+		PyModule_AddIntConstant(m, "MODE_CONFIG", FPGA_MODE_CONFIG) < 0 ||
+		PyModule_AddIntConstant(m, "MODE_WORK", FPGA_MODE_WORK) < 0)
+	{
+		Py_DECREF(m);
+		return NULL;
+	}
+
+	return m;
+}
@@ -6,8 +6,13 @@ config=${4:-"./test/config.txt"}
 work=${5:-"./test/input.txt"}
 output=${6:-"./test/output.txt"}
 
-# Send config frames
-./build/bin/PCIeApp -d ${device} -u ${user_reg} -m 1 -i ${irq_name} -c ${config} -w ${work} -o ${output}
+# Synthetic frames where there are none, see tools/pcie_framegen.c
+mkdir -p $(dirname ${config}) $(dirname ${work})
+[ -f ${config} ] || ./build/bin/pcie_framegen -f txt -o ${config} -s 1
+[ -f ${work} ] || ./build/bin/pcie_framegen -f txt -o ${work} -s 2 -p spike -d 0.05
+
+# Send config frames, text as generated above
+./build/bin/PCIeApp -f txt -d ${device} -u ${user_reg} -m 1 -i ${irq_name} -c ${config} -w ${work} -o ${output}
 
 if [ $? -ne 0 ]; then
     echo "Error: $?"
@@ -16,7 +21,7 @@ fi
 echo "Send configuration frames file OK"
 
 # Send work frames
-# ./build/pcie_app -d ${device} -u ${user_reg} -m 2 -i ${irq_name} -c ${config} -w ${work} -o ${output}
+# ./build/pcie_app -f txt -d ${device} -u ${user_reg} -m 2 -i ${irq_name} -c ${config} -w ${work} -o ${output}
 
 # if [ $? -ne 0 ]; then
 #     echo "Error: $?"
@@ -0,0 +1,148 @@
+#include "config_diff.h"
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+
+/* Frames targeting one address in the old and the new set */
+typedef struct ConfigDiffEntry_TypeDef {
+	uint64_t addr;
+	uint64_t old_seq; // Sequence of frames, see seq_next()
+	uint64_t new_seq;
+	uint64_t old_count;
+	uint64_t new_count;
+	int used;
+} ConfigDiffEntry;
+
+/* Open addressing, with twice the slots of frames at least */
+typedef struct ConfigDiffIndex_TypeDef {
+	ConfigDiffEntry *entries;
+	uint64_t mask;
+} ConfigDiffIndex;
+
+static inline uint64_t addr_hash(uint64_t addr)
+{
+	addr ^= addr >> 33;
+	addr *= 0xFF51AFD7ED558CCDULL;
+	addr ^= addr >> 33;
+	addr *= 0xC4CEB9FE1A85EC53ULL;
+
+	return addr ^ (addr >> 33);
+}
+
+/* A lone frame is its own sequence, compared exactly; longer ones by a 64-bit hash */
+static inline uint64_t seq_next(uint64_t seq, uint64_t count, frame f)
+{
+	return count ? addr_hash(seq + count) ^ f : f;
+}
+
+static ConfigDiffEntry *index_find(ConfigDiffIndex *index, uint64_t addr)
+{
+	uint64_t i = addr_hash(addr) & index->mask;
+
+	while (index->entries[i].used && index->entries[i].addr != addr)
+		i = (i + 1) & index->mask;
+
+	if (!index->entries[i].used)
+	{
+		index->entries[i].used = 1;
+		index->entries[i].addr = addr;
+	}
+
+	return &index->entries[i];
+}
+
+/*
+	@brief
+		Find the config frames of a new set that change what an old set configured
+
+	@param addr: Target address field of config frames
+	@param old_frames: Frames configured before
+	@param new_frames: Frames to be configured
+	@param changed: Frames of new_frames targeting changed addresses, capacity of new_frames->size at least
+	@param diff: Where to store counts, may be NULL
+
+	@return Size of changed frames in bytes, or -ENOMEM
+*/
+ssize_t config_diff(const FrameField *addr, const FrameBuffer *old_frames, const FrameBuffer *new_frames,
+					FrameBuffer *changed, ConfigDiff *diff)
+{
+	ConfigDiffIndex index;
+	ConfigDiff counts = {0};
+	uint64_t slots = 16;
+	size_t n;
+
+	counts.old_frames = old_frames->size / sizeof(frame);
+	counts.new_frames = new_frames->size / sizeof(frame);
+
+	while (slots < 2 * (counts.old_frames + counts.new_frames))
+		slots <<= 1;
+
+	index.entries = (ConfigDiffEntry *)calloc(slots, sizeof(ConfigDiffEntry));
+	if (!index.entries)
+	{
+		fprintf(stderr, "OOM %lu.\n", slots * sizeof(ConfigDiffEntry));
+		return -ENOMEM;
+	}
+	index.mask = slots - 1;
+
+	for (size_t i = 0; i < counts.old_frames; i++)
+	{
+		frame f = old_frames->frames[i];
+		ConfigDiffEntry *entry = index_find(&index, frame_field_get(f, addr));
+
+		entry->old_seq = seq_next(entry->old_seq, entry->old_count++, f);
+	}
+
+	for (size_t i = 0; i < counts.new_frames; i++)
+	{
+		frame f = new_frames->frames[i];
+		ConfigDiffEntry *entry = index_find(&index, frame_field_get(f, addr));
+
+		entry->new_seq = seq_next(entry->new_seq, entry->new_count++, f);
+	}
+
+	for (uint64_t i = 0; i < slots; i++)
+	{
+		ConfigDiffEntry *entry = &index.entries[i];
+
+		if (!entry->used)
+			continue;
+
+		if (!entry->new_count)
+			counts.removed_addrs++;
+		else
+			counts.addrs++;
+
+		if (entry->new_count && (entry->new_count != entry->old_count || entry->new_seq != entry->old_seq))
+			counts.changed_addrs++;
+	}
+
+	/* Every frame of a changed address, in order */
+	n = 0;
+	for (size_t i = 0; i < counts.new_frames; i++)
+	{
+		frame f = new_frames->frames[i];
+		ConfigDiffEntry *entry = index_find(&index, frame_field_get(f, addr));
+
+		if (entry->new_count != entry->old_count || entry->new_seq != entry->old_seq)
+			changed->frames[n++] = f;
+	}
+
+	changed->size = n * sizeof(frame);
+	counts.changed_frames = n;
+
+	free(index.entries);
+
+	if (diff)
+		*diff = counts;
+
+	return changed->size;
+}
+
+void config_diff_dump(FILE *fp, const ConfigDiff *diff)
+{
+	fprintf(fp, "Config diff: %lu of %lu frame(s) changed, %lu of %lu address(es) changed, %lu removed, "
+				"%lu frame(s) before\n",
+			diff->changed_frames, diff->new_frames, diff->changed_addrs, diff->addrs, diff->removed_addrs,
+			diff->old_frames);
+}
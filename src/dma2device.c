@@ -1,5 +1,14 @@
 #include "utils.h"
 #include "dma_utils.h"
+#include "frame_codec.h"
+#include "frame_decoder.h"
+#include "frame_sink.h"
+#include "user_regs.h"
+#include "upstream_rx.h"
+#include "pio.h"
+#include "xdma_perf.h"
+#include "config_diff.h"
+#include "frame_reduce.h"
 #include <errno.h>
 #include <fcntl.h>
 #include <unistd.h>
@@ -9,30 +18,33 @@
 #include <sys/types.h>
 
 extern int verbose;
+extern int frames_format;
 
 /*
 	@brief
-		Read frames file into buffer then send to device
+		Open device, set the mode then send frames in buffer, decoded by reader,
+		or copied from a native frames file
 
 	@param devname: Device name of XDMA h2c channel
 	@param user_reg: Name of user registers: /dev/xdma0_user
 	@param irq_ch1: IRQ name of channel 1
-	@param infname: Name of frames file to be read
+	@param name: Name of frames, for messages
+	@param buffer: 4K-aligned frames buffer, or staging buffer of DOWNSTREAM_BRAM_SIZE bytes with reader
+	@param reader: Reader of packed frames, or NULL
+	@param in_fd: File description of native frames file of buffer->size bytes, or -1
 	@param work_mode: work in which mode
 */
-int FramesFile2Device(char *devname, char *user_reg, char *irq_ch1, char *infname, int work_mode)
+static int frames2device(char *devname, char *user_reg, char *irq_ch1, char *name, FrameBuffer *buffer,
+						 FramePackReader *reader, int in_fd, int work_mode)
 {
 	ssize_t rc;
 	int mode = FPGA_MODE_UNKNOWN;
-	size_t bytes_done = 0;
-	FrameBuffer *FramesBuffer = NULL;
-	frame *allocated = NULL;
+	uint64_t size = reader ? reader->frames * sizeof(frame) : buffer->size;
+	XdmaPerfSample perf;
 
 	void *user_addr = NULL; /* Base address of user registers */
 	int user_reg_fd = -1;
 	int irq_ch1_fd = -1;
-	int infile_fd = -1;
-	off_t inf_size = -1;
 	int h2c_fd = open(devname, O_RDWR);
 
 	/* 1. Check devices, files, memory mapping */
@@ -61,9 +73,17 @@ int FramesFile2Device(char *devname, char *user_reg, char *irq_ch1, char *infnam
 		goto out;
 	}
 
+#ifdef PIO_BRAM_WINDOW
+	/* Tiny loops go by PIO if this host has a threshold for them */
+	if (dma_profile.pio_max_bytes)
+		pio_map(&pio_window, user_reg_fd, PIO_BRAM_WINDOW_OFFSET, PIO_BRAM_WINDOW_SIZE, DOWNSTREAM_BRAM_CH1_ADDR);
+#endif
+
 	/* Reset device and set mode MODE_CONFIG */
 	reset_xdma(user_addr);
 	writeUser(user_addr, FPGA_MODE_RO_ADDR, work_mode);
+	if (work_mode == FPGA_MODE_WORK && upstream_rx_mode == UPSTREAM_RX_PINGPONG)
+		upstream_rx_enable(user_addr, upstream_rx_mode);
 
 	sleep(1);
 
@@ -90,45 +110,90 @@ int FramesFile2Device(char *devname, char *user_reg, char *irq_ch1, char *infnam
 		goto out;
 	}
 
-	if (infname)
+	/* 2. Send to BRAM via single channel */
+	xdma_perf_start(&xdma_perf, XDMA_H2C_CHANNEL_OFFSET(0), &perf);
+	if (reader)
+		rc = single_channel_send_pack(name, h2c_fd, user_addr, irq_ch1_fd, DOWNSTREAM_BRAM_CH1_ADDR,
+									  reader, buffer);
+	else if (in_fd >= 0)
+		rc = single_channel_send_file(name, h2c_fd, user_addr, irq_ch1_fd, DOWNSTREAM_BRAM_CH1_ADDR, in_fd,
+									  buffer->size);
+	else
+		rc = single_channel_send(name, h2c_fd, user_addr, irq_ch1_fd, DOWNSTREAM_BRAM_CH1_ADDR, buffer);
+	xdma_perf_stop(&xdma_perf, &perf, rc > 0 ? rc : 0);
+	xdma_perf_report(&xdma_perf, name, &perf, stdout);
+	if (rc < 0 || rc != size)
 	{
-		infile_fd = open(infname, O_RDONLY);
-		if (infile_fd < 0)
-		{
-			fprintf(stderr, "unable to open input file %s, %d.\n", infname, infile_fd);
-			perror("open input file");
-			rc = -ENOENT;
-			goto out;
-		}
+		fprintf(stderr, "Sending %s to device %d, address 0x%x via channel %d failed, rc=%ld\n",
+				name, h2c_fd, DOWNSTREAM_BRAM_CH1_ADDR, irq_ch1_fd, rc);
+		perror("send data");
+		rc = -EINVAL;
+		goto out;
 	}
 
-	/* 2. Allocate for frames buffer */
-	FramesBuffer = (FrameBuffer *)malloc(sizeof(FrameBuffer));
-	if (!FramesBuffer)
+	if (verbose)
 	{
-		fprintf(stderr, "unable to malloc\n");
-		perror("malloc frames buffer");
-		rc = -EINVAL;
-		goto out;
+		fprintf(stdout, "Sending frames OK, total bytes: %ld\n", size);
+		dumpUserStats(stdout);
 	}
 
-	inf_size = lseek(infile_fd, 0, SEEK_END);
-	if (inf_size < 0)
+	/* Last, if failed or finished, close and unmap */
+out:
+	close(h2c_fd);
+	pio_unmap(&pio_window);
+
+	if (user_addr && user_addr != (void *)-1)
 	{
-		fprintf(stderr, "unable to get frames file size: %ld.\n", inf_size);
-		perror("get file size");
-		rc = -EINVAL;
-		goto out;
+		munmap(user_addr, MAP_SIZE);
 	}
 
-	/* Move the cursor to the head */
-	rc = lseek(infile_fd, 0, SEEK_SET);
-	if (rc != 0)
+	if (user_reg_fd >= 0)
 	{
-		fprintf(stderr, "unable to move the cursor to the head.\n");
-		perror("move the cursor");
-		rc = -EINVAL;
-		goto out;
+		close(user_reg_fd);
+	}
+
+	if (irq_ch1_fd >= 0)
+	{
+		close(irq_ch1_fd);
+	}
+
+	if (rc < 0)
+		return rc;
+
+	return 0;
+}
+
+/*
+	@brief
+		Open a frames file of frames_format and size its frames. Packed files
+		are sized by their header, through reader.
+
+	@param infname: Name of frames file to be read
+	@param fd: Opened file, to be closed by the caller if >= 0
+	@param reader: Opened on packed files, to be closed by frame_pack_close()
+	@param buffer: size set to the bytes of frames in the file
+*/
+static int frames_file_open(char *infname, int *fd, FramePackReader *reader, FrameBuffer *buffer)
+{
+	off_t inf_size;
+
+	buffer->frames = NULL;
+	buffer->size = 0;
+
+	*fd = open(infname, O_RDONLY);
+	if (*fd < 0)
+	{
+		fprintf(stderr, "unable to open input file %s, %d.\n", infname, *fd);
+		perror("open input file");
+		return -ENOENT;
+	}
+
+	inf_size = lseek(*fd, 0, SEEK_END);
+	if (inf_size < 0 || lseek(*fd, 0, SEEK_SET) != 0)
+	{
+		fprintf(stderr, "unable to get frames file size: %ld.\n", inf_size);
+		perror("get file size");
+		return -EINVAL;
 	}
 
 	/*
@@ -137,81 +202,174 @@ int FramesFile2Device(char *devname, char *user_reg, char *irq_ch1, char *infnam
 			Line2: 0000000000000000000001010000000000000000000000000000000000000000\n
 
 		- inf_size = 65*2 bytes
-		- FramesBuffer->size = 2 frames(64-bits) = 16 bytes
+		- buffer->size = 2 frames(64-bits) = 16 bytes
 		- size = frame_num * 8
+		The last line may end without '\n'.
 	*/
-#ifdef TXT_MODE
-	FramesBuffer->size = (uint64_t)(inf_size / 65 * 8);
-#endif
+	if (frames_format == FRAMES_FORMAT_TXT)
+		buffer->size = (uint64_t)((inf_size + 1) / FRAME_TXT_LINE_LEN * 8);
+	else if (frames_format == FRAMES_FORMAT_PACK)
+	{
+		int rc = frame_pack_open(reader, infname, *fd);
 
-	posix_memalign((void **)&allocated, 4096 /* alignment */, inf_size / 8 + 4096);
-	if (!allocated)
+		if (rc < 0)
+			return rc;
+		buffer->size = reader->frames * sizeof(frame);
+	}
+	else
+		buffer->size = (uint64_t)(inf_size / 8 * 8);
+
+	return 0;
+}
+
+/*
+	@brief
+		Allocate a 4K-aligned frames buffer of bytes, with a page to spare
+
+	@return 0, or -ENOMEM
+*/
+static int frames_file_alloc(FrameBuffer *buffer, uint64_t bytes)
+{
+	buffer->frames = NULL;
+	posix_memalign((void **)&buffer->frames, 4096 /* alignment */, bytes + 4096);
+	if (!buffer->frames)
 	{
-		fprintf(stderr, "OOM %lu.\n", (inf_size / 8 + 4096));
-		rc = -ENOMEM;
-		goto out;
+		fprintf(stderr, "OOM %lu.\n", (bytes + 4096));
+		return -ENOMEM;
 	}
 
-	FramesBuffer->frames = allocated;
+	return 0;
+}
 
-	if (verbose)
-		fprintf(stdout, "reading frames into buffer. Size in bytes: %ld\n", FramesBuffer->size);
+/*
+	@brief
+		Read all frames of a file opened by frames_file_open() into buffer
 
-		/* 3. Read configuration frames from file to buffer */
-#ifdef TXT_MODE
-	rc = read_txt_to_buffer(infname, infile_fd, FramesBuffer, 0);
-#endif
-#ifdef BIN_MODE
-	rc = read_bin_to_buffer(infname, infile_fd, FramesBuffer, inf_size / 8, 0);
-#endif
-	if (rc < 0 || rc < FramesBuffer->size)
-		goto out;
+	@return Bytes read, or -errno; a file shorter than its size is -EIO
+*/
+static ssize_t frames_file_read(char *infname, int fd, FramePackReader *reader, FrameBuffer *buffer)
+{
+	ssize_t rc;
 
-	if (verbose)
+	if (frames_format == FRAMES_FORMAT_TXT)
+		rc = read_txt_to_buffer(infname, fd, buffer, 0);
+	else if (frames_format == FRAMES_FORMAT_BIN)
+		rc = read_bin_to_buffer(infname, fd, buffer, buffer->size, 0);
+	else if (frames_format == FRAMES_FORMAT_PACK)
+		rc = frame_pack_read(reader, buffer->frames, buffer->size);
+	else
 	{
-		for (int i = 0; i < FramesBuffer->size; i++)
+		uint64_t count = 0;
+
+		while (count < buffer->size)
 		{
-			printf("%d: 0x%lx\n", i, FramesBuffer->frames[i]);
+			rc = pread(fd, (char *)buffer->frames + count, buffer->size - count, count);
+			if (rc < 0 && errno == EINTR)
+				continue;
+			if (rc < 0)
+			{
+				fprintf(stderr, "%s, read 0x%lx @ 0x%lx failed.\n", infname, buffer->size - count, count);
+				perror("read file");
+				return -EIO;
+			}
+			if (!rc)
+				break;
+
+			count += rc;
 		}
+		rc = count;
 	}
 
-	/* 4. Send to BRAM via single channel */
-	rc = single_channel_send(infname, h2c_fd, user_addr, irq_ch1_fd, DOWNSTREAM_BRAM_CH1_ADDR, FramesBuffer);
-	if (rc < 0 || rc != FramesBuffer->size)
+	if (rc >= 0 && rc < buffer->size)
 	{
-		fprintf(stderr, "Sending %s to device %d, address 0x%x via channel %d failed, rc=%ld\n",
-				infname, h2c_fd, DOWNSTREAM_BRAM_CH1_ADDR, irq_ch1_fd, rc);
-		perror("send data");
-		rc = -EINVAL;
-		goto out;
+		fprintf(stderr, "%s, read underflow 0x%lx/0x%lx.\n", infname, rc, buffer->size);
+		rc = -EIO;
 	}
 
-	if (verbose)
+	return rc;
+}
+
+/*
+	@brief
+		Read frames file into buffer then send to device
+
+	@param devname: Device name of XDMA h2c channel
+	@param user_reg: Name of user registers: /dev/xdma0_user
+	@param irq_ch1: IRQ name of channel 1
+	@param infname: Name of frames file to be read
+	@param work_mode: work in which mode
+*/
+int FramesFile2Device(char *devname, char *user_reg, char *irq_ch1, char *infname, int work_mode)
+{
+	ssize_t rc;
+	FrameBuffer *FramesBuffer = NULL;
+	FramePackReader reader = {0};
+	uint64_t buf_size;
+
+	int infile_fd = -1;
+
+	/* 1. Allocate for frames buffer */
+	FramesBuffer = (FrameBuffer *)malloc(sizeof(FrameBuffer));
+	if (!FramesBuffer)
 	{
-		fprintf(stdout, "Sending frames OK, total bytes: %ld\n", FramesBuffer->size);
+		fprintf(stderr, "unable to malloc\n");
+		perror("malloc frames buffer");
+		return -EINVAL;
 	}
 
-	/* Last, if failed or finished, close and free */
-out:
-	close(h2c_fd);
+	/* 2. Check and size the file */
+	rc = frames_file_open(infname, &infile_fd, &reader, FramesBuffer);
+	if (rc < 0)
+		goto out;
+	buf_size = FramesBuffer->size;
 
-	if (user_reg_fd >= 0)
+	/* Native frames go from the file to the device as they are, no buffer */
+	if (frames_format == FRAMES_FORMAT_NATIVE)
 	{
-		close(user_reg_fd);
+		rc = frames2device(devname, user_reg, irq_ch1, infname, FramesBuffer, NULL, infile_fd, work_mode);
+		goto out;
 	}
 
-	if (irq_ch1_fd >= 0)
+	/* Packed frames are decoded loop by loop into a BRAM-sized staging buffer while sending */
+	if (frames_format == FRAMES_FORMAT_PACK)
+		buf_size = DOWNSTREAM_BRAM_SIZE;
+
+	rc = frames_file_alloc(FramesBuffer, buf_size);
+	if (rc < 0)
+		goto out;
+
+	if (verbose)
+		fprintf(stdout, "reading %s frames into buffer. Size in bytes: %ld\n",
+				frames_format_name(frames_format), FramesBuffer->size);
+
+	/* 3. Read configuration frames from file to buffer */
+	if (frames_format != FRAMES_FORMAT_PACK)
 	{
-		close(irq_ch1_fd);
+		rc = frames_file_read(infname, infile_fd, &reader, FramesBuffer);
+		if (rc < 0)
+			goto out;
 	}
 
-	if (infile_fd >= 0)
+	if (verbose && frames_format != FRAMES_FORMAT_PACK)
 	{
-		close(infile_fd);
+		for (int i = 0; i < FramesBuffer->size / 8; i++)
+		{
+			printf("%d: 0x%lx\n", i, FramesBuffer->frames[i]);
+		}
 	}
 
+	/* 4. Send to device */
+	rc = frames2device(devname, user_reg, irq_ch1, infname, FramesBuffer,
+					   frames_format == FRAMES_FORMAT_PACK ? &reader : NULL, -1, work_mode);
+
+	/* Last, if failed or finished, close and free */
+out:
+	if (infile_fd >= 0)
+		close(infile_fd);
+
+	frame_pack_close(&reader);
+	free(FramesBuffer->frames);
 	free(FramesBuffer);
-	free(allocated);
 
 	if (rc < 0)
 		return rc;
@@ -221,29 +379,138 @@ out:
 
 /*
 	@brief
-		Receives frames then saves into a file.
+		Send frames built in memory to device, e.g. by a FrameBuilder
 
-	@param devname: Device name of XDMA c2h channel
+	@param devname: Device name of XDMA h2c channel
 	@param user_reg: Name of user registers: /dev/xdma0_user
 	@param irq_ch1: IRQ name of channel 1
-	@param ofname: Name of frames file to be saved
+	@param buffer: 4K-aligned frames buffer in host order, e.g. from a FramePool
 	@param work_mode: work in which mode
 */
-int deviceToFramesFile(char *devname, char *user_reg, char *irq_ch1, char *ofname)
+int FramesBuffer2Device(char *devname, char *user_reg, char *irq_ch1, FrameBuffer *buffer, int work_mode)
+{
+	if (!buffer || !buffer->frames || ((uintptr_t)buffer->frames & 4095))
+	{
+		fprintf(stderr, "frames buffer must be 4K-aligned.\n");
+		return -EINVAL;
+	}
+
+	return frames2device(devname, user_reg, irq_ch1, "frames buffer", buffer, NULL, -1, work_mode);
+}
+
+/*
+	@brief
+		Read a whole frames file of frames_format into a 4K-aligned buffer
+
+	@param infname: Name of frames file to be read
+	@param buffer: Frames read, to be freed by free(buffer->frames)
+*/
+static int frames_file_load(char *infname, FrameBuffer *buffer)
 {
 	ssize_t rc;
-	size_t bytes_done = 0;
-	FrameBuffer *FramesBuffer = NULL;
-	frame *allocated = NULL;
+	FramePackReader reader = {0};
+	int infile_fd = -1;
+
+	rc = frames_file_open(infname, &infile_fd, &reader, buffer);
+	if (rc >= 0)
+		rc = frames_file_alloc(buffer, buffer->size);
+	if (rc >= 0)
+		rc = frames_file_read(infname, infile_fd, &reader, buffer);
+
+	if (infile_fd >= 0)
+		close(infile_fd);
+	frame_pack_close(&reader);
+
+	if (rc < 0)
+	{
+		free(buffer->frames);
+		buffer->frames = NULL;
+		return rc;
+	}
+
+	return 0;
+}
+
+/*
+	@brief
+		Reconfigure with only the config frames of a new file that differ from
+		an old one, as the device was configured before. Nothing is sent if
+		none differ.
+
+	@param devname: Device name of XDMA h2c channel
+	@param user_reg: Name of user registers: /dev/xdma0_user
+	@param irq_ch1: IRQ name of channel 1
+	@param oldname: Name of frames file configured before
+	@param newname: Name of frames file to be configured
+	@param addr: Target address field of config frames
+*/
+int ConfigDiff2Device(char *devname, char *user_reg, char *irq_ch1, char *oldname, char *newname,
+					  const FrameField *addr)
+{
+	int rc;
+	ConfigDiff diff;
+	FrameBuffer old_frames = {0}, new_frames = {0}, changed = {0};
+
+	rc = frames_file_load(oldname, &old_frames);
+	if (!rc)
+		rc = frames_file_load(newname, &new_frames);
+	if (rc < 0)
+		goto out;
+
+	posix_memalign((void **)&changed.frames, 4096 /* alignment */, new_frames.size + 4096);
+	if (!changed.frames)
+	{
+		fprintf(stderr, "OOM %lu.\n", (new_frames.size + 4096));
+		rc = -ENOMEM;
+		goto out;
+	}
+
+	rc = config_diff(addr, &old_frames, &new_frames, &changed, &diff);
+	if (rc < 0)
+		goto out;
+
+	if (verbose)
+		config_diff_dump(stdout, &diff);
+
+	if (!changed.size)
+	{
+		fprintf(stdout, "%s, no config frames changed since %s.\n", newname, oldname);
+		rc = 0;
+		goto out;
+	}
+
+	rc = frames2device(devname, user_reg, irq_ch1, newname, &changed, NULL, -1, FPGA_MODE_CONFIG);
+
+out:
+	free(old_frames.frames);
+	free(new_frames.frames);
+	free(changed.frames);
+
+	return rc;
+}
+
+/*
+	@brief
+		Open device then receive one upstream BRAM of frames into buffer
+
+	@param devname: Device name of XDMA c2h channel
+	@param user_reg: Name of user registers: /dev/xdma0_user
+	@param irq_ch1: IRQ name of channel 1
+	@param name: Name of output, for messages
+	@param buffer: 4K-aligned frames buffer of at least UPSTREAM_BRAM_SIZE bytes
+
+	@return # of frames before STOP_FRAME
+*/
+static ssize_t device2frames(char *devname, char *user_reg, char *irq_ch1, char *name, FrameBuffer *buffer)
+{
+	ssize_t rc;
+	XdmaPerfSample perf;
 
 	void *user_addr = NULL; /* Base address of user registers */
 	int user_reg_fd = -1;
-	int irq_ch1_fd = -1;
-	int outfile_fd = -1;
 	int c2h_fd = open(devname, O_RDONLY);
-	off_t offset = 0;
 
-	/* 1. Check devices, files, memory mapping */
+	/* 1. Check devices, memory mapping */
 	if (c2h_fd < 0)
 	{
 		fprintf(stderr, "unable to open device %s, %d.\n", devname, c2h_fd);
@@ -269,118 +536,247 @@ int deviceToFramesFile(char *devname, char *user_reg, char *irq_ch1, char *ofnam
 		goto out;
 	}
 
-	if (ofname)
-	{
-		outfile_fd = open(ofname, O_RDWR | O_CREAT | O_TRUNC, S_IRUSR | S_IWUSR | S_IRGRP | S_IWGRP | S_IROTH | S_IWOTH); /* 0666 */
-		if (outfile_fd < 0)
-		{
-			fprintf(stderr, "unable to open output file %s, %d.\n", ofname, outfile_fd);
-			perror("open output file");
-			rc = -ENOENT;
-			goto out;
-		}
-	}
+	buffer->size = UPSTREAM_BRAM_SIZE;
 
-	/* Move the cursor to the head */
-	// rc = lseek(outfile_fd, 0, SEEK_SET);
-	// if (rc != 0) {
-	// 	fprintf(stderr, "unable to move the cursor to the head.\n");
-	// 	perror("move the cursor");
-	// 	rc = -EINVAL;
-	// 	goto out;
-	// }
+	/* 2. Receive from BRAM via single channel */
+	xdma_perf_start(&xdma_perf, XDMA_C2H_CHANNEL_OFFSET(0), &perf);
+	rc = single_channel_receive(name, c2h_fd, user_addr, -1, UPSTREAM_BRAM_CH1_ADDR, buffer);
+	xdma_perf_stop(&xdma_perf, &perf, rc > 0 ? rc : 0);
+	xdma_perf_report(&xdma_perf, name, &perf, stdout);
 
-	/* 2. Allocate for frames buffer */
-	FramesBuffer = (FrameBuffer *)malloc(sizeof(FrameBuffer));
-	if (!FramesBuffer)
+	if (rc < 0)
 	{
-		fprintf(stderr, "unable to malloc\n");
-		perror("malloc frames buffer");
+		fprintf(stderr, "Receiving %s from device %d, address 0x%x failed, rc=%ld\n",
+				name, c2h_fd, UPSTREAM_BRAM_CH1_ADDR, rc);
+		perror("receive data");
 		rc = -EINVAL;
 		goto out;
 	}
 
-	FramesBuffer->size = UPSTREAM_BRAM_SIZE;
+	buffer->size = rc / sizeof(frame) * sizeof(frame);
+	rc = frames_until_stop(buffer->frames, buffer->size / sizeof(frame));
 
-	posix_memalign((void **)&allocated, 4096 /* alignment */, FramesBuffer->size + 4096);
-	if (!allocated)
+	/* Last, if failed or finished, close and unmap */
+out:
+	close(c2h_fd);
+
+	if (user_addr && user_addr != (void *)-1)
 	{
-		fprintf(stderr, "OOM %lu.\n", FramesBuffer->size + 4096);
-		rc = -ENOMEM;
-		goto out;
+		munmap(user_addr, MAP_SIZE);
 	}
 
-	FramesBuffer->frames = allocated;
-
-	/* 3. Receive from BRAM via single channel */
-	rc = single_channel_receive(ofname, c2h_fd, user_addr, -1, UPSTREAM_BRAM_CH1_ADDR, FramesBuffer);
-
-	if (rc < 0)
+	if (user_reg_fd >= 0)
 	{
-		fprintf(stderr, "Receiving %s from device %d, address 0x%x via channel %d failed, rc=%ld\n",
-				ofname, c2h_fd, UPSTREAM_BRAM_CH1_ADDR, irq_ch1_fd, rc);
-		perror("receive data");
-		rc = -EINVAL;
-		goto out;
+		close(user_reg_fd);
 	}
 
-	int index = 0;
-	uint64_t stop_frame = STOP_FRAME;
-	char frameChar[65];
+	return rc;
+}
+
+/*
+	@brief
+		Open device then receive ping-pong halves into sink until STOP_FRAME
+
+	@return # of frames written
+*/
+static ssize_t device2sink_pingpong(char *devname, char *user_reg, FrameSink *sink)
+{
+	ssize_t rc;
+	UpstreamRx rx = {0};
+	XdmaPerfSample perf;
 
-	frameChar[64] = '\n';
+	void *user_addr = NULL; /* Base address of user registers */
+	int user_reg_fd = -1;
+	int c2h_fd = open(devname, O_RDONLY);
 
-	while (FramesBuffer->frames[index] != stop_frame)
+	if (c2h_fd < 0)
 	{
-		long2bin(FramesBuffer->frames, frameChar);
+		fprintf(stderr, "unable to open device %s, %d.\n", devname, c2h_fd);
+		perror("open device");
+		return -ENXIO;
+	}
 
-		rc = lseek(outfile_fd, offset, SEEK_SET);
-		if (rc != offset)
-		{
-			fprintf(stderr, "%s, seek off 0x%lx != 0x%lx.\n", ofname, rc, offset);
-			perror("seek file");
-			rc = -EIO;
-			goto out;
-		}
+	user_reg_fd = open(user_reg, O_RDWR | O_SYNC);
+	if (user_reg_fd < 0)
+	{
+		fprintf(stderr, "unable to open user registers %s, %d.\n", user_reg, user_reg_fd);
+		perror("open device");
+		rc = -ENXIO;
+		goto out;
+	}
 
-		rc = write(outfile_fd, frameChar, 64);
-		if (rc < 0 || rc != 64)
-		{
-			fprintf(stderr, "%s, write 0x40 @ 0x%lx failed %ld.\n",
-					ofname, offset, rc);
-			perror("write file");
-			rc = -EIO;
-			goto out;
-		}
+	user_addr = mmap(NULL, MAP_SIZE, PROT_READ | PROT_WRITE, MAP_SHARED, user_reg_fd, 0);
+	if (user_addr == (void *)-1)
+	{
+		fprintf(stderr, "Memory mapped failed.\n");
+		perror("mmap error\n");
+		rc = -ENOMEM;
+		goto out;
+	}
 
-		offset += rc;
-		index++;
+	rc = upstream_rx_init(&rx, devname, c2h_fd, user_addr, UPSTREAM_BRAM_CH1_ADDR, UPSTREAM_RX_PINGPONG);
+	if (!rc)
+	{
+		xdma_perf_start(&xdma_perf, XDMA_C2H_CHANNEL_OFFSET(0), &perf);
+		rc = upstream_rx_run(&rx, sink);
+		xdma_perf_stop(&xdma_perf, &perf, rx.blocks * UPSTREAM_HALF_SIZE);
+		xdma_perf_report(&xdma_perf, devname, &perf, stdout);
 	}
+	upstream_rx_release(&rx);
+
+	/* Back to whole-BRAM handover for whoever comes next */
+	upstream_rx_enable(user_addr, UPSTREAM_RX_SINGLE);
 
-	/* Last, if failed or finished, close and free */
 out:
 	close(c2h_fd);
 
-	if (user_reg_fd >= 0)
+	if (user_addr && user_addr != (void *)-1)
 	{
-		close(user_reg_fd);
+		munmap(user_addr, MAP_SIZE);
 	}
 
-	if (irq_ch1_fd >= 0)
+	if (user_reg_fd >= 0)
 	{
-		close(irq_ch1_fd);
+		close(user_reg_fd);
 	}
 
-	if (outfile_fd >= 0)
+	return rc;
+}
+
+/*
+	@brief
+		Receives frames then writes them into a sink as one batch, or as
+		one batch per half in ping-pong mode, see upstream_rx.h
+
+	@param devname: Device name of XDMA c2h channel
+	@param user_reg: Name of user registers: /dev/xdma0_user
+	@param irq_ch1: IRQ name of channel 1
+	@param sink: Opened sink, see frame_sink.h
+
+	@return # of frames written
+*/
+ssize_t deviceToFrameSink(char *devname, char *user_reg, char *irq_ch1, FrameSink *sink)
+{
+	ssize_t rc;
+	FrameBuffer FramesBuffer = {0};
+	frame *allocated = NULL;
+
+	if (upstream_rx_mode == UPSTREAM_RX_PINGPONG)
+		return device2sink_pingpong(devname, user_reg, sink);
+
+	/* 1. Allocate for frames buffer */
+	posix_memalign((void **)&allocated, 4096 /* alignment */, UPSTREAM_BRAM_SIZE + 4096);
+	if (!allocated)
 	{
-		close(outfile_fd);
+		fprintf(stderr, "OOM %u.\n", UPSTREAM_BRAM_SIZE + 4096);
+		return -ENOMEM;
 	}
 
-	free(FramesBuffer);
+	FramesBuffer.frames = allocated;
+
+	/* 2. Receive frames */
+	rc = device2frames(devname, user_reg, irq_ch1, "frame sink", &FramesBuffer);
+
+	/* 3. Write frames before STOP_FRAME */
+	if (rc >= 0)
+		rc = frame_sink_write(sink, FramesBuffer.frames, rc);
+
 	free(allocated);
 
+	return rc;
+}
+
+/*
+	@brief
+		Receives frames then saves into a file as text, or into a ring in
+		/dev/shm if ofname is "shm:/name"
+
+	@param devname: Device name of XDMA c2h channel
+	@param user_reg: Name of user registers: /dev/xdma0_user
+	@param irq_ch1: IRQ name of channel 1
+	@param ofname: Name of frames file to be saved
+*/
+int deviceToFramesFile(char *devname, char *user_reg, char *irq_ch1, char *ofname)
+{
+	ssize_t rc;
+	FrameSink sink;
+
+	rc = frame_sink_open(&sink, ofname, FRAMES_FORMAT_TXT);
+	if (rc < 0)
+		return rc;
+
+	rc = deviceToFrameSink(devname, user_reg, irq_ch1, &sink);
+
+	frame_sink_close(&sink);
+
 	if (rc < 0)
 		return rc;
 
 	return 0;
-}
\ No newline at end of file
+}
+
+/*
+	@brief
+		Receives frames then reduces them as they arrive, saving only counts
+		as CSV, see frame_reduce_save()
+
+	@param devname: Device name of XDMA c2h channel
+	@param user_reg: Name of user registers: /dev/xdma0_user
+	@param irq_ch1: IRQ name of channel 1
+	@param reduce: Reducers, counts of earlier receives are kept
+	@param ofname: Name of CSV file to be saved
+*/
+int deviceToFrameReduce(char *devname, char *user_reg, char *irq_ch1, FrameReduce *reduce, char *ofname)
+{
+	ssize_t rc;
+	FrameSink sink;
+
+	frame_sink_open_reduce(&sink, reduce, NULL);
+
+	rc = deviceToFrameSink(devname, user_reg, irq_ch1, &sink);
+
+	frame_sink_close(&sink);
+
+	if (rc < 0)
+		return rc;
+
+	if (verbose)
+		frame_reduce_dump(stdout, reduce);
+
+	return frame_reduce_save(ofname, reduce);
+}
+
+/*
+	@brief
+		Receives frames then decodes them into columns of fields
+
+	@param devname: Device name of XDMA c2h channel
+	@param user_reg: Name of user registers: /dev/xdma0_user
+	@param irq_ch1: IRQ name of channel 1
+	@param columns: Columns to append decoded frames to
+
+	@return # of frames decoded
+*/
+ssize_t deviceToFrameColumns(char *devname, char *user_reg, char *irq_ch1, FrameColumns *columns)
+{
+	ssize_t rc;
+	FrameBuffer FramesBuffer = {0};
+	frame *allocated = NULL;
+
+	posix_memalign((void **)&allocated, 4096 /* alignment */, UPSTREAM_BRAM_SIZE + 4096);
+	if (!allocated)
+	{
+		fprintf(stderr, "OOM %u.\n", UPSTREAM_BRAM_SIZE + 4096);
+		return -ENOMEM;
+	}
+
+	FramesBuffer.frames = allocated;
+
+	rc = device2frames(devname, user_reg, irq_ch1, "frame columns", &FramesBuffer);
+	if (rc >= 0)
+		rc = frame_decode(FramesBuffer.frames, rc, columns);
+
+	free(allocated);
+
+	return rc;
+}
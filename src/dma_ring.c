@@ -0,0 +1,436 @@
+#include "dma_ring.h"
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+
+#include <linux/io_uring.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+
+DmaRing dma_ring = {.fd = -1};
+
+extern int verbose;
+
+static int ring_setup(unsigned entries, struct io_uring_params *p)
+{
+	return syscall(__NR_io_uring_setup, entries, p);
+}
+
+static int ring_enter(int fd, unsigned to_submit, unsigned min_complete, unsigned flags)
+{
+	return syscall(__NR_io_uring_enter, fd, to_submit, min_complete, flags, NULL, 0);
+}
+
+/* Map the rings of an io_uring, see io_uring_setup(2) */
+static int ring_map(DmaRing *ring, const struct io_uring_params *p)
+{
+	ring->sq_map_size = p->sq_off.array + p->sq_entries * sizeof(unsigned);
+	ring->cq_map_size = p->cq_off.cqes + p->cq_entries * sizeof(struct io_uring_cqe);
+	if (p->features & IORING_FEAT_SINGLE_MMAP)
+	{
+		if (ring->cq_map_size > ring->sq_map_size)
+			ring->sq_map_size = ring->cq_map_size;
+		ring->cq_map_size = ring->sq_map_size;
+	}
+
+	ring->sq_map = mmap(NULL, ring->sq_map_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring->fd,
+						IORING_OFF_SQ_RING);
+	if (ring->sq_map == MAP_FAILED)
+	{
+		ring->sq_map = NULL;
+		return -ENOMEM;
+	}
+
+	if (p->features & IORING_FEAT_SINGLE_MMAP)
+	{
+		ring->cq_map = ring->sq_map;
+	}
+	else
+	{
+		ring->cq_map = mmap(NULL, ring->cq_map_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring->fd,
+							IORING_OFF_CQ_RING);
+		if (ring->cq_map == MAP_FAILED)
+		{
+			ring->cq_map = NULL;
+			return -ENOMEM;
+		}
+	}
+
+	ring->sqes_size = p->sq_entries * sizeof(struct io_uring_sqe);
+	ring->sqes = (struct io_uring_sqe *)mmap(NULL, ring->sqes_size, PROT_READ | PROT_WRITE,
+											 MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_SQES);
+	if (ring->sqes == MAP_FAILED)
+	{
+		ring->sqes = NULL;
+		return -ENOMEM;
+	}
+
+	ring->sq_head = (unsigned *)((char *)ring->sq_map + p->sq_off.head);
+	ring->sq_tail = (unsigned *)((char *)ring->sq_map + p->sq_off.tail);
+	ring->sq_mask = (unsigned *)((char *)ring->sq_map + p->sq_off.ring_mask);
+	ring->sq_array = (unsigned *)((char *)ring->sq_map + p->sq_off.array);
+	ring->cq_head = (unsigned *)((char *)ring->cq_map + p->cq_off.head);
+	ring->cq_tail = (unsigned *)((char *)ring->cq_map + p->cq_off.tail);
+	ring->cq_mask = (unsigned *)((char *)ring->cq_map + p->cq_off.ring_mask);
+	ring->cqes = (struct io_uring_cqe *)((char *)ring->cq_map + p->cq_off.cqes);
+
+	return 0;
+}
+
+static void ring_unmap(DmaRing *ring)
+{
+	if (ring->sqes)
+		munmap(ring->sqes, ring->sqes_size);
+	if (ring->cq_map && ring->cq_map != ring->sq_map)
+		munmap(ring->cq_map, ring->cq_map_size);
+	if (ring->sq_map)
+		munmap(ring->sq_map, ring->sq_map_size);
+
+	ring->sqes = NULL;
+	ring->cq_map = NULL;
+	ring->sq_map = NULL;
+}
+
+/*
+	@brief
+		Set up a ring of entries requests in flight
+
+	@param use_uring: 0 to use plain syscalls even where io_uring is available
+
+	@return 0, the ring falling back to plain syscalls if io_uring is not available
+*/
+int dma_ring_init(DmaRing *ring, unsigned entries, int use_uring)
+{
+	struct io_uring_params p;
+
+	memset(ring, 0, sizeof(*ring));
+	ring->fd = -1;
+	ring->entries = entries ? entries : DMA_RING_ENTRIES_DEFAULT;
+	ring->owner = pthread_self();
+
+	if (!use_uring)
+		return 0;
+
+	memset(&p, 0, sizeof(p));
+	ring->fd = ring_setup(ring->entries, &p);
+	if (ring->fd < 0)
+	{
+		ring->fd = -1;
+		if (verbose)
+			fprintf(stdout, "io_uring not available (%s), plain syscalls.\n", strerror(errno));
+		return 0;
+	}
+
+	if (ring_map(ring, &p) < 0)
+	{
+		if (verbose)
+			fprintf(stdout, "io_uring not mapped, plain syscalls.\n");
+		ring_unmap(ring);
+		close(ring->fd);
+		ring->fd = -1;
+		return 0;
+	}
+
+	/* Completions may take twice the entries, submissions not */
+	ring->entries = p.sq_entries;
+
+	return 0;
+}
+
+/*
+	@brief
+		Complete every request in flight, then release the ring
+*/
+void dma_ring_exit(DmaRing *ring)
+{
+	if (!dma_ring_active(ring))
+		return;
+
+	while (ring->queued || ring->inflight)
+	{
+		if (dma_ring_submit(ring) < 0 || dma_ring_reap(ring, 1) < 0)
+			break;
+	}
+
+	if (ring->fd >= 0)
+	{
+		ring_unmap(ring);
+		close(ring->fd);
+	}
+
+	memset(ring, 0, sizeof(*ring));
+	ring->fd = -1;
+}
+
+/* @return Whether ring is initialized and the calling thread owns it */
+int dma_ring_active(const DmaRing *ring)
+{
+	return ring->entries != 0 && pthread_equal(ring->owner, pthread_self());
+}
+
+static void ring_push(DmaRing *ring, DmaRingReq *req)
+{
+	unsigned tail = *ring->sq_tail;
+	unsigned idx = tail & *ring->sq_mask;
+	struct io_uring_sqe *sqe = &ring->sqes[idx];
+
+	req->iov.iov_base = (char *)req->buf + req->done;
+	req->iov.iov_len = req->bytes - req->done;
+
+	memset(sqe, 0, sizeof(*sqe));
+	sqe->opcode = req->op == DMA_RING_READ ? IORING_OP_READV : IORING_OP_WRITEV;
+	sqe->fd = req->fd;
+	sqe->off = req->offset + req->done;
+	sqe->addr = (uintptr_t)&req->iov;
+	sqe->len = 1;
+	sqe->user_data = (uintptr_t)req;
+
+	ring->sq_array[idx] = idx;
+	__atomic_store_n(ring->sq_tail, tail + 1, __ATOMIC_RELEASE);
+	ring->queued++;
+}
+
+static void ring_complete(DmaRing *ring, DmaRingReq *req, ssize_t res)
+{
+	req->res = res < 0 ? res : (ssize_t)req->done;
+	req->complete = 1;
+	ring->completed++;
+
+	if (req->callback)
+		req->callback(req);
+}
+
+/* The whole transfer with plain syscalls, as a ring without io_uring submits it */
+static ssize_t ring_sync(DmaRingReq *req)
+{
+	while (req->done < req->bytes)
+	{
+		ssize_t rc;
+
+		if (req->op == DMA_RING_READ)
+			rc = pread(req->fd, (char *)req->buf + req->done, req->bytes - req->done, req->offset + req->done);
+		else
+			rc = pwrite(req->fd, (char *)req->buf + req->done, req->bytes - req->done, req->offset + req->done);
+
+		if (rc < 0 && errno == EINTR)
+			continue;
+		if (rc < 0)
+			return -errno;
+		if (!rc)
+			break;
+
+		req->done += rc;
+	}
+
+	return req->done;
+}
+
+/*
+	@brief
+		Queue a request, reaping completions first while the ring is full
+
+	@return 0, or -errno of reaping
+*/
+int dma_ring_queue(DmaRing *ring, DmaRingReq *req)
+{
+	req->done = 0;
+	req->res = 0;
+	req->complete = 0;
+	req->next = NULL;
+
+	while (ring->queued + ring->inflight >= ring->entries)
+	{
+		int rc = dma_ring_submit(ring);
+
+		if (rc >= 0)
+			rc = dma_ring_reap(ring, 1);
+		if (rc < 0)
+			return rc;
+	}
+
+	if (ring->fd >= 0)
+	{
+		ring_push(ring, req);
+		return 0;
+	}
+
+	if (ring->pending_tail)
+		ring->pending_tail->next = req;
+	else
+		ring->pending = req;
+	ring->pending_tail = req;
+	ring->queued++;
+
+	return 0;
+}
+
+/*
+	@brief
+		Submit every queued request in one system call
+
+	@return # of requests submitted, or -errno
+*/
+int dma_ring_submit(DmaRing *ring)
+{
+	int n = 0;
+
+	if (!ring->queued)
+		return 0;
+
+	if (ring->fd < 0)
+	{
+		/* Done right away, completed when reaped */
+		while (ring->pending)
+		{
+			DmaRingReq *req = ring->pending;
+
+			ring->pending = req->next;
+			req->next = NULL;
+			req->res = ring_sync(req);
+
+			if (ring->done_tail)
+				ring->done_tail->next = req;
+			else
+				ring->done = req;
+			ring->done_tail = req;
+			n++;
+		}
+		ring->pending_tail = NULL;
+	}
+	else
+	{
+		do
+		{
+			n = ring_enter(ring->fd, ring->queued, 0, 0);
+		} while (n < 0 && errno == EINTR);
+		ring->enters++;
+
+		if (n < 0)
+		{
+			fprintf(stderr, "io_uring submit of %u failed, %s.\n", ring->queued, strerror(errno));
+			return -errno;
+		}
+	}
+
+	ring->queued -= n;
+	ring->inflight += n;
+	ring->submitted += n;
+
+	return n;
+}
+
+/*
+	@brief
+		Complete requests, waiting until at least wait of them are complete or
+		nothing is in flight. Callbacks run here. A short transfer is
+		resubmitted for the rest instead of completing.
+
+	@return # of requests completed, or -errno
+*/
+int dma_ring_reap(DmaRing *ring, unsigned wait)
+{
+	unsigned n = 0;
+
+	if (ring->fd < 0)
+	{
+		while (ring->done)
+		{
+			DmaRingReq *req = ring->done;
+
+			ring->done = req->next;
+			if (!ring->done)
+				ring->done_tail = NULL;
+			req->next = NULL;
+
+			ring->inflight--;
+			ring_complete(ring, req, req->res);
+			n++;
+		}
+
+		return n;
+	}
+
+	for (;;)
+	{
+		unsigned head = *ring->cq_head;
+		unsigned tail = __atomic_load_n(ring->cq_tail, __ATOMIC_ACQUIRE);
+		int rc;
+
+		while (head != tail)
+		{
+			struct io_uring_cqe *cqe = &ring->cqes[head & *ring->cq_mask];
+			DmaRingReq *req = (DmaRingReq *)(uintptr_t)cqe->user_data;
+			int res = cqe->res;
+
+			__atomic_store_n(ring->cq_head, ++head, __ATOMIC_RELEASE);
+			ring->inflight--;
+
+			if (res > 0 && req->done + res < req->bytes)
+			{
+				req->done += res;
+				ring_push(ring, req);
+				continue;
+			}
+
+			if (res > 0)
+				req->done += res;
+			ring_complete(ring, req, res);
+			n++;
+		}
+
+		if (n >= wait || (!ring->inflight && !ring->queued))
+			break;
+
+		/* Resubmits go with the wait */
+		do
+		{
+			rc = ring_enter(ring->fd, ring->queued, 1, IORING_ENTER_GETEVENTS);
+		} while (rc < 0 && errno == EINTR);
+		ring->enters++;
+
+		if (rc < 0)
+		{
+			fprintf(stderr, "io_uring wait failed, %s.\n", strerror(errno));
+			return -errno;
+		}
+
+		ring->queued -= rc;
+		ring->inflight += rc;
+		ring->submitted += rc;
+	}
+
+	return n;
+}
+
+/*
+	@brief
+		Submit and reap until req is complete, completing others on the way
+
+	@return Bytes transferred by req, or -errno
+*/
+ssize_t dma_ring_wait(DmaRing *ring, DmaRingReq *req)
+{
+	while (!req->complete)
+	{
+		int rc;
+
+		if (!ring->queued && !ring->inflight)
+			return -EINVAL;
+
+		rc = dma_ring_submit(ring);
+		if (rc >= 0)
+			rc = dma_ring_reap(ring, 1);
+		if (rc < 0)
+			return rc;
+	}
+
+	return req->res;
+}
+
+void dma_ring_dump(FILE *fp, const DmaRing *ring)
+{
+	fprintf(fp, "I/O ring: %s, %u entries, %lu submitted, %lu completed, %lu system call(s)\n",
+			ring->fd >= 0 ? "io_uring" : "plain syscalls", ring->entries, ring->submitted, ring->completed,
+			ring->enters);
+}
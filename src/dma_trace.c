@@ -0,0 +1,231 @@
+#include "dma_trace.h"
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+
+#include <sys/syscall.h>
+
+DmaTrace dma_trace = {.lock = PTHREAD_MUTEX_INITIALIZER};
+
+extern int verbose;
+
+static __thread DmaTraceBuffer *trace_local;
+static __thread uint64_t trace_local_generation;
+
+/*
+	@brief
+		Start recording events, up to events per thread
+
+	@param fname: Chrome trace JSON written by dma_trace_close()
+*/
+int dma_trace_open(DmaTrace *trace, const char *fname, size_t events)
+{
+	pthread_mutex_lock(&trace->lock);
+
+	trace->fname = strdup(fname);
+	if (!trace->fname)
+	{
+		pthread_mutex_unlock(&trace->lock);
+		return -ENOMEM;
+	}
+
+	trace->capacity = events ? events : DMA_TRACE_EVENTS_DEFAULT;
+	trace->generation++;
+	trace->buffers = NULL;
+	__atomic_store_n(&trace->enabled, 1, __ATOMIC_RELEASE);
+
+	pthread_mutex_unlock(&trace->lock);
+
+	/* The opening thread, e.g. main(), records from its first transfer without a fault */
+	dma_trace_register(trace);
+
+	return 0;
+}
+
+static DmaTraceBuffer *trace_buffer(DmaTrace *trace)
+{
+	DmaTraceBuffer *buffer;
+
+	if (trace_local && trace_local_generation == trace->generation)
+		return trace_local;
+
+	buffer = (DmaTraceBuffer *)calloc(1, sizeof(DmaTraceBuffer));
+	if (!buffer)
+		return NULL;
+
+	/*
+		Written through now, as calloc() of this size maps pages to be faulted
+		in at first touch, which would land in the first traced stages
+	*/
+	buffer->events = (DmaTraceEvent *)malloc(trace->capacity * sizeof(DmaTraceEvent));
+	if (!buffer->events)
+	{
+		free(buffer);
+		return NULL;
+	}
+	memset(buffer->events, 0, trace->capacity * sizeof(DmaTraceEvent));
+	buffer->capacity = trace->capacity;
+	buffer->tid = (pid_t)syscall(SYS_gettid);
+
+	pthread_mutex_lock(&trace->lock);
+	if (!trace->enabled)
+	{
+		pthread_mutex_unlock(&trace->lock);
+		free(buffer->events);
+		free(buffer);
+		return NULL;
+	}
+	buffer->next = trace->buffers;
+	trace->buffers = buffer;
+	trace_local_generation = trace->generation;
+	pthread_mutex_unlock(&trace->lock);
+
+	trace_local = buffer;
+
+	return buffer;
+}
+
+/*
+	@brief
+		Allocate and prefault the event buffer of the calling thread, so its
+		first traced transfer takes no page faults of it. Threads that do not
+		call it get their buffer at their first event.
+
+	@return 0, -ENODEV if not recording, or -ENOMEM
+*/
+int dma_trace_register(DmaTrace *trace)
+{
+	if (!__atomic_load_n(&trace->enabled, __ATOMIC_ACQUIRE))
+		return -ENODEV;
+
+	return trace_buffer(trace) ? 0 : -ENOMEM;
+}
+
+/*
+	@brief
+		Record an event of the calling thread
+
+	@param name: A string literal
+	@param ph: DMA_TRACE_BEGIN, DMA_TRACE_END or DMA_TRACE_INSTANT
+	@param arg: Bytes of the stage, shown with its end, 0 for none
+*/
+void dma_trace_event(DmaTrace *trace, const char *name, char ph, uint64_t arg)
+{
+	DmaTraceBuffer *buffer;
+	DmaTraceEvent *event;
+
+	if (!trace->enabled)
+		return;
+
+	buffer = trace_buffer(trace);
+	if (!buffer)
+		return;
+
+	if (ph == DMA_TRACE_END && buffer->skipped)
+	{
+		buffer->skipped--;
+		buffer->dropped++;
+		return;
+	}
+
+	/* Room is kept for the ends of open begins */
+	if ((ph == DMA_TRACE_BEGIN && buffer->count + buffer->open + 2 > buffer->capacity) ||
+		(ph == DMA_TRACE_INSTANT && buffer->count + buffer->open + 1 > buffer->capacity))
+	{
+		buffer->skipped += ph == DMA_TRACE_BEGIN;
+		buffer->dropped++;
+		return;
+	}
+
+	if (ph == DMA_TRACE_BEGIN)
+		buffer->open++;
+	else if (ph == DMA_TRACE_END && buffer->open)
+		buffer->open--;
+
+	event = &buffer->events[buffer->count++];
+	event->name = name;
+	event->ts_ns = get_time_ns();
+	event->arg = arg;
+	event->ph = ph;
+}
+
+/*
+	@brief
+		Stop recording and write every event as Chrome trace JSON. Threads
+		must not be in the middle of a traced stage.
+
+	@return 0, or -errno if the file is not written
+*/
+int dma_trace_close(DmaTrace *trace)
+{
+	DmaTraceBuffer *buffer, *next;
+	uint64_t start = ~0ULL, events = 0, dropped = 0;
+	pid_t pid = getpid();
+	int first = 1, rc = 0;
+	FILE *fp;
+
+	if (!trace->enabled)
+		return 0;
+
+	pthread_mutex_lock(&trace->lock);
+	__atomic_store_n(&trace->enabled, 0, __ATOMIC_RELEASE);
+
+	for (buffer = trace->buffers; buffer; buffer = buffer->next)
+		if (buffer->count && buffer->events[0].ts_ns < start)
+			start = buffer->events[0].ts_ns;
+
+	fp = fopen(trace->fname, "w");
+	if (!fp)
+	{
+		fprintf(stderr, "unable to open trace file %s.\n", trace->fname);
+		perror("open trace file");
+		rc = -ENOENT;
+	}
+	else
+	{
+		fprintf(fp, "{\"displayTimeUnit\":\"ns\",\"traceEvents\":[\n");
+
+		for (buffer = trace->buffers; buffer; buffer = buffer->next)
+		{
+			for (size_t i = 0; i < buffer->count; i++)
+			{
+				const DmaTraceEvent *event = &buffer->events[i];
+				uint64_t ts = event->ts_ns - start;
+
+				fprintf(fp, "%s{\"name\":\"%s\",\"ph\":\"%c\",\"ts\":%lu.%03lu,\"pid\":%d,\"tid\":%d",
+						first ? "" : ",\n", event->name, event->ph, ts / 1000, ts % 1000, pid, buffer->tid);
+				if (event->ph == DMA_TRACE_INSTANT)
+					fprintf(fp, ",\"s\":\"t\"");
+				if (event->arg)
+					fprintf(fp, ",\"args\":{\"bytes\":%lu}", event->arg);
+				fprintf(fp, "}");
+				first = 0;
+			}
+
+			events += buffer->count;
+			dropped += buffer->dropped;
+		}
+
+		fprintf(fp, "\n]}\n");
+		if (fclose(fp))
+			rc = -EIO;
+	}
+
+	if (verbose || dropped)
+		fprintf(stdout, "Trace: %lu event(s) to %s, %lu dropped.\n", events, trace->fname, dropped);
+
+	for (buffer = trace->buffers; buffer; buffer = next)
+	{
+		next = buffer->next;
+		free(buffer->events);
+		free(buffer);
+	}
+	trace->buffers = NULL;
+	free(trace->fname);
+	trace->fname = NULL;
+
+	pthread_mutex_unlock(&trace->lock);
+
+	return rc;
+}
@@ -0,0 +1,586 @@
+#include "dma_tune.h"
+#include "user_regs.h"
+#include "pio.h"
+#include "dma_ring.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <sched.h>
+#include <unistd.h>
+
+#define DMA_TUNE_CHUNK_MIN (4096)
+#define DMA_TUNE_NEAR_BEST (1.05) /* A wait using less CPU wins if its loop is this close to the fastest */
+
+extern int verbose;
+
+DmaProfile dma_profile = {
+	.chunk = DOWNSTREAM_BRAM_SIZE,
+	.bounce_align = 0,
+	.wait = DMA_WAIT_SLEEP,
+	.wait_interval_us = 1000000,
+	.retries = DMA_RETRIES_DEFAULT,
+	.retry_us = DMA_RETRY_US_DEFAULT,
+};
+
+/* Aligned copy of a chunk for buffers aligned below bounce_align, allocated on first use */
+static frame *dma_bounce;
+static size_t dma_bounce_size;
+
+static const char *const dma_wait_names[] = {
+	[DMA_WAIT_SLEEP] = "sleep",
+	[DMA_WAIT_YIELD] = "yield",
+	[DMA_WAIT_SPIN] = "spin",
+};
+
+/*
+	@brief
+		Settings of the send path before any tuning: one write per loop,
+		TX done polled once a second, a failed loop resent up to 3 times
+*/
+void dma_profile_default(DmaProfile *profile)
+{
+	memset(profile, 0, sizeof(*profile));
+	profile->chunk = DOWNSTREAM_BRAM_SIZE;
+	profile->bounce_align = 0;
+	profile->wait = DMA_WAIT_SLEEP;
+	profile->wait_interval_us = 1000000;
+	profile->retries = DMA_RETRIES_DEFAULT;
+	profile->retry_us = DMA_RETRY_US_DEFAULT;
+}
+
+/*
+	@brief
+		Load a profile saved by dma_profile_save(). A profile of another host is refused.
+
+	@return 0, -ENOENT if there is no profile, or -EINVAL
+*/
+int dma_profile_load(const char *fname, DmaProfile *profile)
+{
+	DmaProfile loaded;
+	char line[128], key[32], value[96];
+	char host[DMA_PROFILE_HOST_LEN] = {0};
+	FILE *fp = fopen(fname, "r");
+	int n = 0;
+
+	if (!fp)
+		return -errno;
+
+	dma_profile_default(&loaded);
+
+	while (fgets(line, sizeof(line), fp))
+	{
+		if (line[0] == '#' || sscanf(line, " %31[^= ] = %95s", key, value) != 2)
+			continue;
+
+		if (!strcmp(key, "host"))
+		{
+			/* Longer than a host name saved, it is of no host this one can match */
+			if (strlen(value) >= sizeof(loaded.host))
+			{
+				fprintf(stderr, "%s, host %s too long.\n", fname, value);
+				fclose(fp);
+				return -EINVAL;
+			}
+			snprintf(loaded.host, sizeof(loaded.host), "%.*s", DMA_PROFILE_HOST_LEN - 1, value);
+		}
+		else if (!strcmp(key, "chunk"))
+			loaded.chunk = strtoul(value, NULL, 0);
+		else if (!strcmp(key, "bounce_align"))
+			loaded.bounce_align = strtoul(value, NULL, 0);
+		else if (!strcmp(key, "wait_interval_us"))
+			loaded.wait_interval_us = strtoul(value, NULL, 0);
+		else if (!strcmp(key, "retries"))
+			loaded.retries = strtoul(value, NULL, 0);
+		else if (!strcmp(key, "retry_us"))
+			loaded.retry_us = strtoul(value, NULL, 0);
+		else if (!strcmp(key, "pio_max_bytes"))
+			loaded.pio_max_bytes = strtoul(value, NULL, 0);
+		else if (!strcmp(key, "h2c_mbps"))
+			loaded.h2c_mbps = strtod(value, NULL);
+		else if (!strcmp(key, "write_us"))
+			loaded.write_us = strtod(value, NULL);
+		else if (!strcmp(key, "loop_us"))
+			loaded.loop_us = strtod(value, NULL);
+		else if (!strcmp(key, "wait"))
+		{
+			loaded.wait = -1;
+			for (int i = 0; i < sizeof(dma_wait_names) / sizeof(dma_wait_names[0]); i++)
+				if (!strcmp(value, dma_wait_names[i]))
+					loaded.wait = i;
+		}
+		else
+			continue;
+
+		n++;
+	}
+
+	fclose(fp);
+
+	if (!n || loaded.chunk < sizeof(frame) || loaded.chunk % sizeof(frame) || (int)loaded.wait < 0 ||
+		loaded.pio_max_bytes % sizeof(frame) ||
+		(loaded.bounce_align & (loaded.bounce_align - 1)))
+	{
+		fprintf(stderr, "%s, invalid DMA profile.\n", fname);
+		return -EINVAL;
+	}
+
+	gethostname(host, sizeof(host) - 1);
+	if (loaded.host[0] && strcmp(loaded.host, host))
+	{
+		fprintf(stderr, "%s, DMA profile of host %s, not %s.\n", fname, loaded.host, host);
+		return -EINVAL;
+	}
+
+	*profile = loaded;
+
+	return 0;
+}
+
+int dma_profile_save(const char *fname, const DmaProfile *profile)
+{
+	FILE *fp = fopen(fname, "w");
+
+	if (!fp)
+	{
+		fprintf(stderr, "unable to open DMA profile %s.\n", fname);
+		perror("open file");
+		return -errno;
+	}
+
+	fprintf(fp, "# DMA profile of PCIeApp, written by --tune\n");
+	fprintf(fp, "host = %s\n", profile->host);
+	fprintf(fp, "chunk = %u\n", profile->chunk);
+	fprintf(fp, "bounce_align = %u\n", profile->bounce_align);
+	fprintf(fp, "wait = %s\n", dma_wait_names[profile->wait]);
+	fprintf(fp, "wait_interval_us = %u\n", profile->wait_interval_us);
+	fprintf(fp, "retries = %u\n", profile->retries);
+	fprintf(fp, "retry_us = %u\n", profile->retry_us);
+	fprintf(fp, "pio_max_bytes = %u\n", profile->pio_max_bytes);
+	fprintf(fp, "h2c_mbps = %.1f\n", profile->h2c_mbps);
+	fprintf(fp, "write_us = %.2f\n", profile->write_us);
+	fprintf(fp, "loop_us = %.2f\n", profile->loop_us);
+
+	if (fclose(fp))
+		return -EIO;
+
+	return 0;
+}
+
+void dma_profile_dump(FILE *fp, const DmaProfile *profile)
+{
+	fprintf(fp, "DMA profile: chunk %u bytes, bounce below %u, wait %s", profile->chunk,
+			profile->bounce_align, dma_wait_names[profile->wait]);
+	if (profile->wait == DMA_WAIT_SLEEP)
+		fprintf(fp, " %u us", profile->wait_interval_us);
+	fprintf(fp, ", %u retries from %u us", profile->retries, profile->retry_us);
+	if (profile->pio_max_bytes)
+		fprintf(fp, ", PIO up to %u bytes", profile->pio_max_bytes);
+	fprintf(fp, "\n");
+}
+
+/* dma_write() with all chunks in flight on dma_ring at once, up to its entries */
+static ssize_t dma_write_ring(int fd, const frame *buf, uint64_t bytes, off_t offset, const DmaProfile *profile)
+{
+	DmaRingReq reqs[DMA_RING_ENTRIES_DEFAULT];
+	uint64_t count = 0, queued = 0, reaped = 0;
+	int err = 0;
+
+	while (queued < bytes || reaped < queued)
+	{
+		DmaRingReq *req;
+		ssize_t rc;
+
+		while (queued < bytes && (queued - reaped) / profile->chunk < DMA_RING_ENTRIES_DEFAULT && !err)
+		{
+			req = &reqs[(queued / profile->chunk) % DMA_RING_ENTRIES_DEFAULT];
+			req->op = DMA_RING_WRITE;
+			req->fd = fd;
+			req->buf = (char *)buf + queued;
+			req->bytes = bytes - queued < profile->chunk ? bytes - queued : profile->chunk;
+			req->offset = offset + queued;
+			req->callback = NULL;
+
+			if (dma_ring_queue(&dma_ring, req) < 0)
+			{
+				err = 1;
+				break;
+			}
+			queued += req->bytes;
+		}
+
+		if (reaped == queued)
+			break;
+
+		/* In order, so count stops at the first failed or short chunk */
+		req = &reqs[(reaped / profile->chunk) % DMA_RING_ENTRIES_DEFAULT];
+		rc = dma_ring_wait(&dma_ring, req);
+		reaped += req->bytes;
+
+		if (!err && rc >= 0)
+			count += rc;
+		if (rc != req->bytes)
+			err = 1;
+	}
+
+	return count || !err ? (ssize_t)count : -EIO;
+}
+
+/*
+	@brief
+		Write bytes into h2c at offset in chunks of the profile. A buffer aligned
+		below bounce_align is copied chunk by chunk into an aligned buffer first.
+
+	@return Bytes written
+*/
+ssize_t dma_write(int fd, const frame *buf, uint64_t bytes, off_t offset, const DmaProfile *profile)
+{
+	const char *src = (const char *)buf;
+	uint64_t count = 0;
+	int bounce = profile->bounce_align && ((uintptr_t)buf & (profile->bounce_align - 1));
+	ssize_t rc;
+
+	if (bounce && dma_bounce_size < profile->chunk)
+	{
+		free(dma_bounce);
+		dma_bounce = NULL;
+		dma_bounce_size = 0;
+
+		if (posix_memalign((void **)&dma_bounce, 4096 /* alignment */, profile->chunk))
+			bounce = 0;
+		else
+			dma_bounce_size = profile->chunk;
+	}
+
+	if (!bounce && dma_ring_active(&dma_ring))
+		return dma_write_ring(fd, buf, bytes, offset, profile);
+
+	while (count < bytes)
+	{
+		uint64_t len = bytes - count;
+
+		if (len > profile->chunk)
+			len = profile->chunk;
+
+		if (bounce)
+		{
+			memcpy(dma_bounce, src + count, len);
+			rc = pwrite(fd, dma_bounce, len, offset + count);
+		}
+		else
+		{
+			rc = pwrite(fd, src + count, len, offset + count);
+		}
+
+		if (rc < 0)
+			return count ? (ssize_t)count : -EIO;
+
+		count += rc;
+		if (rc != len)
+			break;
+	}
+
+	return count;
+}
+
+/*
+	@brief
+		Wait for TX done by the strategy of the profile, then clear it
+
+	@return 0, or -ETIMEDOUT
+*/
+int dma_wait_tx_done(void *user_addr, const DmaProfile *profile, long timeout_us)
+{
+	uint64_t deadline = get_time_ns() + (uint64_t)timeout_us * 1000;
+	uint32_t val;
+
+	if (profile->wait == DMA_WAIT_SPIN)
+	{
+		if (pollUser(user_addr, TX_DONE_RW_ADDR, 0x00000001, timeout_us, &val) < 0)
+			return -ETIMEDOUT;
+	}
+	else
+	{
+		while (!((val = readUser(user_addr, TX_DONE_RW_ADDR)) & 0x00000001))
+		{
+			if (get_time_ns() > deadline)
+				return -ETIMEDOUT;
+
+			if (profile->wait == DMA_WAIT_YIELD)
+				sched_yield();
+			else
+				usleep(profile->wait_interval_us);
+		}
+	}
+
+	writeUser(user_addr, TX_DONE_RW_ADDR, val & 0xFFFFFFFE);
+
+	return 0;
+}
+
+/* Mean ns of writing one BRAM loop from buf */
+static double tune_write(int fd, const frame *buf, uint64_t base, int iters, const DmaProfile *profile)
+{
+	uint64_t start = get_time_ns();
+
+	for (int i = 0; i < iters; i++)
+	{
+		if (dma_write(fd, buf, DOWNSTREAM_BRAM_SIZE, base, profile) != DOWNSTREAM_BRAM_SIZE)
+			return -1;
+	}
+
+	return (double)(get_time_ns() - start) / iters;
+}
+
+/* Mean ns of storing bytes through the PIO window */
+static double tune_pio(const PioWindow *pio, const frame *buf, uint64_t bytes, uint64_t base, int iters)
+{
+	uint64_t start = get_time_ns();
+
+	for (int i = 0; i < iters; i++)
+	{
+		if (pio_write(pio, buf, bytes, base) != bytes)
+			return -1;
+	}
+
+	/* Stores are posted, a read of the device waits for them */
+	(void)*(volatile frame *)pio->base;
+
+	return (double)(get_time_ns() - start) / iters;
+}
+
+/*
+	Whether the window is the BRAM: a pattern written by DMA reads back
+	through it, and so does another stored through it. Stores into a window
+	decoding nothing would otherwise beat DMA and enable PIO sending nothing.
+*/
+static int tune_pio_check(int fd, const PioWindow *pio, frame *buf, uint64_t base, const DmaProfile *profile)
+{
+	uint64_t bytes = DMA_TUNE_PIO_CHECK_BYTES < pio->size ? DMA_TUNE_PIO_CHECK_BYTES : pio->size;
+	int rc;
+
+	for (uint64_t i = 0; i < bytes / sizeof(frame); i++)
+		buf[i] = (i + 1) * 0x9E3779B97F4A7C15ULL;
+
+	if (dma_write(fd, buf, bytes, base, profile) != bytes)
+		return -EIO;
+	rc = pio_verify(pio, buf, bytes, base);
+	if (rc < 0)
+		return rc;
+
+	for (uint64_t i = 0; i < bytes / sizeof(frame); i++)
+		buf[i] = ~buf[i];
+
+	if (pio_write(pio, buf, bytes, base) != bytes)
+		return -EIO;
+
+	return pio_verify(pio, buf, bytes, base);
+}
+
+/* Mean ns of a DMA of bytes, as a tiny loop is written */
+static double tune_dma_small(int fd, const frame *buf, uint64_t bytes, uint64_t base, int iters,
+							 const DmaProfile *profile)
+{
+	uint64_t start = get_time_ns();
+
+	for (int i = 0; i < iters; i++)
+	{
+		if (dma_write(fd, buf, bytes, base, profile) != bytes)
+			return -1;
+	}
+
+	return (double)(get_time_ns() - start) / iters;
+}
+
+/* Mean ns of an empty loop: a stop frame, the TX request and waiting for TX done */
+static double tune_loop(int fd, void *user_addr, uint64_t base, int iters, const DmaProfile *profile)
+{
+	uint64_t stop_frame = STOP_FRAME;
+	uint64_t start = get_time_ns();
+
+	for (int i = 0; i < iters; i++)
+	{
+		updateUser(user_addr, TRANS_INFO_RW_ADDR, 0x000000FF, 1);
+
+		if (pwrite(fd, &stop_frame, sizeof(stop_frame), base) != sizeof(stop_frame))
+			return -1;
+
+		writeUser(user_addr, TX_STATUS_RW_ADDR, REQ_TX_SENDING);
+
+		if (dma_wait_tx_done(user_addr, profile, IRQ_TIGGERED_TIMEOUT * 1000000L) < 0)
+			return -1;
+	}
+
+	return (double)(get_time_ns() - start) / iters;
+}
+
+/*
+	@brief
+		Sweep the chunk size of writes within a BRAM loop, the alignment below
+		which an aligned copy pays off, and the strategy of waiting for TX done.
+		Frames are only written into BRAM, except for the empty loops timing
+		the wait, which carry nothing but a stop frame. With a PIO window, the
+		largest loop that PIO stores write faster than a DMA is found too.
+
+	@param fname: Name of h2c device
+	@param fd: File description of h2c device
+	@param user_addr: Address of user registers
+	@param pio: PIO window of the downstream BRAM, or NULL
+	@param base: Base offset of H2C device, DOWNSTREAM_BRAM_CH1_ADDR
+	@param iters: # of repeats of each setting
+	@param best: The best settings
+*/
+int dma_tune(char *fname, int fd, void *user_addr, const PioWindow *pio, uint64_t base, int iters,
+			 DmaProfile *best)
+{
+	static const int aligns[] = {512, 64, 8}; /* Descending */
+	static const struct {
+		dma_wait_e wait;
+		uint32_t interval_us;
+	} waits[] = {
+		/* Less CPU first */
+		{DMA_WAIT_SLEEP, 100},
+		{DMA_WAIT_SLEEP, 10},
+		{DMA_WAIT_YIELD, 0},
+		{DMA_WAIT_SPIN, 0},
+	};
+	double loop_ns[sizeof(waits) / sizeof(waits[0])];
+	DmaProfile profile;
+	frame *buf = NULL;
+	double ns, best_ns = 0, min_loop = 0;
+	int rc = 0;
+
+	if (iters <= 0)
+		iters = DMA_TUNE_ITERS_DEFAULT;
+
+	if (posix_memalign((void **)&buf, 4096 /* alignment */, DOWNSTREAM_BRAM_SIZE + 4096))
+	{
+		fprintf(stderr, "OOM %u.\n", DOWNSTREAM_BRAM_SIZE + 4096);
+		return -ENOMEM;
+	}
+	memset(buf, 0, DOWNSTREAM_BRAM_SIZE + 4096);
+
+	dma_profile_default(&profile);
+	gethostname(profile.host, sizeof(profile.host) - 1);
+	*best = profile;
+
+	/* 1. Chunk size, from an aligned buffer */
+	fprintf(stdout, "%s: chunk     MB/s      us/write\n", fname);
+	for (uint32_t chunk = DMA_TUNE_CHUNK_MIN; chunk <= DOWNSTREAM_BRAM_SIZE; chunk <<= 1)
+	{
+		profile.chunk = chunk;
+		ns = tune_write(fd, buf, base, iters, &profile);
+		if (ns < 0)
+		{
+			fprintf(stderr, "%s, write @ 0x%lx failed.\n", fname, base);
+			rc = -EIO;
+			goto out;
+		}
+
+		fprintf(stdout, "%s: %-8u  %-8.1f  %.2f\n", fname, chunk, DOWNSTREAM_BRAM_SIZE * 1e3 / ns,
+				ns / 1e3 / (DOWNSTREAM_BRAM_SIZE / chunk));
+
+		if (!best_ns || ns < best_ns)
+		{
+			best_ns = ns;
+			best->chunk = chunk;
+			best->h2c_mbps = DOWNSTREAM_BRAM_SIZE * 1e3 / ns;
+			best->write_us = ns / 1e3 / (DOWNSTREAM_BRAM_SIZE / chunk);
+		}
+	}
+
+	/* 2. Alignment, the largest one where an aligned copy beats writing in place */
+	profile.chunk = best->chunk;
+	fprintf(stdout, "%s: align     in place MB/s  copied MB/s\n", fname);
+	for (int i = 0; i < sizeof(aligns) / sizeof(aligns[0]); i++)
+	{
+		const frame *src = (const frame *)((char *)buf + aligns[i]);
+		double direct, copied;
+
+		profile.bounce_align = 0;
+		direct = tune_write(fd, src, base, iters, &profile);
+		profile.bounce_align = 4096;
+		copied = tune_write(fd, src, base, iters, &profile);
+		if (direct < 0 || copied < 0)
+		{
+			fprintf(stderr, "%s, write @ 0x%lx failed.\n", fname, base);
+			rc = -EIO;
+			goto out;
+		}
+
+		fprintf(stdout, "%s: %-8d  %-13.1f  %.1f\n", fname, aligns[i],
+				DOWNSTREAM_BRAM_SIZE * 1e3 / direct, DOWNSTREAM_BRAM_SIZE * 1e3 / copied);
+
+		if (copied < direct && !best->bounce_align)
+			best->bounce_align = aligns[i] * 2;
+	}
+	profile.bounce_align = best->bounce_align;
+
+	/* 3. Wait strategy, timed by empty loops */
+	fprintf(stdout, "%s: wait          us/loop\n", fname);
+	for (int i = 0; i < sizeof(waits) / sizeof(waits[0]); i++)
+	{
+		profile.wait = waits[i].wait;
+		profile.wait_interval_us = waits[i].interval_us;
+
+		loop_ns[i] = tune_loop(fd, user_addr, base, iters, &profile);
+		if (loop_ns[i] < 0)
+		{
+			fprintf(stderr, "%s, empty loop failed.\n", fname);
+			rc = -EIO;
+			goto out;
+		}
+
+		fprintf(stdout, "%s: %-5s %-6u  %.2f\n", fname, dma_wait_names[waits[i].wait],
+				waits[i].interval_us, loop_ns[i] / 1e3);
+
+		if (!min_loop || loop_ns[i] < min_loop)
+			min_loop = loop_ns[i];
+	}
+
+	for (int i = 0; i < sizeof(waits) / sizeof(waits[0]); i++)
+	{
+		if (loop_ns[i] <= min_loop * DMA_TUNE_NEAR_BEST)
+		{
+			best->wait = waits[i].wait;
+			best->wait_interval_us = waits[i].interval_us;
+			best->loop_us = loop_ns[i] / 1e3;
+			break;
+		}
+	}
+
+	/* 4. PIO threshold, doubling the loop while stores beat a DMA of it */
+	if (pio && pio->base && tune_pio_check(fd, pio, buf, base, &profile) < 0)
+	{
+		fprintf(stderr, "%s, BRAM does not read back through the PIO window, PIO stays off.\n", fname);
+	}
+	else if (pio && pio->base)
+	{
+		fprintf(stdout, "%s: bytes     PIO us    DMA us\n", fname);
+		for (uint64_t bytes = DMA_TUNE_PIO_MIN; bytes <= pio->size && bytes <= DOWNSTREAM_BRAM_SIZE; bytes <<= 1)
+		{
+			double stores = tune_pio(pio, buf, bytes, base, iters);
+			double dma = tune_dma_small(fd, buf, bytes, base, iters, &profile);
+
+			if (stores < 0 || dma < 0)
+			{
+				fprintf(stderr, "%s, write of %lu bytes @ 0x%lx failed.\n", fname, bytes, base);
+				rc = -EIO;
+				goto out;
+			}
+
+			fprintf(stdout, "%s: %-8lu  %-8.2f  %.2f\n", fname, bytes, stores / 1e3, dma / 1e3);
+
+			if (stores >= dma)
+				break;
+			best->pio_max_bytes = bytes;
+		}
+	}
+
+	if (verbose)
+		dma_profile_dump(stdout, best);
+
+out:
+	free(buf);
+	return rc;
+}
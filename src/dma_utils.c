@@ -1,21 +1,31 @@
+/* splice(), copy_file_range() */
+#define _GNU_SOURCE
 #include "dma_utils.h"
+#include "dma_tune.h"
+#include "frame_codec.h"
+#include "user_regs.h"
+#include "pio.h"
+#include "dma_ring.h"
+#include "dma_trace.h"
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
 #include <unistd.h>
 #include <errno.h>
+#include <fcntl.h>
 #include <byteswap.h>
 #include <sys/types.h>
 
 #define RW_MAX_SIZE (0x7ffff000)
-// #define TXT_MODE			// Deprecated
-
-#ifdef TXT_MODE
-#define READ_ONE_LINE 65
-#define BYTES_IN_ONE_LINE 8
-#endif
+#define TXT_BLOCK_LINES (16 * 1024) /* Lines per read, ~1M bytes of text */
 
 ssize_t write_from_buffer(char *fname, int fd, frame *buffer, uint64_t size, uint64_t base);
 ssize_t write_h2c_with_limit(char *fname, int fd, void *user_addr, int irq_fd, FrameBuffer *buffer,
 							 uint64_t base, uint64_t max_limit);
+ssize_t write_h2c_from_pack(char *fname, int fd, void *user_addr, int irq_fd, FramePackReader *reader,
+							FrameBuffer *staging, uint64_t base, uint64_t max_limit);
+ssize_t write_h2c_from_file(char *fname, int fd, void *user_addr, int irq_fd, int in_fd, uint64_t size,
+							uint64_t base, uint64_t max_limit);
 
 extern int verbose;
 
@@ -78,14 +88,14 @@ ssize_t receive_to_buffer(char *fname, int fd, FrameBuffer *buffer, uint64_t bas
 /*
 	@brief
 		frames file(.txt) to frames(uint64_t)
+		Reads blocks of whole lines and converts them with txt2frames(),
+		which also validates every line.
 
 	@param fname: Input filename
 	@param fd: File description of input file
-	@param buffer: Frame buffer
-	@param size: The size of what to read in bytes
+	@param buffer: Frame buffer, buffer->size is the size of what to read in bytes
 	@param base: Usually is 0
 */
-#ifdef TXT_MODE
 ssize_t read_txt_to_buffer(char *fname, int fd, FrameBuffer *buffer, uint64_t base)
 {
 	ssize_t rc;
@@ -94,61 +104,165 @@ ssize_t read_txt_to_buffer(char *fname, int fd, FrameBuffer *buffer, uint64_t ba
 	uint64_t size = buffer->size;
 	off_t offset = base;
 	int loop = 0;
-	char txt_buf[READ_ONE_LINE];
+	char *txt_buf;
 
-	while (count < size)
+	txt_buf = (char *)malloc(TXT_BLOCK_LINES * FRAME_TXT_LINE_LEN);
+	if (!txt_buf)
 	{
-		if (offset)
-		{
-			rc = lseek(fd, offset, SEEK_SET);
-			if (rc != offset)
-			{
-				fprintf(stderr, "%s, seek off 0x%lx != 0x%lx.\n",
-						fname, rc, offset);
-				perror("seek file");
-				return -EIO;
-			}
-		}
+		fprintf(stderr, "OOM %d.\n", TXT_BLOCK_LINES * FRAME_TXT_LINE_LEN);
+		return -ENOMEM;
+	}
 
-		/* read data from file into txt buffer */
-		rc = read(fd, (void *)txt_buf, READ_ONE_LINE);
+	posix_fadvise(fd, offset, 0, POSIX_FADV_SEQUENTIAL);
 
+	while (count < size)
+	{
+		uint64_t lines = (size - count) / sizeof(frame);
+		uint64_t bytes;
+		size_t consumed;
+		ssize_t converted;
+
+		if (lines > TXT_BLOCK_LINES)
+			lines = TXT_BLOCK_LINES;
+		bytes = lines * FRAME_TXT_LINE_LEN;
+
+		/* read whole lines from file into txt buffer */
+		DMA_TRACE_SPAN_BEGIN("file read");
+		rc = pread(fd, txt_buf, bytes, offset);
+		DMA_TRACE_SPAN_END("file read", rc > 0 ? rc : 0);
 		if (rc < 0)
 		{
-			fprintf(stderr, "%s, read 65 @ 0x%lx failed %ld.\n",
-					fname, offset, rc);
+			fprintf(stderr, "%s, read 0x%lx @ 0x%lx failed %ld.\n",
+					fname, bytes, offset, rc);
 			perror("read file");
+			free(txt_buf);
 			return -EIO;
 		}
 
-		if (rc != READ_ONE_LINE)
+		/* The last line may end without '\n' */
+		if (rc < bytes && rc % FRAME_TXT_LINE_LEN == FRAME_TXT_CHARS)
+			txt_buf[rc++] = '\n';
+
+		DMA_TRACE_SPAN_BEGIN("txt decode");
+		converted = txt2frames(txt_buf, rc, buf, lines, &consumed);
+		DMA_TRACE_SPAN_END("txt decode", converted > 0 ? converted * sizeof(frame) : 0);
+		if (converted < 0)
 		{
-			fprintf(stderr, "%s, read underflow 65/0x%lx @ 0x%lx.\n",
-					fname, rc, offset);
-			break;
+			fprintf(stderr, "%s, malformed frame at line %lu.\n",
+					fname, (offset - base + consumed) / FRAME_TXT_LINE_LEN + 1);
+			free(txt_buf);
+			return -EINVAL;
 		}
 
-		txt_buf[READ_ONE_LINE - 1] = '\0';
-		*buf = (frame)strtoul(txt_buf, NULL, 2);
-
-		count += BYTES_IN_ONE_LINE;
-		buf += 1;
-
-		offset += READ_ONE_LINE;
+		count += converted * sizeof(frame);
+		buf += converted;
+		offset += consumed;
 		loop++;
+
+		if (rc != bytes)
+		{
+			fprintf(stderr, "%s, read underflow 0x%lx/0x%lx @ 0x%lx.\n",
+					fname, rc, bytes, offset);
+			break;
+		}
 	}
 
+	free(txt_buf);
+
 	if (count != size && loop)
 		fprintf(stderr, "%s, read underflow 0x%lx/0x%lx.\n", fname, count, size);
 
 	return count;
 }
-#endif
 
-#ifdef BIN_MODE
+static void read_bin_swap(DmaRingReq *req)
+{
+	frame *frames = (frame *)req->buf;
+
+	DMA_TRACE_SPAN_BEGIN("bin swap");
+	for (ssize_t i = 0; i < req->res / (ssize_t)sizeof(frame); i++)
+		frames[i] = bswap_64(frames[i]);
+	DMA_TRACE_SPAN_END("bin swap", req->res > 0 ? req->res : 0);
+}
+
+/*
+	@brief
+		Read size bytes on dma_ring, DMA_RING_READ_CHUNK each, a window of
+		them in flight. Chunks are swapped as they complete, while later
+		ones are still being read.
+
+	@return Bytes read up to the first short chunk, or -EIO
+*/
+static ssize_t read_bin_ring(char *fname, int fd, char *buf, uint64_t size, uint64_t base, int *loop)
+{
+	DmaRingReq reqs[DMA_RING_ENTRIES_DEFAULT];
+	uint64_t chunks = (size + DMA_RING_READ_CHUNK - 1) / DMA_RING_READ_CHUNK;
+	uint64_t count = 0, queued = 0, reaped = 0;
+	int err = 0, underflow = 0;
+
+	while (reaped < chunks)
+	{
+		DmaRingReq *req;
+		ssize_t rc;
+
+		/* Fill the window, unless the file already ended */
+		while (queued < chunks && queued - reaped < DMA_RING_ENTRIES_DEFAULT && !err && !underflow)
+		{
+			req = &reqs[queued % DMA_RING_ENTRIES_DEFAULT];
+			req->op = DMA_RING_READ;
+			req->fd = fd;
+			req->buf = buf + queued * DMA_RING_READ_CHUNK;
+			req->bytes = size - queued * DMA_RING_READ_CHUNK;
+			if (req->bytes > DMA_RING_READ_CHUNK)
+				req->bytes = DMA_RING_READ_CHUNK;
+			req->offset = base + queued * DMA_RING_READ_CHUNK;
+			req->callback = read_bin_swap;
+			req->arg = NULL;
+
+			if (dma_ring_queue(&dma_ring, req) < 0)
+			{
+				err = 1;
+				break;
+			}
+			queued++;
+		}
+
+		if (reaped == queued)
+			break;
+
+		/* In order, so count stops at the first short chunk */
+		req = &reqs[reaped % DMA_RING_ENTRIES_DEFAULT];
+		DMA_TRACE_SPAN_BEGIN("file read");
+		rc = dma_ring_wait(&dma_ring, req);
+		DMA_TRACE_SPAN_END("file read", rc > 0 ? rc : 0);
+		reaped++;
+
+		if (rc < 0)
+		{
+			fprintf(stderr, "%s, read 0x%lx @ 0x%lx failed %ld.\n", fname, req->bytes, req->offset, rc);
+			err = 1;
+			continue;
+		}
+		if (err || underflow)
+			continue;
+
+		count += rc;
+		(*loop)++;
+
+		if (rc != req->bytes)
+		{
+			fprintf(stderr, "%s, read underflow 0x%lx/0x%lx @ 0x%lx.\n", fname, rc, req->bytes, req->offset + rc);
+			underflow = 1;
+		}
+	}
+
+	return err ? -EIO : (ssize_t)count;
+}
+
 /*
 	@brief
 		frames bin(.bin) to frames(uint64_t)
+		Frames in file are big-endian, swapped in place after reading.
 
 	@param fname: Input filename
 	@param fd: File description of input file
@@ -160,44 +274,59 @@ ssize_t read_bin_to_buffer(char *fname, int fd, FrameBuffer *buffer, ssize_t siz
 {
 	ssize_t rc;
 	uint64_t count = 0; // size in bytes
-	frame *buf = buffer->frames;
+	char *buf = (char *)buffer->frames;
 	off_t offset = base;
 	int loop = 0;
 
+	posix_fadvise(fd, offset, size, POSIX_FADV_SEQUENTIAL);
+
+	if (dma_ring_active(&dma_ring))
+	{
+		rc = read_bin_ring(fname, fd, buf, size, base, &loop);
+		if (rc < 0)
+			return rc;
+
+		count = rc - rc % sizeof(frame);
+		goto swapped;
+	}
+
 	while (count < size)
 	{
-		rc = lseek(fd, offset, SEEK_SET);
-		if (rc != offset)
-		{
-			fprintf(stderr, "%s, seek off 0x%lx != 0x%lx.\n", fname, rc, offset);
-			perror("seek file");
-			return -EIO;
-		}
+		uint64_t bytes = size - count;
 
-		/* read data from file into bin buffer */
-		rc = read(fd, (void *)buf, 8);
-		*buf = bswap_64(*buf);
+		if (bytes > RW_MAX_SIZE)
+			bytes = RW_MAX_SIZE;
 
+		/* read data from file into bin buffer */
+		DMA_TRACE_SPAN_BEGIN("file read");
+		rc = pread(fd, buf + count, bytes, offset);
+		DMA_TRACE_SPAN_END("file read", rc > 0 ? rc : 0);
 		if (rc < 0)
 		{
-			fprintf(stderr, "%s, read 8 @ 0x%lx failed %ld.\n", fname, offset, rc);
+			fprintf(stderr, "%s, read 0x%lx @ 0x%lx failed %ld.\n", fname, bytes, offset, rc);
 			perror("read file");
 			return -EIO;
 		}
 
-		if (rc != 8)
+		count += rc;
+		offset += rc;
+		loop++;
+
+		if (rc != bytes)
 		{
-			fprintf(stderr, "%s, read underflow 65/0x%lx @ 0x%lx.\n", fname, rc, offset);
+			fprintf(stderr, "%s, read underflow 0x%lx/0x%lx @ 0x%lx.\n", fname, rc, bytes, offset);
 			break;
 		}
-
-		buf++;
-		offset += 8;
-		count++;
-		loop++;
 	}
 
-	buffer->size = size;
+	count -= count % sizeof(frame);
+	DMA_TRACE_SPAN_BEGIN("bin swap");
+	for (uint64_t i = 0; i < count / sizeof(frame); i++)
+		buffer->frames[i] = bswap_64(buffer->frames[i]);
+	DMA_TRACE_SPAN_END("bin swap", count);
+
+swapped:
+	buffer->size = count;
 
 	if (count != size && loop)
 		fprintf(stderr, "%s, read underflow 0x%lx/0x%lx.\n", fname, count, size);
@@ -206,7 +335,7 @@ ssize_t read_bin_to_buffer(char *fname, int fd, FrameBuffer *buffer, ssize_t siz
 	{
 		printf("count = %ld, loop = %d\n", count, loop);
 
-		for (int i = 0; i < size; i++)
+		for (int i = 0; i < count / sizeof(frame); i++)
 		{
 			printf("#%d: 0x%lx\n", i, *(buffer->frames + i));
 		}
@@ -214,7 +343,6 @@ ssize_t read_bin_to_buffer(char *fname, int fd, FrameBuffer *buffer, ssize_t siz
 
 	return count;
 }
-#endif
 
 /*
 	@brief
@@ -282,78 +410,247 @@ ssize_t write_from_buffer(char *fname, int fd, frame *buffer, uint64_t size, uin
 	return count;
 }
 
+/* Frames of a loop: in memory, or a range of a file already in device order */
+typedef struct H2CSource_TypeDef {
+	frame *buf;
+	int fd;       // Copied in the kernel if >= 0, buf unused
+	off_t offset; // Of the range in fd
+} H2CSource;
+
+/* How file ranges reach h2c, found on the first copy the kernel refuses */
+typedef enum h2c_copy {
+	H2C_COPY_FILE_RANGE, /* copy_file_range() */
+	H2C_COPY_SPLICE,     /* splice() through a pipe */
+	H2C_COPY_BUFFERED,   /* pread() into a bounce buffer, then dma_write() */
+} h2c_copy_e;
+
+static const char *h2c_copy_names[] = {"copy_file_range", "splice", "buffered"};
+
+static h2c_copy_e h2c_copy_mode = H2C_COPY_FILE_RANGE;
+static int h2c_pipe[2] = {-1, -1};
+static frame *h2c_bounce; // DOWNSTREAM_BRAM_SIZE bytes, 4K-aligned
+
+/* Errors of a copy the kernel cannot do between these files, not of I/O */
+static int h2c_copy_unsupported(int err)
+{
+	return err == EINVAL || err == EXDEV || err == ENOSYS || err == EOPNOTSUPP;
+}
+
+static void h2c_copy_fall_back(char *fname, int err)
+{
+	if (verbose)
+		fprintf(stdout, "%s, %s to h2c not supported (%s), %s copy.\n", fname, h2c_copy_names[h2c_copy_mode],
+				strerror(err), h2c_copy_names[h2c_copy_mode + 1]);
+
+	h2c_copy_mode++;
+}
+
+/* Drop the pipe with whatever a failed splice left in it, the next copy makes a new one */
+static void h2c_pipe_close(void)
+{
+	if (h2c_pipe[0] < 0)
+		return;
+
+	close(h2c_pipe[0]);
+	close(h2c_pipe[1]);
+	h2c_pipe[0] = h2c_pipe[1] = -1;
+}
+
 /*
 	@brief
-		Write data into fd with buffer and size
-	@param fname: Input filename
-	@param fd: File description of input file
-	@param user_addr: Address of user register to control IRQ
-	@param irq_fd: File description of interrupt event
-	@param buffer: Frame buffer
-	@param base: Base offset of H2C device, DOWNSTREAM_BRAM_CH1_ADDR
-	@param size: The size of what to write in bytes
+		Move up to bytes of the file into h2c through a pipe. If h2c takes no
+		splice, what is in the pipe already goes by dma_write() and the mode
+		falls back to buffered. On any other error the pipe is closed, so no
+		bytes of this range are left to go to the offset of the next one.
+
+	@return Bytes moved, or -errno
 */
-ssize_t write_h2c_with_limit(char *fname, int fd, void *user_addr, int irq_fd,
-							 FrameBuffer *buffer, uint64_t base, uint64_t max_limit)
+static ssize_t h2c_splice(char *fname, int fd, const H2CSource *src, uint64_t bytes, off_t offset)
 {
-	ssize_t rc;
-	uint64_t size = buffer->size;
-	uint64_t count = 0;
-	frame *buf = buffer->frames;
-	uint64_t stop_frame = STOP_FRAME;
-	off_t offset = base;
-	int loop = 0;
+	loff_t in = src->offset, out = offset;
+	ssize_t len, done = 0;
 
-	while (count < size)
+	if (h2c_pipe[0] < 0)
 	{
-		uint64_t bytes = size - count;
+		if (pipe(h2c_pipe) < 0)
+			return -errno;
+		fcntl(h2c_pipe[1], F_SETPIPE_SZ, DOWNSTREAM_BRAM_SIZE);
+	}
 
-		if (bytes > max_limit)
-			bytes = max_limit;
+	len = splice(src->fd, &in, h2c_pipe[1], NULL, bytes, SPLICE_F_MOVE);
+	if (len < 0)
+		return -errno;
 
-		if (offset)
+	while (done < len)
+	{
+		ssize_t rc = splice(h2c_pipe[0], NULL, fd, &out, len - done, SPLICE_F_MOVE);
+
+		if (rc > 0)
 		{
-			rc = lseek(fd, offset, SEEK_SET);
-			if (rc != offset)
+			done += rc;
+			continue;
+		}
+		if (rc < 0 && errno == EINTR)
+			continue;
+		if (rc == 0 || done || !h2c_copy_unsupported(errno))
+		{
+			int err = rc < 0 ? -errno : -EIO;
+
+			h2c_pipe_close();
+			return err;
+		}
+
+		/* Drain the pipe, it is empty for the next copy */
+		h2c_copy_fall_back(fname, errno);
+		while (done < len)
+		{
+			rc = read(h2c_pipe[0], (char *)h2c_bounce + done, len - done);
+			if (rc < 0 && errno == EINTR)
+				continue;
+			if (rc <= 0)
 			{
-				fprintf(stderr, "%s, seek off 0x%lx != 0x%lx.\n",
-						fname, rc, offset);
-				perror("seek file");
+				h2c_pipe_close();
 				return -EIO;
 			}
+			done += rc;
 		}
 
-		/* write data to h2c from memory buffer */
-		rc = write(fd, buf, bytes);
+		return dma_write(fd, h2c_bounce, len, offset, &dma_profile);
+	}
+
+	return done;
+}
+
+/*
+	@brief
+		Copy bytes of a file range into h2c at offset without a trip through
+		user space: copy_file_range(), else splice(), else a buffered copy,
+		whichever the first copy finds the kernel and driver support.
+
+	@return Bytes written, or -errno
+*/
+static ssize_t h2c_copy(char *fname, int fd, const H2CSource *src, uint64_t bytes, off_t offset)
+{
+	H2CSource at = *src;
+	uint64_t done = 0;
+
+	/* Any mode may end up buffered within a loop */
+	if (!h2c_bounce && posix_memalign((void **)&h2c_bounce, 4096 /* alignment */, DOWNSTREAM_BRAM_SIZE))
+	{
+		h2c_bounce = NULL;
+		return -ENOMEM;
+	}
+
+	while (done < bytes)
+	{
+		loff_t in = src->offset + done, out = offset + done;
+		ssize_t rc;
+
+		at.offset = in;
+
+		if (h2c_copy_mode == H2C_COPY_FILE_RANGE)
+		{
+			rc = copy_file_range(src->fd, &in, fd, &out, bytes - done, 0);
+			if (rc < 0)
+				rc = -errno;
+		}
+		else if (h2c_copy_mode == H2C_COPY_SPLICE)
+		{
+			rc = h2c_splice(fname, fd, &at, bytes - done, out);
+		}
+		else
+		{
+			rc = pread(src->fd, h2c_bounce, bytes - done, at.offset);
+			if (rc > 0)
+				rc = dma_write(fd, h2c_bounce, rc, out, &dma_profile);
+			else if (rc < 0)
+				rc = -errno;
+		}
+
+		if (rc == -EINTR)
+			continue;
+		if (rc < 0 && h2c_copy_mode != H2C_COPY_BUFFERED && h2c_copy_unsupported(-rc))
+		{
+			h2c_copy_fall_back(fname, -rc);
+			continue;
+		}
 		if (rc < 0)
+			return done ? (ssize_t)done : rc;
+		if (!rc)
+			break;
+
+		done += rc;
+	}
+
+	return done;
+}
+
+/*
+	@brief
+		Write one BRAM loop into h2c, then tell FPGA to start sending and wait for TX done
+	@param fname: Input filename
+	@param fd: File description of h2c device
+	@param user_addr: Address of user register
+	@param src: Frames of this loop
+	@param bytes: The size of what to write in bytes, no more than DOWNSTREAM_BRAM_SIZE
+	@param offset: Offset of H2C device to write at
+	@param last: Whether it's the last loop, a stop frame follows
+
+	@return Bytes written. If less than bytes, no TX request was made.
+*/
+static ssize_t write_h2c_loop(char *fname, int fd, void *user_addr, const H2CSource *src, uint64_t bytes,
+							  off_t offset, int last)
+{
+	ssize_t rc, written;
+	uint64_t stop_frame = STOP_FRAME;
+
+	/* A tiny loop and its stop frame go by PIO stores, below the threshold of the DMA profile */
+	if (src->fd < 0 && pio_select(&dma_profile, &pio_window, bytes + (last ? sizeof(frame) : 0), offset))
+	{
+		DMA_TRACE_SPAN_BEGIN("h2c pio");
+		written = pio_write(&pio_window, src->buf, bytes, offset);
+		if (last)
+			pio_write(&pio_window, &stop_frame, sizeof(frame), offset + bytes);
+		DMA_TRACE_SPAN_END("h2c pio", written > 0 ? written : 0);
+
+		if (verbose && last)
+			fprintf(stdout, "Sending stop frame successful.\n");
+	}
+	else
+	{
+		/* write data to h2c from memory buffer, in chunks of the DMA profile, or from the file in the kernel */
+		DMA_TRACE_SPAN_BEGIN("h2c write");
+		if (src->fd >= 0)
+			written = h2c_copy(fname, fd, src, bytes, offset);
+		else
+			written = dma_write(fd, src->buf, bytes, offset, &dma_profile);
+		DMA_TRACE_SPAN_END("h2c write", written > 0 ? written : 0);
+		if (written < 0)
 		{
 			fprintf(stderr, "%s, write 0x%lx @ 0x%lx failed %ld.\n",
-					fname, bytes, offset, rc);
+					fname, bytes, offset, written);
 			perror("write file");
 			return -EIO;
 		}
 
-		count += rc;
-		if (rc != bytes)
+		if (written != bytes)
 		{
 			fprintf(stderr, "%s, write underflow 0x%lx/0x%lx @ 0x%lx.\n",
-					fname, rc, bytes, offset);
-			break;
+					fname, written, bytes, offset);
+			return written;
 		}
 
-		buf += bytes / 65;
-		offset += bytes;
-		loop++;
-
 		/* Send stop frame when ALL frames sending to card is completed. */
-		if (count == size)
+		if (last)
 		{
+			DMA_TRACE_MARK("stop frame");
+
 			/* Set the cursor at the end */
-			rc = lseek(fd, offset, SEEK_SET);
-			if (rc != offset)
+			rc = lseek(fd, offset + bytes, SEEK_SET);
+			if (rc != offset + bytes)
 			{
 				fprintf(stderr, "%s, seek off 0x%lx != 0x%lx.\n",
-						fname, rc, offset);
+						fname, rc, offset + bytes);
 				perror("seek file");
 				return -EIO;
 			}
@@ -368,35 +665,305 @@ ssize_t write_h2c_with_limit(char *fname, int fd, void *user_addr, int irq_fd,
 			if (verbose)
 				fprintf(stdout, "Sending stop frame successful.\n");
 		}
+	}
+
+	/* 1. When sending max_limit, tell FPGA to steart sending */
+	writeUser(user_addr, TX_STATUS_RW_ADDR, REQ_TX_SENDING);
+	DMA_TRACE_MARK("tx request");
+
+	/* 2. Read the interrupt and do service */
+	// fprintf(stdout, "Reading interrupt IRQ_TX_CH1_DONE.\n");
+	// rc = eventTriggered(irq_fd, IRQ_TX_CH1_DONE);
+	// if (rc < 0) {
+	// 	fprintf(stderr, "Interrupt %d triggered failed.\n", IRQ_TX_CH1_DONE);
+	// 	return -EIO;
+	// }
+
+	/* Wait for TX DONE as the DMA profile says */
+	DMA_TRACE_SPAN_BEGIN("tx wait");
+	rc = dma_wait_tx_done(user_addr, &dma_profile, IRQ_TIGGERED_TIMEOUT * 1000000L);
+	DMA_TRACE_SPAN_END("tx wait", 0);
+	if (rc < 0)
+	{
+		fprintf(stderr, "Got TX done failed.\n");
+		return -EIO;
+	}
+
+	if (verbose)
+	{
+		uint32_t tx_write_bytes = readUser(user_addr, TX_BYTES_NUM_ADDR);
+		printf("Last TX wrote bytes: %d\n", tx_write_bytes & 0xFFFFFFFF);
+	}
+
+	/* 3. Clear the interrupt */
+	// clearIRQ(user_addr, IRQ_TX_CH1_DONE);
+
+	return written;
+}
+
+/*
+	@brief
+		Find where a transfer resumes after loop idx of loops failed. The loops
+		left in TRANS_INFO are the checkpoint kept by the FPGA: unchanged if the
+		loop was not taken, one less if only its TX done went missing.
+
+		A TX merely late is still reading the loop from BRAM, which a resend
+		would overwrite, so while TX status reads sending it is waited for
+		once more before the checkpoint is trusted. This assumes the FPGA
+		moves TX status off TX_STATUS_SENDING once a loop is sent.
+
+		Loops are counted in the low byte of TRANS_INFO, so transfers over
+		255 loops wrap it. The comparisons wrap alike, but a checkpoint 256
+		loops behind would pass as current.
+
+	@return Index of the loop to send next, -EBUSY if the FPGA is still sending
+			loop idx, or -EIO if it lost track of the transfer
+*/
+static int tx_loop_resume(char *fname, void *user_addr, int idx, int loops)
+{
+	uint32_t expected = (loops - idx) & 0x000000FF; /* Left before loop idx */
+	uint32_t done = readUser(user_addr, TX_DONE_RW_ADDR);
+	uint32_t left;
+
+	if (!(done & 0x00000001) && readUser(user_addr, TX_STATUS_RW_ADDR) == TX_STATUS_SENDING)
+	{
+		if (pollUser(user_addr, TX_DONE_RW_ADDR, 0x00000001, IRQ_TIGGERED_TIMEOUT * 1000000L, NULL) < 0)
+		{
+			fprintf(stderr, "%s, loop #%d/%d still sending, not resendable.\n", fname, idx + 1, loops);
+			return -EBUSY;
+		}
+		done = 0x00000001;
+	}
+
+	/* A TX done later than the wait, cleared for the loops to come */
+	if (done & 0x00000001)
+		updateUser(user_addr, TX_DONE_RW_ADDR, 0x00000001, 0);
+
+	left = readUser(user_addr, TRANS_INFO_RW_ADDR) & 0x000000FF;
+	if (left == expected)
+		return idx;
+	if (left == ((expected - 1) & 0x000000FF))
+		return idx + 1;
+
+	fprintf(stderr, "%s, loop #%d/%d failed with %u loop(s) left, not resumable.\n", fname, idx + 1, loops, left);
+	return -EIO;
+}
 
-		/* 1. When sending max_limit, tell FPGA to steart sending */
-		writeUser(user_addr, TX_STATUS_RW_ADDR, REQ_TX_SENDING);
+/*
+	@brief
+		Send loop idx of loops set in TRANS_INFO, resending only this loop, as
+		many times as the DMA profile allows, when it fails
 
-		/* 2. Read the interrupt and do service */
-		// fprintf(stdout, "Reading interrupt IRQ_TX_CH1_DONE.\n");
-		// rc = eventTriggered(irq_fd, IRQ_TX_CH1_DONE);
-		// if (rc < 0) {
-		// 	fprintf(stderr, "Interrupt %d triggered failed.\n", IRQ_TX_CH1_DONE);
-		// 	return -EIO;
-		// }
+	@return As write_h2c_loop()
+*/
+static ssize_t write_h2c_loop_retry(char *fname, int fd, void *user_addr, const H2CSource *src, uint64_t bytes,
+									off_t offset, int last, int idx, int loops)
+{
+	uint32_t backoff = dma_profile.retry_us;
+	ssize_t rc = write_h2c_loop(fname, fd, user_addr, src, bytes, offset, last);
+
+	for (uint32_t retry = 1; rc != bytes && retry <= dma_profile.retries; retry++)
+	{
+		int next = tx_loop_resume(fname, user_addr, idx, loops);
 
-		/* Poll check TX DONE */
-		rc = checkTXCompleted(user_addr, IRQ_TIGGERED_TIMEOUT);
+		if (next < 0)
+			break;
+		if (next > idx)
+			return bytes;
+
+		fprintf(stderr, "%s, resending loop #%d/%d, retry %u/%u.\n", fname, idx + 1, loops, retry,
+				dma_profile.retries);
+		usleep(backoff);
+		backoff *= 2;
+
+		rc = write_h2c_loop(fname, fd, user_addr, src, bytes, offset, last);
+	}
+
+	return rc;
+}
+
+/*
+	@brief
+		Write data into fd with buffer and size
+	@param fname: Input filename
+	@param fd: File description of input file
+	@param user_addr: Address of user register to control IRQ
+	@param irq_fd: File description of interrupt event
+	@param buffer: Frame buffer
+	@param base: Base offset of H2C device, DOWNSTREAM_BRAM_CH1_ADDR
+	@param size: The size of what to write in bytes
+*/
+ssize_t write_h2c_with_limit(char *fname, int fd, void *user_addr, int irq_fd,
+							 FrameBuffer *buffer, uint64_t base, uint64_t max_limit)
+{
+	ssize_t rc;
+	uint64_t size = buffer->size;
+	uint64_t count = 0;
+	frame *buf = buffer->frames;
+	off_t offset = base;
+	int loop = 0;
+	int loops = (size + max_limit - 1) / max_limit;
+
+	while (count < size)
+	{
+		uint64_t bytes = size - count;
+
+		H2CSource src = {buf, -1, 0};
+
+		if (bytes > max_limit)
+			bytes = max_limit;
+
+		DMA_TRACE_SPAN_BEGIN("h2c loop");
+		rc = write_h2c_loop_retry(fname, fd, user_addr, &src, bytes, offset, count + bytes == size, loop, loops);
+		DMA_TRACE_SPAN_END("h2c loop", rc > 0 ? rc : 0);
 		if (rc < 0)
+			return rc;
+
+		count += rc;
+		if (rc != bytes)
+			break;
+
+		buf += bytes / sizeof(frame);
+		offset += bytes;
+		loop++;
+
+		if (verbose)
 		{
-			fprintf(stderr, "Got TX done failed.\n");
-			return -EIO;
+			fprintf(stdout, "Loop #%d: Send %ld frames(%ld bytes) successful.\n", loop, count / 8, count);
 		}
 
-		uint32_t tx_write_bytes = readUser(user_addr, TX_BYTES_NUM_ADDR);
-		printf("Last TX wrote bytes: %d\n", tx_write_bytes & 0xFFFFFFFF);
+		if (offset - base >= DOWNSTREAM_BRAM_SIZE)
+		{
+			offset = base;
+		}
+	}
+
+	if (count != size && loop)
+		fprintf(stderr, "%s, write underflow 0x%lx/0x%lx.\n", fname, count, size);
+	else
+		fprintf(stdout, "TX transaction completed!\n");
+
+	return count;
+}
+
+/*
+	@brief
+		Decode packed frames loop by loop into a staging buffer and write them into fd
+	@param fname: Input filename
+	@param fd: File description of h2c device
+	@param user_addr: Address of user register
+	@param irq_fd: File description of interrupt event
+	@param reader: Reader of packed frames file
+	@param staging: 4K-aligned staging buffer of at least max_limit bytes
+	@param base: Base offset of H2C device, DOWNSTREAM_BRAM_CH1_ADDR
+	@param max_limit: The size of a loop in bytes
+*/
+ssize_t write_h2c_from_pack(char *fname, int fd, void *user_addr, int irq_fd, FramePackReader *reader,
+							FrameBuffer *staging, uint64_t base, uint64_t max_limit)
+{
+	ssize_t rc;
+	uint64_t size = reader->frames * sizeof(frame);
+	uint64_t count = 0;
+	off_t offset = base;
+	int loop = 0;
+	int loops = (size + max_limit - 1) / max_limit;
+
+	while (count < size)
+	{
+		uint64_t bytes = size - count;
+		H2CSource src = {staging->frames, -1, 0};
+
+		if (bytes > max_limit)
+			bytes = max_limit;
+
+		/* Decode the next loop once the previous one has been sent, decoding and sending do not overlap */
+		DMA_TRACE_SPAN_BEGIN("pack decode");
+		rc = frame_pack_read(reader, staging->frames, bytes);
+		DMA_TRACE_SPAN_END("pack decode", rc > 0 ? rc : 0);
+		if (rc != bytes)
+		{
+			fprintf(stderr, "%s, decode 0x%lx frames failed %ld.\n", fname, bytes / 8, rc);
+			return rc < 0 ? rc : -EIO;
+		}
+
+		DMA_TRACE_SPAN_BEGIN("h2c loop");
+		rc = write_h2c_loop_retry(fname, fd, user_addr, &src, bytes, offset, count + bytes == size, loop, loops);
+		DMA_TRACE_SPAN_END("h2c loop", rc > 0 ? rc : 0);
+		if (rc < 0)
+			return rc;
+
+		count += rc;
+		if (rc != bytes)
+			break;
+
+		offset += bytes;
+		loop++;
+
+		if (verbose)
+		{
+			fprintf(stdout, "Loop #%d: Send %ld frames(%ld bytes) successful.\n", loop, count / 8, count);
+		}
+
+		if (offset - base >= DOWNSTREAM_BRAM_SIZE)
+		{
+			offset = base;
+		}
+	}
+
+	if (count != size && loop)
+		fprintf(stderr, "%s, write underflow 0x%lx/0x%lx.\n", fname, count, size);
+	else
+		fprintf(stdout, "TX transaction completed!\n");
+
+	return count;
+}
+
+/*
+	@brief
+		Copy a native frames file into fd loop by loop, the kernel moving each
+		BRAM-sized range from the file to its offset of h2c
+	@param fname: Input filename
+	@param fd: File description of h2c device
+	@param user_addr: Address of user register
+	@param irq_fd: File description of interrupt event
+	@param in_fd: File description of input file, frames in device order
+	@param size: The size of what to write in bytes
+	@param base: Base offset of H2C device, DOWNSTREAM_BRAM_CH1_ADDR
+	@param max_limit: The size of a loop in bytes
+*/
+ssize_t write_h2c_from_file(char *fname, int fd, void *user_addr, int irq_fd, int in_fd, uint64_t size,
+							uint64_t base, uint64_t max_limit)
+{
+	ssize_t rc;
+	uint64_t count = 0;
+	off_t offset = base;
+	int loop = 0;
+	int loops = (size + max_limit - 1) / max_limit;
 
-		/* 3. Clear the interrupt */
-		// clearIRQ(user_addr, IRQ_TX_CH1_DONE);
+	while (count < size)
+	{
+		uint64_t bytes = size - count;
+		H2CSource src = {NULL, in_fd, count};
+
+		if (bytes > max_limit)
+			bytes = max_limit;
+
+		DMA_TRACE_SPAN_BEGIN("h2c loop");
+		rc = write_h2c_loop_retry(fname, fd, user_addr, &src, bytes, offset, count + bytes == size, loop, loops);
+		DMA_TRACE_SPAN_END("h2c loop", rc > 0 ? rc : 0);
+		if (rc < 0)
+			return rc;
+
+		count += rc;
+		if (rc != bytes)
+			break;
+
+		offset += bytes;
+		loop++;
 
 		if (verbose)
 		{
-			fprintf(stdout, "Loop #%d: Send %ld frames(%ld bytes) successful.\n", loop, count / 65, count);
+			fprintf(stdout, "Loop #%d: Send %ld frames(%ld bytes) successful.\n", loop, count / 8, count);
 		}
 
 		if (offset - base >= DOWNSTREAM_BRAM_SIZE)
@@ -413,6 +980,42 @@ ssize_t write_h2c_with_limit(char *fname, int fd, void *user_addr, int irq_fd,
 	return count;
 }
 
+/*
+	@brief
+		Set the # of loops of a TX transaction
+*/
+static void set_tx_loops(void *user_addr, uint64_t size)
+{
+	uint32_t tx_frames_num;
+
+	/* ceil() */
+	tx_frames_num = (size + DOWNSTREAM_BRAM_SIZE - 1) / DOWNSTREAM_BRAM_SIZE;
+
+	if (verbose)
+	{
+		fprintf(stdout, "%d loop(s) will be sent.\n", tx_frames_num);
+	}
+
+	/* Set the # of frames that will be sent. The rest bits come from the shadow. */
+	updateUser(user_addr, TRANS_INFO_RW_ADDR, 0x000000FF, tx_frames_num);
+}
+
+/*
+	@brief
+		Check a TX transaction. It fails when:
+		1. # of sent frames is NOT correct.
+		2. The rest loops is NOT left, 0 at the end of a transaction.
+*/
+static void check_tx_loops(void *user_addr, ssize_t rc, uint64_t size, uint32_t left)
+{
+	uint32_t _read = readUser(user_addr, TRANS_INFO_RW_ADDR);
+
+	if ((rc != size) || ((_read & 0x000000FF) != left))
+	{
+		fprintf(stderr, "write failed. Actual wrote: %ld.\nLoop(s) left: %d\n", rc, _read & 0x000000FF);
+	}
+}
+
 /*
 	@brief
 		Send data in frame buffer via single channel
@@ -427,33 +1030,105 @@ ssize_t write_h2c_with_limit(char *fname, int fd, void *user_addr, int irq_fd,
 ssize_t single_channel_send(char *fname, int fpga_fd, void *user_addr, int irq_fd, uint64_t addr, FrameBuffer *buffer)
 {
 	ssize_t rc;
-	uint32_t _read, tx_frames_num;
 
-	/* ceil() */
-	tx_frames_num = (buffer->size + DOWNSTREAM_BRAM_SIZE / 2) / DOWNSTREAM_BRAM_SIZE;
+	set_tx_loops(user_addr, buffer->size);
 
-	if (verbose)
-	{
-		fprintf(stdout, "%d loop(s) will be sent.\n", tx_frames_num);
-	}
+	rc = write_h2c_with_limit(fname, fpga_fd, user_addr, irq_fd, buffer, addr, DOWNSTREAM_BRAM_SIZE);
 
-	_read = readUser(user_addr, TRANS_INFO_RW_ADDR);
+	check_tx_loops(user_addr, rc, buffer->size, 0);
 
-	/* Set the # of frames that will be sent. */
-	writeUser(user_addr, TRANS_INFO_RW_ADDR, (_read & 0xFFFFFF00) | tx_frames_num);
+	return rc;
+}
 
-	rc = write_h2c_with_limit(fname, fpga_fd, user_addr, irq_fd, buffer, addr, DOWNSTREAM_BRAM_SIZE);
-	_read = readUser(user_addr, TRANS_INFO_RW_ADDR);
+/*
+	@brief
+		Send loop idx of a transfer of loops on its own, for callers interleaving
+		the loops of several transfers. Only the last loop is followed by a stop
+		frame.
 
-	/*
-		A TX transaction fails when:
-		1. # of sent frames is NOT correct.
-		2. The rest loops is NOT 0.
-	*/
-	if ((rc != buffer->size) || ((_read & 0x000000FF) != 0))
-	{
-		fprintf(stderr, "write failed. Actual wrote: %ld.\nLoop(s) left: %d\n", rc, _read & 0x000000FF);
-	}
+		TRANS_INFO is set to the loops left before this one, as the FPGA counts
+		them down in a transfer sent in one go, so every loop of a transfer
+		reads as the same transaction whatever was sent in between. This needs
+		the FPGA to take loops left from TRANS_INFO as written before each loop,
+		as tx_loop_resume() assumes, not only before the first one.
+
+	@param fname: Input file name
+	@param fpga_fd: File description of XDMA0_H2C channel
+	@param user_addr: Address of user registers
+	@param addr: Address of where to write, H2C device
+	@param buf: Frames of this loop
+	@param bytes: The size of what to write in bytes, no more than DOWNSTREAM_BRAM_SIZE
+	@param idx: Index of this loop in its transfer
+	@param loops: # of loops of its transfer
+*/
+ssize_t single_channel_send_loop(char *fname, int fpga_fd, void *user_addr, uint64_t addr,
+								 const frame *buf, uint64_t bytes, int idx, int loops)
+{
+	H2CSource src = {(frame *)buf, -1, 0};
+	ssize_t rc;
+
+	if (bytes > DOWNSTREAM_BRAM_SIZE || idx < 0 || idx >= loops)
+		return -EINVAL;
+
+	updateUser(user_addr, TRANS_INFO_RW_ADDR, 0x000000FF, loops - idx);
+
+	rc = write_h2c_loop_retry(fname, fpga_fd, user_addr, &src, bytes, addr, idx + 1 == loops, idx, loops);
+
+	check_tx_loops(user_addr, rc, bytes, (loops - idx - 1) & 0x000000FF);
+
+	return rc;
+}
+
+/*
+	@brief
+		Send a packed frames file via single channel, decoding loop by loop
+
+	@param fname: Input file name
+	@param fpga_fd: File description of XDMA0_H2C channel
+	@param user_addr: Address of user registers
+	@param irq_fd: File description of IRQ channel 1
+	@param addr: Address of where to write, H2C device
+	@param reader: Reader of packed frames file
+	@param staging: 4K-aligned staging buffer of DOWNSTREAM_BRAM_SIZE bytes
+*/
+ssize_t single_channel_send_pack(char *fname, int fpga_fd, void *user_addr, int irq_fd, uint64_t addr,
+								 FramePackReader *reader, FrameBuffer *staging)
+{
+	ssize_t rc;
+	uint64_t size = reader->frames * sizeof(frame);
+
+	set_tx_loops(user_addr, size);
+
+	rc = write_h2c_from_pack(fname, fpga_fd, user_addr, irq_fd, reader, staging, addr, DOWNSTREAM_BRAM_SIZE);
+
+	check_tx_loops(user_addr, rc, size, 0);
+
+	return rc;
+}
+
+/*
+	@brief
+		Send a native frames file via single channel, copied to h2c in the kernel
+		where it can be
+
+	@param fname: Input file name
+	@param fpga_fd: File description of XDMA0_H2C channel
+	@param user_addr: Address of user registers
+	@param irq_fd: File description of IRQ channel 1
+	@param addr: Address of where to write, H2C device
+	@param in_fd: File description of input file, frames in device order
+	@param size: The size of the file in bytes
+*/
+ssize_t single_channel_send_file(char *fname, int fpga_fd, void *user_addr, int irq_fd, uint64_t addr, int in_fd,
+								 uint64_t size)
+{
+	ssize_t rc;
+
+	set_tx_loops(user_addr, size);
+
+	rc = write_h2c_from_file(fname, fpga_fd, user_addr, irq_fd, in_fd, size, addr, DOWNSTREAM_BRAM_SIZE);
+
+	check_tx_loops(user_addr, rc, size, 0);
 
 	return rc;
 }
@@ -489,10 +1164,11 @@ ssize_t double_channel_send(char *fname, int fpga_fd, void *user_addr, int irq_f
 ssize_t single_channel_receive(char *fname, int fpga_fd, void *user_addr, int irq_fd, uint64_t addr, FrameBuffer *buffer)
 {
 	ssize_t rc;
-	uint32_t _read;
 
 	/* Poll check RX DONE */
-	rc = checkRXCompleted(user_addr, IRQ_TIGGERED_TIMEOUT);
+	DMA_TRACE_SPAN_BEGIN("rx wait");
+	rc = pollUser(user_addr, TX_DONE_RW_ADDR, 0x00000002, IRQ_TIGGERED_TIMEOUT * 1000000L, NULL);
+	DMA_TRACE_SPAN_END("rx wait", 0);
 	if (rc < 0)
 	{
 		fprintf(stderr, "Got RX done failed.\n");
@@ -500,10 +1176,15 @@ ssize_t single_channel_receive(char *fname, int fpga_fd, void *user_addr, int ir
 	}
 
 	/* Read fpga_fd+addr to buffer via fpga_fd */
+	DMA_TRACE_SPAN_BEGIN("c2h read");
 	rc = receive_to_buffer(fname, fpga_fd, buffer, addr);
+	DMA_TRACE_SPAN_END("c2h read", rc > 0 ? rc : 0);
 
-	_read = readUser(user_addr, TX_DONE_RW_ADDR);
-	writeUser(user_addr, TX_DONE_RW_ADDR, _read & 0xFFFFFFFD);
+	/*
+		Clear only RX done, from a fresh read: the value polled before the
+		read may miss bits the FPGA set since, e.g. TX done.
+	*/
+	updateUser(user_addr, TX_DONE_RW_ADDR, 0x00000002, 0);
 
 	if (rc != UPSTREAM_BRAM_SIZE)
 	{
@@ -0,0 +1,267 @@
+#include "frame_builder.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+
+/*
+	@brief
+		Add a bit field to layout
+
+	@param layout: Layout of frame
+	@param name: Name of field
+	@param offset: LSB of field
+	@param width: Width of field in bits
+
+	@return Index of field
+*/
+int frame_layout_add(FrameLayout *layout, const char *name, int offset, int width)
+{
+	FrameField *field;
+	uint64_t mask;
+
+	if (layout->num >= FRAME_FIELDS_MAX || width < 1 || offset < 0 || offset + width > 64)
+		return -EINVAL;
+
+	mask = (width >= 64 ? ~0ULL : ((1ULL << width) - 1)) << offset;
+	for (int i = 0; i < layout->num; i++)
+	{
+		if (mask & (frame_field_mask(&layout->fields[i]) << layout->fields[i].offset))
+		{
+			fprintf(stderr, "field %s overlaps %s.\n", name, layout->fields[i].name);
+			return -EINVAL;
+		}
+	}
+
+	field = &layout->fields[layout->num];
+	field->name = name;
+	field->offset = offset;
+	field->width = width;
+
+	return layout->num++;
+}
+
+int frame_layout_find(const FrameLayout *layout, const char *name)
+{
+	for (int i = 0; i < layout->num; i++)
+	{
+		if (!strcmp(layout->fields[i].name, name))
+			return i;
+	}
+
+	return -ENOENT;
+}
+
+/*
+	@brief
+		Allocate num 4K-aligned buffers of capacity bytes at once
+
+	@param pool: Pool to be initialized
+	@param num: # of buffers
+	@param capacity: Capacity of each buffer in bytes
+*/
+int frame_pool_init(FramePool *pool, int num, size_t capacity)
+{
+	memset(pool, 0, sizeof(*pool));
+
+	/* Keep every buffer 4K-aligned */
+	capacity = (capacity + 4095) & ~(size_t)4095;
+
+	pool->buffers = (FrameBuffer *)calloc(num, sizeof(FrameBuffer));
+	pool->free_list = (int *)calloc(num, sizeof(int));
+	posix_memalign((void **)&pool->allocated, 4096 /* alignment */, num * capacity);
+	if (!pool->buffers || !pool->free_list || !pool->allocated)
+	{
+		fprintf(stderr, "OOM %lu.\n", num * capacity);
+		frame_pool_destroy(pool);
+		return -ENOMEM;
+	}
+
+	for (int i = 0; i < num; i++)
+	{
+		pool->buffers[i].frames = pool->allocated + i * (capacity / sizeof(frame));
+		pool->buffers[i].size = 0;
+		pool->free_list[i] = num - 1 - i;
+	}
+
+	pool->num = num;
+	pool->free_num = num;
+	pool->capacity = capacity;
+
+	return 0;
+}
+
+FrameBuffer *frame_pool_get(FramePool *pool)
+{
+	FrameBuffer *buffer;
+
+	if (!pool->free_num)
+		return NULL;
+
+	buffer = &pool->buffers[pool->free_list[--pool->free_num]];
+	buffer->size = 0;
+
+	return buffer;
+}
+
+void frame_pool_put(FramePool *pool, FrameBuffer *buffer)
+{
+	int index = buffer - pool->buffers;
+
+	if (index < 0 || index >= pool->num || pool->free_num >= pool->num)
+		return;
+
+	pool->free_list[pool->free_num++] = index;
+}
+
+void frame_pool_destroy(FramePool *pool)
+{
+	free(pool->buffers);
+	free(pool->free_list);
+	free(pool->allocated);
+	memset(pool, 0, sizeof(*pool));
+}
+
+/*
+	@brief
+		Build frames straight into buffer, in host order as the send path expects
+
+	@param builder: Builder to be initialized
+	@param layout: Layout of frame
+	@param buffer: Where to build frames, appended from buffer->size
+	@param capacity: Capacity of buffer in frames
+
+	@return 0, or -EINVAL if buffer already holds more than capacity
+*/
+int frame_builder_init(FrameBuilder *builder, const FrameLayout *layout, FrameBuffer *buffer, size_t capacity)
+{
+	if (buffer->size / sizeof(frame) > capacity)
+		return -EINVAL;
+
+	builder->layout = layout;
+	builder->buffer = buffer;
+	builder->capacity = capacity;
+	builder->base = 0;
+
+	return 0;
+}
+
+/*
+	@brief
+		Append one frame
+
+	@param builder: Frame builder
+	@param values: Value of every field, in the order of layout
+
+	@return # of frames in buffer, -ENOSPC if full, -ERANGE if a value exceeds its field
+*/
+ssize_t frame_builder_add(FrameBuilder *builder, const uint64_t *values)
+{
+	return frame_builder_add_rows(builder, values, 1);
+}
+
+/*
+	@brief
+		Append rows of frames
+
+	@param builder: Frame builder
+	@param values: rows * layout->num values, row by row
+	@param rows: # of frames
+*/
+ssize_t frame_builder_add_rows(FrameBuilder *builder, const uint64_t *values, size_t rows)
+{
+	const FrameLayout *layout = builder->layout;
+	size_t n = builder->buffer->size / sizeof(frame);
+	frame *out = builder->buffer->frames + n;
+
+	if (n + rows > builder->capacity)
+		return -ENOSPC;
+
+	for (size_t r = 0; r < rows; r++)
+	{
+		frame f = builder->base;
+
+		for (int i = 0; i < layout->num; i++, values++)
+		{
+			const FrameField *field = &layout->fields[i];
+
+			if (*values & ~frame_field_mask(field))
+			{
+				fprintf(stderr, "value 0x%lx of field %s exceeds %d bits.\n", *values, field->name, field->width);
+				builder->buffer->size += r * sizeof(frame);
+				return -ERANGE;
+			}
+
+			f = frame_field_set(f, field, *values);
+		}
+
+		if (f == STOP_FRAME)
+		{
+			builder->buffer->size += r * sizeof(frame);
+			return -ERANGE;
+		}
+
+		out[r] = f;
+	}
+
+	builder->buffer->size += rows * sizeof(frame);
+
+	return builder->buffer->size / sizeof(frame);
+}
+
+/*
+	@brief
+		Append a batch of spike events of one timestep, one frame per event.
+		Other fields take their values from builder->base.
+
+	@param builder: Frame builder
+	@param addr_field: Index of address field in layout
+	@param addrs: Addresses of spike events
+	@param n: # of spike events
+	@param ts_field: Index of timestep field in layout, or -1
+	@param timestep: Timestep of events
+*/
+ssize_t frame_builder_add_spikes(FrameBuilder *builder, int addr_field, const uint64_t *addrs, size_t n,
+								 int ts_field, uint64_t timestep)
+{
+	const FrameLayout *layout = builder->layout;
+	size_t count = builder->buffer->size / sizeof(frame);
+	frame *out = builder->buffer->frames + count;
+	const FrameField *addr;
+	frame base = builder->base;
+	uint64_t addr_mask;
+
+	if (addr_field < 0 || addr_field >= layout->num || ts_field >= layout->num)
+		return -EINVAL;
+
+	if (count + n > builder->capacity)
+		return -ENOSPC;
+
+	if (ts_field >= 0)
+	{
+		if (timestep & ~frame_field_mask(&layout->fields[ts_field]))
+			return -ERANGE;
+		base = frame_field_set(base, &layout->fields[ts_field], timestep);
+	}
+
+	addr = &layout->fields[addr_field];
+	addr_mask = frame_field_mask(addr);
+	base = frame_field_set(base, addr, 0);
+
+	for (size_t i = 0; i < n; i++)
+	{
+		frame f = base | (addrs[i] << addr->offset);
+
+		if ((addrs[i] & ~addr_mask) || f == STOP_FRAME)
+		{
+			builder->buffer->size += i * sizeof(frame);
+			return -ERANGE;
+		}
+
+		out[i] = f;
+	}
+
+	builder->buffer->size += n * sizeof(frame);
+
+	return builder->buffer->size / sizeof(frame);
+}
@@ -0,0 +1,160 @@
+#include "frame_codec.h"
+#include <errno.h>
+#include <string.h>
+#include <byteswap.h>
+
+#if defined(__AVX2__) || defined(__SSE2__)
+#include <immintrin.h>
+#endif
+
+/*
+	@brief
+		Reverse the bit order of a 64-bit word.
+		Masks are collected in character order (char 0 -> bit 0), while
+		the first character of a line is the MSB of the frame.
+*/
+static inline uint64_t bit_reverse64(uint64_t v)
+{
+	v = ((v >> 1) & 0x5555555555555555ULL) | ((v & 0x5555555555555555ULL) << 1);
+	v = ((v >> 2) & 0x3333333333333333ULL) | ((v & 0x3333333333333333ULL) << 2);
+	v = ((v >> 4) & 0x0F0F0F0F0F0F0F0FULL) | ((v & 0x0F0F0F0F0F0F0F0FULL) << 4);
+
+	return bswap_64(v);
+}
+
+/*
+	@brief
+		Convert one 65-byte line into a frame.
+		('0' | 1) == ('1' | 1) == '1', so one compare validates the characters
+		and another one extracts the bits.
+
+	@param line: At least FRAME_TXT_LINE_LEN readable bytes
+	@param out: Where to store the frame
+*/
+#if defined(__AVX2__)
+static inline int txt_line2frame(const char *line, frame *out)
+{
+	const __m256i one = _mm256_set1_epi8('1');
+	const __m256i lsb = _mm256_set1_epi8(1);
+	__m256i lo = _mm256_loadu_si256((const __m256i *)line);
+	__m256i hi = _mm256_loadu_si256((const __m256i *)(line + 32));
+	uint64_t ones, valid;
+
+	ones = (uint32_t)_mm256_movemask_epi8(_mm256_cmpeq_epi8(lo, one)) |
+		   ((uint64_t)(uint32_t)_mm256_movemask_epi8(_mm256_cmpeq_epi8(hi, one)) << 32);
+	valid = (uint32_t)_mm256_movemask_epi8(_mm256_cmpeq_epi8(_mm256_or_si256(lo, lsb), one)) |
+			((uint64_t)(uint32_t)_mm256_movemask_epi8(_mm256_cmpeq_epi8(_mm256_or_si256(hi, lsb), one)) << 32);
+
+	if (valid != ~0ULL || line[FRAME_TXT_CHARS] != '\n')
+		return -1;
+
+	*out = bit_reverse64(ones);
+	return 0;
+}
+#elif defined(__SSE2__)
+static inline int txt_line2frame(const char *line, frame *out)
+{
+	const __m128i one = _mm_set1_epi8('1');
+	const __m128i lsb = _mm_set1_epi8(1);
+	uint64_t ones = 0, valid = 0;
+
+	for (int i = 0; i < 4; i++)
+	{
+		__m128i x = _mm_loadu_si128((const __m128i *)(line + 16 * i));
+
+		ones |= (uint64_t)(uint16_t)_mm_movemask_epi8(_mm_cmpeq_epi8(x, one)) << (16 * i);
+		valid |= (uint64_t)(uint16_t)_mm_movemask_epi8(_mm_cmpeq_epi8(_mm_or_si128(x, lsb), one)) << (16 * i);
+	}
+
+	if (valid != ~0ULL || line[FRAME_TXT_CHARS] != '\n')
+		return -1;
+
+	*out = bit_reverse64(ones);
+	return 0;
+}
+#else
+static inline int txt_line2frame(const char *line, frame *out)
+{
+	frame value = 0;
+	int invalid = 0;
+
+	for (int i = 0; i < FRAME_TXT_CHARS; i++)
+	{
+		invalid |= (line[i] | 1) != '1';
+		value = (value << 1) | (frame)(line[i] & 1);
+	}
+
+	if (invalid || line[FRAME_TXT_CHARS] != '\n')
+		return -1;
+
+	*out = value;
+	return 0;
+}
+#endif
+
+/*
+	@brief
+		Convert complete 65-byte text lines into frames
+
+	@param txt: Text of frames, one 64-character '0'/'1' line per frame
+	@param len: Length of text in bytes
+	@param frames: Output frames
+	@param max_frames: Capacity of frames
+	@param consumed: Bytes of text converted. On error, offset of the malformed line
+
+	@return # of frames converted, or -EINVAL if a line is malformed
+*/
+ssize_t txt2frames(const char *txt, size_t len, frame *frames, size_t max_frames, size_t *consumed)
+{
+	const char *p = txt;
+	size_t n = 0;
+
+	while (n < max_frames && len - (size_t)(p - txt) >= FRAME_TXT_LINE_LEN)
+	{
+		if (txt_line2frame(p, &frames[n]) < 0)
+		{
+			if (consumed)
+				*consumed = p - txt;
+			return -EINVAL;
+		}
+
+		p += FRAME_TXT_LINE_LEN;
+		n++;
+	}
+
+	if (consumed)
+		*consumed = p - txt;
+
+	return n;
+}
+
+int frames_format_from_name(const char *name)
+{
+	if (!strcmp(name, "bin"))
+		return FRAMES_FORMAT_BIN;
+	if (!strcmp(name, "txt"))
+		return FRAMES_FORMAT_TXT;
+	if (!strcmp(name, "pack"))
+		return FRAMES_FORMAT_PACK;
+	if (!strcmp(name, "native"))
+		return FRAMES_FORMAT_NATIVE;
+
+	return -EINVAL;
+}
+
+const char *frames_format_name(int format)
+{
+	switch (format)
+	{
+	case FRAMES_FORMAT_BIN:
+		return "bin";
+	case FRAMES_FORMAT_TXT:
+		return "txt";
+	case FRAMES_FORMAT_PACK:
+		return "pack";
+	case FRAMES_FORMAT_NATIVE:
+		return "native";
+	default:
+		return "unknown";
+	}
+}
@@ -0,0 +1,177 @@
+#include "frame_decoder.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+
+#if defined(__AVX2__) || defined(__SSE2__)
+#include <immintrin.h>
+#endif
+
+#define DECODE_BLOCK_FRAMES (1024) /* 8K bytes of frames stay in L1 while all fields are extracted */
+
+/*
+	@brief
+		Allocate a column for every field of layout
+
+	@param columns: Columns to be initialized
+	@param layout: Layout of frame
+	@param capacity: Capacity of each column in rows
+*/
+int frame_columns_init(FrameColumns *columns, const FrameLayout *layout, size_t capacity)
+{
+	memset(columns, 0, sizeof(*columns));
+	columns->layout = layout;
+	columns->capacity = capacity;
+
+	for (int i = 0; i < layout->num; i++)
+	{
+		posix_memalign((void **)&columns->columns[i], 64 /* alignment */, capacity * sizeof(uint64_t) + 64);
+		if (!columns->columns[i])
+		{
+			fprintf(stderr, "OOM %lu.\n", capacity * sizeof(uint64_t) + 64);
+			frame_columns_free(columns);
+			return -ENOMEM;
+		}
+	}
+
+	return 0;
+}
+
+void frame_columns_free(FrameColumns *columns)
+{
+	for (int i = 0; i < FRAME_FIELDS_MAX; i++)
+	{
+		free(columns->columns[i]);
+		columns->columns[i] = NULL;
+	}
+
+	columns->rows = 0;
+}
+
+/*
+	@brief
+		# of frames before the first STOP_FRAME, or n if there is none
+*/
+size_t frames_until_stop(const frame *frames, size_t n)
+{
+	size_t i = 0;
+
+#if defined(__AVX2__)
+	const __m256i stop = _mm256_set1_epi64x((long long)STOP_FRAME);
+
+	for (; i + 4 <= n; i += 4)
+	{
+		__m256i x = _mm256_loadu_si256((const __m256i *)(frames + i));
+		int mask = _mm256_movemask_pd(_mm256_castsi256_pd(_mm256_cmpeq_epi64(x, stop)));
+
+		if (mask)
+			return i + __builtin_ctz(mask);
+	}
+#elif defined(__SSE2__)
+	const __m128i stop = _mm_set1_epi32(-1);
+
+	for (; i + 2 <= n; i += 2)
+	{
+		__m128i x = _mm_loadu_si128((const __m128i *)(frames + i));
+		int mask = _mm_movemask_epi8(_mm_cmpeq_epi8(x, stop));
+
+		if ((mask & 0x00FF) == 0x00FF)
+			return i;
+		if ((mask & 0xFF00) == 0xFF00)
+			return i + 1;
+	}
+#endif
+
+	for (; i < n; i++)
+	{
+		if (frames[i] == STOP_FRAME)
+			return i;
+	}
+
+	return n;
+}
+
+/*
+	@brief
+		(frame >> shift) & mask of n frames, shift below 64
+*/
+void frame_extract_field(const frame *in, size_t n, uint64_t *out, int shift, uint64_t mask)
+{
+	size_t i = 0;
+
+#if defined(__AVX2__)
+	const __m256i m = _mm256_set1_epi64x((long long)mask);
+	const __m128i count = _mm_cvtsi32_si128(shift);
+
+	for (; i + 4 <= n; i += 4)
+	{
+		__m256i x = _mm256_loadu_si256((const __m256i *)(in + i));
+
+		_mm256_storeu_si256((__m256i *)(out + i), _mm256_and_si256(_mm256_srl_epi64(x, count), m));
+	}
+#elif defined(__SSE2__)
+	const __m128i m = _mm_set1_epi64x((long long)mask);
+	const __m128i count = _mm_cvtsi32_si128(shift);
+
+	for (; i + 2 <= n; i += 2)
+	{
+		__m128i x = _mm_loadu_si128((const __m128i *)(in + i));
+
+		_mm_storeu_si128((__m128i *)(out + i), _mm_and_si128(_mm_srl_epi64(x, count), m));
+	}
+#endif
+
+	for (; i < n; i++)
+		out[i] = (in[i] >> shift) & mask;
+}
+
+/*
+	@brief
+		Extract every field of n frames, appended to columns
+
+	@param frames: Received frames
+	@param n: # of frames
+	@param columns: Output columns
+
+	@return # of rows appended, or -ENOSPC if columns are full
+*/
+ssize_t frame_decode(const frame *frames, size_t n, FrameColumns *columns)
+{
+	const FrameLayout *layout = columns->layout;
+	size_t rows = columns->rows;
+
+	if (n > columns->capacity - rows)
+		return -ENOSPC;
+
+	for (size_t b = 0; b < n; b += DECODE_BLOCK_FRAMES)
+	{
+		size_t len = n - b < DECODE_BLOCK_FRAMES ? n - b : DECODE_BLOCK_FRAMES;
+
+		for (int i = 0; i < layout->num; i++)
+		{
+			const FrameField *field = &layout->fields[i];
+
+			frame_extract_field(frames + b, len, columns->columns[i] + rows + b,
+								field->offset, frame_field_mask(field));
+		}
+	}
+
+	columns->rows += n;
+
+	return n;
+}
+
+/*
+	@brief
+		Decode received frames up to STOP_FRAME
+
+	@param buffer: Frames buffer, e.g. filled by single_channel_receive
+	@param columns: Output columns
+*/
+ssize_t frame_decode_buffer(const FrameBuffer *buffer, FrameColumns *columns)
+{
+	size_t n = frames_until_stop(buffer->frames, buffer->size / sizeof(frame));
+
+	return frame_decode(buffer->frames, n, columns);
+}
@@ -0,0 +1,357 @@
+#include "frame_pack.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <endian.h>
+
+static inline uint8_t *put_varint(uint8_t *p, uint32_t v)
+{
+	while (v >= 0x80)
+	{
+		*p++ = (uint8_t)(v | 0x80);
+		v >>= 7;
+	}
+	*p++ = (uint8_t)v;
+
+	return p;
+}
+
+static inline int get_varint(const uint8_t *p, const uint8_t *end, uint32_t *v)
+{
+	const uint8_t *start = p;
+	uint32_t value = 0;
+	int shift = 0;
+
+	while (p < end && shift < 32)
+	{
+		value |= (uint32_t)(*p & 0x7F) << shift;
+		if (!(*p++ & 0x80))
+		{
+			*v = value;
+			return p - start;
+		}
+		shift += 7;
+	}
+
+	return -1;
+}
+
+/*
+	@brief
+		Encode up to one block of frames
+
+	@param frames: Frames to be encoded
+	@param n: # of frames, no more than FRAME_PACK_BLOCK_FRAMES
+	@param out: Payload, at least FRAME_PACK_BLOCK_MAX bytes
+
+	@return Size of payload in bytes
+*/
+size_t frame_pack_encode_block(const frame *frames, uint32_t n, uint8_t *out)
+{
+	uint8_t *p = out;
+	frame prev = 0;
+	uint32_t i = 0;
+
+	while (i < n)
+	{
+		frame diff = frames[i] ^ prev;
+
+		if (!diff)
+		{
+			uint32_t run = 1;
+
+			while (i + run < n && frames[i + run] == prev)
+				run++;
+
+			*p++ = 0;
+			p = put_varint(p, run);
+			i += run;
+			continue;
+		}
+
+		uint8_t *tag = p++;
+
+		*tag = 0;
+		for (int b = 0; b < 8; b++)
+		{
+			uint8_t byte = (uint8_t)(diff >> (8 * b));
+
+			if (byte)
+			{
+				*tag |= (uint8_t)(1 << b);
+				*p++ = byte;
+			}
+		}
+
+		prev = frames[i++];
+	}
+
+	return p - out;
+}
+
+/*
+	@brief
+		Write frames into a packed frames file
+
+	@param fname: Output filename
+	@param fd: File description of output file
+	@param frames: Frames to be written
+	@param n: # of frames
+
+	@return Size of file in bytes
+*/
+ssize_t frame_pack_write(char *fname, int fd, const frame *frames, uint64_t n)
+{
+	ssize_t rc;
+	uint64_t done = 0;
+	off_t offset = 0;
+	FramePackHeader header;
+	uint8_t *block;
+
+	block = (uint8_t *)malloc(sizeof(FramePackBlock) + FRAME_PACK_BLOCK_MAX);
+	if (!block)
+	{
+		fprintf(stderr, "OOM %lu.\n", sizeof(FramePackBlock) + FRAME_PACK_BLOCK_MAX);
+		return -ENOMEM;
+	}
+
+	header.magic = htole32(FRAME_PACK_MAGIC);
+	header.version = htole32(FRAME_PACK_VERSION);
+	header.frames = htole64(n);
+
+	rc = pwrite(fd, &header, sizeof(header), offset);
+	if (rc != sizeof(header))
+	{
+		fprintf(stderr, "%s, write header failed %ld.\n", fname, rc);
+		perror("write file");
+		free(block);
+		return -EIO;
+	}
+	offset += rc;
+
+	while (done < n)
+	{
+		FramePackBlock *bh = (FramePackBlock *)block;
+		uint32_t frames_num = FRAME_PACK_BLOCK_FRAMES;
+		size_t bytes;
+
+		if (n - done < frames_num)
+			frames_num = n - done;
+
+		bytes = frame_pack_encode_block(frames + done, frames_num, block + sizeof(FramePackBlock));
+		bh->frames = htole32(frames_num);
+		bh->bytes = htole32(bytes);
+		bytes += sizeof(FramePackBlock);
+
+		rc = pwrite(fd, block, bytes, offset);
+		if (rc < 0 || rc != bytes)
+		{
+			fprintf(stderr, "%s, write 0x%lx @ 0x%lx failed %ld.\n", fname, bytes, offset, rc);
+			perror("write file");
+			free(block);
+			return -EIO;
+		}
+
+		offset += rc;
+		done += frames_num;
+	}
+
+	free(block);
+
+	return offset;
+}
+
+/*
+	@brief
+		Whether the file is a packed frames file
+*/
+int frame_pack_probe(int fd)
+{
+	uint32_t magic;
+
+	if (pread(fd, &magic, sizeof(magic), 0) != sizeof(magic))
+		return 0;
+
+	return le32toh(magic) == FRAME_PACK_MAGIC;
+}
+
+/*
+	@brief
+		Prepare to decode a packed frames file block by block
+
+	@param reader: Reader to be initialized
+	@param fname: Input filename
+	@param fd: File description of input file
+*/
+int frame_pack_open(FramePackReader *reader, char *fname, int fd)
+{
+	ssize_t rc;
+	FramePackHeader header;
+
+	memset(reader, 0, sizeof(*reader));
+	reader->fname = fname;
+	reader->fd = fd;
+
+	rc = pread(fd, &header, sizeof(header), 0);
+	if (rc != sizeof(header) || le32toh(header.magic) != FRAME_PACK_MAGIC)
+	{
+		fprintf(stderr, "%s, not a packed frames file.\n", fname);
+		return -EINVAL;
+	}
+
+	if (le32toh(header.version) != FRAME_PACK_VERSION)
+	{
+		fprintf(stderr, "%s, unsupported version %u.\n", fname, le32toh(header.version));
+		return -EINVAL;
+	}
+
+	reader->payload = (uint8_t *)malloc(FRAME_PACK_BLOCK_MAX);
+	if (!reader->payload)
+	{
+		fprintf(stderr, "OOM %lu.\n", FRAME_PACK_BLOCK_MAX);
+		return -ENOMEM;
+	}
+
+	reader->frames = le64toh(header.frames);
+	reader->offset = sizeof(header);
+
+	return 0;
+}
+
+static int frame_pack_next_block(FramePackReader *reader)
+{
+	ssize_t rc;
+	FramePackBlock bh;
+
+	rc = pread(reader->fd, &bh, sizeof(bh), reader->offset);
+	if (rc != sizeof(bh))
+	{
+		fprintf(stderr, "%s, read block @ 0x%lx failed %ld.\n", reader->fname, reader->offset, rc);
+		return -EIO;
+	}
+
+	bh.frames = le32toh(bh.frames);
+	bh.bytes = le32toh(bh.bytes);
+	if (!bh.frames || bh.frames > FRAME_PACK_BLOCK_FRAMES || bh.bytes > FRAME_PACK_BLOCK_MAX)
+	{
+		fprintf(stderr, "%s, corrupted block @ 0x%lx.\n", reader->fname, reader->offset);
+		return -EINVAL;
+	}
+
+	rc = pread(reader->fd, reader->payload, bh.bytes, reader->offset + sizeof(bh));
+	if (rc != bh.bytes)
+	{
+		fprintf(stderr, "%s, read underflow 0x%lx/0x%x @ 0x%lx.\n",
+				reader->fname, rc, bh.bytes, reader->offset + sizeof(bh));
+		return -EIO;
+	}
+
+	reader->offset += sizeof(bh) + bh.bytes;
+	reader->payload_len = bh.bytes;
+	reader->payload_pos = 0;
+	reader->block_left = bh.frames;
+	reader->repeat = 0;
+	reader->prev = 0;
+
+	return 0;
+}
+
+/*
+	@brief
+		Decode the next frames straight into a (staging) buffer
+
+	@param reader: Reader of packed frames file
+	@param out: Where to decode to
+	@param size: The size of what to decode in bytes
+
+	@return Size of decoded frames in bytes, less than size only at the end of file
+*/
+ssize_t frame_pack_read(FramePackReader *reader, frame *out, uint64_t size)
+{
+	uint64_t n = size / sizeof(frame);
+	uint64_t i = 0;
+
+	while (i < n && reader->frames_out < reader->frames)
+	{
+		if (!reader->block_left)
+		{
+			int rc = frame_pack_next_block(reader);
+
+			if (rc < 0)
+				return rc;
+		}
+
+		const uint8_t *p = reader->payload + reader->payload_pos;
+		const uint8_t *end = reader->payload + reader->payload_len;
+		uint64_t todo = n - i;
+		uint64_t start = i;
+		frame prev = reader->prev;
+
+		if (todo > reader->block_left)
+			todo = reader->block_left;
+
+		while (todo)
+		{
+			if (reader->repeat)
+			{
+				uint32_t run = reader->repeat < todo ? reader->repeat : todo;
+
+				for (uint32_t r = 0; r < run; r++)
+					out[i++] = prev;
+
+				reader->repeat -= run;
+				todo -= run;
+				continue;
+			}
+
+			if (p >= end)
+				goto corrupted;
+
+			uint8_t tag = *p++;
+
+			if (!tag)
+			{
+				int len = get_varint(p, end, &reader->repeat);
+
+				if (len < 0 || !reader->repeat || reader->repeat > reader->block_left - (i - start))
+					goto corrupted;
+				p += len;
+				continue;
+			}
+
+			if (end - p < __builtin_popcount(tag))
+				goto corrupted;
+
+			frame diff = 0;
+
+			for (int b = 0; b < 8; b++)
+			{
+				if (tag & (1 << b))
+					diff |= (frame)*p++ << (8 * b);
+			}
+
+			prev ^= diff;
+			out[i++] = prev;
+			todo--;
+		}
+
+		reader->prev = prev;
+		reader->payload_pos = p - reader->payload;
+		reader->block_left -= i - start;
+		reader->frames_out += i - start;
+	}
+
+	return i * sizeof(frame);
+
+corrupted:
+	fprintf(stderr, "%s, corrupted payload before 0x%lx.\n", reader->fname, reader->offset);
+	return -EINVAL;
+}
+
+void frame_pack_close(FramePackReader *reader)
+{
+	free(reader->payload);
+	reader->payload = NULL;
+}
@@ -0,0 +1,454 @@
+#include "frame_reduce.h"
+#include "frame_decoder.h"
+#include "dma_trace.h"
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+
+/*
+	@brief
+		No reducers, add them with frame_reduce_add_*() or frame_reduce_parse()
+*/
+int frame_reduce_init(FrameReduce *reduce)
+{
+	memset(reduce, 0, sizeof(*reduce));
+
+	posix_memalign((void **)&reduce->keys, 64 /* alignment */, FRAME_REDUCE_BLOCK_FRAMES * sizeof(uint64_t));
+	if (!reduce->keys)
+	{
+		fprintf(stderr, "OOM %lu.\n", FRAME_REDUCE_BLOCK_FRAMES * sizeof(uint64_t));
+		return -ENOMEM;
+	}
+
+	return 0;
+}
+
+void frame_reduce_free(FrameReduce *reduce)
+{
+	for (int i = 0; i < reduce->num; i++)
+	{
+		free(reduce->reducers[i].table);
+		free(reduce->reducers[i].counts);
+	}
+
+	free(reduce->keys);
+	memset(reduce, 0, sizeof(*reduce));
+}
+
+static FrameReducer *reducer_add(FrameReduce *reduce, frame_reduce_type_e type, const char *name)
+{
+	FrameReducer *reducer;
+
+	if (reduce->num >= FRAME_REDUCERS_MAX)
+	{
+		fprintf(stderr, "frame reduce, more than %d reducers.\n", FRAME_REDUCERS_MAX);
+		return NULL;
+	}
+
+	reducer = &reduce->reducers[reduce->num];
+	memset(reducer, 0, sizeof(*reducer));
+	reducer->type = type;
+	snprintf(reducer->name, sizeof(reducer->name), "%s", name);
+
+	return reducer;
+}
+
+/*
+	@brief
+		Count frames per bucket of 2^shift values of key
+
+	@param name: Name of reducer, in dumps and saved files
+	@param key: Bit field counted by
+	@param shift: Low bits of key ignored, below its width
+	@param bins: Buckets counted, keys beyond go to overflow; 0 for all of key
+*/
+int frame_reduce_add_hist(FrameReduce *reduce, const char *name, const FrameField *key, int shift, uint64_t bins)
+{
+	FrameReducer *reducer;
+
+	if (key->width < 1 || key->offset + key->width > 64 || shift < 0 || shift >= key->width)
+	{
+		fprintf(stderr, "frame reduce, bad field %u:%u or shift %d of %s.\n", key->offset, key->width, shift, name);
+		return -EINVAL;
+	}
+
+	if (!bins && key->width - shift <= 24)
+		bins = 1ULL << (key->width - shift);
+
+	if (!bins || bins > FRAME_REDUCE_BINS_MAX)
+	{
+		fprintf(stderr, "frame reduce, %s needs bins of 1~%d.\n", name, FRAME_REDUCE_BINS_MAX);
+		return -EINVAL;
+	}
+
+	reducer = reducer_add(reduce, shift ? FRAME_REDUCE_HIST : FRAME_REDUCE_COUNT, name);
+	if (!reducer)
+		return -ENOSPC;
+
+	reducer->key = *key;
+	reducer->shift = shift;
+	reducer->bins = bins;
+	reducer->lanes = bins <= FRAME_REDUCE_LANE_BINS_MAX ? FRAME_REDUCE_LANES : 1;
+
+	reducer->table = (uint64_t *)calloc(reducer->lanes * (bins + 1), sizeof(uint64_t));
+	reducer->counts = (uint64_t *)calloc(bins, sizeof(uint64_t));
+	if (!reducer->table || !reducer->counts)
+	{
+		fprintf(stderr, "OOM %lu.\n", (reducer->lanes + 1) * (bins + 1) * sizeof(uint64_t));
+		free(reducer->table);
+		free(reducer->counts);
+		return -ENOMEM;
+	}
+
+	reduce->num++;
+
+	return 0;
+}
+
+/*
+	@brief
+		Count frames per value of key, of 2^24 values at most
+*/
+int frame_reduce_add_count(FrameReduce *reduce, const char *name, const FrameField *key)
+{
+	return frame_reduce_add_hist(reduce, name, key, 0, 0);
+}
+
+/*
+	@brief
+		Hand every batch to callback, after it is counted
+*/
+int frame_reduce_add_callback(FrameReduce *reduce, const char *name, frame_reduce_callback callback, void *arg)
+{
+	FrameReducer *reducer = reducer_add(reduce, FRAME_REDUCE_CALLBACK, name);
+
+	if (!reducer)
+		return -ENOSPC;
+
+	reducer->callback = callback;
+	reducer->arg = arg;
+	reduce->num++;
+
+	return 0;
+}
+
+static int parse_number(const char **s, unsigned long *value)
+{
+	char *end;
+
+	if (**s != ':')
+		return -EINVAL;
+
+	*value = strtoul(*s + 1, &end, 0);
+	if (end == *s + 1)
+		return -EINVAL;
+
+	*s = end;
+
+	return 0;
+}
+
+/*
+	@brief
+		Add reducers of spec, separated by ',':
+			count:OFFSET:WIDTH
+			hist:OFFSET:WIDTH:SHIFT[:BINS]
+		each named as given, e.g. "count:32:16,hist:0:32:10:1024"
+*/
+int frame_reduce_parse(FrameReduce *reduce, const char *spec)
+{
+	const char *s = spec;
+
+	while (*s)
+	{
+		const char *start = s;
+		char name[FRAME_REDUCE_NAME_LEN];
+		unsigned long offset, width, shift = 0, bins = 0;
+		FrameField key;
+		int hist, rc;
+
+		if (!strncmp(s, "count", 5))
+			hist = 0, s += 5;
+		else if (!strncmp(s, "hist", 4))
+			hist = 1, s += 4;
+		else
+			goto bad;
+
+		if (parse_number(&s, &offset) || parse_number(&s, &width) || offset > 63 || width > 64)
+			goto bad;
+		if (hist && parse_number(&s, &shift))
+			goto bad;
+		if (hist && *s == ':' && parse_number(&s, &bins))
+			goto bad;
+		if (*s && *s != ',')
+			goto bad;
+
+		snprintf(name, sizeof(name), "%.*s", (int)(s - start), start);
+		key.name = NULL;
+		key.offset = offset;
+		key.width = width;
+
+		rc = frame_reduce_add_hist(reduce, name, &key, shift, bins);
+		if (rc < 0)
+			return rc;
+
+		if (*s == ',')
+			s++;
+	}
+
+	return 0;
+
+bad:
+	fprintf(stderr, "frame reduce, bad spec %s.\n", spec);
+	return -EINVAL;
+}
+
+/*
+	@brief
+		Zero every count, keeping reducers
+*/
+void frame_reduce_reset(FrameReduce *reduce)
+{
+	for (int i = 0; i < reduce->num; i++)
+	{
+		FrameReducer *reducer = &reduce->reducers[i];
+
+		if (reducer->table)
+			memset(reducer->table, 0, reducer->lanes * (reducer->bins + 1) * sizeof(uint64_t));
+	}
+
+	reduce->frames = 0;
+}
+
+/* Keys beyond bins count in the last slot of a table, without a branch */
+static void count_keys(FrameReducer *reducer, const uint64_t *keys, size_t n)
+{
+	uint64_t bins = reducer->bins;
+	uint64_t *t0 = reducer->table;
+	size_t i = 0;
+
+	if (reducer->lanes == FRAME_REDUCE_LANES)
+	{
+		/* Consecutive frames hit different tables, so equal keys do not wait on each other's store */
+		uint64_t *t1 = t0 + (bins + 1), *t2 = t1 + (bins + 1), *t3 = t2 + (bins + 1);
+
+		for (; i + 4 <= n; i += 4)
+		{
+			uint64_t k0 = keys[i], k1 = keys[i + 1], k2 = keys[i + 2], k3 = keys[i + 3];
+
+			t0[k0 < bins ? k0 : bins]++;
+			t1[k1 < bins ? k1 : bins]++;
+			t2[k2 < bins ? k2 : bins]++;
+			t3[k3 < bins ? k3 : bins]++;
+		}
+	}
+
+	for (; i < n; i++)
+		t0[keys[i] < bins ? keys[i] : bins]++;
+}
+
+/*
+	@brief
+		Reduce n frames, one batch to callbacks
+
+	@return n, or -errno of a callback
+*/
+ssize_t frame_reduce(FrameReduce *reduce, const frame *frames, size_t n)
+{
+	DMA_TRACE_SPAN_BEGIN("reduce");
+
+	for (size_t b = 0; b < n; b += FRAME_REDUCE_BLOCK_FRAMES)
+	{
+		size_t len = n - b < FRAME_REDUCE_BLOCK_FRAMES ? n - b : FRAME_REDUCE_BLOCK_FRAMES;
+
+		for (int i = 0; i < reduce->num; i++)
+		{
+			FrameReducer *reducer = &reduce->reducers[i];
+
+			if (reducer->type == FRAME_REDUCE_CALLBACK)
+				continue;
+
+			frame_extract_field(frames + b, len, reduce->keys, reducer->key.offset + reducer->shift,
+								frame_field_mask(&reducer->key) >> reducer->shift);
+			count_keys(reducer, reduce->keys, len);
+		}
+	}
+
+	for (int i = 0; i < reduce->num; i++)
+	{
+		FrameReducer *reducer = &reduce->reducers[i];
+		int rc;
+
+		if (reducer->type != FRAME_REDUCE_CALLBACK)
+			continue;
+
+		rc = reducer->callback(frames, n, reduce->frames, reducer->arg);
+		if (rc < 0)
+		{
+			DMA_TRACE_SPAN_END("reduce", 0);
+			return rc;
+		}
+	}
+
+	reduce->frames += n;
+
+	DMA_TRACE_SPAN_END("reduce", n * sizeof(frame));
+
+	return n;
+}
+
+/*
+	@brief
+		Reduce received frames up to STOP_FRAME
+
+	@param buffer: Frames buffer, e.g. filled by single_channel_receive
+*/
+ssize_t frame_reduce_buffer(FrameReduce *reduce, const FrameBuffer *buffer)
+{
+	size_t n = frames_until_stop(buffer->frames, buffer->size / sizeof(frame));
+
+	return frame_reduce(reduce, buffer->frames, n);
+}
+
+/*
+	@brief
+		Merge the lanes of a counter or histogram
+
+	@return Frames per bin, reducer->bins of them, or NULL for a callback
+*/
+const uint64_t *frame_reduce_counts(FrameReducer *reducer)
+{
+	uint64_t bins = reducer->bins;
+
+	if (reducer->type == FRAME_REDUCE_CALLBACK)
+		return NULL;
+
+	memcpy(reducer->counts, reducer->table, bins * sizeof(uint64_t));
+	reducer->overflow = reducer->table[bins];
+
+	for (int l = 1; l < reducer->lanes; l++)
+	{
+		const uint64_t *t = reducer->table + l * (bins + 1);
+
+		for (uint64_t b = 0; b < bins; b++)
+			reducer->counts[b] += t[b];
+		reducer->overflow += t[bins];
+	}
+
+	return reducer->counts;
+}
+
+void frame_reduce_dump(FILE *fp, FrameReduce *reduce)
+{
+	fprintf(fp, "Reduce: %lu frame(s), %d reducer(s)\n", reduce->frames, reduce->num);
+
+	for (int i = 0; i < reduce->num; i++)
+	{
+		FrameReducer *reducer = &reduce->reducers[i];
+		const uint64_t *counts = frame_reduce_counts(reducer);
+		uint64_t used = 0, max = 0;
+
+		if (!counts)
+		{
+			fprintf(fp, "  %s: callback\n", reducer->name);
+			continue;
+		}
+
+		for (uint64_t b = 0; b < reducer->bins; b++)
+		{
+			used += counts[b] != 0;
+			if (counts[b] > max)
+				max = counts[b];
+		}
+
+		fprintf(fp, "  %s: %lu of %lu bin(s) used, %lu frame(s) at most, %lu overflow\n",
+				reducer->name, used, reducer->bins, max, reducer->overflow);
+	}
+}
+
+/*
+	@brief
+		Save counts as CSV lines of "reducer,key,frames", nonzero bins only. Key
+		is the lowest value of a bin; keys of no bin count as "overflow".
+
+	@return 0, or -errno if the file is not written
+*/
+int frame_reduce_save(const char *fname, FrameReduce *reduce)
+{
+	FILE *fp = fopen(fname, "w");
+
+	if (!fp)
+	{
+		fprintf(stderr, "unable to open reduce file %s.\n", fname);
+		perror("open reduce file");
+		return -ENOENT;
+	}
+
+	fprintf(fp, "reducer,key,frames\n");
+
+	for (int i = 0; i < reduce->num; i++)
+	{
+		FrameReducer *reducer = &reduce->reducers[i];
+		const uint64_t *counts = frame_reduce_counts(reducer);
+
+		if (!counts)
+			continue;
+
+		for (uint64_t b = 0; b < reducer->bins; b++)
+		{
+			if (counts[b])
+				fprintf(fp, "%s,%lu,%lu\n", reducer->name, b << reducer->shift, counts[b]);
+		}
+
+		if (reducer->overflow)
+			fprintf(fp, "%s,overflow,%lu\n", reducer->name, reducer->overflow);
+	}
+
+	if (fclose(fp))
+		return -EIO;
+
+	return 0;
+}
+
+/* Sink */
+static ssize_t reduce_sink_write(FrameSink *sink, const frame *frames, size_t n)
+{
+	FrameSink *next = (FrameSink *)sink->arg;
+	ssize_t rc = frame_reduce((FrameReduce *)sink->priv, frames, n);
+
+	if (rc < 0 || !next)
+		return rc;
+
+	return frame_sink_write(next, frames, n);
+}
+
+static void reduce_sink_close(FrameSink *sink)
+{
+}
+
+static const FrameSinkOps reduce_sink_ops = {
+	.name = "reduce",
+	.write = reduce_sink_write,
+	.close = reduce_sink_close,
+};
+
+/*
+	@brief
+		Reduce frames in the thread writing them, before writing them on to
+		next, or instead of writing them anywhere. Neither reduce nor next
+		is closed with the sink.
+
+	@param sink: Sink to be opened
+	@param reduce: Reducers, initialized
+	@param next: Opened sink, or NULL
+*/
+int frame_sink_open_reduce(FrameSink *sink, FrameReduce *reduce, FrameSink *next)
+{
+	memset(sink, 0, sizeof(*sink));
+	sink->fd = -1;
+	sink->priv = reduce;
+	sink->arg = next;
+	sink->ops = &reduce_sink_ops;
+
+	return 0;
+}
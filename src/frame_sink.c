@@ -0,0 +1,621 @@
+#include "frame_sink.h"
+#include "frame_codec.h"
+#include "dma_ring.h"
+#include "dma_trace.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <time.h>
+#include <unistd.h>
+#include <stdatomic.h>
+#include <byteswap.h>
+
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#define FRAME_SINK_BLOCK_FRAMES (4096) /* Frames converted per write() of a file sink */
+#define FRAME_SINK_FILE_BLOCKS (4)      /* Blocks of a file sink in flight on dma_ring */
+#define FRAME_RING_MAGIC 0x474E5246    /* "FRNG" */
+#define FRAME_RING_VERSION 1
+#define FRAME_RING_SPINS (1024)        /* Polls before sleeping while waiting */
+#define FRAME_RING_SLEEP_NS (20000)
+
+/* Header of the shared memory, data follows at FRAME_RING_DATA_OFFSET */
+typedef struct FrameRingShm_TypeDef {
+	uint32_t magic;
+	uint32_t version;
+	uint64_t capacity; // Bytes of data, a power of 2
+	_Atomic uint32_t closed;
+	_Alignas(64) _Atomic uint64_t head; // Bytes produced, producer only
+	_Alignas(64) _Atomic uint64_t tail; // Bytes consumed, consumer only
+} FrameRingShm;
+
+typedef struct FrameRecord_TypeDef {
+	uint64_t seq;   // # of the first frame
+	uint32_t n;     // # of frames
+	uint32_t batch; // # of batch, low 32 bits
+} FrameRecord;
+
+#define FRAME_RING_DATA_OFFSET (4096)
+
+extern int verbose;
+
+/* File */
+typedef struct FileSink_TypeDef {
+	char *blocks[FRAME_SINK_FILE_BLOCKS];
+	DmaRingReq reqs[FRAME_SINK_FILE_BLOCKS]; // Writes of blocks in flight on dma_ring
+	int busy[FRAME_SINK_FILE_BLOCKS];
+	int nblocks;                             // 1 without dma_ring
+	int next;
+	uint64_t offset;                         // Of the next block in the file
+	int err;                                 // Of a write completed in the ring, sticky
+} FileSink;
+
+static void file_sink_written(DmaRingReq *req)
+{
+	FileSink *fs = (FileSink *)req->arg;
+
+	if (req->res != req->bytes)
+	{
+		fprintf(stderr, "frame sink, write 0x%lx @ 0x%lx failed %ld.\n", req->bytes, req->offset, req->res);
+		fs->err = -EIO;
+	}
+}
+
+/* Wait for the write of a block, to reuse it */
+static int file_sink_reclaim(FileSink *fs, int i)
+{
+	if (fs->busy[i])
+	{
+		DMA_TRACE_SPAN_BEGIN("file write");
+		dma_ring_wait(&dma_ring, &fs->reqs[i]);
+		DMA_TRACE_SPAN_END("file write", fs->reqs[i].done);
+		fs->busy[i] = 0;
+	}
+
+	return fs->err;
+}
+
+static ssize_t file_sink_write(FrameSink *sink, const frame *frames, size_t n)
+{
+	FileSink *fs = (FileSink *)sink->priv;
+	size_t done = 0;
+
+	if (fs->err)
+		return fs->err;
+
+	while (done < n)
+	{
+		size_t k = n - done, bytes;
+		char *block;
+		ssize_t rc;
+
+		if (k > FRAME_SINK_BLOCK_FRAMES)
+			k = FRAME_SINK_BLOCK_FRAMES;
+
+		if (file_sink_reclaim(fs, fs->next))
+			return fs->err;
+		block = fs->blocks[fs->next];
+
+		DMA_TRACE_SPAN_BEGIN("sink encode");
+		if (sink->format == FRAMES_FORMAT_TXT)
+		{
+			for (size_t i = 0; i < k; i++)
+			{
+				long2bin(&frames[done + i], block + i * FRAME_TXT_LINE_LEN);
+				block[i * FRAME_TXT_LINE_LEN + FRAME_TXT_CHARS] = '\n';
+			}
+			bytes = k * FRAME_TXT_LINE_LEN;
+		}
+		else if (sink->format == FRAMES_FORMAT_NATIVE)
+		{
+			memcpy(block, &frames[done], k * sizeof(frame));
+			bytes = k * sizeof(frame);
+		}
+		else
+		{
+			/* Big-endian, as read_bin_to_buffer() reads */
+			for (size_t i = 0; i < k; i++)
+				((frame *)block)[i] = bswap_64(frames[done + i]);
+			bytes = k * sizeof(frame);
+		}
+		DMA_TRACE_SPAN_END("sink encode", bytes);
+
+		if (fs->nblocks > 1)
+		{
+			/* Converting the next block overlaps the write of this one */
+			DmaRingReq *req = &fs->reqs[fs->next];
+
+			req->op = DMA_RING_WRITE;
+			req->fd = sink->fd;
+			req->buf = block;
+			req->bytes = bytes;
+			req->offset = fs->offset;
+			req->callback = file_sink_written;
+			req->arg = fs;
+
+			rc = dma_ring_queue(&dma_ring, req);
+			if (rc < 0)
+				return rc;
+			fs->busy[fs->next] = 1;
+			fs->next = (fs->next + 1) % fs->nblocks;
+		}
+		else
+		{
+			DMA_TRACE_SPAN_BEGIN("file write");
+			rc = pwrite(sink->fd, block, bytes, fs->offset);
+			DMA_TRACE_SPAN_END("file write", rc > 0 ? rc : 0);
+			if (rc != bytes)
+			{
+				fprintf(stderr, "frame sink, write 0x%lx failed %ld.\n", bytes, rc);
+				perror("write file");
+				return -EIO;
+			}
+		}
+
+		fs->offset += bytes;
+		done += k;
+	}
+
+	if (fs->nblocks > 1 && dma_ring_submit(&dma_ring) < 0)
+		return -EIO;
+
+	return n;
+}
+
+static void file_sink_close(FrameSink *sink)
+{
+	FileSink *fs = (FileSink *)sink->priv;
+
+	for (int i = 0; i < fs->nblocks; i++)
+	{
+		file_sink_reclaim(fs, i);
+		free(fs->blocks[i]);
+	}
+
+	if (fs->err)
+		fprintf(stderr, "frame sink, output file incomplete.\n");
+
+	close(sink->fd);
+	free(fs);
+}
+
+static const FrameSinkOps file_sink_ops = {
+	.name = "file",
+	.write = file_sink_write,
+	.close = file_sink_close,
+};
+
+/*
+	@brief
+		Write frames into a file, as text lines, big-endian or native binary. Blocks
+		are written asynchronously on dma_ring once it is initialized.
+
+	@param sink: Sink to be opened
+	@param fname: Name of file, truncated
+	@param format: FRAMES_FORMAT_TXT, FRAMES_FORMAT_BIN or FRAMES_FORMAT_NATIVE
+*/
+int frame_sink_open_file(FrameSink *sink, const char *fname, int format)
+{
+	FileSink *fs;
+
+	memset(sink, 0, sizeof(*sink));
+
+	if (format != FRAMES_FORMAT_TXT && format != FRAMES_FORMAT_BIN && format != FRAMES_FORMAT_NATIVE)
+	{
+		fprintf(stderr, "frame sink, format %s not supported.\n", frames_format_name(format));
+		return -EINVAL;
+	}
+
+	fs = (FileSink *)calloc(1, sizeof(FileSink));
+	if (!fs)
+		return -ENOMEM;
+
+	fs->nblocks = dma_ring_active(&dma_ring) ? FRAME_SINK_FILE_BLOCKS : 1;
+	for (int i = 0; i < fs->nblocks; i++)
+	{
+		fs->blocks[i] = (char *)malloc(FRAME_SINK_BLOCK_FRAMES * FRAME_TXT_LINE_LEN);
+		if (!fs->blocks[i])
+		{
+			while (i--)
+				free(fs->blocks[i]);
+			free(fs);
+			return -ENOMEM;
+		}
+	}
+
+	sink->fd = open(fname, O_WRONLY | O_CREAT | O_TRUNC, 0666);
+	if (sink->fd < 0)
+	{
+		fprintf(stderr, "unable to open output file %s, %d.\n", fname, sink->fd);
+		perror("open output file");
+		for (int i = 0; i < fs->nblocks; i++)
+			free(fs->blocks[i]);
+		free(fs);
+		return -ENOENT;
+	}
+
+	sink->priv = fs;
+	sink->format = format;
+	sink->ops = &file_sink_ops;
+
+	return 0;
+}
+
+/* Callback */
+static ssize_t callback_sink_write(FrameSink *sink, const frame *frames, size_t n)
+{
+	int rc = sink->callback(frames, n, sink->batches, sink->frames, sink->arg);
+
+	return rc < 0 ? rc : (ssize_t)n;
+}
+
+static void callback_sink_close(FrameSink *sink)
+{
+}
+
+static const FrameSinkOps callback_sink_ops = {
+	.name = "callback",
+	.write = callback_sink_write,
+	.close = callback_sink_close,
+};
+
+/*
+	@brief
+		Hand frames to callback, in the thread writing them
+*/
+int frame_sink_open_callback(FrameSink *sink, frame_sink_callback callback, void *arg)
+{
+	memset(sink, 0, sizeof(*sink));
+	sink->fd = -1;
+	sink->callback = callback;
+	sink->arg = arg;
+	sink->ops = &callback_sink_ops;
+
+	return 0;
+}
+
+/* Ring */
+static void ring_pause(int *spins)
+{
+	struct timespec ts = {0, FRAME_RING_SLEEP_NS};
+
+	if (++*spins > FRAME_RING_SPINS)
+		nanosleep(&ts, NULL);
+}
+
+static void ring_copy_in(FrameRing *ring, uint64_t pos, const void *src, size_t len)
+{
+	uint64_t mask = ring->shm->capacity - 1;
+	size_t first = ring->shm->capacity - (pos & mask);
+
+	if (first > len)
+		first = len;
+
+	memcpy(ring->data + (pos & mask), src, first);
+	memcpy(ring->data, (const char *)src + first, len - first);
+}
+
+static void ring_copy_out(FrameRing *ring, uint64_t pos, void *dst, size_t len)
+{
+	uint64_t mask = ring->shm->capacity - 1;
+	size_t first = ring->shm->capacity - (pos & mask);
+
+	if (first > len)
+		first = len;
+
+	memcpy(dst, ring->data + (pos & mask), first);
+	memcpy((char *)dst + first, ring->data, len - first);
+}
+
+static ssize_t ring_sink_write(FrameSink *sink, const frame *frames, size_t n)
+{
+	FrameRing *ring = (FrameRing *)sink->priv;
+	FrameRingShm *shm = ring->shm;
+	size_t max_frames = (shm->capacity / 2 - sizeof(FrameRecord)) / sizeof(frame);
+	uint64_t head = atomic_load_explicit(&shm->head, memory_order_relaxed);
+	uint64_t deadline = ring->timeout_us < 0 ? 0 : get_time_ns() + (uint64_t)ring->timeout_us * 1000;
+	size_t done = 0;
+
+	while (done < n)
+	{
+		FrameRecord rec;
+		size_t k = n - done;
+		int spins = 0;
+
+		if (k > max_frames)
+			k = max_frames;
+
+		/* Backpressure: wait for the consumer to make room */
+		while (shm->capacity - (head - atomic_load_explicit(&shm->tail, memory_order_acquire)) <
+			   sizeof(rec) + k * sizeof(frame))
+		{
+			if (deadline && get_time_ns() > deadline)
+				return done ? (ssize_t)done : -EAGAIN;
+			ring_pause(&spins);
+		}
+
+		rec.seq = sink->frames + done;
+		rec.n = k;
+		rec.batch = (uint32_t)sink->batches;
+
+		ring_copy_in(ring, head, &rec, sizeof(rec));
+		ring_copy_in(ring, head + sizeof(rec), frames + done, k * sizeof(frame));
+
+		head += sizeof(rec) + k * sizeof(frame);
+		atomic_store_explicit(&shm->head, head, memory_order_release);
+
+		done += k;
+	}
+
+	return n;
+}
+
+static void ring_sink_close(FrameSink *sink)
+{
+	FrameRing *ring = (FrameRing *)sink->priv;
+
+	atomic_store_explicit(&ring->shm->closed, 1, memory_order_release);
+	munmap(ring->map, ring->map_size);
+	close(ring->fd);
+	free(ring);
+}
+
+static const FrameSinkOps ring_sink_ops = {
+	.name = "ring",
+	.write = ring_sink_write,
+	.close = ring_sink_close,
+};
+
+/*
+	@brief
+		Write frames into a ring in /dev/shm, created or reset, for a consumer
+		process attached by frame_ring_attach(). The consumer unlinks it.
+
+	@param sink: Sink to be opened
+	@param name: Name of shared memory, e.g. /pcieapp_out
+	@param capacity: Bytes of the ring, rounded up to a power of 2
+	@param timeout_us: Wait for room at most this long, < 0 forever
+*/
+int frame_sink_open_ring(FrameSink *sink, const char *name, size_t capacity, long timeout_us)
+{
+	FrameRing *ring;
+	size_t size = 4096;
+	int rc;
+
+	memset(sink, 0, sizeof(*sink));
+	sink->fd = -1;
+
+	while (size < capacity)
+		size <<= 1;
+
+	ring = (FrameRing *)calloc(1, sizeof(FrameRing));
+	if (!ring)
+		return -ENOMEM;
+
+	ring->timeout_us = timeout_us;
+	ring->map_size = FRAME_RING_DATA_OFFSET + size;
+
+	ring->fd = shm_open(name, O_RDWR | O_CREAT, 0600);
+	if (ring->fd < 0)
+	{
+		fprintf(stderr, "unable to open shared memory %s.\n", name);
+		perror("shm_open");
+		rc = -errno;
+		goto err;
+	}
+
+	if (ftruncate(ring->fd, ring->map_size) < 0)
+	{
+		perror("ftruncate shared memory");
+		rc = -errno;
+		goto err;
+	}
+
+	ring->map = mmap(NULL, ring->map_size, PROT_READ | PROT_WRITE, MAP_SHARED, ring->fd, 0);
+	if (ring->map == MAP_FAILED)
+	{
+		fprintf(stderr, "Memory mapped failed.\n");
+		perror("mmap error\n");
+		rc = -ENOMEM;
+		goto err;
+	}
+
+	ring->shm = (FrameRingShm *)ring->map;
+	ring->data = (char *)ring->map + FRAME_RING_DATA_OFFSET;
+
+	/* Reset, publishing the magic last for a consumer attaching meanwhile */
+	ring->shm->magic = 0;
+	ring->shm->version = FRAME_RING_VERSION;
+	ring->shm->capacity = size;
+	atomic_store(&ring->shm->closed, 0);
+	atomic_store(&ring->shm->head, 0);
+	atomic_store(&ring->shm->tail, 0);
+	atomic_thread_fence(memory_order_release);
+	ring->shm->magic = FRAME_RING_MAGIC;
+
+	sink->priv = ring;
+	sink->ops = &ring_sink_ops;
+
+	return 0;
+
+err:
+	if (ring->fd >= 0)
+		close(ring->fd);
+	free(ring);
+	return rc;
+}
+
+/*
+	@brief
+		Open a sink by name: "shm:/name" is a ring in /dev/shm, others are files
+
+	@param format: Format of files, see frame_sink_open_file()
+*/
+int frame_sink_open(FrameSink *sink, const char *name, int format)
+{
+	size_t len = strlen(FRAME_SINK_SHM_PREFIX);
+
+	if (!strncmp(name, FRAME_SINK_SHM_PREFIX, len))
+		return frame_sink_open_ring(sink, name + len, FRAME_RING_CAPACITY_DEFAULT, FRAME_RING_TIMEOUT_US_DEFAULT);
+
+	return frame_sink_open_file(sink, name, format);
+}
+
+/*
+	@brief
+		Write a batch of frames
+
+	@return n, or -errno
+*/
+ssize_t frame_sink_write(FrameSink *sink, const frame *frames, size_t n)
+{
+	ssize_t rc = sink->ops->write(sink, frames, n);
+
+	if (rc > 0)
+		sink->frames += rc;
+	if (rc >= 0)
+		sink->batches++;
+
+	if (verbose && rc < 0)
+		fprintf(stderr, "%s sink, batch #%lu failed %ld.\n", sink->ops->name, sink->batches, rc);
+
+	return rc;
+}
+
+void frame_sink_close(FrameSink *sink)
+{
+	if (sink->ops)
+		sink->ops->close(sink);
+
+	sink->ops = NULL;
+}
+
+/*
+	@brief
+		Attach to a ring created by frame_sink_open_ring()
+
+	@return 0, -ENOENT if the producer has not created it yet, or -EINVAL
+*/
+int frame_ring_attach(FrameRing *ring, const char *name)
+{
+	struct stat st;
+	FrameRingShm *shm;
+
+	memset(ring, 0, sizeof(*ring));
+
+	ring->fd = shm_open(name, O_RDWR, 0600);
+	if (ring->fd < 0)
+		return -errno;
+
+	if (fstat(ring->fd, &st) < 0 || st.st_size <= FRAME_RING_DATA_OFFSET)
+	{
+		close(ring->fd);
+		return -EINVAL;
+	}
+
+	ring->map_size = st.st_size;
+	ring->map = mmap(NULL, ring->map_size, PROT_READ | PROT_WRITE, MAP_SHARED, ring->fd, 0);
+	if (ring->map == MAP_FAILED)
+	{
+		close(ring->fd);
+		return -ENOMEM;
+	}
+
+	shm = (FrameRingShm *)ring->map;
+	if (shm->magic != FRAME_RING_MAGIC || shm->version != FRAME_RING_VERSION ||
+		shm->capacity + FRAME_RING_DATA_OFFSET != ring->map_size)
+	{
+		munmap(ring->map, ring->map_size);
+		close(ring->fd);
+		return -EINVAL;
+	}
+
+	atomic_thread_fence(memory_order_acquire);
+	ring->shm = shm;
+	ring->data = (char *)ring->map + FRAME_RING_DATA_OFFSET;
+
+	return 0;
+}
+
+/*
+	@brief
+		Read the frames of the next record, up to max. The rest of a longer
+		record is left for the next read.
+
+	@param ring: Attached ring
+	@param frames: Where to read frames
+	@param max: Capacity of frames
+	@param seq: # of the first frame read, may be NULL
+	@param batch: # of the batch read, low 32 bits, may be NULL
+	@param timeout_us: Wait for frames at most this long, < 0 forever
+
+	@return # of frames, 0 once the producer closed and all frames are read, or -EAGAIN
+*/
+ssize_t frame_ring_read(FrameRing *ring, frame *frames, size_t max, uint64_t *seq, uint64_t *batch, long timeout_us)
+{
+	FrameRingShm *shm = ring->shm;
+	uint64_t tail = atomic_load_explicit(&shm->tail, memory_order_relaxed);
+	uint64_t deadline = timeout_us < 0 ? 0 : get_time_ns() + (uint64_t)timeout_us * 1000;
+	FrameRecord rec;
+	size_t k;
+	int spins = 0;
+
+	while (atomic_load_explicit(&shm->head, memory_order_acquire) == tail)
+	{
+		/* Check head again after closed, so no frames written before closing are lost */
+		if (atomic_load_explicit(&shm->closed, memory_order_acquire) &&
+			atomic_load_explicit(&shm->head, memory_order_acquire) == tail)
+			return 0;
+		if (deadline && get_time_ns() > deadline)
+			return -EAGAIN;
+		ring_pause(&spins);
+	}
+
+	ring_copy_out(ring, tail, &rec, sizeof(rec));
+
+	k = rec.n < max ? rec.n : max;
+	ring_copy_out(ring, tail + sizeof(rec), frames, k * sizeof(frame));
+
+	if (seq)
+		*seq = rec.seq;
+	if (batch)
+		*batch = rec.batch;
+
+	if (k < rec.n)
+	{
+		/* Shrink the record in place, the consumer owns it until tail moves past */
+		rec.seq += k;
+		rec.n -= k;
+		tail += k * sizeof(frame);
+		ring_copy_in(ring, tail, &rec, sizeof(rec));
+	}
+	else
+	{
+		tail += sizeof(rec) + k * sizeof(frame);
+	}
+
+	atomic_store_explicit(&shm->tail, tail, memory_order_release);
+
+	return k;
+}
+
+/*
+	@brief
+		Detach from a ring, unlinking it if name is not NULL
+*/
+void frame_ring_detach(FrameRing *ring, const char *name)
+{
+	if (ring->map)
+		munmap(ring->map, ring->map_size);
+	if (ring->fd >= 0)
+		close(ring->fd);
+
+	if (name)
+		shm_unlink(name);
+
+	memset(ring, 0, sizeof(*ring));
+	ring->fd = -1;
+}
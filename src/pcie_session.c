@@ -0,0 +1,281 @@
+#include "pcie_session.h"
+#include "frame_decoder.h"
+#include "user_regs.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <sys/mman.h>
+
+extern int verbose;
+
+/*
+	@brief
+		Open devices, map user registers, allocate pinned buffers and set the mode once
+
+	@param session: Session to be opened
+	@param h2c_name: Device name of XDMA h2c channel
+	@param c2h_name: Device name of XDMA c2h channel
+	@param user_reg: Name of user registers: /dev/xdma0_user
+	@param work_mode: work in which mode
+*/
+int pcie_session_open(PCIeSession *session, char *h2c_name, char *c2h_name, char *user_reg, int work_mode)
+{
+	int rc;
+	uint64_t deadline;
+
+	memset(session, 0, sizeof(*session));
+	session->h2c_fd = -1;
+	session->c2h_fd = -1;
+	session->user_reg_fd = -1;
+	session->h2c_addr = DOWNSTREAM_BRAM_CH1_ADDR;
+	session->c2h_addr = UPSTREAM_BRAM_CH1_ADDR;
+	session->timeout_us = SESSION_TIMEOUT_US_DEFAULT;
+	session->rx_chunk = SESSION_RX_CHUNK_DEFAULT;
+
+	session->h2c_fd = open(h2c_name, O_RDWR);
+	if (session->h2c_fd < 0)
+	{
+		fprintf(stderr, "unable to open device %s, %d.\n", h2c_name, session->h2c_fd);
+		perror("open device");
+		rc = -ENXIO;
+		goto err;
+	}
+
+	session->c2h_fd = open(c2h_name, O_RDONLY);
+	if (session->c2h_fd < 0)
+	{
+		fprintf(stderr, "unable to open device %s, %d.\n", c2h_name, session->c2h_fd);
+		perror("open device");
+		rc = -ENXIO;
+		goto err;
+	}
+
+	session->user_reg_fd = open(user_reg, O_RDWR | O_SYNC);
+	if (session->user_reg_fd < 0)
+	{
+		fprintf(stderr, "unable to open user registers %s, %d.\n", user_reg, session->user_reg_fd);
+		perror("open device");
+		rc = -ENXIO;
+		goto err;
+	}
+
+	session->user_addr = mmap(NULL, MAP_SIZE, PROT_READ | PROT_WRITE, MAP_SHARED, session->user_reg_fd, 0);
+	if (session->user_addr == (void *)-1)
+	{
+		fprintf(stderr, "Memory mapped failed.\n");
+		perror("mmap error\n");
+		session->user_addr = NULL;
+		rc = -ENOMEM;
+		goto err;
+	}
+
+#ifdef PIO_BRAM_WINDOW
+	if (dma_profile.pio_max_bytes)
+		pio_map(&session->pio, session->user_reg_fd, PIO_BRAM_WINDOW_OFFSET, PIO_BRAM_WINDOW_SIZE,
+				session->h2c_addr);
+#endif
+
+	posix_memalign((void **)&session->allocated, 4096 /* alignment */, DOWNSTREAM_BRAM_SIZE + UPSTREAM_BRAM_SIZE);
+	if (!session->allocated)
+	{
+		fprintf(stderr, "OOM %u.\n", DOWNSTREAM_BRAM_SIZE + UPSTREAM_BRAM_SIZE);
+		rc = -ENOMEM;
+		goto err;
+	}
+
+	session->tx.frames = session->allocated;
+	session->rx.frames = session->allocated + DOWNSTREAM_BRAM_SIZE / sizeof(frame);
+
+	/* Keep buffers resident so no step takes a page fault */
+	if (mlock(session->allocated, DOWNSTREAM_BRAM_SIZE + UPSTREAM_BRAM_SIZE) < 0 && verbose)
+		perror("mlock buffers");
+
+	/* Reset device and set mode, waiting for the mode without sleeping a whole second */
+	reset_xdma(session->user_addr);
+	writeUser(session->user_addr, FPGA_MODE_RO_ADDR, work_mode);
+
+	deadline = get_time_ns() + 1000000000ULL;
+	while (readUser(session->user_addr, FPGA_MODE_RO_ADDR) != work_mode)
+	{
+		if (get_time_ns() > deadline)
+		{
+			fprintf(stderr, "mode error, %d.\n", readUser(session->user_addr, FPGA_MODE_RO_ADDR));
+			rc = -EINVAL;
+			goto err;
+		}
+	}
+
+	return 0;
+
+err:
+	pcie_session_close(session);
+	return rc;
+}
+
+void pcie_session_close(PCIeSession *session)
+{
+	if (session->allocated)
+	{
+		munlock(session->allocated, DOWNSTREAM_BRAM_SIZE + UPSTREAM_BRAM_SIZE);
+		free(session->allocated);
+		session->allocated = NULL;
+	}
+
+	pio_unmap(&session->pio);
+
+	if (session->user_addr)
+	{
+		munmap(session->user_addr, MAP_SIZE);
+		session->user_addr = NULL;
+	}
+
+	if (session->user_reg_fd >= 0)
+		close(session->user_reg_fd);
+	if (session->c2h_fd >= 0)
+		close(session->c2h_fd);
+	if (session->h2c_fd >= 0)
+		close(session->h2c_fd);
+
+	session->user_reg_fd = -1;
+	session->c2h_fd = -1;
+	session->h2c_fd = -1;
+}
+
+/*
+	@brief
+		Send one timestep of frames in a single loop and read back its output.
+		Output frames are left in session->rx, session->rx.size in bytes.
+
+	@param session: Opened session
+	@param frames: Frames of this step, may be pcie_session_tx_frames(session)
+	@param n: # of frames, no more than pcie_session_tx_capacity()
+	@param stats: Latency of this step, may be NULL
+
+	@return # of output frames before STOP_FRAME
+*/
+ssize_t pcie_session_step(PCIeSession *session, const frame *frames, size_t n, PCIeStepStats *stats)
+{
+	ssize_t rc;
+	PCIeStepStats st = {0};
+	void *user_addr = session->user_addr;
+	size_t bytes = (n + 1) * sizeof(frame);
+	size_t done = 0, chunk = session->rx_chunk;
+	ssize_t found = -1;
+	uint64_t t0, t1, t2, t3, t4;
+
+	if (n > pcie_session_tx_capacity(session))
+		return -E2BIG;
+
+	t0 = get_time_ns();
+
+	updateUser(user_addr, TRANS_INFO_RW_ADDR, 0x000000FF, 1);
+
+	/* 1. Frames and stop frame go in one write, or straight into BRAM by PIO stores when tiny */
+	if (pio_select(&dma_profile, &session->pio, bytes, session->h2c_addr))
+	{
+		frame stop_frame = STOP_FRAME;
+
+		rc = pio_write(&session->pio, frames, n * sizeof(frame), session->h2c_addr);
+		if (rc >= 0)
+			rc = pio_write(&session->pio, &stop_frame, sizeof(frame), session->h2c_addr + n * sizeof(frame));
+		if (rc >= 0)
+			rc = bytes;
+	}
+	else
+	{
+		if (frames != session->tx.frames)
+			memcpy(session->tx.frames, frames, n * sizeof(frame));
+		session->tx.frames[n] = STOP_FRAME;
+
+		rc = pwrite(session->h2c_fd, session->tx.frames, bytes, session->h2c_addr);
+	}
+	if (rc != bytes)
+	{
+		fprintf(stderr, "step #%lu, write 0x%lx @ 0x%lx failed %ld.\n", session->steps, bytes, session->h2c_addr, rc);
+		perror("write file");
+		return -EIO;
+	}
+
+	writeUser(user_addr, TX_STATUS_RW_ADDR, REQ_TX_SENDING);
+	t1 = get_time_ns();
+
+	/* 2. Spin for TX done, then clear it */
+	if (pollUser(user_addr, TX_DONE_RW_ADDR, 0x00000001, session->timeout_us, NULL) < 0)
+	{
+		fprintf(stderr, "step #%lu, got TX done failed.\n", session->steps);
+		return -ETIMEDOUT;
+	}
+	/*
+		Clear only TX done, from a fresh read: the value polled may miss bits
+		set since. A bit set between the read and the write is still lost
+		until TX_DONE_RW_ADDR clears on writing 1.
+	*/
+	updateUser(user_addr, TX_DONE_RW_ADDR, 0x00000001, 0);
+	t2 = get_time_ns();
+
+	/* 3. Spin for RX done */
+	if (pollUser(user_addr, TX_DONE_RW_ADDR, 0x00000002, session->timeout_us, NULL) < 0)
+	{
+		fprintf(stderr, "step #%lu, got RX done failed.\n", session->steps);
+		return -ETIMEDOUT;
+	}
+	t3 = get_time_ns();
+
+	/* 4. Read the output from small to large until STOP_FRAME */
+	while (done < UPSTREAM_BRAM_SIZE)
+	{
+		size_t len = UPSTREAM_BRAM_SIZE - done;
+		size_t stop;
+
+		if (len > chunk)
+			len = chunk;
+
+		rc = pread(session->c2h_fd, (char *)session->rx.frames + done, len, session->c2h_addr + done);
+		if (rc != len)
+		{
+			fprintf(stderr, "step #%lu, read 0x%lx @ 0x%lx failed %ld.\n",
+					session->steps, len, session->c2h_addr + done, rc);
+			perror("read file");
+			return -EIO;
+		}
+
+		stop = frames_until_stop(session->rx.frames + done / sizeof(frame), len / sizeof(frame));
+		if (stop < len / sizeof(frame))
+		{
+			found = done / sizeof(frame) + stop;
+			done += len;
+			break;
+		}
+
+		done += len;
+		chunk *= 2;
+	}
+
+	if (found < 0)
+		found = done / sizeof(frame);
+
+	/* Clear only RX done, from a fresh read as with TX done */
+	updateUser(user_addr, TX_DONE_RW_ADDR, 0x00000002, 0);
+	t4 = get_time_ns();
+
+	session->rx.size = found * sizeof(frame);
+
+	st.send_ns = t1 - t0;
+	st.tx_wait_ns = t2 - t1;
+	st.rx_wait_ns = t3 - t2;
+	st.recv_ns = t4 - t3;
+	st.total_ns = t4 - t0;
+	st.rx_bytes = done;
+	st.rx_frames = found;
+
+	session->last = st;
+	session->steps++;
+	if (stats)
+		*stats = st;
+
+	return found;
+}
@@ -0,0 +1,105 @@
+#include "pio.h"
+#include "user_regs.h"
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+
+#include <sys/mman.h>
+
+PioWindow pio_window = {0};
+
+extern int verbose;
+
+/*
+	@brief
+		Map size bytes of fd at offset as the window of H2C address addr
+
+	@param fd: File description of user registers, or of a file standing in for them
+
+	@return 0, or -ENOMEM and the window left unmapped
+*/
+int pio_map(PioWindow *pio, int fd, off_t offset, size_t size, uint64_t addr)
+{
+	void *base = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, offset);
+
+	memset(pio, 0, sizeof(*pio));
+
+	if (base == MAP_FAILED)
+	{
+		if (verbose)
+			perror("mmap PIO window");
+		return -ENOMEM;
+	}
+
+	pio->base = base;
+	pio->size = size;
+	pio->addr = addr;
+
+	return 0;
+}
+
+void pio_unmap(PioWindow *pio)
+{
+	if (pio->base)
+		munmap(pio->base, pio->size);
+
+	memset(pio, 0, sizeof(*pio));
+}
+
+/*
+	@return Whether bytes at H2C offset go by PIO: the window is mapped, holds
+	them, and they are no more than the threshold of the profile
+*/
+int pio_select(const DmaProfile *profile, const PioWindow *pio, uint64_t bytes, off_t offset)
+{
+	return pio->base && bytes <= profile->pio_max_bytes && offset >= pio->addr &&
+		   offset + bytes <= pio->addr + pio->size;
+}
+
+/*
+	@brief
+		Check that frames at H2C offset read back through the window as
+		expect, e.g. after a DMA or pio_write() of them. A window decoding
+		nothing reads back ones or zeros.
+
+	@return 0, -EIO if they differ, or -EINVAL if the window does not hold them
+*/
+int pio_verify(const PioWindow *pio, const frame *expect, uint64_t bytes, off_t offset)
+{
+	const volatile frame *src;
+
+	if (!pio->base || bytes % sizeof(frame) || offset < pio->addr || offset + bytes > pio->addr + pio->size)
+		return -EINVAL;
+
+	src = (const volatile frame *)((char *)pio->base + (offset - pio->addr));
+	for (uint64_t i = 0; i < bytes / sizeof(frame); i++)
+	{
+		frame f = src[i];
+
+		if (f != expect[i])
+		{
+			if (verbose)
+				fprintf(stderr, "PIO window @ 0x%lx: 0x%016lx, expected 0x%016lx.\n",
+						offset + i * sizeof(frame), f, expect[i]);
+			return -EIO;
+		}
+	}
+
+	return 0;
+}
+
+/*
+	@brief
+		Store whole frames at H2C offset through the window
+
+	@return Bytes written, or -EINVAL if the window does not hold them
+*/
+ssize_t pio_write(const PioWindow *pio, const frame *buf, uint64_t bytes, off_t offset)
+{
+	if (!pio->base || bytes % sizeof(frame) || offset < pio->addr || offset + bytes > pio->addr + pio->size)
+		return -EINVAL;
+
+	writeUser64(pio->base, offset - pio->addr, buf, bytes / sizeof(frame));
+
+	return bytes;
+}
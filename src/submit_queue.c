@@ -0,0 +1,518 @@
+#include "submit_queue.h"
+#include "dma_utils.h"
+#include "dma_trace.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sched.h>
+#include <linux/futex.h>
+#include <sys/syscall.h>
+
+#define ENGINE_IDLE_SPINS (1024)   /* Polls of an empty queue before sleeping */
+#define ENGINE_IDLE_NS (100000000) /* Sleep at most 100ms, to notice stop */
+
+extern int verbose;
+
+static inline void futex_wait(_Atomic unsigned int *addr, unsigned int val, long ns)
+{
+	struct timespec ts = {ns / 1000000000, ns % 1000000000};
+
+	syscall(SYS_futex, addr, FUTEX_WAIT_PRIVATE, val, ns ? &ts : NULL, NULL, 0);
+}
+
+static inline void futex_wake(_Atomic unsigned int *addr, int n)
+{
+	syscall(SYS_futex, addr, FUTEX_WAKE_PRIVATE, n, NULL, NULL, 0);
+}
+
+/*
+	@brief
+		Initialize a queue of depth slots, rounded up to a power of 2
+*/
+int submit_queue_init(SubmitQueue *queue, size_t depth)
+{
+	size_t size = 1;
+
+	while (size < depth)
+		size <<= 1;
+
+	memset(queue, 0, sizeof(*queue));
+	queue->slots = (SubmitSlot *)calloc(size, sizeof(SubmitSlot));
+	if (!queue->slots)
+	{
+		fprintf(stderr, "OOM %lu.\n", size * sizeof(SubmitSlot));
+		return -ENOMEM;
+	}
+
+	for (size_t i = 0; i < size; i++)
+		atomic_init(&queue->slots[i].seq, i);
+
+	queue->mask = size - 1;
+	atomic_init(&queue->tail, 0);
+	atomic_init(&queue->doorbell, 0);
+	atomic_init(&queue->sleeping, 0);
+
+	return 0;
+}
+
+void submit_queue_destroy(SubmitQueue *queue)
+{
+	free(queue->slots);
+	queue->slots = NULL;
+}
+
+/*
+	@brief
+		Push a request from any thread. Never blocks.
+
+	@return 0, or -EAGAIN if the queue is full
+*/
+int submit_queue_push(SubmitQueue *queue, SubmitRequest *req)
+{
+	size_t pos = atomic_load_explicit(&queue->tail, memory_order_relaxed);
+	SubmitSlot *slot;
+
+	for (;;)
+	{
+		slot = &queue->slots[pos & queue->mask];
+		size_t seq = atomic_load_explicit(&slot->seq, memory_order_acquire);
+		intptr_t diff = (intptr_t)seq - (intptr_t)pos;
+
+		if (diff == 0)
+		{
+			if (atomic_compare_exchange_weak_explicit(&queue->tail, &pos, pos + 1,
+													  memory_order_relaxed, memory_order_relaxed))
+				break;
+		}
+		else if (diff < 0)
+		{
+			return -EAGAIN;
+		}
+		else
+		{
+			pos = atomic_load_explicit(&queue->tail, memory_order_relaxed);
+		}
+	}
+
+	slot->req = req;
+	atomic_store_explicit(&slot->seq, pos + 1, memory_order_release);
+
+	/* Ring the doorbell, waking the consumer only if it sleeps */
+	atomic_fetch_add_explicit(&queue->doorbell, 1, memory_order_seq_cst);
+	if (atomic_load_explicit(&queue->sleeping, memory_order_seq_cst))
+		futex_wake(&queue->doorbell, 1);
+
+	return 0;
+}
+
+/*
+	@brief
+		Pop a request, by the consumer thread only
+
+	@return The request, or NULL if the queue is empty
+*/
+SubmitRequest *submit_queue_pop(SubmitQueue *queue)
+{
+	SubmitSlot *slot = &queue->slots[queue->head & queue->mask];
+	SubmitRequest *req;
+
+	if (atomic_load_explicit(&slot->seq, memory_order_acquire) != queue->head + 1)
+		return NULL;
+
+	req = slot->req;
+	atomic_store_explicit(&slot->seq, queue->head + queue->mask + 1, memory_order_release);
+	queue->head++;
+
+	return req;
+}
+
+static void submit_request_complete(SubmitEngine *engine, SubmitRequest *req, ssize_t rc)
+{
+	req->rc = rc;
+
+	if (rc < 0)
+		atomic_fetch_add(&engine->failed, 1);
+	atomic_fetch_add(&engine->completed, 1);
+
+	/* The callback is the last touch of the engine, so it may free the request */
+	if (req->callback)
+	{
+		req->callback(req, req->arg);
+		return;
+	}
+
+	atomic_store_explicit(&req->state, SUBMIT_DONE, memory_order_release);
+	futex_wake(&req->state, 1 << 30);
+}
+
+static void submit_engine_run(SubmitEngine *engine, SubmitRequest *req)
+{
+	PCIeSession *session = engine->session;
+	ssize_t rc;
+
+	switch (req->op)
+	{
+	case SUBMIT_SEND:
+	{
+		FrameBuffer buffer = {(frame *)req->frames, req->n * sizeof(frame)};
+
+		rc = single_channel_send("submit queue", session->h2c_fd, session->user_addr, -1,
+								 session->h2c_addr, &buffer);
+		break;
+	}
+	case SUBMIT_STEP:
+		rc = pcie_session_step(session, req->frames, req->n, &req->stats);
+		if (rc > 0 && req->output)
+		{
+			size_t n = (size_t)rc < req->output_max ? (size_t)rc : req->output_max;
+
+			memcpy(req->output, session->rx.frames, n * sizeof(frame));
+		}
+		break;
+	default:
+		rc = -EINVAL;
+		break;
+	}
+
+	submit_request_complete(engine, req, rc);
+}
+
+/*
+	@brief
+		Output frames of each request in order, as many as its output_n or
+		else its input frames. The last one takes the rest.
+*/
+void submit_split_ordered(const frame *output, size_t n, SubmitRequest *const *reqs, int count, size_t *counts,
+						  void *arg)
+{
+	size_t left = n;
+
+	for (int i = 0; i < count; i++)
+	{
+		size_t want = reqs[i]->output_n ? reqs[i]->output_n : reqs[i]->n;
+
+		if (i == count - 1 || want > left)
+			want = left;
+
+		counts[i] = want;
+		left -= want;
+	}
+}
+
+static int submit_coalesce_packable(const SubmitCoalescer *coalesce, const SubmitRequest *req)
+{
+	return coalesce->max_bytes && (req->op == SUBMIT_SEND || req->op == SUBMIT_STEP) && req->n &&
+		   req->n * sizeof(frame) <= coalesce->max_bytes;
+}
+
+/* Send the packed loop and complete its requests */
+static void submit_coalesce_flush(SubmitEngine *engine)
+{
+	SubmitCoalescer *coalesce = &engine->coalesce;
+	PCIeSession *session = engine->session;
+	uint64_t now = get_time_ns();
+	uint64_t bytes = coalesce->n * sizeof(frame);
+	ssize_t rc;
+
+	if (!coalesce->count)
+		return;
+
+	for (int i = 0; i < coalesce->count; i++)
+	{
+		uint64_t delay = now - coalesce->packed_ns[i];
+
+		coalesce->delay_ns += delay;
+		if (delay > coalesce->delay_ns_max)
+			coalesce->delay_ns_max = delay;
+	}
+
+	coalesce->loops++;
+	coalesce->requests += coalesce->count;
+	coalesce->bytes += bytes;
+
+	if (coalesce->op == SUBMIT_SEND)
+	{
+		rc = single_channel_send_loop("submit queue", session->h2c_fd, session->user_addr, session->h2c_addr,
+									  session->tx.frames, bytes, 0, 1);
+
+		for (int i = 0; i < coalesce->count; i++)
+		{
+			SubmitRequest *req = coalesce->reqs[i];
+
+			submit_request_complete(engine, req, rc == bytes ? (ssize_t)(req->n * sizeof(frame)) : rc < 0 ? rc : -EIO);
+		}
+	}
+	else
+	{
+		size_t counts[SUBMIT_COALESCE_MAX];
+		PCIeStepStats stats;
+		size_t out = 0;
+
+		rc = pcie_session_step(session, session->tx.frames, coalesce->n, &stats);
+		if (rc >= 0)
+			coalesce->split(session->rx.frames, rc, coalesce->reqs, coalesce->count, counts, coalesce->split_arg);
+
+		for (int i = 0; i < coalesce->count; i++)
+		{
+			SubmitRequest *req = coalesce->reqs[i];
+
+			if (rc < 0)
+			{
+				submit_request_complete(engine, req, rc);
+				continue;
+			}
+
+			req->stats = stats;
+			if (req->output)
+				memcpy(req->output, session->rx.frames + out,
+					   (counts[i] < req->output_max ? counts[i] : req->output_max) * sizeof(frame));
+			out += counts[i];
+
+			submit_request_complete(engine, req, counts[i]);
+		}
+	}
+
+	coalesce->count = 0;
+	coalesce->n = 0;
+}
+
+/* Pack a request into the loop in session->tx, sending the loop first if it does not fit */
+static void submit_coalesce_add(SubmitEngine *engine, SubmitRequest *req)
+{
+	SubmitCoalescer *coalesce = &engine->coalesce;
+
+	if (coalesce->count && (req->op != coalesce->op || coalesce->count == SUBMIT_COALESCE_MAX ||
+							(coalesce->n + req->n) * sizeof(frame) > coalesce->max_bytes))
+		submit_coalesce_flush(engine);
+
+	memcpy(engine->session->tx.frames + coalesce->n, req->frames, req->n * sizeof(frame));
+	coalesce->op = req->op;
+	coalesce->reqs[coalesce->count] = req;
+	coalesce->packed_ns[coalesce->count] = get_time_ns();
+	coalesce->count++;
+	coalesce->n += req->n;
+
+	if (coalesce->n * sizeof(frame) >= coalesce->max_bytes)
+		submit_coalesce_flush(engine);
+}
+
+/* @return ns left until the packed loop is due, 0 if it is */
+static uint64_t submit_coalesce_left_ns(const SubmitCoalescer *coalesce)
+{
+	uint64_t due = coalesce->packed_ns[0] + (uint64_t)coalesce->deadline_us * 1000;
+	uint64_t now = get_time_ns();
+
+	return now < due ? due - now : 0;
+}
+
+static void *submit_engine_thread(void *arg)
+{
+	SubmitEngine *engine = (SubmitEngine *)arg;
+	SubmitQueue *queue = &engine->queue;
+	SubmitCoalescer *coalesce = &engine->coalesce;
+	int idle = 0;
+
+	/* Its trace buffer is faulted in before the first request, if tracing */
+	dma_trace_register(&dma_trace);
+
+	for (;;)
+	{
+		unsigned int doorbell = atomic_load_explicit(&queue->doorbell, memory_order_seq_cst);
+		SubmitRequest *req = submit_queue_pop(queue);
+		uint64_t left = 0;
+
+		if (req)
+		{
+			if (submit_coalesce_packable(coalesce, req))
+			{
+				submit_coalesce_add(engine, req);
+			}
+			else
+			{
+				/* In order: the packed loop goes before a request not packed */
+				submit_coalesce_flush(engine);
+				submit_engine_run(engine, req);
+			}
+			idle = 0;
+			continue;
+		}
+
+		if (coalesce->count)
+		{
+			left = submit_coalesce_left_ns(coalesce);
+			if (!left || atomic_load(&engine->stop))
+			{
+				submit_coalesce_flush(engine);
+				idle = 0;
+				continue;
+			}
+		}
+
+		if (atomic_load(&engine->stop))
+			break;
+
+		/* Spin a little while producers are busy, then sleep until the doorbell rings */
+		if (++idle < ENGINE_IDLE_SPINS)
+			continue;
+
+		atomic_store_explicit(&queue->sleeping, 1, memory_order_seq_cst);
+		futex_wait(&queue->doorbell, doorbell, left && left < ENGINE_IDLE_NS ? (long)left : ENGINE_IDLE_NS);
+		atomic_store_explicit(&queue->sleeping, 0, memory_order_seq_cst);
+		idle = 0;
+	}
+
+	return NULL;
+}
+
+/*
+	@brief
+		Start the engine thread. It owns the devices and user registers of
+		session until submit_engine_stop(); no other thread may use them.
+
+	@param engine: Engine to be started
+	@param session: Opened session
+	@param depth: Depth of submission queue
+*/
+int submit_engine_start(SubmitEngine *engine, PCIeSession *session, size_t depth)
+{
+	return submit_engine_start_coalesce(engine, session, depth, 0, 0, NULL, NULL);
+}
+
+/*
+	@brief
+		Start the engine thread, packing small requests into shared loops
+
+	@param max_bytes: Requests up to this are packed, 0 for none, at most a loop
+	@param deadline_us: Wait of the oldest packed request, 0 for SUBMIT_COALESCE_US_DEFAULT
+	@param split: Split of outputs of packed steps, NULL for submit_split_ordered()
+*/
+int submit_engine_start_coalesce(SubmitEngine *engine, PCIeSession *session, size_t depth, size_t max_bytes,
+								 long deadline_us, submit_split_fn split, void *split_arg)
+{
+	size_t capacity = pcie_session_tx_capacity(session) * sizeof(frame);
+	int rc;
+
+	memset(engine, 0, sizeof(*engine));
+	engine->session = session;
+	engine->coalesce.max_bytes = max_bytes < capacity ? max_bytes : capacity;
+	engine->coalesce.deadline_us = deadline_us > 0 ? deadline_us : SUBMIT_COALESCE_US_DEFAULT;
+	engine->coalesce.split = split ? split : submit_split_ordered;
+	engine->coalesce.split_arg = split_arg;
+	atomic_init(&engine->stop, 0);
+	atomic_init(&engine->producers, 0);
+	atomic_init(&engine->completed, 0);
+	atomic_init(&engine->failed, 0);
+
+	rc = submit_queue_init(&engine->queue, depth ? depth : SUBMIT_QUEUE_DEPTH_DEFAULT);
+	if (rc < 0)
+		return rc;
+
+	rc = pthread_create(&engine->thread, NULL, submit_engine_thread, engine);
+	if (rc)
+	{
+		fprintf(stderr, "unable to create engine thread, %d.\n", rc);
+		submit_queue_destroy(&engine->queue);
+		return -rc;
+	}
+
+	return 0;
+}
+
+/*
+	@brief
+		Complete every request queued before, then stop the engine thread.
+		Requests pushed while it stops complete with -ESHUTDOWN, the rest
+		are refused.
+*/
+void submit_engine_stop(SubmitEngine *engine)
+{
+	SubmitRequest *req;
+
+	atomic_store(&engine->stop, 1);
+	atomic_fetch_add(&engine->queue.doorbell, 1);
+	futex_wake(&engine->queue.doorbell, 1);
+
+	pthread_join(engine->thread, NULL);
+
+	/* A push that missed stop is in flight; once none is, no push can land */
+	while (atomic_load(&engine->producers))
+		sched_yield();
+
+	while ((req = submit_queue_pop(&engine->queue)))
+		submit_request_complete(engine, req, -ESHUTDOWN);
+
+	submit_queue_destroy(&engine->queue);
+
+	if (verbose)
+	{
+		fprintf(stdout, "submit engine: %lu request(s) completed, %lu failed.\n",
+				atomic_load(&engine->completed), atomic_load(&engine->failed));
+		if (engine->coalesce.max_bytes)
+			submit_coalesce_report(&engine->coalesce, stdout);
+	}
+}
+
+void submit_coalesce_report(const SubmitCoalescer *coalesce, FILE *fp)
+{
+	double loops = coalesce->loops ? (double)coalesce->loops : 1;
+	double requests = coalesce->requests ? (double)coalesce->requests : 1;
+
+	fprintf(fp, "submit coalesce: %lu loop(s), %lu request(s), %.1f per loop, fill %.1f%%, "
+				"added latency %.1f us mean, %.1f us max\n",
+			coalesce->loops, coalesce->requests, coalesce->requests / loops,
+			100.0 * coalesce->bytes / (loops * DOWNSTREAM_BRAM_SIZE), coalesce->delay_ns / 1e3 / requests,
+			coalesce->delay_ns_max / 1e3);
+}
+
+void submit_request_init(SubmitRequest *req, submit_op_e op, const frame *frames, size_t n)
+{
+	memset(req, 0, sizeof(*req));
+	req->op = op;
+	req->frames = frames;
+	req->n = n;
+	atomic_init(&req->state, SUBMIT_PENDING);
+}
+
+/*
+	@return 0, or -EAGAIN if the queue is full, or -ESHUTDOWN if the engine is stopping
+*/
+int submit_request_push(SubmitEngine *engine, SubmitRequest *req)
+{
+	int rc;
+
+	/* Counted before stop is checked, as submit_engine_stop() sets stop before it counts */
+	atomic_fetch_add(&engine->producers, 1);
+	if (atomic_load(&engine->stop))
+	{
+		atomic_fetch_sub(&engine->producers, 1);
+		return -ESHUTDOWN;
+	}
+
+	atomic_store_explicit(&req->state, SUBMIT_PENDING, memory_order_relaxed);
+	rc = submit_queue_push(&engine->queue, req);
+
+	atomic_fetch_sub(&engine->producers, 1);
+
+	return rc;
+}
+
+int submit_request_done(SubmitRequest *req)
+{
+	return atomic_load_explicit(&req->state, memory_order_acquire) == SUBMIT_DONE;
+}
+
+/*
+	@brief
+		Wait for a request to complete
+
+	@return rc of request
+*/
+ssize_t submit_request_wait(SubmitRequest *req)
+{
+	while (atomic_load_explicit(&req->state, memory_order_acquire) != SUBMIT_DONE)
+		futex_wait(&req->state, SUBMIT_PENDING, 0);
+
+	return req->rc;
+}
@@ -0,0 +1,386 @@
+#include "tx_sched.h"
+#include "dma_utils.h"
+#include "user_regs.h"
+#include "dma_trace.h"
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+
+#define TX_VTIME_SCALE (1 << 16) /* Virtual time of a byte at weight 1 */
+
+extern int verbose;
+
+static const char *const tx_class_names[TX_CLASSES] = {
+	[TX_CLASS_LATENCY] = "latency",
+	[TX_CLASS_NORMAL] = "normal",
+	[TX_CLASS_BULK] = "bulk",
+};
+
+/*
+	Next tenant to send a loop: highest class, then least virtual start time,
+	of the mode of jobs partly sent if any. With lock held.
+*/
+static TxTenant *tx_sched_pick(TxScheduler *sched, uint64_t *vstart)
+{
+	for (int cls = 0; cls < TX_CLASSES; cls++)
+	{
+		TxTenant *best = NULL;
+		uint64_t best_start = 0;
+
+		for (int i = 0; i < sched->num; i++)
+		{
+			TxTenant *tenant = &sched->tenants[i];
+			uint64_t start;
+
+			if (tenant->cls != cls || !tenant->head)
+				continue;
+			if (sched->partial && tenant->head->mode != sched->mode)
+				continue;
+
+			/* A tenant idle for a while starts from now, not from its credit */
+			start = tenant->vfinish > sched->vclock[cls] ? tenant->vfinish : sched->vclock[cls];
+			if (!best || start < best_start)
+			{
+				best = tenant;
+				best_start = start;
+			}
+		}
+
+		if (best)
+		{
+			*vstart = best_start;
+			return best;
+		}
+	}
+
+	return NULL;
+}
+
+static void tx_job_complete(TxScheduler *sched, TxJob *job, ssize_t rc, uint64_t now)
+{
+	TxTenant *tenant = job->tenant;
+
+	tenant->head = job->next;
+	if (!tenant->head)
+		tenant->tail = NULL;
+
+	job->rc = rc;
+	job->done_ns = now;
+	job->done = 1;
+	tenant->wait_ns += now - job->submit_ns - job->busy_ns;
+	if (sched->running == job)
+		sched->running = NULL;
+
+	pthread_cond_broadcast(&sched->done);
+}
+
+/*
+	@brief
+		Switch the FPGA mode between jobs, without a reset so the configuration
+		stays, waiting for it as pcie_session_open() does. Without the lock.
+*/
+static int tx_sched_set_mode(TxScheduler *sched, int mode)
+{
+	uint64_t deadline = get_time_ns() + 1000000000ULL;
+
+	writeUser(sched->user_addr, FPGA_MODE_RO_ADDR, mode);
+
+	while (readUser(sched->user_addr, FPGA_MODE_RO_ADDR) != mode)
+	{
+		if (get_time_ns() > deadline)
+		{
+			fprintf(stderr, "%s, mode error, %d.\n", sched->fname, readUser(sched->user_addr, FPGA_MODE_RO_ADDR));
+			return -EINVAL;
+		}
+	}
+
+	return 0;
+}
+
+static void *tx_sched_thread(void *arg)
+{
+	TxScheduler *sched = (TxScheduler *)arg;
+
+	/* Its trace buffer is faulted in before the first loop, if tracing */
+	dma_trace_register(&dma_trace);
+
+	pthread_mutex_lock(&sched->lock);
+
+	for (;;)
+	{
+		uint64_t vstart, bytes, t0, t1;
+		TxTenant *tenant = tx_sched_pick(sched, &vstart);
+		TxJob *job;
+		ssize_t rc;
+		int idx, loops, last, started;
+
+		if (!tenant)
+		{
+			if (sched->stop)
+				break;
+			pthread_cond_wait(&sched->work, &sched->lock);
+			continue;
+		}
+
+		job = tenant->head;
+
+		/* No job is partly sent in another mode, or it would not be picked */
+		if (job->mode != sched->mode)
+		{
+			pthread_mutex_unlock(&sched->lock);
+			rc = tx_sched_set_mode(sched, job->mode);
+			pthread_mutex_lock(&sched->lock);
+
+			if (rc < 0)
+			{
+				tx_job_complete(sched, job, rc, get_time_ns());
+				continue;
+			}
+			sched->mode = job->mode;
+		}
+
+		bytes = job->bytes - job->sent;
+		if (bytes > DOWNSTREAM_BRAM_SIZE)
+			bytes = DOWNSTREAM_BRAM_SIZE;
+		idx = job->sent / DOWNSTREAM_BRAM_SIZE;
+		loops = (job->bytes + DOWNSTREAM_BRAM_SIZE - 1) / DOWNSTREAM_BRAM_SIZE;
+		last = idx + 1 == loops;
+		started = job->sent > 0;
+
+		sched->vclock[tenant->cls] = vstart;
+		tenant->vfinish = vstart + bytes * TX_VTIME_SCALE / tenant->weight;
+
+		if (sched->running && sched->running != job)
+			sched->preemptions++;
+
+		t0 = get_time_ns();
+		if (!job->start_ns)
+		{
+			job->start_ns = t0;
+			tenant->queue_ns += t0 - job->submit_ns;
+			if (t0 - job->submit_ns > tenant->queue_ns_max)
+				tenant->queue_ns_max = t0 - job->submit_ns;
+		}
+
+		/* The device is driven without the lock, so tenants keep submitting */
+		pthread_mutex_unlock(&sched->lock);
+		rc = single_channel_send_loop(sched->fname, sched->fd, sched->user_addr, sched->addr,
+									  job->frames + job->sent / sizeof(frame), bytes, idx, loops);
+		t1 = get_time_ns();
+		pthread_mutex_lock(&sched->lock);
+
+		job->busy_ns += t1 - t0;
+		tenant->busy_ns += t1 - t0;
+		tenant->loops++;
+		sched->busy_ns += t1 - t0;
+		sched->loops++;
+
+		if (rc != bytes)
+		{
+			fprintf(stderr, "%s, tenant %s, loop @ 0x%lx failed %ld.\n", sched->fname, tenant->name, job->sent, rc);
+			sched->partial -= started;
+			tx_job_complete(sched, job, rc < 0 ? rc : -EIO, t1);
+			continue;
+		}
+
+		job->sent += bytes;
+		tenant->bytes += bytes;
+
+		if (last)
+		{
+			sched->partial -= started;
+			tx_job_complete(sched, job, job->bytes, t1);
+		}
+		else
+		{
+			sched->partial += !started;
+			sched->running = job;
+		}
+	}
+
+	pthread_mutex_unlock(&sched->lock);
+
+	return NULL;
+}
+
+/*
+	@brief
+		Start the scheduler thread, the only one driving fd and the TX registers
+		until tx_sched_stop()
+
+	@param sched: Scheduler to be started
+	@param fname: Name of h2c device
+	@param fd: File description of h2c device
+	@param user_addr: Address of user registers
+	@param addr: Address of where to write, H2C device
+*/
+int tx_sched_start(TxScheduler *sched, char *fname, int fd, void *user_addr, uint64_t addr)
+{
+	int rc;
+
+	memset(sched, 0, sizeof(*sched));
+	sched->fname = fname;
+	sched->fd = fd;
+	sched->user_addr = user_addr;
+	sched->addr = addr;
+	sched->mode = readUser(user_addr, FPGA_MODE_RO_ADDR);
+	sched->start_ns = get_time_ns();
+
+	pthread_mutex_init(&sched->lock, NULL);
+	pthread_cond_init(&sched->work, NULL);
+	pthread_cond_init(&sched->done, NULL);
+
+	rc = pthread_create(&sched->thread, NULL, tx_sched_thread, sched);
+	if (rc)
+	{
+		fprintf(stderr, "unable to create scheduler thread, %d.\n", rc);
+		return -rc;
+	}
+
+	return 0;
+}
+
+/*
+	@brief
+		Complete every queued transfer, then stop the scheduler thread
+*/
+void tx_sched_stop(TxScheduler *sched)
+{
+	pthread_mutex_lock(&sched->lock);
+	sched->stop = 1;
+	pthread_cond_signal(&sched->work);
+	pthread_mutex_unlock(&sched->lock);
+
+	pthread_join(sched->thread, NULL);
+
+	if (verbose)
+		tx_sched_report(sched, stdout);
+
+	pthread_cond_destroy(&sched->done);
+	pthread_cond_destroy(&sched->work);
+	pthread_mutex_destroy(&sched->lock);
+}
+
+/*
+	@param weight: Share of the device among tenants of the same class, at least 1
+
+	@return The tenant, or NULL if there are TX_TENANTS_MAX already
+*/
+TxTenant *tx_sched_add_tenant(TxScheduler *sched, const char *name, tx_class_e cls, uint32_t weight)
+{
+	TxTenant *tenant = NULL;
+
+	if (cls < 0 || cls >= TX_CLASSES)
+		return NULL;
+
+	pthread_mutex_lock(&sched->lock);
+
+	if (sched->num < TX_TENANTS_MAX)
+	{
+		tenant = &sched->tenants[sched->num++];
+		memset(tenant, 0, sizeof(*tenant));
+		tenant->name = name;
+		tenant->cls = cls;
+		tenant->weight = weight ? weight : 1;
+		tenant->vfinish = sched->vclock[cls];
+	}
+
+	pthread_mutex_unlock(&sched->lock);
+
+	return tenant;
+}
+
+/*
+	@brief
+		Queue a transfer of n frames behind the tenant's earlier ones. Frames
+		and job must stay valid until tx_sched_wait() returns.
+
+	@param mode: FPGA mode to send the frames in, FPGA_MODE_CONFIG or FPGA_MODE_WORK
+
+	@return 0, -EINVAL for another mode, or -ESHUTDOWN if the scheduler is stopping
+*/
+int tx_sched_submit(TxScheduler *sched, TxTenant *tenant, TxJob *job, int mode, const frame *frames, size_t n)
+{
+	if (mode != FPGA_MODE_CONFIG && mode != FPGA_MODE_WORK)
+		return -EINVAL;
+
+	memset(job, 0, sizeof(*job));
+	job->tenant = tenant;
+	job->mode = mode;
+	job->frames = frames;
+	job->bytes = n * sizeof(frame);
+
+	pthread_mutex_lock(&sched->lock);
+
+	if (sched->stop)
+	{
+		pthread_mutex_unlock(&sched->lock);
+		return -ESHUTDOWN;
+	}
+
+	job->submit_ns = get_time_ns();
+	tenant->jobs++;
+
+	if (!n)
+	{
+		job->done_ns = job->submit_ns;
+		job->done = 1;
+		pthread_mutex_unlock(&sched->lock);
+		return 0;
+	}
+
+	if (tenant->tail)
+		tenant->tail->next = job;
+	else
+		tenant->head = job;
+	tenant->tail = job;
+
+	pthread_cond_signal(&sched->work);
+	pthread_mutex_unlock(&sched->lock);
+
+	return 0;
+}
+
+/*
+	@return Bytes sent, or -errno
+*/
+ssize_t tx_sched_wait(TxScheduler *sched, TxJob *job)
+{
+	pthread_mutex_lock(&sched->lock);
+	while (!job->done)
+		pthread_cond_wait(&sched->done, &sched->lock);
+	pthread_mutex_unlock(&sched->lock);
+
+	return job->rc;
+}
+
+/*
+	@brief
+		Print queueing delay and device occupancy of every tenant
+*/
+void tx_sched_report(TxScheduler *sched, FILE *fp)
+{
+	uint64_t elapsed;
+
+	pthread_mutex_lock(&sched->lock);
+
+	elapsed = get_time_ns() - sched->start_ns;
+	if (!elapsed)
+		elapsed = 1;
+
+	fprintf(fp, "tenant          class    weight  jobs    loops     queue us (mean/max)  wait us (mean)  occupancy\n");
+	for (int i = 0; i < sched->num; i++)
+	{
+		TxTenant *tenant = &sched->tenants[i];
+		double jobs = tenant->jobs ? (double)tenant->jobs : 1;
+
+		fprintf(fp, "%-15s %-8s %-7u %-7lu %-9lu %-9.1f/%-10.1f %-15.1f %.1f%%\n", tenant->name ? tenant->name : "-",
+				tx_class_names[tenant->cls], tenant->weight, tenant->jobs, tenant->loops,
+				tenant->queue_ns / jobs / 1e3, tenant->queue_ns_max / 1e3, tenant->wait_ns / jobs / 1e3,
+				100.0 * tenant->busy_ns / elapsed);
+	}
+	fprintf(fp, "device: %lu loop(s), %lu preemption(s), %.1f%% busy\n", sched->loops, sched->preemptions,
+			100.0 * sched->busy_ns / elapsed);
+
+	pthread_mutex_unlock(&sched->lock);
+}
@@ -0,0 +1,206 @@
+#include "upstream_rx.h"
+#include "frame_decoder.h"
+#include "dma_trace.h"
+#include "user_regs.h"
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sched.h>
+
+int upstream_rx_mode = UPSTREAM_RX_SINGLE;
+
+extern int verbose;
+
+static ssize_t upstream_pread(void *arg, frame *buf, size_t bytes, uint64_t addr)
+{
+	UpstreamRx *rx = (UpstreamRx *)arg;
+	size_t count = 0;
+
+	while (count < bytes)
+	{
+		ssize_t rc = pread(rx->fd, (char *)buf + count, bytes - count, addr + count);
+
+		if (rc < 0)
+		{
+			fprintf(stderr, "%s, read 0x%lx @ 0x%lx failed %ld.\n", rx->fname, bytes - count, addr + count, rc);
+			perror("read file");
+			return -EIO;
+		}
+		if (!rc)
+			break;
+
+		count += rc;
+	}
+
+	return count;
+}
+
+/* Wait for mask in TX done, like dma_wait_tx_done() but leaving it set */
+static int upstream_wait(UpstreamRx *rx, uint32_t mask)
+{
+	uint64_t deadline = get_time_ns() + (uint64_t)rx->timeout_us * 1000;
+
+	if (rx->wait == DMA_WAIT_SPIN)
+		return pollUser(rx->user_addr, TX_DONE_RW_ADDR, mask, rx->timeout_us, NULL);
+
+	while ((readUser(rx->user_addr, TX_DONE_RW_ADDR) & mask) != mask)
+	{
+		if (get_time_ns() > deadline)
+			return -ETIMEDOUT;
+
+		if (rx->wait == DMA_WAIT_YIELD)
+			sched_yield();
+		else
+			usleep(rx->wait_interval_us);
+	}
+
+	return 0;
+}
+
+/*
+	@param fname: Name of c2h device, for messages
+	@param fd: File description of c2h device
+	@param user_addr: Address of user registers
+	@param addr: Address of upstream BRAM, C2H device
+
+	@return 0, or -ENOMEM
+*/
+int upstream_rx_init(UpstreamRx *rx, char *fname, int fd, void *user_addr, uint64_t addr, upstream_rx_mode_e mode)
+{
+	memset(rx, 0, sizeof(*rx));
+	rx->fname = fname;
+	rx->fd = fd;
+	rx->user_addr = user_addr;
+	rx->addr = addr;
+	rx->mode = mode;
+	rx->timeout_us = IRQ_TIGGERED_TIMEOUT * 1000000L;
+	rx->wait = DMA_WAIT_SPIN;
+	rx->wait_interval_us = 10;
+	rx->read = upstream_pread;
+	rx->read_arg = rx;
+
+	if (posix_memalign((void **)&rx->buf, 4096 /* alignment */, UPSTREAM_BRAM_SIZE))
+	{
+		fprintf(stderr, "OOM %u.\n", UPSTREAM_BRAM_SIZE);
+		rx->buf = NULL;
+		return -ENOMEM;
+	}
+
+	return 0;
+}
+
+/*
+	@brief
+		Select how the FPGA hands over its output. Must be set before the
+		work frames are sent, while the upstream BRAM is empty. Bitstreams
+		without ping-pong have no RX_PINGPONG_RW_ADDR, so callers write it
+		only when ping-pong is requested, or to turn it back off.
+*/
+void upstream_rx_enable(void *user_addr, upstream_rx_mode_e mode)
+{
+	writeUser(user_addr, RX_PINGPONG_RW_ADDR, mode == UPSTREAM_RX_PINGPONG ? RX_PINGPONG_ENABLE : 0);
+}
+
+/*
+	@brief
+		Receive blocks into sink until one holds a STOP_FRAME
+
+	@return # of frames written to sink, or -errno
+*/
+ssize_t upstream_rx_run(UpstreamRx *rx, FrameSink *sink)
+{
+	int pingpong = rx->mode == UPSTREAM_RX_PINGPONG;
+	uint64_t bytes = pingpong ? UPSTREAM_HALF_SIZE : UPSTREAM_BRAM_SIZE;
+	uint64_t start = get_time_ns();
+	int half = 0;
+
+	rx->blocks = 0;
+	rx->frames = 0;
+	rx->wait_ns = 0;
+	rx->read_ns = 0;
+	rx->sink_ns = 0;
+
+	for (;;)
+	{
+		uint32_t mask = pingpong ? RX_HALF_READY_MASK(half) : 0x00000002;
+		uint64_t addr = rx->addr + (pingpong ? half * UPSTREAM_HALF_SIZE : 0);
+		uint64_t t0, t1, t2, t3;
+		size_t n;
+		ssize_t rc;
+
+		t0 = get_time_ns();
+		DMA_TRACE_SPAN_BEGIN("rx wait");
+		rc = upstream_wait(rx, mask);
+		DMA_TRACE_SPAN_END("rx wait", 0);
+		if (rc < 0)
+		{
+			fprintf(stderr, "%s, block %lu not ready.\n", rx->fname, rx->blocks);
+			return -EIO;
+		}
+
+		t1 = get_time_ns();
+		DMA_TRACE_SPAN_BEGIN("c2h read");
+		rc = rx->read(rx->read_arg, rx->buf, bytes, addr);
+		DMA_TRACE_SPAN_END("c2h read", rc > 0 ? rc : 0);
+
+		/* Hand the block back first, so the FPGA refills it while the sink works */
+		if (pingpong)
+			writeUser(rx->user_addr, RX_HALF_ACK_WO_ADDR, RX_HALF_ACK_MASK(half));
+		else
+			updateUser(rx->user_addr, TX_DONE_RW_ADDR, 0x00000002, 0); /* From a fresh read, not the polled value */
+		t2 = get_time_ns();
+
+		if (rc != bytes)
+		{
+			fprintf(stderr, "%s, read failed. Actual read: %ld.\n", rx->fname, rc);
+			return rc < 0 ? rc : -EIO;
+		}
+
+		n = frames_until_stop(rx->buf, bytes / sizeof(frame));
+		if (n)
+		{
+			DMA_TRACE_SPAN_BEGIN("sink write");
+			rc = frame_sink_write(sink, rx->buf, n);
+			DMA_TRACE_SPAN_END("sink write", n * sizeof(frame));
+			if (rc < 0)
+				return rc;
+		}
+		t3 = get_time_ns();
+
+		rx->blocks++;
+		rx->frames += n;
+		rx->wait_ns += t1 - t0;
+		rx->read_ns += t2 - t1;
+		rx->sink_ns += t3 - t2;
+
+		if (n < bytes / sizeof(frame))
+			break;
+
+		if (pingpong)
+			half ^= 1;
+	}
+
+	rx->elapsed_ns = get_time_ns() - start;
+
+	if (verbose)
+		upstream_rx_report(rx, stdout);
+
+	return rx->frames;
+}
+
+void upstream_rx_report(const UpstreamRx *rx, FILE *fp)
+{
+	double elapsed = rx->elapsed_ns ? (double)rx->elapsed_ns : 1;
+
+	fprintf(fp, "upstream %s: %lu block(s), %lu frame(s), %.1f MB/s, wait %.1f%%, read %.1f%%, sink %.1f%%\n",
+			rx->mode == UPSTREAM_RX_PINGPONG ? "ping-pong" : "single", rx->blocks, rx->frames,
+			rx->frames * sizeof(frame) * 1e3 / elapsed, 100.0 * rx->wait_ns / elapsed,
+			100.0 * rx->read_ns / elapsed, 100.0 * rx->sink_ns / elapsed);
+}
+
+void upstream_rx_release(UpstreamRx *rx)
+{
+	free(rx->buf);
+	rx->buf = NULL;
+}
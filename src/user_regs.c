@@ -0,0 +1,231 @@
+#include "utils.h"
+#include "user_regs.h"
+#include <string.h>
+#include <errno.h>
+
+#if __BYTE_ORDER == __LITTLE_ENDIAN
+#define ltohl(x) (x)
+#define htoll(x) (x)
+#elif __BYTE_ORDER == __BIG_ENDIAN
+#define ltohl(x) __bswap_32(x)
+#define htoll(x) __bswap_32(x)
+#endif
+
+/*
+	Order MMIO against normal memory, e.g. frames written into a buffer
+	before the register that tells FPGA to fetch them, as the kernel's
+	wmb()/rmb(). A thread fence alone orders only CPUs: compiler-only on
+	x86 and dmb ish on arm64, neither covering the device.
+*/
+#if defined(__x86_64__) || defined(__i386__)
+#define user_wmb() __asm__ __volatile__("sfence" ::: "memory")
+#define user_rmb() __asm__ __volatile__("lfence" ::: "memory")
+#elif defined(__aarch64__)
+#define user_wmb() __asm__ __volatile__("dsb st" ::: "memory")
+#define user_rmb() __asm__ __volatile__("dsb ld" ::: "memory")
+#else
+#define user_wmb() __sync_synchronize()
+#define user_rmb() __sync_synchronize()
+#endif
+
+#define USER_REG_INDEX(offset) ((offset) >> 2)
+#define USER_REG_SHADOWED(offset) ((offset) >= 0 && (offset) < USER_REGS_NUM * 4)
+
+/*
+	Bits written only by host, which the shadow may stand in for.
+	IRQ_CONTROL_RW_ADDR is not: FPGA sets its bits, so clearIRQ() must read it.
+*/
+static const uint32_t user_owned_mask[USER_REGS_NUM] = {
+#ifdef TRANS_INFO_RW_ADDR
+	[USER_REG_INDEX(TRANS_INFO_RW_ADDR)] = 0xFFFFFF00, /* Low byte is the # of loops left, decremented by FPGA */
+#endif
+};
+
+static void *user_shadow_base; // Mapping the shadow is of
+static uint32_t user_shadow[USER_REGS_NUM];
+static uint32_t user_shadow_valid;
+static UserRegStats user_stats[USER_REGS_NUM];
+
+/* An access through another mapping drops the shadow of the previous one */
+static inline void shadow_bind(void *baseAddr)
+{
+	if (baseAddr != user_shadow_base)
+	{
+		user_shadow_base = baseAddr;
+		user_shadow_valid = 0;
+	}
+}
+
+static inline void shadow_store(void *baseAddr, off_t offset, uint32_t val)
+{
+	shadow_bind(baseAddr);
+	user_shadow[USER_REG_INDEX(offset)] = val;
+	user_shadow_valid |= 1U << USER_REG_INDEX(offset);
+}
+
+void writeUser(void *baseAddr, off_t offset, uint32_t val)
+{
+	user_wmb();
+	*((volatile uint32_t *)(baseAddr + offset)) = htoll(val);
+
+	if (USER_REG_SHADOWED(offset))
+	{
+		shadow_store(baseAddr, offset, val);
+		user_stats[USER_REG_INDEX(offset)].writes++;
+	}
+}
+
+uint32_t readUser(void *baseAddr, off_t offset)
+{
+	uint32_t val = ltohl(*((volatile uint32_t *)(baseAddr + offset)));
+
+	user_rmb();
+
+	if (USER_REG_SHADOWED(offset))
+	{
+		shadow_store(baseAddr, offset, val);
+		user_stats[USER_REG_INDEX(offset)].reads++;
+	}
+
+	return val;
+}
+
+/*
+	@brief
+		Read-modify-write the bits of mask. Reads the device only if the
+		bits out of mask are not all host-owned or not shadowed yet.
+
+	@param baseAddr: Base address of user registers
+	@param offset: Offset of register
+	@param mask: Bits to be modified
+	@param val: New value of the bits
+*/
+void updateUser(void *baseAddr, off_t offset, uint32_t mask, uint32_t val)
+{
+	uint32_t cur;
+
+	if (USER_REG_SHADOWED(offset) && baseAddr == user_shadow_base && (user_shadow_valid & (1U << USER_REG_INDEX(offset))) &&
+		!(~mask & ~user_owned_mask[USER_REG_INDEX(offset)]))
+	{
+		cur = user_shadow[USER_REG_INDEX(offset)];
+		user_stats[USER_REG_INDEX(offset)].saved_reads++;
+	}
+	else
+	{
+		cur = readUser(baseAddr, offset);
+	}
+
+	writeUser(baseAddr, offset, (cur & ~mask) | (val & mask));
+}
+
+/*
+	@brief
+		Store n 64-bit words in order from offset of a mapped BAR window, with
+		one barrier before all of them. Words keep the byte order they have in
+		memory, as a DMA of them would.
+*/
+void writeUser64(void *baseAddr, off_t offset, const uint64_t *vals, size_t n)
+{
+	volatile uint64_t *dst = (volatile uint64_t *)(baseAddr + offset);
+
+	user_wmb();
+
+	for (size_t i = 0; i < n; i++)
+		dst[i] = vals[i];
+}
+
+/*
+	@brief
+		Write a sequence of registers in order, with one barrier before all of them
+*/
+void writeUserBatch(void *baseAddr, const UserRegWrite *seq, int n)
+{
+	user_wmb();
+
+	for (int i = 0; i < n; i++)
+	{
+		*((volatile uint32_t *)(baseAddr + seq[i].offset)) = htoll(seq[i].val);
+
+		if (USER_REG_SHADOWED(seq[i].offset))
+		{
+			shadow_store(baseAddr, seq[i].offset, seq[i].val);
+			user_stats[USER_REG_INDEX(seq[i].offset)].writes++;
+		}
+	}
+}
+
+/*
+	@brief
+		Drop the shadow, e.g. after FPGA is reset
+*/
+void invalidateUserShadow(void)
+{
+	user_shadow_valid = 0;
+}
+
+void getUserStats(off_t offset, UserRegStats *stats)
+{
+	if (USER_REG_SHADOWED(offset))
+		*stats = user_stats[USER_REG_INDEX(offset)];
+	else
+		memset(stats, 0, sizeof(*stats));
+}
+
+void clearUserStats(void)
+{
+	memset(user_stats, 0, sizeof(user_stats));
+}
+
+void dumpUserStats(FILE *fp)
+{
+	fprintf(fp, "register  reads       writes      saved reads\n");
+
+	for (int i = 0; i < USER_REGS_NUM; i++)
+	{
+		if (!user_stats[i].reads && !user_stats[i].writes && !user_stats[i].saved_reads)
+			continue;
+
+		fprintf(fp, "0x%02x      %-10lu  %-10lu  %lu\n", i * 4,
+				user_stats[i].reads, user_stats[i].writes, user_stats[i].saved_reads);
+	}
+}
+
+/*
+	@brief
+		Measure the latency of MMIO accesses to the user registers.
+		Reads FPGA_MODE_RO_ADDR and writes IRQ_CONTROL_RW_ADDR back with its own value.
+
+	@param baseAddr: Base address of user registers
+	@param iters: # of accesses of each kind
+	@param bench: Mean latencies
+*/
+int benchUser(void *baseAddr, int iters, UserRegBench *bench)
+{
+	uint64_t start;
+	uint32_t val;
+
+	if (iters <= 0)
+		return -EINVAL;
+
+	val = readUser(baseAddr, IRQ_CONTROL_RW_ADDR);
+
+	start = get_time_ns();
+	for (int i = 0; i < iters; i++)
+		readUser(baseAddr, FPGA_MODE_RO_ADDR);
+	bench->read_ns = (double)(get_time_ns() - start) / iters;
+
+	start = get_time_ns();
+	for (int i = 0; i < iters; i++)
+		writeUser(baseAddr, IRQ_CONTROL_RW_ADDR, val);
+	/* Posted writes complete after a read of the same device */
+	readUser(baseAddr, IRQ_CONTROL_RW_ADDR);
+	bench->write_ns = (double)(get_time_ns() - start) / iters;
+
+	start = get_time_ns();
+	for (int i = 0; i < iters; i++)
+		updateUser(baseAddr, IRQ_CONTROL_RW_ADDR, 0, 0);
+	readUser(baseAddr, IRQ_CONTROL_RW_ADDR);
+	bench->rmw_ns = (double)(get_time_ns() - start) / iters;
+
+	return 0;
+}
@@ -1,4 +1,5 @@
 #include "utils.h"
+#include "user_regs.h"
 #include <fcntl.h>
 #include <unistd.h>
 #include <errno.h>
@@ -12,6 +13,8 @@ int verbose = 1;
 int verbose = 0;
 #endif
 
+int frames_format = FRAMES_FORMAT_DEFAULT;
+
 #if __BYTE_ORDER == __LITTLE_ENDIAN
 #define ltohl(x) (x)
 #define ltohs(x) (x)
@@ -39,14 +42,49 @@ uint64_t getopt_integer(char *optarg)
     return value;
 }
 
-void writeUser(void *baseAddr, off_t offset, uint32_t val)
+/*
+    @brief
+        Monotonic time in nanoseconds
+*/
+uint64_t get_time_ns(void)
 {
-    *((uint32_t *)(baseAddr + offset)) = htoll(val);
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
 }
 
-uint32_t readUser(void *baseAddr, off_t offset)
+/*
+    @brief
+        Spin on a user register until all bits of mask are set, without sleeping.
+    @param baseAddr: Base address of user registers
+    @param offset: Offset of register
+    @param mask: Bits to wait for
+    @param timeout_us: Timeout in microseconds
+    @param value: Value of register when done, may be NULL
+    @return 0, or -ETIMEDOUT
+*/
+int pollUser(void *baseAddr, off_t offset, uint32_t mask, long timeout_us, uint32_t *value)
 {
-    return ltohl(*((uint32_t *)(baseAddr + offset)));
+    uint64_t deadline = get_time_ns() + (uint64_t)timeout_us * 1000;
+    uint32_t val;
+
+    do
+    {
+        /* Check a few times between reading the clock */
+        for (int i = 0; i < 16; i++)
+        {
+            val = readUser(baseAddr, offset);
+            if ((val & mask) == mask)
+            {
+                if (value)
+                    *value = val;
+                return 0;
+            }
+        }
+    } while (get_time_ns() < deadline);
+
+    return -ETIMEDOUT;
 }
 
 int checkTXCompleted(void *baseAddr, long timeout)
@@ -149,14 +187,13 @@ int eventTriggered(int fd, irq_e irq)
 */
 void clearIRQ(void *baseAddr, irq_e irq)
 {
-    uint32_t irq_value = readUser(baseAddr, IRQ_CONTROL_RW_ADDR);
-
-    writeUser(baseAddr, IRQ_CONTROL_RW_ADDR, irq_value & ~(1 << irq));
+    updateUser(baseAddr, IRQ_CONTROL_RW_ADDR, 1 << irq, 0);
 }
 
 void reset_xdma(void *userAddr)
 {
     writeUser(userAddr, FPGA_MODE_RO_ADDR, FPGA_MODE_RESET);
+    invalidateUserShadow();
 }
 
 int openH2C(char *devName)
@@ -0,0 +1,151 @@
+#include "xdma_perf.h"
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <endian.h>
+
+#include <sys/mman.h>
+
+XdmaPerf xdma_perf = {.fd = -1};
+
+extern int verbose;
+
+/* Registers of the control BAR, little-endian as the user BAR */
+static uint32_t perf_read(const XdmaPerf *perf, off_t offset)
+{
+	return le32toh(*(volatile uint32_t *)((char *)perf->base + offset));
+}
+
+static void perf_write(const XdmaPerf *perf, off_t offset, uint32_t val)
+{
+	*(volatile uint32_t *)((char *)perf->base + offset) = htole32(val);
+}
+
+/* 42-bit counter of LO/HI registers, overflow flagged in HI */
+static uint64_t perf_counter(const XdmaPerf *perf, off_t lo, off_t hi, int *overflow)
+{
+	uint32_t high = perf_read(perf, hi);
+
+	if (high & XDMA_PERF_OVERFLOW)
+		*overflow = 1;
+
+	return (uint64_t)(high & XDMA_PERF_COUNT_MASK) << 32 | perf_read(perf, lo);
+}
+
+/*
+	@brief
+		Map the control BAR
+
+	@param name: Name of control BAR: /dev/xdma0_control, or of a file standing in for it
+
+	@return 0, or -errno and nothing counted
+*/
+int xdma_perf_open(XdmaPerf *perf, const char *name)
+{
+	memset(perf, 0, sizeof(*perf));
+	perf->clock_mhz = XDMA_PERF_CLOCK_MHZ_DEFAULT;
+	perf->beat_bytes = XDMA_PERF_BEAT_BYTES_DEFAULT;
+
+	perf->fd = open(name, O_RDWR | O_SYNC);
+	if (perf->fd < 0)
+	{
+		fprintf(stderr, "unable to open control BAR %s, %d.\n", name, perf->fd);
+		perror("open device");
+		return -ENXIO;
+	}
+
+	perf->base = mmap(NULL, CONTROL_MAP_SIZE, PROT_READ | PROT_WRITE, MAP_SHARED, perf->fd, 0);
+	if (perf->base == MAP_FAILED)
+	{
+		fprintf(stderr, "Memory mapped failed.\n");
+		perror("mmap error\n");
+		perf->base = NULL;
+		close(perf->fd);
+		perf->fd = -1;
+		return -ENOMEM;
+	}
+
+	return 0;
+}
+
+void xdma_perf_close(XdmaPerf *perf)
+{
+	if (perf->base)
+		munmap(perf->base, CONTROL_MAP_SIZE);
+	if (perf->fd >= 0)
+		close(perf->fd);
+
+	memset(perf, 0, sizeof(*perf));
+	perf->fd = -1;
+}
+
+/*
+	@brief
+		Clear the counters of engine and run them, before a transfer
+*/
+void xdma_perf_start(XdmaPerf *perf, off_t engine, XdmaPerfSample *sample)
+{
+	memset(sample, 0, sizeof(*sample));
+	sample->engine = engine;
+
+	if (perf->base)
+	{
+		perf_write(perf, engine + XDMA_PERF_CONTROL_ADDR, XDMA_PERF_CLEAR);
+		perf_write(perf, engine + XDMA_PERF_CONTROL_ADDR, XDMA_PERF_RUN);
+	}
+
+	sample->host_ns = get_time_ns();
+}
+
+/*
+	@brief
+		Stop the counters of the engine of sample and read them, after a transfer
+
+	@param bytes: Moved by the host in the transfer
+*/
+void xdma_perf_stop(XdmaPerf *perf, XdmaPerfSample *sample, uint64_t bytes)
+{
+	sample->host_ns = get_time_ns() - sample->host_ns;
+	sample->bytes = bytes;
+
+	if (!perf->base)
+		return;
+
+	perf_write(perf, sample->engine + XDMA_PERF_CONTROL_ADDR, 0);
+	sample->cycles = perf_counter(perf, sample->engine + XDMA_PERF_CYCLES_LO_ADDR,
+								  sample->engine + XDMA_PERF_CYCLES_HI_ADDR, &sample->overflow);
+	sample->beats = perf_counter(perf, sample->engine + XDMA_PERF_DATA_LO_ADDR,
+								 sample->engine + XDMA_PERF_DATA_HI_ADDR, &sample->overflow);
+}
+
+/*
+	@brief
+		Print device-side throughput and engine utilization next to host
+		timings, and which side bound the transfer
+*/
+void xdma_perf_report(const XdmaPerf *perf, const char *name, const XdmaPerfSample *sample, FILE *fp)
+{
+	double host_ns = sample->host_ns ? (double)sample->host_ns : 1;
+	double engine_ns = sample->cycles * 1e3 / perf->clock_mhz;
+	double busy = sample->cycles ? (double)sample->beats / sample->cycles : 0;
+	double active = engine_ns / host_ns;
+	const char *bound;
+
+	if (!perf->base)
+		return;
+
+	if (active < XDMA_PERF_HOST_BOUND)
+		bound = "host-bound";
+	else if (busy >= XDMA_PERF_LINK_BOUND)
+		bound = "link-bound";
+	else
+		bound = "device-bound";
+
+	fprintf(fp, "%s %s engine: host %.1f us %.1f MB/s, engine %.1f us %.1f MB/s, "
+				"%lu beat(s) in %lu cycle(s), utilization %.1f%%, active %.1f%% of host time, %s%s\n",
+			name, sample->engine >= XDMA_C2H_CHANNEL_OFFSET(0) ? "c2h" : "h2c", sample->host_ns / 1e3,
+			sample->bytes * 1e3 / host_ns, engine_ns / 1e3,
+			engine_ns > 0 ? sample->beats * perf->beat_bytes * 1e3 / engine_ns : 0, sample->beats,
+			sample->cycles, 100.0 * busy, 100.0 * active, bound, sample->overflow ? ", overflowed" : "");
+}
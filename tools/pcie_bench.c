@@ -0,0 +1,598 @@
+/*
+	Microbenchmarks of the per-frame kernels and I/O primitives of the SDK.
+
+	Every benchmark runs its operation over N frames, first for the warmup
+	repetitions and then for the timed ones, and reports min, median, mean,
+	p95 and standard deviation per repetition with ns/frame and MB/s of the
+	median. Results are printed as a table, CSV or JSON lines.
+
+	tx_sched runs a bulk config tenant and a latency work tenant through the
+	TX scheduler, with a thread playing the FPGA on the stand-in registers,
+	so it is skipped on real ones.
+*/
+#include "utils.h"
+#include "config.h"
+#include "dma_utils.h"
+#include "frame_codec.h"
+#include "frame_decoder.h"
+#include "user_regs.h"
+#include "dma_tune.h"
+#include "pio.h"
+#include "tx_sched.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <getopt.h>
+#include <math.h>
+#include <pthread.h>
+#include <sched.h>
+#include <unistd.h>
+
+#include <sys/mman.h>
+
+#define BENCH_FRAMES_DEFAULT (DOWNSTREAM_BRAM_SIZE / 8) /* One BRAM loop */
+#define BENCH_REPS_DEFAULT 20
+#define BENCH_WARMUP_DEFAULT 3
+#define BENCH_REG_OPS (4096) /* Accesses per repetition of register benchmarks */
+#define BENCH_SCHED_JOBS (4)   /* Config jobs and work jobs of a tx_sched repetition */
+
+enum bench_output {
+	BENCH_OUTPUT_TEXT,
+	BENCH_OUTPUT_CSV,
+	BENCH_OUTPUT_JSON,
+};
+
+typedef struct BenchCtx_TypeDef {
+	size_t n;          // # of frames
+	frame *frames;     // Random frames, 4K-aligned
+	frame *out;        // Output frames, 4K-aligned
+	char *txt;         // n text lines
+	char *scratch;     // n text lines written by the benchmarks
+	int *ints;
+	char bin_name[64]; // Temporary files of frames
+	char txt_name[64];
+	char bar_name[64]; // File standing in for the user BAR
+	char h2c_name[64]; // File standing in for the h2c channel
+	int bin_fd;
+	int txt_fd;
+	int bar_fd;
+	int h2c_fd;
+	PioWindow pio;     // Its window of the downstream BRAM
+	size_t pio_frames; // Frames of a tiny loop, those of n the window holds
+	void *user_addr;   // User registers, or anonymous memory standing in for them
+	int stand_in;      // user_addr is anonymous memory
+	size_t ops;        // # of items processed by one repetition
+	size_t bytes;      // Bytes processed by one repetition
+} BenchCtx;
+
+typedef struct Bench_TypeDef {
+	const char *name;
+	int (*run)(BenchCtx *ctx);
+	int stand_in; // Runs on the stand-in registers only
+} Bench;
+
+/* FPGA played on the stand-in registers */
+typedef struct BenchFpga_TypeDef {
+	volatile uint32_t *regs;
+	int stop;
+	uint64_t loops;
+} BenchFpga;
+
+extern int verbose;
+
+static volatile uint64_t bench_sink; /* Keeps results alive */
+
+static int bench_long2bin(BenchCtx *ctx)
+{
+	for (size_t i = 0; i < ctx->n; i++)
+		long2bin(&ctx->frames[i], ctx->scratch + i * FRAME_TXT_LINE_LEN);
+
+	ctx->ops = ctx->n;
+	ctx->bytes = ctx->n * sizeof(frame);
+	return 0;
+}
+
+static int bench_int2bin(BenchCtx *ctx)
+{
+	char bin[33];
+
+	for (size_t i = 0; i < ctx->n; i++)
+	{
+		int2bin(&ctx->ints[i], bin);
+		bench_sink += bin[31];
+	}
+
+	ctx->ops = ctx->n;
+	ctx->bytes = ctx->n * sizeof(int);
+	return 0;
+}
+
+static int bench_txt2frames(BenchCtx *ctx)
+{
+	size_t consumed;
+	ssize_t rc = txt2frames(ctx->txt, ctx->n * FRAME_TXT_LINE_LEN, ctx->out, ctx->n, &consumed);
+
+	ctx->ops = ctx->n;
+	ctx->bytes = ctx->n * FRAME_TXT_LINE_LEN;
+	return rc == ctx->n ? 0 : -EINVAL;
+}
+
+static int bench_read_bin(BenchCtx *ctx)
+{
+	FrameBuffer buffer = {ctx->out, 0};
+	ssize_t rc = read_bin_to_buffer(ctx->bin_name, ctx->bin_fd, &buffer, ctx->n * sizeof(frame), 0);
+
+	ctx->ops = ctx->n;
+	ctx->bytes = ctx->n * sizeof(frame);
+	return rc == ctx->n * sizeof(frame) ? 0 : -EIO;
+}
+
+static int bench_read_txt(BenchCtx *ctx)
+{
+	FrameBuffer buffer = {ctx->out, ctx->n * sizeof(frame)};
+	ssize_t rc = read_txt_to_buffer(ctx->txt_name, ctx->txt_fd, &buffer, 0);
+
+	ctx->ops = ctx->n;
+	ctx->bytes = ctx->n * FRAME_TXT_LINE_LEN;
+	return rc == ctx->n * sizeof(frame) ? 0 : -EIO;
+}
+
+static int bench_receive(BenchCtx *ctx)
+{
+	FrameBuffer buffer = {ctx->out, UPSTREAM_BRAM_SIZE};
+	ssize_t rc;
+
+	/* It seeks only to a nonzero base */
+	lseek(ctx->bin_fd, 0, SEEK_SET);
+	rc = receive_to_buffer(ctx->bin_name, ctx->bin_fd, &buffer, 0);
+
+	ctx->ops = UPSTREAM_BRAM_SIZE / sizeof(frame);
+	ctx->bytes = UPSTREAM_BRAM_SIZE;
+	return rc == UPSTREAM_BRAM_SIZE ? 0 : -EIO;
+}
+
+static int bench_frames_until_stop(BenchCtx *ctx)
+{
+	bench_sink += frames_until_stop(ctx->frames, ctx->n);
+
+	ctx->ops = ctx->n;
+	ctx->bytes = ctx->n * sizeof(frame);
+	return 0;
+}
+
+static int bench_read_user(BenchCtx *ctx)
+{
+	for (int i = 0; i < BENCH_REG_OPS; i++)
+		bench_sink += readUser(ctx->user_addr, FPGA_MODE_RO_ADDR);
+
+	ctx->ops = BENCH_REG_OPS;
+	ctx->bytes = BENCH_REG_OPS * sizeof(uint32_t);
+	return 0;
+}
+
+static int bench_write_user(BenchCtx *ctx)
+{
+	for (int i = 0; i < BENCH_REG_OPS; i++)
+		writeUser(ctx->user_addr, IRQ_CONTROL_RW_ADDR, 0);
+
+	/* Posted writes complete after a read of the same device */
+	readUser(ctx->user_addr, IRQ_CONTROL_RW_ADDR);
+
+	ctx->ops = BENCH_REG_OPS;
+	ctx->bytes = BENCH_REG_OPS * sizeof(uint32_t);
+	return 0;
+}
+
+/* Tiny loop by PIO stores into the stand-in window */
+static int bench_pio_write(BenchCtx *ctx)
+{
+	ssize_t rc = pio_write(&ctx->pio, ctx->frames, ctx->pio_frames * sizeof(frame), DOWNSTREAM_BRAM_CH1_ADDR);
+
+	ctx->ops = ctx->pio_frames;
+	ctx->bytes = ctx->pio_frames * sizeof(frame);
+	return rc == ctx->bytes ? 0 : -EIO;
+}
+
+/* The same loop by the write() path of DMA, into the stand-in file */
+static int bench_dma_write(BenchCtx *ctx)
+{
+	ssize_t rc = dma_write(ctx->bar_fd, ctx->frames, ctx->pio_frames * sizeof(frame), PIO_BRAM_WINDOW_OFFSET,
+						   &dma_profile);
+
+	ctx->ops = ctx->pio_frames;
+	ctx->bytes = ctx->pio_frames * sizeof(frame);
+	return rc == ctx->bytes ? 0 : -EIO;
+}
+
+/* Take every loop requested: count it down in TRANS_INFO and set TX done */
+static void *bench_fpga_thread(void *arg)
+{
+	BenchFpga *fpga = (BenchFpga *)arg;
+	volatile uint32_t *regs = fpga->regs;
+
+	while (!__atomic_load_n(&fpga->stop, __ATOMIC_ACQUIRE))
+	{
+		uint32_t info;
+
+		if (regs[TX_STATUS_RW_ADDR / 4] != REQ_TX_SENDING)
+		{
+			sched_yield();
+			continue;
+		}
+
+		info = regs[TRANS_INFO_RW_ADDR / 4];
+		regs[TRANS_INFO_RW_ADDR / 4] = (info & 0xFFFFFF00) | ((info - 1) & 0x000000FF);
+		regs[TX_STATUS_RW_ADDR / 4] = TX_STATUS_DONE;
+		__atomic_thread_fence(__ATOMIC_RELEASE);
+		regs[TX_DONE_RW_ADDR / 4] |= 0x00000001;
+		fpga->loops++;
+	}
+
+	return NULL;
+}
+
+/* Work jobs of one tiny loop each, submitted with a config upload cut into jobs of n frames */
+static int bench_tx_sched(BenchCtx *ctx)
+{
+	BenchFpga fpga = {(volatile uint32_t *)ctx->user_addr, 0, 0};
+	TxJob config_jobs[BENCH_SCHED_JOBS], work_jobs[BENCH_SCHED_JOBS];
+	TxTenant *config, *work;
+	DmaProfile profile = dma_profile;
+	TxScheduler sched;
+	pthread_t thread;
+	int rc;
+
+	if (pthread_create(&thread, NULL, bench_fpga_thread, &fpga))
+		return -EAGAIN;
+
+	/* The untuned profile sleeps a second before each check of TX done */
+	dma_profile.wait = DMA_WAIT_SPIN;
+
+	rc = tx_sched_start(&sched, ctx->h2c_name, ctx->h2c_fd, ctx->user_addr, DOWNSTREAM_BRAM_CH1_ADDR);
+	if (!rc)
+	{
+		config = tx_sched_add_tenant(&sched, "config", TX_CLASS_BULK, 1);
+		work = tx_sched_add_tenant(&sched, "work", TX_CLASS_LATENCY, 1);
+
+		for (int i = 0; i < BENCH_SCHED_JOBS; i++)
+		{
+			tx_sched_submit(&sched, config, &config_jobs[i], FPGA_MODE_CONFIG, ctx->frames, ctx->n);
+			tx_sched_submit(&sched, work, &work_jobs[i], FPGA_MODE_WORK, ctx->frames, ctx->pio_frames);
+		}
+
+		for (int i = 0; i < BENCH_SCHED_JOBS; i++)
+		{
+			if (tx_sched_wait(&sched, &config_jobs[i]) != ctx->n * sizeof(frame) ||
+				tx_sched_wait(&sched, &work_jobs[i]) != ctx->pio_frames * sizeof(frame))
+				rc = -EIO;
+		}
+
+		tx_sched_stop(&sched);
+	}
+
+	__atomic_store_n(&fpga.stop, 1, __ATOMIC_RELEASE);
+	pthread_join(thread, NULL);
+	dma_profile = profile;
+
+	ctx->ops = BENCH_SCHED_JOBS * (ctx->n + ctx->pio_frames);
+	ctx->bytes = ctx->ops * sizeof(frame);
+	return rc;
+}
+
+static const Bench benches[] = {
+	{"long2bin", bench_long2bin},
+	{"int2bin", bench_int2bin},
+	{"txt2frames", bench_txt2frames},
+	{"read_bin_to_buffer", bench_read_bin},
+	{"read_txt_to_buffer", bench_read_txt},
+	{"receive_to_buffer", bench_receive},
+	{"frames_until_stop", bench_frames_until_stop},
+	{"readUser", bench_read_user},
+	{"writeUser", bench_write_user},
+	{"pio_write", bench_pio_write},
+	{"dma_write", bench_dma_write},
+	{"tx_sched", bench_tx_sched, 1},
+};
+
+static int cmp_u64(const void *a, const void *b)
+{
+	uint64_t x = *(const uint64_t *)a, y = *(const uint64_t *)b;
+
+	return x < y ? -1 : x > y;
+}
+
+/* xorshift64*, so runs are reproducible */
+static uint64_t bench_rand(uint64_t *state)
+{
+	*state ^= *state >> 12;
+	*state ^= *state << 25;
+	*state ^= *state >> 27;
+	return *state * 0x2545F4914F6CDD1DULL;
+}
+
+static int bench_setup(BenchCtx *ctx, size_t n, const char *user_reg)
+{
+	uint64_t state = 0x9E3779B97F4A7C15ULL;
+	size_t bytes = n * sizeof(frame) > UPSTREAM_BRAM_SIZE ? n * sizeof(frame) : UPSTREAM_BRAM_SIZE;
+	FILE *fp;
+
+	memset(ctx, 0, sizeof(*ctx));
+	ctx->n = n;
+	ctx->bin_fd = -1;
+	ctx->txt_fd = -1;
+	ctx->bar_fd = -1;
+	ctx->h2c_fd = -1;
+	ctx->pio_frames = n < PIO_BRAM_WINDOW_SIZE / sizeof(frame) ? n : PIO_BRAM_WINDOW_SIZE / sizeof(frame);
+
+	if (posix_memalign((void **)&ctx->frames, 4096, bytes) || posix_memalign((void **)&ctx->out, 4096, bytes))
+		return -ENOMEM;
+
+	ctx->txt = (char *)malloc(n * FRAME_TXT_LINE_LEN + 1);
+	ctx->scratch = (char *)malloc(n * FRAME_TXT_LINE_LEN + 1);
+	ctx->ints = (int *)malloc(n * sizeof(int));
+	if (!ctx->txt || !ctx->scratch || !ctx->ints)
+		return -ENOMEM;
+
+	for (size_t i = 0; i < bytes / sizeof(frame); i++)
+	{
+		/* No STOP_FRAME, so scans run through all frames */
+		ctx->frames[i] = bench_rand(&state) & ~1ULL;
+		if (i < n)
+			ctx->ints[i] = (int)ctx->frames[i];
+	}
+
+	for (size_t i = 0; i < n; i++)
+	{
+		long2bin(&ctx->frames[i], ctx->txt + i * FRAME_TXT_LINE_LEN);
+		ctx->txt[i * FRAME_TXT_LINE_LEN + FRAME_TXT_CHARS] = '\n';
+	}
+
+	/* Files of the same frames, left in page cache by the first read */
+	snprintf(ctx->bin_name, sizeof(ctx->bin_name), "/tmp/pcie_bench_%d.bin", getpid());
+	snprintf(ctx->txt_name, sizeof(ctx->txt_name), "/tmp/pcie_bench_%d.txt", getpid());
+	snprintf(ctx->bar_name, sizeof(ctx->bar_name), "/tmp/pcie_bench_%d.bar", getpid());
+	snprintf(ctx->h2c_name, sizeof(ctx->h2c_name), "/tmp/pcie_bench_%d.h2c", getpid());
+
+	fp = fopen(ctx->bin_name, "wb");
+	if (!fp || fwrite(ctx->frames, 1, bytes, fp) != bytes || fclose(fp))
+		return -EIO;
+	fp = fopen(ctx->txt_name, "wb");
+	if (!fp || fwrite(ctx->txt, 1, n * FRAME_TXT_LINE_LEN, fp) != n * FRAME_TXT_LINE_LEN || fclose(fp))
+		return -EIO;
+
+	ctx->bin_fd = open(ctx->bin_name, O_RDONLY);
+	ctx->txt_fd = open(ctx->txt_name, O_RDONLY);
+	if (ctx->bin_fd < 0 || ctx->txt_fd < 0)
+		return -EIO;
+
+	ctx->bar_fd = open(ctx->bar_name, O_RDWR | O_CREAT | O_TRUNC, 0644);
+	if (ctx->bar_fd < 0 || ftruncate(ctx->bar_fd, PIO_BRAM_WINDOW_OFFSET + PIO_BRAM_WINDOW_SIZE) ||
+		pio_map(&ctx->pio, ctx->bar_fd, PIO_BRAM_WINDOW_OFFSET, PIO_BRAM_WINDOW_SIZE, DOWNSTREAM_BRAM_CH1_ADDR))
+		return -EIO;
+
+	/* Sparse, loops land at DOWNSTREAM_BRAM_CH1_ADDR */
+	ctx->h2c_fd = open(ctx->h2c_name, O_RDWR | O_CREAT | O_TRUNC, 0644);
+	if (ctx->h2c_fd < 0)
+		return -EIO;
+
+	if (user_reg)
+	{
+		int fd = open(user_reg, O_RDWR | O_SYNC);
+
+		if (fd < 0)
+		{
+			fprintf(stderr, "unable to open user registers %s, %d.\n", user_reg, fd);
+			perror("open device");
+			return -ENXIO;
+		}
+
+		ctx->user_addr = mmap(NULL, MAP_SIZE, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+		close(fd);
+	}
+	else
+	{
+		ctx->user_addr = mmap(NULL, MAP_SIZE, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+		ctx->stand_in = 1;
+	}
+
+	if (ctx->user_addr == MAP_FAILED)
+	{
+		ctx->user_addr = NULL;
+		perror("mmap error");
+		return -ENOMEM;
+	}
+
+	return 0;
+}
+
+static void bench_teardown(BenchCtx *ctx)
+{
+	if (ctx->bin_fd >= 0)
+		close(ctx->bin_fd);
+	if (ctx->txt_fd >= 0)
+		close(ctx->txt_fd);
+	if (ctx->bin_name[0])
+		unlink(ctx->bin_name);
+	if (ctx->txt_name[0])
+		unlink(ctx->txt_name);
+	pio_unmap(&ctx->pio);
+	if (ctx->bar_fd >= 0)
+		close(ctx->bar_fd);
+	if (ctx->bar_name[0])
+		unlink(ctx->bar_name);
+	if (ctx->h2c_fd >= 0)
+		close(ctx->h2c_fd);
+	if (ctx->h2c_name[0])
+		unlink(ctx->h2c_name);
+	if (ctx->user_addr)
+		munmap(ctx->user_addr, MAP_SIZE);
+
+	free(ctx->frames);
+	free(ctx->out);
+	free(ctx->txt);
+	free(ctx->scratch);
+	free(ctx->ints);
+}
+
+static int bench_run(const Bench *bench, BenchCtx *ctx, int warmup, int reps, int output)
+{
+	uint64_t *ns = (uint64_t *)calloc(reps, sizeof(uint64_t));
+	double mean = 0, var = 0, median, per_op, mbps;
+	uint64_t p95;
+
+	if (!ns)
+		return -ENOMEM;
+
+	for (int i = 0; i < warmup + reps; i++)
+	{
+		uint64_t start = get_time_ns();
+		int rc = bench->run(ctx);
+		uint64_t end = get_time_ns();
+
+		if (rc < 0)
+		{
+			fprintf(stderr, "%s failed, %d.\n", bench->name, rc);
+			free(ns);
+			return rc;
+		}
+
+		if (i >= warmup)
+			ns[i - warmup] = end - start;
+	}
+
+	for (int i = 0; i < reps; i++)
+		mean += ns[i];
+	mean /= reps;
+	for (int i = 0; i < reps; i++)
+		var += (ns[i] - mean) * (ns[i] - mean);
+	var = reps > 1 ? var / (reps - 1) : 0;
+
+	qsort(ns, reps, sizeof(uint64_t), cmp_u64);
+	median = reps % 2 ? ns[reps / 2] : (ns[reps / 2 - 1] + ns[reps / 2]) / 2.0;
+	p95 = ns[(reps * 95 + 99) / 100 - 1];
+	per_op = median / ctx->ops;
+	mbps = ctx->bytes * 1e3 / median;
+
+	switch (output)
+	{
+	case BENCH_OUTPUT_CSV:
+		fprintf(stdout, "%s,%zu,%d,%lu,%.0f,%.0f,%lu,%.0f,%.3f,%.1f\n", bench->name, ctx->ops, reps,
+				ns[0], median, mean, p95, sqrt(var), per_op, mbps);
+		break;
+	case BENCH_OUTPUT_JSON:
+		fprintf(stdout, "{\"name\":\"%s\",\"ops\":%zu,\"reps\":%d,\"min_ns\":%lu,\"median_ns\":%.0f,"
+						"\"mean_ns\":%.0f,\"p95_ns\":%lu,\"stddev_ns\":%.0f,\"ns_per_op\":%.3f,\"mb_per_s\":%.1f}\n",
+				bench->name, ctx->ops, reps, ns[0], median, mean, p95, sqrt(var), per_op, mbps);
+		break;
+	default:
+		fprintf(stdout, "%-20s %-8zu %-11lu %-11.0f %-11.0f %-11lu %-9.1f%% %-9.3f %.1f\n", bench->name, ctx->ops,
+				ns[0], median, mean, p95, mean ? 100.0 * sqrt(var) / mean : 0, per_op, mbps);
+		break;
+	}
+
+	free(ns);
+	return 0;
+}
+
+static void usage(const char *name)
+{
+	fprintf(stdout, "usage: %s [OPTIONS] [BENCHMARK...]\n\n", name);
+	fprintf(stdout, "  -n frames per repetition (defaults to %d)\n", BENCH_FRAMES_DEFAULT);
+	fprintf(stdout, "  -r timed repetitions (defaults to %d)\n", BENCH_REPS_DEFAULT);
+	fprintf(stdout, "  -w warmup repetitions (defaults to %d)\n", BENCH_WARMUP_DEFAULT);
+	fprintf(stdout, "  -o output, text, csv or json (defaults to text)\n");
+	fprintf(stdout, "  -u user registers to time readUser/writeUser on, e.g. %s\n", USER_REG_NAME_DEFAULT);
+	fprintf(stdout, "     (defaults to anonymous memory, timing the accessors only; tx_sched needs it)\n");
+	fprintf(stdout, "  -l list benchmarks and exit\n");
+}
+
+int main(int argc, char *argv[])
+{
+	BenchCtx ctx;
+	size_t n = BENCH_FRAMES_DEFAULT;
+	int reps = BENCH_REPS_DEFAULT, warmup = BENCH_WARMUP_DEFAULT;
+	int output = BENCH_OUTPUT_TEXT;
+	char *user_reg = NULL;
+	int cmd_opt, rc = 0;
+
+	while ((cmd_opt = getopt(argc, argv, "hln:r:w:o:u:")) != -1)
+	{
+		switch (cmd_opt)
+		{
+		case 'n':
+			n = getopt_integer(optarg);
+			break;
+		case 'r':
+			reps = getopt_integer(optarg);
+			break;
+		case 'w':
+			warmup = getopt_integer(optarg);
+			break;
+		case 'o':
+			if (!strcmp(optarg, "csv"))
+				output = BENCH_OUTPUT_CSV;
+			else if (!strcmp(optarg, "json"))
+				output = BENCH_OUTPUT_JSON;
+			else
+				output = BENCH_OUTPUT_TEXT;
+			break;
+		case 'u':
+			user_reg = optarg;
+			break;
+		case 'l':
+			for (int i = 0; i < sizeof(benches) / sizeof(benches[0]); i++)
+				fprintf(stdout, "%s\n", benches[i].name);
+			return 0;
+		case 'h':
+		default:
+			usage(argv[0]);
+			return 0;
+		}
+	}
+
+	if (!n || reps <= 0 || warmup < 0)
+	{
+		usage(argv[0]);
+		return 1;
+	}
+
+	/* The SDK prints every frame read when verbose */
+	verbose = 0;
+
+	rc = bench_setup(&ctx, n, user_reg);
+	if (rc < 0)
+	{
+		fprintf(stderr, "benchmark setup failed, %d.\n", rc);
+		bench_teardown(&ctx);
+		return 1;
+	}
+
+	if (output == BENCH_OUTPUT_CSV)
+		fprintf(stdout, "name,ops,reps,min_ns,median_ns,mean_ns,p95_ns,stddev_ns,ns_per_op,mb_per_s\n");
+	else if (output == BENCH_OUTPUT_TEXT)
+		fprintf(stdout, "%-20s %-8s %-11s %-11s %-11s %-11s %-10s %-9s %s\n", "benchmark", "ops", "min ns",
+				"median ns", "mean ns", "p95 ns", "cv", "ns/op", "MB/s");
+
+	for (int i = 0; i < sizeof(benches) / sizeof(benches[0]); i++)
+	{
+		int selected = optind == argc;
+
+		for (int j = optind; j < argc && !selected; j++)
+			selected = !strcmp(argv[j], benches[i].name);
+
+		if (selected && benches[i].stand_in && !ctx.stand_in)
+		{
+			fprintf(stderr, "%s runs on the stand-in registers only, skipped.\n", benches[i].name);
+			continue;
+		}
+
+		if (selected && bench_run(&benches[i], &ctx, warmup, reps, output) < 0)
+			rc = 1;
+	}
+
+	bench_teardown(&ctx);
+
+	return rc;
+}
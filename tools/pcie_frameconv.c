@@ -0,0 +1,646 @@
+/*
+	Offline converter of frames files between txt, bin, native and pack,
+	on all cores.
+
+	Files are cut into chunks of up to one BRAM loop of frames: line-aligned
+	ranges of text, ranges of binary frames, or the blocks of a packed file.
+	Chunks go in batches to a pool of workers. Each worker starts on its own
+	contiguous range of the batch and, once it runs dry, steals the upper
+	half of what is left to another worker. Chunks are decoded and encoded
+	with the SDK's codecs; binary and text outputs are written in place by
+	the worker, packed blocks in order once their batch is done.
+
+	bin is big-endian and native in host order, so converting between them
+	swaps the byte order.
+*/
+#include "utils.h"
+#include "config.h"
+#include "frame_codec.h"
+#include "frame_pack.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <getopt.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <byteswap.h>
+#include <endian.h>
+
+#include <sys/stat.h>
+
+#define FRAMECONV_CHUNK_FRAMES FRAME_PACK_BLOCK_FRAMES /* As frame_pack_write() blocks */
+#define FRAMECONV_BATCH_CHUNKS (8)                     /* Per worker */
+#define FRAMECONV_THREADS_MAX (256)
+
+extern int verbose;
+
+typedef struct ConvChunk_TypeDef {
+	uint64_t first;  // First frame
+	uint32_t frames;
+	off_t offset;    // Of the block in a packed input
+	uint8_t *block;  // Packed output: header and payload
+	size_t bytes;
+} ConvChunk;
+
+struct FrameConv_TypeDef;
+
+/* Chunks [lo, hi) of the batch left to a worker, taken from lo, stolen from hi */
+typedef struct ConvWorker_TypeDef {
+	struct FrameConv_TypeDef *conv;
+	int id;
+	pthread_t thread;
+	pthread_mutex_t lock;
+	uint64_t lo;
+	uint64_t hi;
+
+	char *txt;       // FRAMECONV_CHUNK_FRAMES text lines
+	frame *frames;   // FRAMECONV_CHUNK_FRAMES frames
+	FramePackReader reader;
+
+	uint64_t chunks; // Converted
+	uint64_t steals;
+} ConvWorker;
+
+typedef struct FrameConv_TypeDef {
+	char *in_name;
+	char *out_name;
+	int in_fd;
+	int out_fd;
+	int in_format;
+	int out_format;
+	uint64_t frames;  // # of frames in input
+	off_t in_size;
+
+	int threads;
+	ConvWorker *workers;
+	ConvChunk *chunks; // Of the batch
+	uint64_t batch;    // # of chunks in the batch
+
+	pthread_mutex_t lock;
+	pthread_cond_t start;
+	pthread_cond_t done;
+	uint64_t generation;
+	int busy;          // Workers in the batch
+	int quit;
+	int err;           // First error of a chunk
+} FrameConv;
+
+/* Frames of a chunk from the input */
+static int conv_decode(FrameConv *conv, ConvWorker *w, const ConvChunk *chunk)
+{
+	size_t bytes, consumed;
+	ssize_t rc;
+
+	switch (conv->in_format)
+	{
+	case FRAMES_FORMAT_TXT:
+		bytes = (size_t)chunk->frames * FRAME_TXT_LINE_LEN;
+		rc = pread(conv->in_fd, w->txt, bytes, chunk->first * FRAME_TXT_LINE_LEN);
+		/* The last line may end without '\n' */
+		if (rc == bytes - 1 && chunk->first + chunk->frames == conv->frames)
+			w->txt[rc++] = '\n';
+		if (rc != bytes)
+			break;
+
+		rc = txt2frames(w->txt, bytes, w->frames, chunk->frames, &consumed);
+		if (rc != chunk->frames)
+		{
+			fprintf(stderr, "%s, line %lu malformed.\n", conv->in_name,
+					chunk->first + consumed / FRAME_TXT_LINE_LEN + 1);
+			return -EINVAL;
+		}
+		return 0;
+
+	case FRAMES_FORMAT_BIN:
+	case FRAMES_FORMAT_NATIVE:
+		bytes = (size_t)chunk->frames * sizeof(frame);
+		rc = pread(conv->in_fd, w->frames, bytes, chunk->first * sizeof(frame));
+		if (rc != bytes)
+			break;
+
+		if (conv->in_format == FRAMES_FORMAT_BIN)
+			for (uint32_t i = 0; i < chunk->frames; i++)
+				w->frames[i] = bswap_64(w->frames[i]);
+		return 0;
+
+	case FRAMES_FORMAT_PACK:
+		/* Blocks decode on their own: point the reader at this one */
+		w->reader.offset = chunk->offset;
+		w->reader.frames_out = chunk->first;
+		w->reader.block_left = 0;
+		bytes = (size_t)chunk->frames * sizeof(frame);
+		rc = frame_pack_read(&w->reader, w->frames, bytes);
+		if (rc != bytes)
+			return rc < 0 ? rc : -EINVAL;
+		return 0;
+
+	default:
+		return -EINVAL;
+	}
+
+	fprintf(stderr, "%s, read 0x%lx @ frame %lu failed %ld.\n", conv->in_name, bytes, chunk->first, rc);
+	return -EIO;
+}
+
+/* Frames of a chunk to the output, or to its packed block */
+static int conv_encode(FrameConv *conv, ConvWorker *w, ConvChunk *chunk)
+{
+	FramePackBlock *bh;
+	size_t bytes;
+	off_t offset;
+	ssize_t rc;
+	void *buf;
+
+	switch (conv->out_format)
+	{
+	case FRAMES_FORMAT_TXT:
+		for (uint32_t i = 0; i < chunk->frames; i++)
+		{
+			long2bin(&w->frames[i], w->txt + (size_t)i * FRAME_TXT_LINE_LEN);
+			w->txt[(size_t)i * FRAME_TXT_LINE_LEN + FRAME_TXT_CHARS] = '\n';
+		}
+		buf = w->txt;
+		bytes = (size_t)chunk->frames * FRAME_TXT_LINE_LEN;
+		offset = chunk->first * FRAME_TXT_LINE_LEN;
+		break;
+
+	case FRAMES_FORMAT_BIN:
+	case FRAMES_FORMAT_NATIVE:
+		if (conv->out_format == FRAMES_FORMAT_BIN)
+			for (uint32_t i = 0; i < chunk->frames; i++)
+				w->frames[i] = bswap_64(w->frames[i]);
+		buf = w->frames;
+		bytes = (size_t)chunk->frames * sizeof(frame);
+		offset = chunk->first * sizeof(frame);
+		break;
+
+	case FRAMES_FORMAT_PACK:
+		bh = (FramePackBlock *)chunk->block;
+		bytes = frame_pack_encode_block(w->frames, chunk->frames, chunk->block + sizeof(FramePackBlock));
+		bh->frames = htole32(chunk->frames);
+		bh->bytes = htole32(bytes);
+		chunk->bytes = bytes + sizeof(FramePackBlock);
+		return 0;
+
+	default:
+		return -EINVAL;
+	}
+
+	rc = pwrite(conv->out_fd, buf, bytes, offset);
+	if (rc != bytes)
+	{
+		fprintf(stderr, "%s, write 0x%lx @ 0x%lx failed %ld.\n", conv->out_name, bytes, offset, rc);
+		perror("write file");
+		return -EIO;
+	}
+
+	return 0;
+}
+
+/* Next chunk of the worker, stealing half of the chunks left to another one when it has none */
+static int conv_take(FrameConv *conv, ConvWorker *w, uint64_t *idx)
+{
+	pthread_mutex_lock(&w->lock);
+	if (w->lo < w->hi)
+	{
+		*idx = w->lo++;
+		pthread_mutex_unlock(&w->lock);
+		return 1;
+	}
+	pthread_mutex_unlock(&w->lock);
+
+	for (int k = 1; k < conv->threads; k++)
+	{
+		ConvWorker *victim = &conv->workers[(w->id + k) % conv->threads];
+		uint64_t lo, hi;
+
+		pthread_mutex_lock(&victim->lock);
+		hi = victim->hi;
+		lo = victim->lo + (victim->hi - victim->lo) / 2;
+		if (lo < hi)
+			victim->hi = lo;
+		pthread_mutex_unlock(&victim->lock);
+
+		if (lo >= hi)
+			continue;
+
+		/* The first one stolen is taken right away */
+		pthread_mutex_lock(&w->lock);
+		w->lo = lo + 1;
+		w->hi = hi;
+		pthread_mutex_unlock(&w->lock);
+
+		w->steals++;
+		*idx = lo;
+		return 1;
+	}
+
+	return 0;
+}
+
+static void *conv_thread(void *arg)
+{
+	ConvWorker *w = (ConvWorker *)arg;
+	FrameConv *conv = w->conv;
+	uint64_t generation = 0;
+
+	for (;;)
+	{
+		uint64_t idx;
+
+		pthread_mutex_lock(&conv->lock);
+		while (!conv->quit && conv->generation == generation)
+			pthread_cond_wait(&conv->start, &conv->lock);
+		if (conv->quit)
+		{
+			pthread_mutex_unlock(&conv->lock);
+			break;
+		}
+		generation = conv->generation;
+		pthread_mutex_unlock(&conv->lock);
+
+		while (conv_take(conv, w, &idx))
+		{
+			ConvChunk *chunk = &conv->chunks[idx];
+			int rc;
+
+			if (__atomic_load_n(&conv->err, __ATOMIC_RELAXED))
+				continue;
+
+			rc = conv_decode(conv, w, chunk);
+			if (!rc)
+				rc = conv_encode(conv, w, chunk);
+			if (rc)
+				__atomic_compare_exchange_n(&conv->err, &(int){0}, rc, 0, __ATOMIC_RELAXED, __ATOMIC_RELAXED);
+
+			w->chunks++;
+		}
+
+		pthread_mutex_lock(&conv->lock);
+		if (!--conv->busy)
+			pthread_cond_signal(&conv->done);
+		pthread_mutex_unlock(&conv->lock);
+	}
+
+	return NULL;
+}
+
+/* Convert the chunks of the batch on all workers */
+static int conv_run_batch(FrameConv *conv)
+{
+	for (int i = 0; i < conv->threads; i++)
+	{
+		ConvWorker *w = &conv->workers[i];
+
+		pthread_mutex_lock(&w->lock);
+		w->lo = conv->batch * i / conv->threads;
+		w->hi = conv->batch * (i + 1) / conv->threads;
+		pthread_mutex_unlock(&w->lock);
+	}
+
+	pthread_mutex_lock(&conv->lock);
+	conv->busy = conv->threads;
+	conv->generation++;
+	pthread_cond_broadcast(&conv->start);
+	while (conv->busy)
+		pthread_cond_wait(&conv->done, &conv->lock);
+	pthread_mutex_unlock(&conv->lock);
+
+	return conv->err;
+}
+
+/* Chunks of the next batch of a packed input, from its block headers */
+static int conv_index_pack(FrameConv *conv, off_t *offset, uint64_t *first, uint64_t max)
+{
+	conv->batch = 0;
+
+	while (conv->batch < max && *first < conv->frames)
+	{
+		ConvChunk *chunk = &conv->chunks[conv->batch];
+		FramePackBlock bh;
+		ssize_t rc = pread(conv->in_fd, &bh, sizeof(bh), *offset);
+
+		if (rc != sizeof(bh))
+		{
+			fprintf(stderr, "%s, read block @ 0x%lx failed %ld.\n", conv->in_name, *offset, rc);
+			return -EIO;
+		}
+
+		bh.frames = le32toh(bh.frames);
+		bh.bytes = le32toh(bh.bytes);
+		if (!bh.frames || bh.frames > FRAME_PACK_BLOCK_FRAMES || bh.bytes > FRAME_PACK_BLOCK_MAX ||
+			bh.frames > conv->frames - *first)
+		{
+			fprintf(stderr, "%s, corrupted block @ 0x%lx.\n", conv->in_name, *offset);
+			return -EINVAL;
+		}
+
+		chunk->first = *first;
+		chunk->frames = bh.frames;
+		chunk->offset = *offset;
+
+		*offset += sizeof(bh) + bh.bytes;
+		*first += bh.frames;
+		conv->batch++;
+	}
+
+	return 0;
+}
+
+static int conv_open(FrameConv *conv)
+{
+	struct stat st;
+	FramePackReader header;
+	int rc;
+
+	conv->in_fd = open(conv->in_name, O_RDONLY);
+	if (conv->in_fd < 0)
+	{
+		fprintf(stderr, "unable to open input file %s.\n", conv->in_name);
+		perror("open input file");
+		return -ENOENT;
+	}
+
+	if (fstat(conv->in_fd, &st) < 0)
+	{
+		perror("get file size");
+		return -EINVAL;
+	}
+	conv->in_size = st.st_size;
+
+	/* Sized as FramesFile2Device() does */
+	if (conv->in_format == FRAMES_FORMAT_TXT)
+		conv->frames = (conv->in_size + 1) / FRAME_TXT_LINE_LEN;
+	else if (conv->in_format == FRAMES_FORMAT_PACK)
+	{
+		rc = frame_pack_open(&header, conv->in_name, conv->in_fd);
+		conv->frames = header.frames;
+		frame_pack_close(&header);
+		if (rc < 0)
+			return rc;
+	}
+	else
+		conv->frames = conv->in_size / sizeof(frame);
+
+	conv->out_fd = open(conv->out_name, O_WRONLY | O_CREAT | O_TRUNC, 0666);
+	if (conv->out_fd < 0)
+	{
+		fprintf(stderr, "unable to open output file %s.\n", conv->out_name);
+		perror("open output file");
+		return -ENOENT;
+	}
+
+	return 0;
+}
+
+static int conv_start(FrameConv *conv)
+{
+	uint64_t max = (uint64_t)conv->threads * FRAMECONV_BATCH_CHUNKS;
+
+	pthread_mutex_init(&conv->lock, NULL);
+	pthread_cond_init(&conv->start, NULL);
+	pthread_cond_init(&conv->done, NULL);
+
+	conv->chunks = (ConvChunk *)calloc(max, sizeof(ConvChunk));
+	conv->workers = (ConvWorker *)calloc(conv->threads, sizeof(ConvWorker));
+	if (!conv->chunks || !conv->workers)
+		return -ENOMEM;
+
+	if (conv->out_format == FRAMES_FORMAT_PACK)
+	{
+		for (uint64_t i = 0; i < max; i++)
+		{
+			conv->chunks[i].block = (uint8_t *)malloc(sizeof(FramePackBlock) + FRAME_PACK_BLOCK_MAX);
+			if (!conv->chunks[i].block)
+				return -ENOMEM;
+		}
+	}
+
+	for (int i = 0; i < conv->threads; i++)
+	{
+		ConvWorker *w = &conv->workers[i];
+
+		w->conv = conv;
+		w->id = i;
+		pthread_mutex_init(&w->lock, NULL);
+
+		w->txt = (char *)malloc(FRAMECONV_CHUNK_FRAMES * FRAME_TXT_LINE_LEN);
+		w->frames = (frame *)malloc(FRAMECONV_CHUNK_FRAMES * sizeof(frame));
+		if (!w->txt || !w->frames)
+			return -ENOMEM;
+
+		if (conv->in_format == FRAMES_FORMAT_PACK && frame_pack_open(&w->reader, conv->in_name, conv->in_fd) < 0)
+			return -EINVAL;
+
+		if (pthread_create(&w->thread, NULL, conv_thread, w))
+		{
+			w->thread = 0;
+			return -EAGAIN;
+		}
+	}
+
+	return 0;
+}
+
+static void conv_stop(FrameConv *conv)
+{
+	if (conv->workers)
+	{
+		pthread_mutex_lock(&conv->lock);
+		conv->quit = 1;
+		pthread_cond_broadcast(&conv->start);
+		pthread_mutex_unlock(&conv->lock);
+
+		for (int i = 0; i < conv->threads; i++)
+		{
+			ConvWorker *w = &conv->workers[i];
+
+			if (w->thread)
+				pthread_join(w->thread, NULL);
+			frame_pack_close(&w->reader);
+			free(w->txt);
+			free(w->frames);
+		}
+	}
+
+	if (conv->chunks)
+		for (uint64_t i = 0; i < (uint64_t)conv->threads * FRAMECONV_BATCH_CHUNKS; i++)
+			free(conv->chunks[i].block);
+
+	free(conv->chunks);
+	free(conv->workers);
+}
+
+static int conv_run(FrameConv *conv)
+{
+	uint64_t max = (uint64_t)conv->threads * FRAMECONV_BATCH_CHUNKS;
+	uint64_t first = 0;
+	off_t in_offset = sizeof(FramePackHeader);
+	off_t out_offset = 0;
+	ssize_t rc;
+
+	if (conv->out_format == FRAMES_FORMAT_PACK)
+	{
+		FramePackHeader header;
+
+		header.magic = htole32(FRAME_PACK_MAGIC);
+		header.version = htole32(FRAME_PACK_VERSION);
+		header.frames = htole64(conv->frames);
+
+		rc = pwrite(conv->out_fd, &header, sizeof(header), 0);
+		if (rc != sizeof(header))
+		{
+			fprintf(stderr, "%s, write header failed %ld.\n", conv->out_name, rc);
+			return -EIO;
+		}
+		out_offset = sizeof(header);
+	}
+
+	while (first < conv->frames)
+	{
+		if (conv->in_format == FRAMES_FORMAT_PACK)
+		{
+			rc = conv_index_pack(conv, &in_offset, &first, max);
+			if (rc < 0)
+				return rc;
+		}
+		else
+		{
+			for (conv->batch = 0; conv->batch < max && first < conv->frames; conv->batch++)
+			{
+				ConvChunk *chunk = &conv->chunks[conv->batch];
+
+				chunk->first = first;
+				chunk->frames = conv->frames - first < FRAMECONV_CHUNK_FRAMES ? conv->frames - first
+																			   : FRAMECONV_CHUNK_FRAMES;
+				first += chunk->frames;
+			}
+		}
+
+		rc = conv_run_batch(conv);
+		if (rc < 0)
+			return rc;
+
+		/* Packed blocks vary in size, so they are placed in order */
+		if (conv->out_format == FRAMES_FORMAT_PACK)
+		{
+			for (uint64_t i = 0; i < conv->batch; i++)
+			{
+				rc = pwrite(conv->out_fd, conv->chunks[i].block, conv->chunks[i].bytes, out_offset);
+				if (rc != conv->chunks[i].bytes)
+				{
+					fprintf(stderr, "%s, write 0x%lx @ 0x%lx failed %ld.\n", conv->out_name,
+							conv->chunks[i].bytes, out_offset, rc);
+					perror("write file");
+					return -EIO;
+				}
+				out_offset += rc;
+			}
+		}
+
+		if (verbose)
+			fprintf(stdout, "%lu/%lu frames converted.\n", first, conv->frames);
+	}
+
+	return 0;
+}
+
+static void usage(const char *name)
+{
+	fprintf(stdout, "usage: %s [OPTIONS] -i FILE -o FILE\n\n", name);
+	fprintf(stdout, "  -i frames file to read\n");
+	fprintf(stdout, "  -o frames file to write\n");
+	fprintf(stdout, "  -f input format, txt, bin, pack or native (defaults to %s)\n",
+			frames_format_name(FRAMES_FORMAT_DEFAULT));
+	fprintf(stdout, "  -t output format, txt, bin, pack or native (defaults to %s)\n",
+			frames_format_name(FRAMES_FORMAT_DEFAULT));
+	fprintf(stdout, "  -j worker threads (defaults to # of online CPUs)\n");
+	fprintf(stdout, "  -v verbose output\n");
+	fprintf(stdout, "  -h print usage help and exit\n");
+}
+
+int main(int argc, char *argv[])
+{
+	FrameConv conv = {0};
+	uint64_t start, elapsed, chunks = 0, steals = 0;
+	int cmd_opt;
+	int rc;
+
+	conv.in_fd = -1;
+	conv.out_fd = -1;
+	conv.in_format = FRAMES_FORMAT_DEFAULT;
+	conv.out_format = FRAMES_FORMAT_DEFAULT;
+	conv.threads = sysconf(_SC_NPROCESSORS_ONLN);
+	verbose = 0;
+
+	while ((cmd_opt = getopt(argc, argv, "hvi:o:f:t:j:")) != -1)
+	{
+		switch (cmd_opt)
+		{
+		case 'i':
+			conv.in_name = optarg;
+			break;
+		case 'o':
+			conv.out_name = optarg;
+			break;
+		case 'f':
+			conv.in_format = frames_format_from_name(optarg);
+			break;
+		case 't':
+			conv.out_format = frames_format_from_name(optarg);
+			break;
+		case 'j':
+			conv.threads = getopt_integer(optarg);
+			break;
+		case 'v':
+			verbose = 1;
+			break;
+		case 'h':
+		default:
+			usage(argv[0]);
+			exit(0);
+		}
+	}
+
+	if (!conv.in_name || !conv.out_name || conv.in_format < 0 || conv.out_format < 0 || conv.threads < 1 ||
+		conv.threads > FRAMECONV_THREADS_MAX)
+	{
+		usage(argv[0]);
+		return 1;
+	}
+
+	start = get_time_ns();
+
+	rc = conv_open(&conv);
+	if (!rc)
+		rc = conv_start(&conv);
+	if (!rc)
+		rc = conv_run(&conv);
+
+	for (int i = 0; conv.workers && i < conv.threads; i++)
+	{
+		chunks += conv.workers[i].chunks;
+		steals += conv.workers[i].steals;
+	}
+	conv_stop(&conv);
+	if (conv.in_fd >= 0)
+		close(conv.in_fd);
+	if (conv.out_fd >= 0)
+		close(conv.out_fd);
+
+	if (rc < 0)
+	{
+		fprintf(stderr, "%s, converting to %s failed %d.\n", conv.in_name, conv.out_name, rc);
+		return 1;
+	}
+
+	elapsed = get_time_ns() - start;
+	fprintf(stdout, "%s: %lu %s frame(s) to %s %s, %d thread(s), %lu chunk(s), %lu stolen, %.1f MB/s\n",
+			conv.in_name, conv.frames, frames_format_name(conv.in_format), frames_format_name(conv.out_format),
+			conv.out_name, conv.threads, chunks, steals,
+			elapsed ? conv.frames * sizeof(frame) * 1000.0 / elapsed : 0.0);
+
+	return 0;
+}
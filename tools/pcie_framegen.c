@@ -0,0 +1,408 @@
+/*
+	Generator of synthetic frames files, to benchmark on corpora anyone
+	can reproduce instead of production config and work files.
+
+	The same seed and options always give the same frames, whatever the
+	host. Event frames carry a given number of random bits; idle frames are
+	0. Profiles set where events fall:
+		uniform: each frame is an event with probability density
+		burst:   events come in bursts, on and off runs of mean length -l
+		spike:   spike trains, every neuron of -N spikes with probability
+		         density each timestep; frames are {timestep, neuron}
+
+	No frame is ever STOP_FRAME. The checksum printed at the end identifies
+	the corpus. Spike frames are checked as they are generated, to be in
+	order and one timestep per neurons draws.
+*/
+#include "utils.h"
+#include "config.h"
+#include "frame_codec.h"
+#include "frame_builder.h"
+#include "frame_sink.h"
+#include "frame_pack.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <getopt.h>
+#include <unistd.h>
+
+#define FRAMEGEN_FRAMES_DEFAULT (16 * DOWNSTREAM_BRAM_SIZE / 8) /* 16 BRAM loops */
+#define FRAMEGEN_SEED_DEFAULT (1)
+#define FRAMEGEN_BURST_DEFAULT (64)    /* Mean run of events or idle frames */
+#define FRAMEGEN_NEURONS_DEFAULT (4096)
+#define FRAMEGEN_TS_OFFSET (32)        /* Timestep field of spike frames, bits 47:32 */
+#define FRAMEGEN_TS_WIDTH (16)
+#define FRAMEGEN_BLOCK_FRAMES (DOWNSTREAM_BRAM_SIZE / 8)
+
+extern int verbose;
+
+typedef enum framegen_profile {
+	FRAMEGEN_UNIFORM,
+	FRAMEGEN_BURST,
+	FRAMEGEN_SPIKE,
+} framegen_profile_e;
+
+typedef struct FrameGen_TypeDef {
+	framegen_profile_e profile;
+	uint64_t frames;   // Frames to generate
+	uint64_t seed;
+	double density;    // Share of event frames, or spike probability
+	int entropy;       // Random bits of an event frame, 1~64
+	uint64_t burst;    // FRAMEGEN_BURST
+	uint64_t neurons;  // FRAMEGEN_SPIKE
+
+	uint64_t state;    // Of the generator
+	int on;            // FRAMEGEN_BURST: in a run of events
+	FrameLayout layout; // FRAMEGEN_SPIKE
+	uint64_t timestep;
+	uint64_t neuron;   // Next neuron to draw in timestep
+
+	uint64_t events;
+	uint64_t draws;    // FRAMEGEN_SPIKE: neurons drawn
+	uint64_t checksum; // FNV-1a of frames
+
+	/* FRAMEGEN_SPIKE: draw of the last spike generated, see check_spikes() */
+	uint64_t last_draw;
+	uint64_t last_ts;
+	int spiked;
+} FrameGen;
+
+static const char *profile_names[] = {"uniform", "burst", "spike"};
+
+/* splitmix64, the same sequence on every host */
+static uint64_t gen_next(FrameGen *gen)
+{
+	uint64_t z = (gen->state += 0x9E3779B97F4A7C15ULL);
+
+	z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+	z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+
+	return z ^ (z >> 31);
+}
+
+/* Uniform in [0, 1) */
+static double gen_uniform(FrameGen *gen)
+{
+	return (gen_next(gen) >> 11) * (1.0 / 9007199254740992.0);
+}
+
+static frame gen_event(FrameGen *gen)
+{
+	frame f;
+
+	do
+	{
+		f = gen_next(gen);
+		if (gen->entropy < 64)
+			f &= (1ULL << gen->entropy) - 1;
+	} while (f == STOP_FRAME);
+
+	return f;
+}
+
+/*
+	Idle runs end with probability 1/burst after each frame, runs of events
+	with the probability keeping the long-run share of events at density.
+*/
+static int gen_burst(FrameGen *gen)
+{
+	double end;
+
+	if (gen->density <= 0 || gen->density >= 1)
+		return gen->density >= 1;
+
+	if (gen->on)
+		end = (1 - gen->density) / (gen->density * gen->burst);
+	else
+		end = 1.0 / gen->burst;
+	if (end > 1)
+		end = 1;
+
+	if (gen_uniform(gen) < end)
+		gen->on = !gen->on;
+
+	return gen->on;
+}
+
+/* Spikes of the next timesteps into out, n frames at most */
+static size_t gen_spikes(FrameGen *gen, frame *out, size_t n)
+{
+	FrameBuffer buffer = {out, 0};
+	FrameBuilder builder;
+	uint64_t addrs[256];
+	size_t count;
+
+	frame_builder_init(&builder, &gen->layout, &buffer, n);
+
+	while (buffer.size / sizeof(frame) < n)
+	{
+		size_t k = 0;
+
+		while (k < 256 && gen->neuron < gen->neurons && buffer.size / sizeof(frame) + k < n)
+		{
+			if (gen_uniform(gen) < gen->density)
+				addrs[k++] = gen->neuron;
+			gen->neuron++;
+			gen->draws++;
+		}
+
+		if (k && frame_builder_add_spikes(&builder, 0, addrs, k, 1, gen->timestep) < 0)
+			break;
+
+		if (gen->neuron == gen->neurons)
+		{
+			gen->neuron = 0;
+			gen->timestep = (gen->timestep + 1) & ((1ULL << FRAMEGEN_TS_WIDTH) - 1);
+		}
+	}
+
+	count = buffer.size / sizeof(frame);
+	gen->events += count;
+
+	return count;
+}
+
+/*
+	Every spike frame is one draw: neuron + steps * neurons, steps the
+	timesteps since the first draw. Draws of spikes must go strictly up and
+	be drawn already, so each timestep takes exactly neurons draws and no
+	frame is a zero, a stale or a repeated one of an earlier block.
+	Timesteps wrap, so spikes must not be 2^FRAMEGEN_TS_WIDTH timesteps apart.
+*/
+static int check_spikes(FrameGen *gen, const frame *frames, size_t n)
+{
+	const FrameField *neuron = &gen->layout.fields[0], *ts = &gen->layout.fields[1];
+	uint64_t mask = frame_field_mask(ts);
+
+	for (size_t i = 0; i < n; i++)
+	{
+		uint64_t t = frame_field_get(frames[i], ts);
+		uint64_t steps = gen->spiked ? gen->last_draw / gen->neurons + ((t - gen->last_ts) & mask) : t;
+		uint64_t draw = steps * gen->neurons + frame_field_get(frames[i], neuron);
+
+		if (frame_field_get(frames[i], neuron) >= gen->neurons || draw >= gen->draws ||
+			(gen->spiked && draw <= gen->last_draw))
+		{
+			fprintf(stderr, "spike frame 0x%016lx out of order after draw %lu of %lu.\n", frames[i], gen->last_draw,
+					gen->draws);
+			return -EINVAL;
+		}
+
+		gen->last_draw = draw;
+		gen->last_ts = t;
+		gen->spiked = 1;
+	}
+
+	return 0;
+}
+
+/* The next n frames at most, @return # of frames generated or -errno */
+static ssize_t gen_frames(FrameGen *gen, frame *out, size_t n)
+{
+	if (gen->profile == FRAMEGEN_SPIKE)
+	{
+		n = gen_spikes(gen, out, n);
+		if (check_spikes(gen, out, n) < 0)
+			return -EINVAL;
+	}
+	else
+	{
+		for (size_t i = 0; i < n; i++)
+		{
+			int event = gen->profile == FRAMEGEN_BURST ? gen_burst(gen) : gen_uniform(gen) < gen->density;
+
+			out[i] = event ? gen_event(gen) : 0;
+			gen->events += event;
+		}
+	}
+
+	for (size_t i = 0; i < n; i++)
+	{
+		for (int b = 0; b < 8; b++)
+		{
+			gen->checksum ^= (out[i] >> (b * 8)) & 0xFF;
+			gen->checksum *= 0x100000001B3ULL;
+		}
+	}
+
+	return n;
+}
+
+static int gen_init(FrameGen *gen)
+{
+	int width = 1;
+
+	gen->state = gen->seed;
+	gen->checksum = 0xCBF29CE484222325ULL;
+
+	if (gen->profile != FRAMEGEN_SPIKE)
+		return 0;
+
+	while (width < 32 && (1ULL << width) < gen->neurons)
+		width++;
+
+	memset(&gen->layout, 0, sizeof(gen->layout));
+	if (frame_layout_add(&gen->layout, "neuron", 0, width) < 0 ||
+		frame_layout_add(&gen->layout, "timestep", FRAMEGEN_TS_OFFSET, FRAMEGEN_TS_WIDTH) < 0)
+		return -EINVAL;
+
+	return 0;
+}
+
+static void usage(const char *name)
+{
+	fprintf(stdout, "usage: %s [OPTIONS] -o FILE\n\n", name);
+	fprintf(stdout, "  -o frames file to write\n");
+	fprintf(stdout, "  -f format, txt, bin, pack or native (defaults to %s)\n", frames_format_name(FRAMES_FORMAT_DEFAULT));
+	fprintf(stdout, "  -n frames (defaults to %d)\n", FRAMEGEN_FRAMES_DEFAULT);
+	fprintf(stdout, "  -s seed (defaults to %d)\n", FRAMEGEN_SEED_DEFAULT);
+	fprintf(stdout, "  -p profile, uniform, burst or spike (defaults to uniform)\n");
+	fprintf(stdout, "  -d density, share of event frames or spike probability, 0~1 (defaults to 1)\n");
+	fprintf(stdout, "  -e entropy, random bits of an event frame, 1~64 (defaults to 64)\n");
+	fprintf(stdout, "  -l mean run length of the burst profile (defaults to %d)\n", FRAMEGEN_BURST_DEFAULT);
+	fprintf(stdout, "  -N neurons of the spike profile (defaults to %d)\n", FRAMEGEN_NEURONS_DEFAULT);
+	fprintf(stdout, "  -h print usage help and exit\n");
+}
+
+int main(int argc, char *argv[])
+{
+	FrameGen gen = {0};
+	FrameSink sink;
+	char *fname = NULL;
+	int format = FRAMES_FORMAT_DEFAULT;
+	frame *frames;
+	uint64_t done = 0;
+	double actual;
+	ssize_t rc = 0;
+	int cmd_opt;
+
+	gen.frames = FRAMEGEN_FRAMES_DEFAULT;
+	gen.seed = FRAMEGEN_SEED_DEFAULT;
+	gen.density = 1.0;
+	gen.entropy = 64;
+	gen.burst = FRAMEGEN_BURST_DEFAULT;
+	gen.neurons = FRAMEGEN_NEURONS_DEFAULT;
+
+	while ((cmd_opt = getopt(argc, argv, "ho:f:n:s:p:d:e:l:N:")) != -1)
+	{
+		switch (cmd_opt)
+		{
+		case 'o':
+			fname = optarg;
+			break;
+		case 'f':
+			format = frames_format_from_name(optarg);
+			break;
+		case 'n':
+			gen.frames = getopt_integer(optarg);
+			break;
+		case 's':
+			gen.seed = getopt_integer(optarg);
+			break;
+		case 'p':
+			gen.profile = -1;
+			for (int i = 0; i < sizeof(profile_names) / sizeof(profile_names[0]); i++)
+				if (!strcmp(optarg, profile_names[i]))
+					gen.profile = i;
+			break;
+		case 'd':
+			gen.density = atof(optarg);
+			break;
+		case 'e':
+			gen.entropy = getopt_integer(optarg);
+			break;
+		case 'l':
+			gen.burst = getopt_integer(optarg);
+			break;
+		case 'N':
+			gen.neurons = getopt_integer(optarg);
+			break;
+		case 'h':
+		default:
+			usage(argv[0]);
+			exit(0);
+		}
+	}
+
+	if (!fname || format < 0 || (int)gen.profile < 0 || gen.density < 0 || gen.density > 1 || gen.entropy < 1 ||
+		gen.entropy > 64 || !gen.burst || !gen.neurons || gen.neurons > (1ULL << 32) ||
+		(gen.profile == FRAMEGEN_SPIKE && !gen.density))
+	{
+		usage(argv[0]);
+		return 1;
+	}
+
+	verbose = 0;
+
+	if (gen_init(&gen) < 0)
+		return 1;
+
+	/* Packed files are encoded from all frames at once, others go block by block */
+	frames = (frame *)malloc((format == FRAMES_FORMAT_PACK ? gen.frames : FRAMEGEN_BLOCK_FRAMES) * sizeof(frame));
+	if (!frames)
+	{
+		fprintf(stderr, "OOM.\n");
+		return 1;
+	}
+
+	if (format == FRAMES_FORMAT_PACK)
+	{
+		int fd = open(fname, O_WRONLY | O_CREAT | O_TRUNC, 0666);
+
+		if (fd < 0)
+		{
+			fprintf(stderr, "unable to open output file %s.\n", fname);
+			perror("open output file");
+			free(frames);
+			return 1;
+		}
+
+		rc = gen_frames(&gen, frames, gen.frames);
+		if (rc >= 0)
+		{
+			done = rc;
+			rc = frame_pack_write(fname, fd, frames, done);
+		}
+		close(fd);
+	}
+	else if (!(rc = frame_sink_open_file(&sink, fname, format)))
+	{
+		while (done < gen.frames && rc >= 0)
+		{
+			size_t n = gen.frames - done < FRAMEGEN_BLOCK_FRAMES ? gen.frames - done : FRAMEGEN_BLOCK_FRAMES;
+
+			rc = gen_frames(&gen, frames, n);
+			if (rc <= 0)
+			{
+				rc = rc < 0 ? rc : -EIO;
+				break;
+			}
+
+			n = rc;
+			rc = frame_sink_write(&sink, frames, n);
+			done += n;
+		}
+		frame_sink_close(&sink);
+	}
+
+	free(frames);
+
+	if (rc < 0)
+	{
+		fprintf(stderr, "%s, writing frames failed %ld.\n", fname, rc);
+		return 1;
+	}
+
+	if (gen.profile == FRAMEGEN_SPIKE)
+		actual = gen.draws ? (double)gen.events / gen.draws : 0;
+	else
+		actual = done ? (double)gen.events / done : 0;
+
+	fprintf(stdout, "%s: %lu %s frame(s), %s, seed %lu, density %.4f (%.4f actual), entropy %d, checksum %016lx\n",
+			fname, done, frames_format_name(format), profile_names[gen.profile], gen.seed, gen.density, actual,
+			gen.entropy, gen.checksum);
+
+	return 0;
+}
@@ -0,0 +1,277 @@
+/*
+	Software model of the FPGA side of the upstream, to measure sustained
+	output bandwidth of single and ping-pong handover without hardware.
+
+	The model produces sequence-numbered frames at a given rate into an
+	upstream BRAM in memory and hands blocks over through user registers
+	in anonymous memory, as the FPGA would. The host side is the real
+	upstream_rx_run(), reading the BRAM at a given link rate into a sink
+	that checks the sequence and spends a given time per frame.
+*/
+#include "utils.h"
+#include "config.h"
+#include "upstream_rx.h"
+#include "frame_sink.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <getopt.h>
+#include <pthread.h>
+#include <sched.h>
+#include <time.h>
+
+#include <sys/mman.h>
+#include <sys/prctl.h>
+
+#define MODEL_FRAMES_DEFAULT (16 * UPSTREAM_BRAM_SIZE / 8) /* 16 BRAMs of output */
+#define MODEL_PRODUCE_MBPS_DEFAULT 2000.0
+#define MODEL_LINK_MBPS_DEFAULT 3000.0
+
+typedef struct RxModel_TypeDef {
+	void *user_addr;
+	frame *bram;
+	upstream_rx_mode_e mode;
+	uint64_t frames;     // Output frames before STOP_FRAME
+	double produce_mbps; // FPGA output rate
+	double link_mbps;    // C2H DMA rate
+	long sink_ns;        // Host time per frame in the sink
+
+	pthread_t thread;
+	uint64_t stall_ns;   // FPGA waiting for a block to be handed back
+	uint64_t expected;   // Next sequence number in the sink
+	uint64_t errors;
+} RxModel;
+
+extern int verbose;
+
+static volatile uint32_t *model_reg(RxModel *model, off_t offset)
+{
+	return (volatile uint32_t *)((char *)model->user_addr + offset);
+}
+
+/* Time of the device passes asleep, so the model runs on a single CPU too */
+static void sleep_until(uint64_t deadline)
+{
+	struct timespec ts = {deadline / 1000000000ULL, deadline % 1000000000ULL};
+
+	while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL) == EINTR)
+		;
+}
+
+/*
+	Acks of the host, taken from the ack register. The host acks halves in
+	order, so an ack of the newer half also covers the older one, in case
+	two writes landed before the model looked.
+*/
+static void model_take_acks(RxModel *model, int newest)
+{
+	uint32_t acks = __atomic_exchange_n(model_reg(model, RX_HALF_ACK_WO_ADDR), 0, __ATOMIC_ACQUIRE);
+	uint32_t ready = 0;
+
+	if (!acks)
+		return;
+
+	if (acks & RX_HALF_ACK_MASK(newest))
+		ready = RX_HALF_READY_MASK(0) | RX_HALF_READY_MASK(1);
+	else if (acks & RX_HALF_ACK_MASK(newest ^ 1))
+		ready = RX_HALF_READY_MASK(newest ^ 1);
+
+	__atomic_fetch_and(model_reg(model, TX_DONE_RW_ADDR), ~ready, __ATOMIC_RELEASE);
+}
+
+static void *model_thread(void *arg)
+{
+	RxModel *model = (RxModel *)arg;
+	int pingpong = model->mode == UPSTREAM_RX_PINGPONG;
+	size_t block = (pingpong ? UPSTREAM_HALF_SIZE : UPSTREAM_BRAM_SIZE) / sizeof(frame);
+	double ns_per_frame = sizeof(frame) * 1e3 / model->produce_mbps;
+	uint64_t seq = 0;
+	int half = 0, newest = 1;
+
+	for (;;)
+	{
+		uint32_t busy = pingpong ? RX_HALF_READY_MASK(half) : 0x00000002;
+		frame *out = model->bram + (pingpong ? half * block : 0);
+		uint64_t t0 = get_time_ns(), next;
+
+		/* Wait for the block to be handed back */
+		for (;;)
+		{
+			if (pingpong)
+				model_take_acks(model, newest);
+			if (!(__atomic_load_n(model_reg(model, TX_DONE_RW_ADDR), __ATOMIC_ACQUIRE) & busy))
+				break;
+			sched_yield();
+		}
+
+		next = get_time_ns();
+		model->stall_ns += next - t0;
+
+		/* Produce at the output rate, the clock does not catch up after a stall */
+		for (size_t i = 0; i < block; i++)
+			out[i] = seq < model->frames ? seq++ : STOP_FRAME;
+		sleep_until(next + (uint64_t)(block * ns_per_frame));
+
+		__atomic_fetch_or(model_reg(model, TX_DONE_RW_ADDR), busy, __ATOMIC_RELEASE);
+
+		if (out[block - 1] == STOP_FRAME)
+			break;
+
+		newest = half;
+		if (pingpong)
+			half ^= 1;
+	}
+
+	return NULL;
+}
+
+/* DMA of the upstream BRAM at the link rate */
+static ssize_t model_read(void *arg, frame *buf, size_t bytes, uint64_t addr)
+{
+	RxModel *model = (RxModel *)arg;
+	uint64_t t0 = get_time_ns();
+
+	memcpy(buf, (char *)model->bram + addr, bytes);
+	sleep_until(t0 + (uint64_t)(bytes * 1e3 / model->link_mbps));
+
+	return bytes;
+}
+
+static int model_sink(const frame *frames, size_t n, uint64_t batch, uint64_t seq, void *arg)
+{
+	RxModel *model = (RxModel *)arg;
+	uint64_t t0 = get_time_ns();
+
+	for (size_t i = 0; i < n; i++)
+		if (frames[i] != model->expected++)
+			model->errors++;
+
+	sleep_until(t0 + n * model->sink_ns);
+
+	return 0;
+}
+
+/*
+	@return Sustained MB/s of output, or < 0 if the run failed
+*/
+static double model_run(RxModel *model, upstream_rx_mode_e mode)
+{
+	UpstreamRx rx;
+	FrameSink sink;
+	ssize_t rc;
+
+	memset(model->user_addr, 0, MAP_SIZE);
+	model->mode = mode;
+	model->stall_ns = 0;
+	model->expected = 0;
+	model->errors = 0;
+
+	if (upstream_rx_init(&rx, "model", -1, model->user_addr, 0, mode))
+		return -1;
+	rx.wait = DMA_WAIT_YIELD;
+	rx.read = model_read;
+	rx.read_arg = model;
+	frame_sink_open_callback(&sink, model_sink, model);
+
+	if (pthread_create(&model->thread, NULL, model_thread, model))
+	{
+		upstream_rx_release(&rx);
+		return -1;
+	}
+
+	rc = upstream_rx_run(&rx, &sink);
+	pthread_join(model->thread, NULL);
+
+	frame_sink_close(&sink);
+	upstream_rx_release(&rx);
+
+	if (rc != model->frames || model->errors)
+	{
+		fprintf(stderr, "%s: %ld/%lu frame(s), %lu out of sequence.\n",
+				mode == UPSTREAM_RX_PINGPONG ? "ping-pong" : "single", rc, model->frames, model->errors);
+		return -1;
+	}
+
+	fprintf(stdout, "%-10s %-10.1f %-10.1f %-10.1f %.1f%%\n", mode == UPSTREAM_RX_PINGPONG ? "ping-pong" : "single",
+			rx.frames * sizeof(frame) * 1e3 / rx.elapsed_ns, rx.read_ns / 1e3 / rx.blocks,
+			rx.wait_ns / 1e3 / rx.blocks, 100.0 * model->stall_ns / rx.elapsed_ns);
+
+	return rx.frames * sizeof(frame) * 1e3 / rx.elapsed_ns;
+}
+
+static void usage(const char *name)
+{
+	fprintf(stdout, "usage: %s [OPTIONS]\n\n", name);
+	fprintf(stdout, "  -n frames of output (defaults to %d)\n", MODEL_FRAMES_DEFAULT);
+	fprintf(stdout, "  -p MB/s produced by the FPGA (defaults to %.0f)\n", MODEL_PRODUCE_MBPS_DEFAULT);
+	fprintf(stdout, "  -l MB/s of the c2h link (defaults to %.0f)\n", MODEL_LINK_MBPS_DEFAULT);
+	fprintf(stdout, "  -c ns spent by the host per frame after reading (defaults to 0)\n");
+	fprintf(stdout, "  -h print usage help and exit\n");
+}
+
+int main(int argc, char *argv[])
+{
+	RxModel model = {0};
+	double single, pingpong;
+	int cmd_opt;
+
+	model.frames = MODEL_FRAMES_DEFAULT;
+	model.produce_mbps = MODEL_PRODUCE_MBPS_DEFAULT;
+	model.link_mbps = MODEL_LINK_MBPS_DEFAULT;
+
+	while ((cmd_opt = getopt(argc, argv, "hn:p:l:c:")) != -1)
+	{
+		switch (cmd_opt)
+		{
+		case 'n':
+			model.frames = getopt_integer(optarg);
+			break;
+		case 'p':
+			model.produce_mbps = atof(optarg);
+			break;
+		case 'l':
+			model.link_mbps = atof(optarg);
+			break;
+		case 'c':
+			model.sink_ns = getopt_integer(optarg);
+			break;
+		case 'h':
+		default:
+			usage(argv[0]);
+			exit(0);
+		}
+	}
+
+	if (model.produce_mbps <= 0 || model.link_mbps <= 0)
+	{
+		usage(argv[0]);
+		return 1;
+	}
+
+	verbose = 0;
+	prctl(PR_SET_TIMERSLACK, 1UL);
+
+	model.user_addr = mmap(NULL, MAP_SIZE, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if (model.user_addr == MAP_FAILED || posix_memalign((void **)&model.bram, 4096, UPSTREAM_BRAM_SIZE))
+	{
+		fprintf(stderr, "OOM.\n");
+		return 1;
+	}
+
+	fprintf(stdout, "%lu frame(s), FPGA %.0f MB/s, link %.0f MB/s, sink %ld ns/frame\n\n", model.frames,
+			model.produce_mbps, model.link_mbps, model.sink_ns);
+	fprintf(stdout, "mode       MB/s       read us    wait us    FPGA stalled\n");
+
+	single = model_run(&model, UPSTREAM_RX_SINGLE);
+	pingpong = model_run(&model, UPSTREAM_RX_PINGPONG);
+	if (single <= 0 || pingpong <= 0)
+		return 1;
+
+	fprintf(stdout, "\nping-pong gain: %.2fx\n", pingpong / single);
+
+	free(model.bram);
+	munmap(model.user_addr, MAP_SIZE);
+
+	return 0;
+}
@@ -0,0 +1,124 @@
+/*
+	Closed-loop steps through the C++ layer, pcieapp.hpp.
+
+	Opens a pcie::Session in work mode and runs steps of random work frames
+	through a pcie::Engine, one reused pcie::Request at a time, then prints
+	the mean and max latency of each stage of a step.
+*/
+#include "pcieapp.hpp"
+
+#include <algorithm>
+#include <cstdio>
+#include <getopt.h>
+
+#define STEP_STEPS_DEFAULT 1000
+#define STEP_FRAMES_DEFAULT 64
+
+extern int verbose;
+
+static void usage(const char *name)
+{
+	fprintf(stdout, "usage: %s [OPTIONS]\n\n", name);
+	fprintf(stdout, "  -d h2c device (defaults to %s)\n", H2C_DEVICE_NAME_DEFAULT);
+	fprintf(stdout, "  -c c2h device (defaults to %s)\n", C2H_DEVICE_NAME_DEFAULT);
+	fprintf(stdout, "  -u user registers (defaults to %s)\n", USER_REG_NAME_DEFAULT);
+	fprintf(stdout, "  -n steps (defaults to %d)\n", STEP_STEPS_DEFAULT);
+	fprintf(stdout, "  -f work frames per step (defaults to %d)\n", STEP_FRAMES_DEFAULT);
+}
+
+int main(int argc, char *argv[])
+{
+	std::string h2c = H2C_DEVICE_NAME_DEFAULT, c2h = C2H_DEVICE_NAME_DEFAULT, user = USER_REG_NAME_DEFAULT;
+	long steps = STEP_STEPS_DEFAULT, n = STEP_FRAMES_DEFAULT;
+	uint64_t state = 0x9E3779B97F4A7C15ULL;
+	PCIeStepStats sum = {}, max = {};
+	int cmd_opt;
+
+	while ((cmd_opt = getopt(argc, argv, "hd:c:u:n:f:")) != -1)
+	{
+		switch (cmd_opt)
+		{
+		case 'd':
+			h2c = optarg;
+			break;
+		case 'c':
+			c2h = optarg;
+			break;
+		case 'u':
+			user = optarg;
+			break;
+		case 'n':
+			steps = getopt_integer(optarg);
+			break;
+		case 'f':
+			n = getopt_integer(optarg);
+			break;
+		case 'h':
+		default:
+			usage(argv[0]);
+			return 0;
+		}
+	}
+
+	if (steps <= 0 || n <= 0 || (size_t)n > DOWNSTREAM_BRAM_SIZE / sizeof(frame) - 1)
+	{
+		usage(argv[0]);
+		return 1;
+	}
+
+	/* The SDK prints every frame read when verbose */
+	verbose = 0;
+
+	try
+	{
+		pcie::Session session(h2c, c2h, user, FPGA_MODE_WORK);
+		pcie::Engine engine(session);
+		pcie::Buffer input((size_t)n), output(UPSTREAM_BRAM_SIZE / sizeof(frame));
+		pcie::Request req;
+
+		/* xorshift64*, no STOP_FRAME among the work frames */
+		for (long i = 0; i < n; i++)
+		{
+			state ^= state >> 12;
+			state ^= state << 25;
+			state ^= state >> 27;
+			input.storage()[i] = (state * 0x2545F4914F6CDD1DULL) & ~1ULL;
+		}
+		input.resize((size_t)n);
+
+		for (long i = 0; i < steps; i++)
+		{
+			const PCIeStepStats *st;
+
+			req.step(input.frames(), output.storage());
+			engine.submit(req);
+			req.wait();
+
+			st = &req.stats();
+			sum.send_ns += st->send_ns;
+			sum.tx_wait_ns += st->tx_wait_ns;
+			sum.rx_wait_ns += st->rx_wait_ns;
+			sum.recv_ns += st->recv_ns;
+			sum.total_ns += st->total_ns;
+			max.send_ns = std::max(max.send_ns, st->send_ns);
+			max.tx_wait_ns = std::max(max.tx_wait_ns, st->tx_wait_ns);
+			max.rx_wait_ns = std::max(max.rx_wait_ns, st->rx_wait_ns);
+			max.recv_ns = std::max(max.recv_ns, st->recv_ns);
+			max.total_ns = std::max(max.total_ns, st->total_ns);
+		}
+	}
+	catch (const std::system_error &e)
+	{
+		fprintf(stderr, "%s.\n", e.what());
+		return 1;
+	}
+
+	fprintf(stdout, "%ld step(s) of %ld frame(s), us (mean/max):\n", steps, n);
+	fprintf(stdout, "  send     %.1f/%.1f\n", sum.send_ns / 1e3 / steps, max.send_ns / 1e3);
+	fprintf(stdout, "  tx wait  %.1f/%.1f\n", sum.tx_wait_ns / 1e3 / steps, max.tx_wait_ns / 1e3);
+	fprintf(stdout, "  rx wait  %.1f/%.1f\n", sum.rx_wait_ns / 1e3 / steps, max.rx_wait_ns / 1e3);
+	fprintf(stdout, "  recv     %.1f/%.1f\n", sum.recv_ns / 1e3 / steps, max.recv_ns / 1e3);
+	fprintf(stdout, "  total    %.1f/%.1f\n", sum.total_ns / 1e3 / steps, max.total_ns / 1e3);
+
+	return 0;
+}